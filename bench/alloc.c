@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+
+// --------------------------
+// Runtime allocators vs a mapping per allocation
+//
+// Links against the kernels written by `dang -emit-runtime`, checks that
+// arena and pool blocks are aligned, writable and disjoint, then times
+// allocation throughput for sizes up to a pool's largest size class.
+
+extern void *_rt_mmap(size_t);
+extern int64_t _rt_munmap(void *, size_t);
+extern void *_rt_arena_alloc(size_t);
+extern void _rt_arena_reset(void);
+extern void *_rt_pool_alloc(size_t);
+extern void _rt_pool_release(void *, size_t);
+
+static const size_t sizes[] = {8, 16, 24, 64, 100, 256};
+#define NSIZES (sizeof(sizes) / sizeof(size_t))
+#define COUNT 100000
+
+static void *blocks[COUNT];
+
+static int fill(size_t size, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (blocks[i] == NULL || (uintptr_t)blocks[i] % 16 != 0)
+      return 0;
+    memset(blocks[i], (int)i, size);
+  }
+  for (size_t i = 0; i < count; i++)
+    for (size_t j = 0; j < size; j++)
+      if (((unsigned char *)blocks[i])[j] != (unsigned char)i)
+        return 0;
+  return 1;
+}
+
+static int check() {
+  for (size_t s = 0; s < NSIZES; s++) {
+    size_t size = sizes[s];
+
+    for (int round = 0; round < 3; round++) {
+      for (size_t i = 0; i < COUNT; i++)
+        blocks[i] = _rt_arena_alloc(size);
+      if (!fill(size, COUNT))
+        return 0;
+      _rt_arena_reset();
+    }
+
+    // Freed blocks are handed out again before fresh ones
+    for (size_t i = 0; i < COUNT; i++)
+      blocks[i] = _rt_pool_alloc(size);
+    if (!fill(size, COUNT))
+      return 0;
+    void *last = blocks[COUNT - 1];
+    _rt_pool_release(last, size);
+    if (_rt_pool_alloc(size) != last)
+      return 0;
+    for (size_t i = 0; i < COUNT; i++)
+      _rt_pool_release(blocks[i], size);
+  }
+
+  // Allocations too big for a chunk get a mapping of their own
+  char *big = _rt_arena_alloc(4 << 20);
+  if (big == NULL)
+    return 0;
+  memset(big, 1, 4 << 20);
+  _rt_arena_reset();
+  return 1;
+}
+
+static void report(const char *name, size_t size, size_t count,
+                   double elapsed) {
+  printf("%-8s %6zu %10.2f ns %8.2f M/s\n", name, size,
+         elapsed / count * 1e9, count / elapsed / 1e6);
+}
+
+static void bench(size_t size) {
+  double start = now();
+  for (int round = 0; round < 10; round++) {
+    for (size_t i = 0; i < COUNT; i++)
+      blocks[i] = _rt_arena_alloc(size);
+    _rt_arena_reset();
+  }
+  report("arena", size, 10 * COUNT, now() - start);
+
+  start = now();
+  for (int round = 0; round < 10; round++) {
+    for (size_t i = 0; i < COUNT; i++)
+      blocks[i] = _rt_pool_alloc(size);
+    for (size_t i = 0; i < COUNT; i++)
+      _rt_pool_release(blocks[i], size);
+  }
+  report("pool", size, 10 * COUNT, now() - start);
+
+  start = now();
+  for (int round = 0; round < 10; round++) {
+    for (size_t i = 0; i < COUNT; i++)
+      blocks[i] = malloc(size);
+    for (size_t i = 0; i < COUNT; i++)
+      free(blocks[i]);
+  }
+  report("malloc", size, 10 * COUNT, now() - start);
+
+  start = now();
+  for (size_t i = 0; i < COUNT; i++)
+    blocks[i] = _rt_mmap(size);
+  for (size_t i = 0; i < COUNT; i++)
+    _rt_munmap(blocks[i], size);
+  report("mmap", size, COUNT, now() - start);
+}
+
+int main() {
+  if (!check()) {
+    fprintf(stderr, "allocator returned overlapping or unusable blocks\n");
+    return 1;
+  }
+
+  for (size_t s = 0; s < NSIZES; s++)
+    bench(sizes[s]);
+
+  return 0;
+}
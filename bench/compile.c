@@ -0,0 +1,269 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// --------------------------
+// Compile throughput
+//
+// Generates synthetic .dang workloads at several sizes, compiles each one
+// with `dang -stats-json` and reports lines per second and the peak RSS of
+// every phase. Phases whose time grows faster than the input are flagged.
+//
+//   bench/compile                       run the suite, write bench/compile.json
+//   bench/compile gen KIND UNITS DIR    only write the DIR/main.dang workload
+
+static const char *kinds[] = {"functions", "expressions", "includes",
+                              "strings", "comments"};
+#define NKINDS (sizeof(kinds) / sizeof(char *))
+
+static const int units[] = {40, 80, 160, 320};
+#define NUNITS (sizeof(units) / sizeof(int))
+
+static const char *phases[] = {"read", "lex", "parse", "const-eval",
+                               "whole-program", "codegen"};
+#define NPHASES (sizeof(phases) / sizeof(char *))
+
+// Growth of time over growth of input above which a phase is flagged
+#define SUPERLINEAR 1.5
+
+typedef struct {
+  double seconds;
+  long maxrss;
+} Sample;
+
+static FILE *create(const char *dir, const char *name) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    perror(path);
+    exit(1);
+  }
+  return f;
+}
+
+// Every workload writes a byte first, assignments can't start a program
+static void prologue(FILE *f) { fprintf(f, "syscall 1 1 \"x\" 1 end\n"); }
+
+static void epilogue(FILE *f) { fprintf(f, "syscall 60 0 end\n"); }
+
+static void genFunctions(FILE *f, int n) {
+  prologue(f);
+  for (int i = 0; i < n; i++) {
+    fprintf(f, "fn f%d:int ( let x:int )\n", i);
+    fprintf(f, "  let y%d:int = x + %d\n", i, i);
+    fprintf(f, "  return y%d\n", i);
+    fprintf(f, "end\n");
+  }
+  for (int i = 0; i < n; i++)
+    fprintf(f, "let r%d:int = f%d <| %d\n", i, i, i);
+  epilogue(f);
+}
+
+static void genExpressions(FILE *f, int n) {
+  prologue(f);
+  fprintf(f, "let e0:int = 1\n");
+  for (int i = 1; i < n; i++) {
+    fprintf(f, "let e%d:int = e%d", i, i - 1);
+    for (int j = 0; j < 16; j++)
+      fprintf(f, " %c %d", "+-*"[j % 3], j + 1);
+    fprintf(f, "\n");
+  }
+  epilogue(f);
+}
+
+static void genIncludes(FILE *f, const char *dir, int n) {
+  // main includes m0, which includes m1, ... down to m{n-1}
+  prologue(f);
+  fprintf(f, "include m0.dang\n");
+  for (int i = 0; i < n; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "m%d.dang", i);
+    FILE *m = create(dir, name);
+    if (i + 1 < n)
+      fprintf(m, "include m%d.dang\n", i + 1);
+    fprintf(m, "fn g%d:int ( let x:int )\n  return x + %d\nend\n", i, i);
+    fclose(m);
+  }
+  for (int i = 0; i < n; i++)
+    fprintf(f, "let r%d:int = g%d <| %d\n", i, i, i);
+  epilogue(f);
+}
+
+static void genStrings(FILE *f, int n) {
+  prologue(f);
+  for (int i = 0; i < n; i++) {
+    char text[128];
+    int len = snprintf(text, sizeof(text),
+                       "string number %d of the table, padded out a bit", i);
+    fprintf(f, "syscall 1 1 \"%s\" %d end\n", text, len);
+  }
+  epilogue(f);
+}
+
+static void genComments(FILE *f, int n) {
+  prologue(f);
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < 8; j++)
+      fprintf(f, "# comment %d.%d explaining the next line at length\n", i, j);
+    fprintf(f, "let c%d:int = %d\n", i, i);
+  }
+  epilogue(f);
+}
+
+static void generate(const char *kind, int n, const char *dir) {
+  FILE *f = create(dir, "main.dang");
+  if (strcmp(kind, "functions") == 0)
+    genFunctions(f, n);
+  else if (strcmp(kind, "expressions") == 0)
+    genExpressions(f, n);
+  else if (strcmp(kind, "includes") == 0)
+    genIncludes(f, dir, n);
+  else if (strcmp(kind, "strings") == 0)
+    genStrings(f, n);
+  else if (strcmp(kind, "comments") == 0)
+    genComments(f, n);
+  else {
+    fprintf(stderr, "unknown workload \"%s\"\n", kind);
+    exit(1);
+  }
+  fclose(f);
+}
+
+static long countLines(const char *dir) {
+  char command[PATH_MAX + 64];
+  snprintf(command, sizeof(command), "cat %s/*.dang | wc -l", dir);
+  FILE *p = popen(command, "r");
+  long lines = 0;
+  if (p == NULL || fscanf(p, "%ld", &lines) != 1)
+    lines = 0;
+  if (p != NULL)
+    pclose(p);
+  return lines;
+}
+
+// Reads the phase lines of -stats-json, one phase per line
+static int readStats(const char *path, Sample *samples) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return 0;
+
+  char line[512];
+  int found = 0;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    char name[32];
+    double seconds;
+    long maxrss;
+    if (sscanf(line, " \"%31[^\"]\": {\"seconds\": %lf, \"allocations\": %*u, "
+                     "\"bytes\": %*u, \"calls\": %*u, \"max_rss_kb\": %ld",
+               name, &seconds, &maxrss) != 3)
+      continue;
+    for (size_t p = 0; p < NPHASES; p++)
+      if (strcmp(name, phases[p]) == 0) {
+        samples[p] = (Sample){seconds, maxrss};
+        found++;
+      }
+  }
+
+  fclose(f);
+  return found == NPHASES;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 5 && strcmp(argv[1], "gen") == 0) {
+    generate(argv[2], atoi(argv[3]), argv[4]);
+    return 0;
+  }
+
+  char dang[PATH_MAX];
+  if (realpath("dang", dang) == NULL) {
+    fprintf(stderr, "run from the repository root after `make build`\n");
+    return 1;
+  }
+
+  FILE *json = fopen("bench/compile.json", "w");
+  if (json == NULL) {
+    perror("bench/compile.json");
+    return 1;
+  }
+  fprintf(json, "[\n");
+
+  printf("%-12s %6s %8s %-10s %10s %12s %10s\n", "workload", "units", "lines",
+         "phase", "ms", "lines/s", "rss KiB");
+
+  int flagged = 0, first = 1;
+  for (size_t k = 0; k < NKINDS; k++) {
+    Sample samples[NUNITS][NPHASES];
+    long lines[NUNITS];
+
+    for (size_t u = 0; u < NUNITS; u++) {
+      char dir[] = "/tmp/dang-bench-XXXXXX";
+      if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+      }
+
+      generate(kinds[k], units[u], dir);
+      lines[u] = countLines(dir);
+
+      char command[3 * PATH_MAX];
+      snprintf(command, sizeof(command),
+               "cd %s && %s main.dang -stats-json=stats.json >/dev/null 2>&1",
+               dir, dang);
+      system(command);
+
+      char stats[PATH_MAX];
+      snprintf(stats, sizeof(stats), "%s/stats.json", dir);
+      int ok = readStats(stats, samples[u]);
+      snprintf(command, sizeof(command), "rm -rf %s", dir);
+      system(command);
+
+      if (!ok) {
+        printf("!! %s: dang failed at %d units\n", kinds[k], units[u]);
+        flagged++;
+        for (size_t p = 0; p < NPHASES; p++)
+          samples[u][p] = (Sample){0, 0};
+        continue;
+      }
+
+      for (size_t p = 0; p < NPHASES; p++) {
+        Sample *s = &samples[u][p];
+        double rate = s->seconds > 0 ? lines[u] / s->seconds : 0;
+        printf("%-12s %6d %8ld %-10s %10.3f %12.0f %10ld\n", kinds[k],
+               units[u], lines[u], phases[p], s->seconds * 1e3, rate,
+               s->maxrss);
+        fprintf(json,
+                "%s  {\"workload\": \"%s\", \"units\": %d, \"lines\": %ld, "
+                "\"phase\": \"%s\", \"seconds\": %.9f, "
+                "\"lines_per_second\": %.0f, \"max_rss_kb\": %ld}",
+                first ? "" : ",\n", kinds[k], units[u], lines[u], phases[p],
+                s->seconds, rate, s->maxrss);
+        first = 0;
+      }
+    }
+
+    // Growth exponent between the two largest sizes: ~1 is linear
+    for (size_t p = 0; p < NPHASES; p++) {
+      double t0 = samples[NUNITS - 2][p].seconds;
+      double t1 = samples[NUNITS - 1][p].seconds;
+      if (t0 < 1e-3 || t1 < 1e-3)
+        continue;
+
+      double growth = log(t1 / t0) / log((double)lines[NUNITS - 1] /
+                                         lines[NUNITS - 2]);
+      if (growth > SUPERLINEAR) {
+        printf("!! %s: %s grows as lines^%.2f\n", kinds[k], phases[p], growth);
+        flagged++;
+      }
+    }
+  }
+
+  fprintf(json, "\n]\n");
+  fclose(json);
+
+  printf("%d problem(s) found, results in bench/compile.json\n", flagged);
+  return 0;
+}
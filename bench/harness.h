@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef HARNESS_H_INCLUDED
+#define HARNESS_H_INCLUDED
+// --------------------------
+// Benchmark harness
+//
+// What the benchmarks share: the clock, running a binary with its stdout
+// captured and its wall clock taken, and checking what it printed against
+// the kernel's NAME.out.
+
+#define MAXOUT 65536
+
+typedef struct {
+  char output[MAXOUT];
+  size_t length;
+  int status;
+  double seconds;
+} Run;
+
+static inline double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Read what a program writes to the pipe until it closes it, then
+ * reap the program and stop its clock
+ */
+static inline void finishRun(pid_t pid, int out, double start, Run *run) {
+  run->length = 0;
+  ssize_t n;
+  while ((n = read(out, run->output + run->length,
+                   MAXOUT - run->length)) > 0)
+    run->length += n;
+  close(out);
+
+  waitpid(pid, &run->status, 0);
+  run->seconds = now() - start;
+}
+
+static inline void execute(char *const argv[], Run *run) {
+  int out[2];
+  if (pipe(out) != 0) {
+    perror("pipe");
+    exit(1);
+  }
+
+  double start = now();
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(out[0]);
+    dup2(out[1], STDOUT_FILENO);
+    execv(argv[0], argv);
+    _exit(127);
+  }
+  close(out[1]);
+  finishRun(pid, out[0], start, run);
+}
+
+static inline size_t readFile(const char *path, char *buffer, size_t size) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return 0;
+  size_t length = fread(buffer, 1, size, f);
+  fclose(f);
+  return length;
+}
+
+static inline int correct(Run *run, const char *expected, size_t length) {
+  return WIFEXITED(run->status) && WEXITSTATUS(run->status) == 0 &&
+         run->length == length && memcmp(run->output, expected, length) == 0;
+}
+
+#endif
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "harness.h"
+
+// --------------------------
+// Interpreter vs native
+//
+// Runs every kernel in bench/kernels, plus a program that only prints a
+// byte, three ways: built with nasm and ld then executed, interpreted with
+// -interp, and assembled in memory with -run. The hello program shows
+// startup cost and the kernels show steady-state speed. The native build
+// and run are timed separately. Each mode's output has to match NAME.out.
+
+static const char *kernels[] = {"hello", "loops", "calls", "arith", "strings"};
+#define NKERNELS (sizeof(kernels) / sizeof(char *))
+#define RUNS 5
+#define STARTUP_RUNS 50
+
+enum { BUILD, NATIVE, INTERP, JIT, NMODES };
+static const char *modeNames[] = {"build", "native", "interp", "run"};
+
+int main() {
+  char dir[] = "/tmp/dang-interp-XXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  // The startup program, its expected output is the byte it writes
+  char hello[256];
+  snprintf(hello, sizeof(hello), "%s/hello.dang", dir);
+  FILE *f = fopen(hello, "w");
+  fprintf(f, "syscall 1 1 \"x\" 1 end\nsyscall 60 0 end\n");
+  fclose(f);
+
+  char cwd[1024], dang[1100], binary[256];
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    perror("getcwd");
+    return 1;
+  }
+  snprintf(dang, sizeof(dang), "%s/dang", cwd);
+  snprintf(binary, sizeof(binary), "%s/a.out", dir);
+
+  FILE *json = fopen("bench/interp.json", "w");
+  if (json == NULL) {
+    perror("bench/interp.json");
+    return 1;
+  }
+  fprintf(json, "[\n");
+
+  printf("%-10s %10s %10s %10s %10s %9s\n", "kernel", "build ms", "native ms",
+         "interp ms", "run ms", "interp/x");
+
+  int failed = 0;
+  for (size_t k = 0; k < NKERNELS; k++) {
+    char source[1200], expected[MAXOUT];
+    size_t expectedLength;
+    if (k == 0) {
+      snprintf(source, sizeof(source), "%s", hello);
+      expectedLength = 1;
+      expected[0] = 'x';
+    } else {
+      char path[256];
+      snprintf(source, sizeof(source), "%s/bench/kernels/%s.dang", cwd,
+               kernels[k]);
+      snprintf(path, sizeof(path), "bench/kernels/%s.out", kernels[k]);
+      expectedLength = readFile(path, expected, MAXOUT);
+    }
+
+    // Build in the temporary directory, a.out lands there
+    char command[4096];
+    snprintf(command, sizeof(command),
+             "cd %s && ln -sfn %s/stdlib stdlib && %s %s >/dev/null 2>&1", dir,
+             cwd, dang, source);
+
+    int runs = k == 0 ? STARTUP_RUNS : RUNS;
+    double best[NMODES] = {};
+    int ok = 1;
+    for (int r = 0; r < runs; r++) {
+      double start = now();
+      if (system(command) != 0) {
+        printf("%-10s failed to compile\n", kernels[k]);
+        ok = 0;
+        break;
+      }
+      double build = now() - start;
+
+      static Run run;
+      char *native[] = {binary, NULL};
+      char *interp[] = {dang, source, "-interp", NULL};
+      char *jit[] = {dang, source, "-run", NULL};
+      char *const *argvs[] = {NULL, native, interp, jit};
+
+      if (r == 0 || build < best[BUILD])
+        best[BUILD] = build;
+      for (int m = NATIVE; m < NMODES; m++) {
+        execute(argvs[m], &run);
+        ok &= correct(&run, expected, expectedLength);
+        if (r == 0 || run.seconds < best[m])
+          best[m] = run.seconds;
+      }
+    }
+    failed += !ok;
+
+    // Interpreter time over the whole native build and run
+    double native = best[BUILD] + best[NATIVE];
+    printf("%-10s %10.3f %10.3f %10.3f %10.3f %8.2fx %s\n", kernels[k],
+           best[BUILD] * 1e3, best[NATIVE] * 1e3, best[INTERP] * 1e3,
+           best[JIT] * 1e3, native > 0 ? best[INTERP] / native : 0.0,
+           ok ? "" : "WRONG");
+
+    fprintf(json, "%s  {\"kernel\": \"%s\", \"ok\": %s", k ? ",\n" : "",
+            kernels[k], ok ? "true" : "false");
+    for (int m = 0; m < NMODES; m++)
+      fprintf(json, ", \"%s_seconds\": %.9f", modeNames[m], best[m]);
+    fprintf(json, "}");
+  }
+
+  fprintf(json, "\n]\n");
+  fclose(json);
+
+  snprintf(dang, sizeof(dang), "rm -rf %s", dir);
+  system(dang);
+
+  printf("%d kernel(s) failed, results in bench/interp.json\n", failed);
+  return failed != 0;
+}
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "harness.h"
+
+// --------------------------
+// Profile-guided builds
+//
+// Builds every kernel in bench/kernels three times: plainly, with
+// -fprofile-generate, and with -fprofile-use on the profile the
+// instrumented binary wrote while running. The plain and the profiled
+// binary are timed against each other and the instrumented one shows
+// what counting costs. Every binary's output has to match NAME.out.
+
+static const char *kernels[] = {"loops",  "calls",  "arith",   "strings",
+                                "floats", "arrays", "branches"};
+#define NKERNELS (sizeof(kernels) / sizeof(char *))
+#define RUNS 5
+
+enum { PLAIN, GENERATE, USE, NBUILDS };
+static const char *buildNames[] = {"plain", "instrumented", "profiled"};
+
+int main() {
+  char dir[] = "/tmp/dang-pgo-XXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  char cwd[1024], binary[256], profile[256];
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    perror("getcwd");
+    return 1;
+  }
+  snprintf(binary, sizeof(binary), "%s/a.out", dir);
+  snprintf(profile, sizeof(profile), "%s/dang.profile", dir);
+
+  FILE *json = fopen("bench/pgo.json", "w");
+  if (json == NULL) {
+    perror("bench/pgo.json");
+    return 1;
+  }
+  fprintf(json, "[\n");
+
+  printf("%-10s %10s %14s %12s %9s\n", "kernel", "plain ms", "instrumented ms",
+         "profiled ms", "speedup");
+
+  int failed = 0;
+  for (size_t k = 0; k < NKERNELS; k++) {
+    char expected[MAXOUT], path[256];
+    snprintf(path, sizeof(path), "bench/kernels/%s.out", kernels[k]);
+    size_t expectedLength = readFile(path, expected, MAXOUT);
+
+    const char *flags[NBUILDS];
+    char generate[300], use[300];
+    snprintf(generate, sizeof(generate), "-fprofile-generate=%s", profile);
+    snprintf(use, sizeof(use), "-fprofile-use=%s", profile);
+    flags[PLAIN] = "";
+    flags[GENERATE] = generate;
+    flags[USE] = use;
+
+    // The instrumented binary runs before the profiled build reads its
+    // profile, every run of it rewrites the same counts
+    double best[NBUILDS] = {};
+    int ok = 1;
+    for (int b = 0; b < NBUILDS && ok; b++) {
+      char command[4096];
+      snprintf(command, sizeof(command),
+               "cd %s && ln -sfn %s/stdlib stdlib && %s/dang "
+               "%s/bench/kernels/%s.dang %s >/dev/null 2>&1",
+               dir, cwd, cwd, cwd, kernels[k], flags[b]);
+      if (system(command) != 0) {
+        printf("%-10s failed to compile %s\n", kernels[k], buildNames[b]);
+        ok = 0;
+        break;
+      }
+
+      static Run run;
+      char *argv[] = {binary, NULL};
+      for (int r = 0; r < RUNS; r++) {
+        execute(argv, &run);
+        ok &= correct(&run, expected, expectedLength);
+        if (r == 0 || run.seconds < best[b])
+          best[b] = run.seconds;
+      }
+    }
+    failed += !ok;
+
+    printf("%-10s %10.3f %14.3f %12.3f %8.2fx %s\n", kernels[k],
+           best[PLAIN] * 1e3, best[GENERATE] * 1e3, best[USE] * 1e3,
+           best[USE] > 0 ? best[PLAIN] / best[USE] : 0.0, ok ? "" : "WRONG");
+
+    fprintf(json, "%s  {\"kernel\": \"%s\", \"ok\": %s", k ? ",\n" : "",
+            kernels[k], ok ? "true" : "false");
+    for (int b = 0; b < NBUILDS; b++)
+      fprintf(json, ", \"%s_seconds\": %.9f", buildNames[b], best[b]);
+    fprintf(json, "}");
+    remove(profile);
+  }
+
+  fprintf(json, "\n]\n");
+  fclose(json);
+
+  char command[300];
+  snprintf(command, sizeof(command), "rm -rf %s", dir);
+  system(command);
+
+  printf("%d kernel(s) failed, results in bench/pgo.json\n", failed);
+  return failed != 0;
+}
@@ -0,0 +1,188 @@
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "harness.h"
+
+// --------------------------
+// Generated code performance
+//
+// Compiles every kernel in bench/kernels with dang, runs the binaries and
+// reads cycles, instructions and branch misses through perf_event_open.
+// Falls back to wall clock only when the counters are unavailable. Output
+// is compared against the checked-in NAME.out, so a fast but wrong binary
+// fails the run.
+
+static const char *kernels[] = {"loops",  "calls",  "arith",   "strings",
+                                "floats", "arrays", "branches"};
+#define NKERNELS (sizeof(kernels) / sizeof(char *))
+#define RUNS 5
+
+enum { CYCLES, INSTRUCTIONS, BRANCH_MISSES, NCOUNTERS };
+static const char *counterNames[] = {"cycles", "instructions",
+                                     "branch_misses"};
+static const uint64_t counterConfigs[] = {PERF_COUNT_HW_CPU_CYCLES,
+                                          PERF_COUNT_HW_INSTRUCTIONS,
+                                          PERF_COUNT_HW_BRANCH_MISSES};
+
+typedef struct {
+  Run run;
+  uint64_t counters[NCOUNTERS];
+  int counted; // perf counters were available
+} CountedRun;
+
+static uint64_t fnv1a(const char *data, size_t length) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < length; i++)
+    hash = (hash ^ (unsigned char)data[i]) * 0x100000001b3ull;
+  return hash;
+}
+
+// Counts user space of pid from its next exec on
+static int openCounter(pid_t pid, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.enable_on_exec = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+static void executeCounted(const char *binary, CountedRun *run) {
+  int go[2], out[2];
+  if (pipe(go) != 0 || pipe(out) != 0) {
+    perror("pipe");
+    exit(1);
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    // Wait until the counters are attached, then exec
+    char c;
+    close(go[1]);
+    close(out[0]);
+    dup2(out[1], STDOUT_FILENO);
+    if (read(go[0], &c, 1) != 1)
+      _exit(127);
+    execl(binary, binary, (char *)NULL);
+    _exit(127);
+  }
+  close(go[0]);
+  close(out[1]);
+
+  int fds[NCOUNTERS];
+  run->counted = 1;
+  for (int i = 0; i < NCOUNTERS; i++) {
+    fds[i] = openCounter(pid, counterConfigs[i]);
+    if (fds[i] < 0)
+      run->counted = 0;
+  }
+
+  double start = now();
+  if (write(go[1], "x", 1) != 1) {
+    perror("write");
+    exit(1);
+  }
+  close(go[1]);
+  finishRun(pid, out[0], start, &run->run);
+
+  for (int i = 0; i < NCOUNTERS; i++) {
+    run->counters[i] = 0;
+    if (fds[i] >= 0) {
+      if (read(fds[i], &run->counters[i], sizeof(uint64_t)) !=
+          sizeof(uint64_t))
+        run->counted = 0;
+      close(fds[i]);
+    }
+  }
+}
+
+int main() {
+  char binary[] = "/tmp/dang-kernel-XXXXXX";
+  int fd = mkstemp(binary);
+  if (fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+
+  FILE *json = fopen("bench/run.json", "w");
+  if (json == NULL) {
+    perror("bench/run.json");
+    return 1;
+  }
+  fprintf(json, "[\n");
+
+  printf("%-10s %-6s %-18s %10s %14s %14s %12s\n", "kernel", "result",
+         "checksum", "ms", "cycles", "instructions", "br-misses");
+
+  int failed = 0;
+  for (size_t k = 0; k < NKERNELS; k++) {
+    char command[256], path[256];
+    snprintf(command, sizeof(command),
+             "./dang bench/kernels/%s.dang >/dev/null 2>&1 && mv a.out %s",
+             kernels[k], binary);
+    if (system(command) != 0) {
+      printf("%-10s failed to compile\n", kernels[k]);
+      failed++;
+      continue;
+    }
+
+    static char expected[MAXOUT];
+    snprintf(path, sizeof(path), "bench/kernels/%s.out", kernels[k]);
+    size_t expectedLength = readFile(path, expected, MAXOUT);
+
+    // Keep the fastest run, every run must be correct
+    static CountedRun run, best;
+    int ok = 1;
+    for (int r = 0; r < RUNS; r++) {
+      executeCounted(binary, &run);
+      ok &= correct(&run.run, expected, expectedLength);
+      if (r == 0 || run.run.seconds < best.run.seconds)
+        best = run;
+    }
+    failed += !ok;
+
+    uint64_t checksum = fnv1a(best.run.output, best.run.length);
+    printf("%-10s %-6s %016llx %10.3f", kernels[k], ok ? "ok" : "WRONG",
+           (unsigned long long)checksum, best.run.seconds * 1e3);
+    if (best.counted)
+      printf(" %14llu %14llu %12llu\n",
+             (unsigned long long)best.counters[CYCLES],
+             (unsigned long long)best.counters[INSTRUCTIONS],
+             (unsigned long long)best.counters[BRANCH_MISSES]);
+    else
+      printf(" %14s %14s %12s\n", "-", "-", "-");
+
+    fprintf(json,
+            "%s  {\"kernel\": \"%s\", \"ok\": %s, \"checksum\": \"%016llx\", "
+            "\"expected_checksum\": \"%016llx\", \"seconds\": %.9f",
+            k ? ",\n" : "", kernels[k], ok ? "true" : "false",
+            (unsigned long long)checksum,
+            (unsigned long long)fnv1a(expected, expectedLength),
+            best.run.seconds);
+    for (int i = 0; i < NCOUNTERS; i++)
+      if (best.counted)
+        fprintf(json, ", \"%s\": %llu", counterNames[i],
+                (unsigned long long)best.counters[i]);
+      else
+        fprintf(json, ", \"%s\": null", counterNames[i]);
+    fprintf(json, ", \"clock\": \"%s\"}", best.counted ? "perf" : "wall");
+  }
+
+  fprintf(json, "\n]\n");
+  fclose(json);
+  unlink(binary);
+
+  printf("%d kernel(s) failed, results in bench/run.json\n", failed);
+  return failed != 0;
+}
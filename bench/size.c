@@ -0,0 +1,157 @@
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "harness.h"
+
+// --------------------------
+// Size-optimized builds
+//
+// Builds every kernel in bench/kernels plainly and with -Os, and compares
+// the bytes of code, read-only data, data and .bss in the two binaries,
+// read from their section headers. Both are timed, since shorter encodings
+// and shared tails may cost a little speed. Every binary's output has to
+// match NAME.out.
+
+static const char *kernels[] = {"loops",  "calls",  "arith",   "strings",
+                                "floats", "arrays", "branches"};
+#define NKERNELS (sizeof(kernels) / sizeof(char *))
+#define RUNS 5
+
+enum { PLAIN, SIZE, NBUILDS };
+static const char *buildNames[] = {"plain", "size"};
+
+enum { TEXT, RODATA, DATA, BSS, NSECTIONS };
+static const char *sectionNames[] = {"text", "rodata", "data", "bss"};
+
+/**
+ * @brief Bytes of the allocated sections of an ELF binary, by kind
+ */
+static int sectionSizes(const char *path, size_t sizes[NSECTIONS]) {
+  memset(sizes, 0, NSECTIONS * sizeof(size_t));
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return 0;
+
+  Elf64_Ehdr header;
+  int ok = fread(&header, sizeof(header), 1, f) == 1 &&
+           memcmp(header.e_ident, ELFMAG, SELFMAG) == 0;
+  for (int i = 0; ok && i < header.e_shnum; i++) {
+    Elf64_Shdr section;
+    ok = fseek(f, header.e_shoff + i * header.e_shentsize, SEEK_SET) == 0 &&
+         fread(&section, sizeof(section), 1, f) == 1;
+    if (!ok || !(section.sh_flags & SHF_ALLOC))
+      continue;
+
+    if (section.sh_type == SHT_NOBITS)
+      sizes[BSS] += section.sh_size;
+    else if (section.sh_flags & SHF_EXECINSTR)
+      sizes[TEXT] += section.sh_size;
+    else if (section.sh_flags & SHF_WRITE)
+      sizes[DATA] += section.sh_size;
+    else
+      sizes[RODATA] += section.sh_size;
+  }
+
+  fclose(f);
+  return ok;
+}
+
+int main() {
+  char dir[] = "/tmp/dang-size-XXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  char cwd[1024], binary[256];
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    perror("getcwd");
+    return 1;
+  }
+  snprintf(binary, sizeof(binary), "%s/a.out", dir);
+
+  FILE *json = fopen("bench/size.json", "w");
+  if (json == NULL) {
+    perror("bench/size.json");
+    return 1;
+  }
+  fprintf(json, "[\n");
+
+  printf("%-10s %11s %11s %7s %11s %11s %9s %9s\n", "kernel", "plain text",
+         "-Os text", "saved", "plain bss", "-Os bss", "plain ms", "-Os ms");
+
+  int failed = 0;
+  size_t totals[NBUILDS][NSECTIONS] = {};
+  for (size_t k = 0; k < NKERNELS; k++) {
+    char expected[MAXOUT], path[256];
+    snprintf(path, sizeof(path), "bench/kernels/%s.out", kernels[k]);
+    size_t expectedLength = readFile(path, expected, MAXOUT);
+
+    const char *flags[NBUILDS] = {"", "-Os"};
+    size_t sizes[NBUILDS][NSECTIONS] = {};
+    double best[NBUILDS] = {};
+    int ok = 1;
+    for (int b = 0; b < NBUILDS && ok; b++) {
+      char command[4096];
+      snprintf(command, sizeof(command),
+               "cd %s && ln -sfn %s/stdlib stdlib && %s/dang "
+               "%s/bench/kernels/%s.dang %s >/dev/null 2>&1",
+               dir, cwd, cwd, cwd, kernels[k], flags[b]);
+      if (system(command) != 0 || !sectionSizes(binary, sizes[b])) {
+        printf("%-10s failed to build %s\n", kernels[k], buildNames[b]);
+        ok = 0;
+        break;
+      }
+
+      static Run run;
+      char *argv[] = {binary, NULL};
+      for (int r = 0; r < RUNS; r++) {
+        execute(argv, &run);
+        ok &= correct(&run, expected, expectedLength);
+        if (r == 0 || run.seconds < best[b])
+          best[b] = run.seconds;
+      }
+
+      for (int s = 0; s < NSECTIONS; s++)
+        totals[b][s] += sizes[b][s];
+    }
+    failed += !ok;
+
+    size_t plain = sizes[PLAIN][TEXT], size = sizes[SIZE][TEXT];
+    printf("%-10s %11zu %11zu %6.1f%% %11zu %11zu %9.3f %9.3f %s\n",
+           kernels[k], plain, size,
+           plain > 0 ? 100.0 * ((double)plain - size) / plain : 0.0,
+           sizes[PLAIN][BSS], sizes[SIZE][BSS], best[PLAIN] * 1e3,
+           best[SIZE] * 1e3, ok ? "" : "WRONG");
+
+    fprintf(json, "%s  {\"kernel\": \"%s\", \"ok\": %s", k ? ",\n" : "",
+            kernels[k], ok ? "true" : "false");
+    for (int b = 0; b < NBUILDS; b++) {
+      for (int s = 0; s < NSECTIONS; s++)
+        fprintf(json, ", \"%s_%s\": %zu", buildNames[b], sectionNames[s],
+                sizes[b][s]);
+      fprintf(json, ", \"%s_seconds\": %.9f", buildNames[b], best[b]);
+    }
+    fprintf(json, "}");
+  }
+
+  fprintf(json, "\n]\n");
+  fclose(json);
+
+  char command[300];
+  snprintf(command, sizeof(command), "rm -rf %s", dir);
+  system(command);
+
+  printf("%-10s %11zu %11zu %6.1f%% %11zu %11zu\n", "total",
+         totals[PLAIN][TEXT], totals[SIZE][TEXT],
+         totals[PLAIN][TEXT] > 0
+             ? 100.0 * ((double)totals[PLAIN][TEXT] - totals[SIZE][TEXT]) /
+                   totals[PLAIN][TEXT]
+             : 0.0,
+         totals[PLAIN][BSS], totals[SIZE][BSS]);
+  printf("%d kernel(s) failed, results in bench/size.json\n", failed);
+  return failed != 0;
+}
@@ -0,0 +1,212 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "harness.h"
+
+// --------------------------
+// Runtime string kernels vs glibc
+//
+// Links against the kernels written by `dang -emit-runtime`, checks every
+// variant against glibc (including strings ending at an unmapped page) and
+// then times them across sizes.
+
+extern uint64_t _rt_cpu_features;
+extern void _rt_cpu_init(void);
+
+#define KERNEL(name)                                                           \
+  extern void *name##_word();                                                  \
+  extern void *name##_sse2();                                                  \
+  extern void *name##_avx2();
+
+KERNEL(_rt_strlen)
+KERNEL(_rt_memchr)
+KERNEL(_rt_memcpy)
+KERNEL(_rt_memset)
+KERNEL(_rt_memcmp)
+
+typedef size_t (*strlen_fn)(const char *);
+typedef void *(*memchr_fn)(const void *, int, size_t);
+typedef void *(*memcpy_fn)(void *, const void *, size_t);
+typedef void *(*memset_fn)(void *, int, size_t);
+typedef int64_t (*memcmp_fn)(const void *, const void *, size_t);
+
+static const char *levels[] = {"glibc", "word", "sse2", "avx2"};
+static const char *names[] = {"strlen", "memchr", "memcpy", "memset",
+                              "memcmp"};
+static const size_t sizes[] = {1, 7, 16, 31, 64, 200, 1024, 4096, 65536};
+#define NSIZES (sizeof(sizes) / sizeof(size_t))
+#define MAXSIZE 65536
+
+static int memcmp_sign(int64_t x) { return (x > 0) - (x < 0); }
+
+static volatile uint64_t sink;
+static char *src, *dst;
+
+// glibc entry points, called through pointers so they aren't inlined
+static strlen_fn glibc_strlen = (strlen_fn)strlen;
+static memchr_fn glibc_memchr = memchr;
+static memcpy_fn glibc_memcpy = memcpy;
+static memset_fn glibc_memset = memset;
+
+static int64_t glibc_memcmp(const void *a, const void *b, size_t n) {
+  return memcmp(a, b, n);
+}
+
+static void *variant(void *glibc, void *word, void *sse2, void *avx2,
+                     int level) {
+  void *all[] = {glibc, word, sse2, avx2};
+  return all[level];
+}
+
+static int available(int level) {
+  if (level == 3)
+    return (_rt_cpu_features & 2) != 0;
+  return 1;
+}
+
+static int check(int level) {
+  strlen_fn f_strlen = variant(glibc_strlen, _rt_strlen_word,
+                               _rt_strlen_sse2, _rt_strlen_avx2, level);
+  memchr_fn f_memchr = variant(glibc_memchr, _rt_memchr_word,
+                               _rt_memchr_sse2, _rt_memchr_avx2, level);
+  memcpy_fn f_memcpy = variant(glibc_memcpy, _rt_memcpy_word,
+                               _rt_memcpy_sse2, _rt_memcpy_avx2, level);
+  memset_fn f_memset = variant(glibc_memset, _rt_memset_word,
+                               _rt_memset_sse2, _rt_memset_avx2, level);
+  memcmp_fn f_memcmp = variant(glibc_memcmp, _rt_memcmp_word,
+                               _rt_memcmp_sse2, _rt_memcmp_avx2, level);
+
+  // Strings ending right before an unmapped page
+  long page = sysconf(_SC_PAGESIZE);
+  char *map = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  mprotect(map + page, page, PROT_NONE);
+  memset(map, 'a', page);
+  map[page - 1] = '\0';
+  for (size_t len = 0; len < 100; len++) {
+    char *s = map + page - 1 - len;
+    if (f_strlen(s) != len)
+      return 0;
+    if (f_memchr(s, 'b', len + 1) != NULL)
+      return 0;
+    if (f_memchr(s, '\0', len + 1) != s + len)
+      return 0;
+  }
+  munmap(map, 2 * page);
+
+  for (size_t align = 0; align < 33; align++)
+    for (size_t len = 0; len < 300; len += 1 + len / 8) {
+      char *s = src + align;
+      for (size_t i = 0; i < len; i++)
+        s[i] = 'a' + (i % 26);
+      s[len] = '\0';
+
+      if (f_strlen(s) != len)
+        return 0;
+      if (f_memchr(s, 'z', len) != memchr(s, 'z', len))
+        return 0;
+      if (f_memchr(s, '#', len) != NULL)
+        return 0;
+
+      memset(dst, 0x55, len + 64);
+      if (f_memcpy(dst + align, s, len) != dst + align ||
+          memcmp(dst + align, s, len) != 0 || dst[align + len] != 0x55)
+        return 0;
+      if (memcmp_sign(f_memcmp(dst + align, s, len)) != 0)
+        return 0;
+
+      for (size_t i = 0; i < len; i += 1 + i / 4) {
+        dst[align + i] ^= 1;
+        if (memcmp_sign(f_memcmp(dst + align, s, len)) !=
+            memcmp_sign(memcmp(dst + align, s, len)))
+          return 0;
+        dst[align + i] ^= 1;
+      }
+
+      if (f_memset(dst + align, 0x7f, len) != dst + align ||
+          dst[align + len] != 0x55)
+        return 0;
+      for (size_t i = 0; i < len; i++)
+        if (dst[align + i] != 0x7f)
+          return 0;
+    }
+
+  return 1;
+}
+
+static void bench(int routine, int level, size_t size) {
+  size_t iters = 1 + (64 << 20) / (size + 32);
+
+  memset(src, 'a', size);
+  src[size] = '\0';
+  memcpy(dst, src, size + 1);
+
+  void *fn[] = {
+      variant(glibc_strlen, _rt_strlen_word, _rt_strlen_sse2, _rt_strlen_avx2,
+              level),
+      variant(glibc_memchr, _rt_memchr_word, _rt_memchr_sse2, _rt_memchr_avx2,
+              level),
+      variant(glibc_memcpy, _rt_memcpy_word, _rt_memcpy_sse2, _rt_memcpy_avx2,
+              level),
+      variant(glibc_memset, _rt_memset_word, _rt_memset_sse2, _rt_memset_avx2,
+              level),
+      variant(glibc_memcmp, _rt_memcmp_word, _rt_memcmp_sse2, _rt_memcmp_avx2,
+              level),
+  };
+
+  double start = now();
+  switch (routine) {
+  case 0:
+    for (size_t i = 0; i < iters; i++)
+      sink += ((strlen_fn)fn[0])(src);
+    break;
+  case 1:
+    for (size_t i = 0; i < iters; i++)
+      sink += (uintptr_t)((memchr_fn)fn[1])(src, 'b', size);
+    break;
+  case 2:
+    for (size_t i = 0; i < iters; i++)
+      sink += (uintptr_t)((memcpy_fn)fn[2])(dst, src, size);
+    break;
+  case 3:
+    for (size_t i = 0; i < iters; i++)
+      sink += (uintptr_t)((memset_fn)fn[3])(dst, 'a', size);
+    break;
+  case 4:
+    for (size_t i = 0; i < iters; i++)
+      sink += ((memcmp_fn)fn[4])(dst, src, size);
+    break;
+  }
+  double elapsed = now() - start;
+
+  printf("%-8s %-6s %8zu %10.2f ns %8.2f GB/s\n", names[routine],
+         levels[level], size, elapsed / iters * 1e9,
+         (double)size * iters / elapsed / 1e9);
+}
+
+int main() {
+  _rt_cpu_init();
+  src = aligned_alloc(64, MAXSIZE + 128);
+  dst = aligned_alloc(64, MAXSIZE + 128);
+
+  for (int level = 1; level < 4; level++) {
+    if (!available(level))
+      continue;
+    if (!check(level)) {
+      fprintf(stderr, "%s kernels disagree with glibc\n", levels[level]);
+      return 1;
+    }
+  }
+
+  for (int routine = 0; routine < 5; routine++)
+    for (size_t s = 0; s < NSIZES; s++)
+      for (int level = 0; level < 4; level++)
+        if (available(level))
+          bench(routine, level, sizes[s]);
+
+  return 0;
+}
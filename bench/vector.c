@@ -0,0 +1,481 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "harness.h"
+
+// --------------------------
+// Array kernels vs scalar loops
+//
+// Links against the kernels written by `dang -emit-runtime` and checks
+// every level of the vector and reduce kernels against C, then times them
+// per element. Then builds dang programs doing the same work twice, once
+// on whole arrays and once in a while loop over v[i], and times both
+// binaries. Each pair has to print the same output. Last, loops filling,
+// copying and searching arrays are built with and without
+// -fno-loop-idioms: the default build has to call the vector kernel in
+// their place and print what the loops print.
+
+extern uint64_t _rt_cpu_features;
+extern void _rt_cpu_init(void);
+
+#define KERNEL(name)                                                           \
+  extern void *name##_word();                                                  \
+  extern void *name##_sse2();                                                  \
+  extern void *name##_avx2();
+
+KERNEL(_rt_vector)
+KERNEL(_rt_reduce)
+
+typedef void (*vector_fn)(void *, const void *, const void *, int64_t,
+                          int64_t);
+typedef int64_t (*find_fn)(void *, const void *, const void *, int64_t,
+                           int64_t);
+typedef int64_t (*reduce_fn)(const void *, int64_t, int64_t);
+typedef double (*freduce_fn)(const void *, int64_t, int64_t);
+
+// Operations and reductions, numbered like src/runtime.c
+static const char *operations[] = {"copy", "add",  "sub",  "mul",  "and",
+                                   "or",   "xor",  "shl",  "sar",  "fadd",
+                                   "fsub", "fmul", "fdiv", "fill", "find"};
+static const char *reductions[] = {"sum", "min", "max", "fsum", "fmin",
+                                   "fmax"};
+#define NOPERATIONS 13
+#define NREDUCTIONS 6
+#define SHL 7
+#define SAR 8
+#define FADD 9
+#define FILL 13
+#define FIND 14
+#define FSUM 3
+
+static const char *levels[] = {"word", "sse2", "avx2"};
+#define MAXLEN 4096
+#define RUNS 5
+
+static volatile int64_t sink;
+static volatile double fsink;
+
+static int available(int level) {
+  if (level == 1)
+    return (_rt_cpu_features & 1) != 0;
+  if (level == 2)
+    return (_rt_cpu_features & 2) != 0;
+  return 1;
+}
+
+static vector_fn vector(int level) {
+  void *all[] = {_rt_vector_word, _rt_vector_sse2, _rt_vector_avx2};
+  return (vector_fn)all[level];
+}
+
+static void *reduce(int level) {
+  void *all[] = {_rt_reduce_word, _rt_reduce_sse2, _rt_reduce_avx2};
+  return all[level];
+}
+
+static int64_t expectElement(int op, int64_t a, int64_t b) {
+  uint64_t x = a, y = b;
+  switch (op) {
+  case 0: return a;
+  case 1: return x + y;
+  case 2: return x - y;
+  case 3: return x * y;
+  case 4: return a & b;
+  case 5: return a | b;
+  case 6: return a ^ b;
+  case SHL: return x << 5;
+  default: return a >> 5;
+  }
+}
+
+static double expectFloat(int op, double a, double b) {
+  switch (op) {
+  case 9: return a + b;
+  case 10: return a - b;
+  case 11: return a * b;
+  default: return a / b;
+  }
+}
+
+static int check(int level) {
+  static int64_t a[MAXLEN], b[MAXLEN], dst[MAXLEN + 8];
+  static double fa[MAXLEN], fb[MAXLEN], fdst[MAXLEN + 8];
+  for (int i = 0; i < MAXLEN; i++) {
+    a[i] = (i * 7919 - 123456789) * (i % 3 ? 1 : -1) * 1000003;
+    b[i] = i * 31 - 77;
+    fa[i] = i * 0.37 - 3.1;
+    fb[i] = 1.0 + i * 0.5;
+  }
+
+  for (int64_t n = 0; n < 70; n++) {
+    for (int op = 0; op < NOPERATIONS; op++) {
+      int floats = op >= FADD;
+      void *out = floats ? (void *)fdst : (void *)dst;
+      memset(out, 0x55, (n + 8) * 8);
+
+      const void *second = op == SHL || op == SAR ? (void *)(intptr_t)5
+                           : floats              ? (void *)fb
+                                                 : (void *)b;
+      vector(level)(out, floats ? (void *)fa : (void *)a, second, n, op);
+
+      for (int64_t i = 0; i < n; i++)
+        if (floats ? fdst[i] != expectFloat(op, fa[i], fb[i])
+                   : dst[i] != expectElement(op, a[i], b[i]))
+          return 0;
+      if (((int64_t *)out)[n] != 0x5555555555555555)
+        return 0;
+    }
+
+    // A fill stores its second argument, a search returns the first index
+    // of it, or n
+    memset(dst, 0x55, (n + 8) * 8);
+    vector(level)(dst, NULL, (void *)(intptr_t)-7, n, FILL);
+    for (int64_t i = 0; i < n; i++)
+      if (dst[i] != -7)
+        return 0;
+    if (dst[n] != 0x5555555555555555)
+      return 0;
+
+    for (int64_t at = 0; at <= n; at++) {
+      int64_t wanted = at < n ? a[at] : 42, first = 0;
+      while (first < n && a[first] != wanted)
+        first++;
+      if (((find_fn)vector(level))(NULL, a, (void *)(intptr_t)wanted, n,
+                                   FIND) != first)
+        return 0;
+    }
+
+    // Float sums are added in four interleaved lanes on every level
+    int64_t sum = 0, min = 0, max = 0;
+    double lanes[4] = {0, 0, 0, 0}, fmin = 0, fmax = 0;
+    int64_t i = 0;
+    for (; i + 4 <= n; i += 4)
+      for (int lane = 0; lane < 4; lane++)
+        lanes[lane] += fa[i + lane];
+    double fsum = (lanes[0] + lanes[2]) + (lanes[1] + lanes[3]);
+    for (; i < n; i++)
+      fsum += fa[i];
+    for (i = 0; i < n; i++) {
+      sum += a[i];
+      min = i == 0 || a[i] < min ? a[i] : min;
+      max = i == 0 || a[i] > max ? a[i] : max;
+      fmin = i == 0 || fa[i] < fmin ? fa[i] : fmin;
+      fmax = i == 0 || fa[i] > fmax ? fa[i] : fmax;
+    }
+
+    int64_t expected[] = {sum, min, max};
+    double fexpected[] = {fsum, fmin, fmax};
+    for (int op = 0; op < NREDUCTIONS; op++)
+      if (op < FSUM ? ((reduce_fn)reduce(level))(a, n, op) != expected[op]
+                    : ((freduce_fn)reduce(level))(fa, n, op) !=
+                          fexpected[op - FSUM])
+        return 0;
+  }
+
+  return 1;
+}
+
+static void benchKernels(int64_t n) {
+  static int64_t a[MAXLEN], b[MAXLEN], dst[MAXLEN];
+  static double fa[MAXLEN], fb[MAXLEN], fdst[MAXLEN];
+  for (int i = 0; i < MAXLEN; i++) {
+    a[i] = i, b[i] = i ^ 1023;
+    fa[i] = i, fb[i] = 1.0 + i;
+  }
+  size_t iters = 1 + (256 << 20) / (n * 8 + 64);
+
+  // Searches look for a value that isn't there
+  int ops[] = {1, 3, SAR, FADD, 12, FILL, FIND};
+  for (int k = 0; k < 7; k++)
+    for (int level = 0; level < 3; level++) {
+      if (!available(level))
+        continue;
+      int op = ops[k], floats = op >= FADD && op < FILL;
+      const void *second = op == SAR    ? (void *)(intptr_t)3
+                           : op >= FILL ? (void *)(intptr_t)-1
+                           : floats     ? (void *)fb
+                                        : (void *)b;
+
+      double start = now();
+      for (size_t i = 0; i < iters; i++)
+        vector(level)(floats ? (void *)fdst : (void *)dst,
+                      floats ? (void *)fa : (void *)a, second, n, op);
+      double elapsed = now() - start;
+      printf("%-6s %-6s %6ld %8.3f ns/element\n", operations[op],
+             levels[level], n, elapsed / iters / n * 1e9);
+    }
+
+  for (int op = 0; op < NREDUCTIONS; op++)
+    for (int level = 0; level < 3; level++) {
+      if (!available(level))
+        continue;
+
+      double start = now();
+      for (size_t i = 0; i < iters; i++)
+        if (op < FSUM)
+          sink += ((reduce_fn)reduce(level))(a, n, op);
+        else
+          fsink += ((freduce_fn)reduce(level))(fa, n, op);
+      double elapsed = now() - start;
+      printf("%-6s %-6s %6ld %8.3f ns/element\n", reductions[op],
+             levels[level], n, elapsed / iters / n * 1e9);
+    }
+}
+
+// --------------------------
+// Whole arrays vs v[i] loops
+
+typedef struct {
+  const char *name;
+  const char *type;     // of the elements
+  const char *whole;    // statement on whole arrays
+  const char *element;  // the same statement on element i
+  const char *reduce;   // reduction of c, added to total
+  const char *start;    // the same reduction on element i, from start
+  const char *fold;
+} Workload;
+
+static const Workload workloads[] = {
+    {"add", "int", "c = a + b", "c[i] = a[i] + b[i]", "sum <| c 4096", "0",
+     "s = s + c[i]"},
+    {"mul", "int", "c = a * b", "c[i] = a[i] * b[i]", "sum <| c 4096", "0",
+     "s = s + c[i]"},
+    {"shift", "int", "c = a >> 3", "c[i] = a[i] >> 3", "max <| c 4096",
+     "c[0]", "if c[i] > s then\n      s = c[i]\n    end"},
+    {"xor", "int", "c = a ^ b", "c[i] = a[i] ^ b[i]", "sum <| c 4096", "0",
+     "s = s + c[i]"},
+    // Products and sums stay integers below 2^53, so the order sums are
+    // added in doesn't round differently
+    {"fmul", "float", "c = a * b", "c[i] = a[i] * b[i]", "fsum <| c 4096",
+     "0", "s = s + c[i]"},
+};
+#define NWORKLOADS (sizeof(workloads) / sizeof(Workload))
+
+static void writeProgram(const char *path, const Workload *w, int whole) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    perror(path);
+    exit(1);
+  }
+
+  fprintf(f, "include stdlib/io.dang\ninclude stdlib/array.dang\n\n");
+  fprintf(f, "let a:%s[4096]\nlet b:%s[4096]\nlet c:%s[4096]\n", w->type,
+          w->type, w->type);
+  fprintf(f, "let i:int = 0\nwhile i < 4096 do\n  a[i] = i + 1\n"
+             "  b[i] = i * 3\n  i = i + 1\nend\n\n");
+  fprintf(f, "let total:%s = 0\nlet s:%s = 0\nlet n:int = 0\n", w->type,
+          w->type);
+  fprintf(f, "while n < 20000 do\n");
+  if (whole)
+    fprintf(f, "  %s\n  total = total + %s\n", w->whole, w->reduce);
+  else
+    fprintf(f,
+            "  i = 0\n  while i < 4096 do\n    %s\n    i = i + 1\n  end\n"
+            "  s = %s\n  i = 0\n  while i < 4096 do\n    %s\n"
+            "    i = i + 1\n  end\n  total = total + s\n",
+            w->element, w->start, w->fold);
+  fprintf(f, "  n = n + 1\nend\n\nprintint <| total\nprintln <| \"\"\n");
+  fclose(f);
+}
+
+// Best of RUNS, -1 when a run failed
+static double fastest(const char *binary, Run *run) {
+  char *const argv[] = {(char *)binary, NULL};
+  double best = -1;
+  for (int r = 0; r < RUNS; r++) {
+    execute(argv, run);
+    if (!WIFEXITED(run->status) || WEXITSTATUS(run->status) != 0)
+      return -1;
+    if (r == 0 || run->seconds < best)
+      best = run->seconds;
+  }
+  return best;
+}
+
+static int benchPrograms() {
+  char dir[] = "/tmp/dang-vector-XXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  printf("\n%-8s %12s %12s %8s\n", "program", "loop ms", "whole ms",
+         "speedup");
+  int failed = 0;
+  for (size_t k = 0; k < NWORKLOADS; k++) {
+    double best[2];
+    static Run runs[2];
+
+    for (int whole = 0; whole < 2; whole++) {
+      char source[256], binary[256], command[768];
+      snprintf(source, sizeof(source), "%s/%s-%d.dang", dir,
+               workloads[k].name, whole);
+      snprintf(binary, sizeof(binary), "%s/%s-%d", dir, workloads[k].name,
+               whole);
+      writeProgram(source, &workloads[k], whole);
+
+      snprintf(command, sizeof(command),
+               "./dang %s >/dev/null 2>&1 && mv a.out %s", source, binary);
+      best[whole] = -1;
+      if (system(command) != 0)
+        continue;
+
+      best[whole] = fastest(binary, &runs[whole]);
+    }
+
+    int ok = best[0] >= 0 && best[1] >= 0 &&
+             runs[0].length == runs[1].length &&
+             memcmp(runs[0].output, runs[1].output, runs[0].length) == 0;
+    if (!ok) {
+      printf("%-8s failed, the two programs disagree or didn't run\n",
+             workloads[k].name);
+      failed++;
+      continue;
+    }
+    printf("%-8s %12.3f %12.3f %7.2fx\n", workloads[k].name, best[0] * 1e3,
+           best[1] * 1e3, best[0] / best[1]);
+  }
+
+  char command[64];
+  snprintf(command, sizeof(command), "rm -rf %s", dir);
+  if (system(command) != 0)
+    fprintf(stderr, "couldn't remove %s\n", dir);
+  return failed;
+}
+
+// --------------------------
+// Loop idioms
+
+typedef struct {
+  const char *name;
+  const char *loop;   // over c or a, with k = n & 4095 and m = k + 1
+  const char *result; // added to total
+} Idiom;
+
+static const Idiom idioms[] = {
+    {"fill", "i = 0\n  while i < 4096 do\n    c[i] = n\n    i = i + 1\n  end",
+     "c[k]"},
+    {"copy",
+     "i = 0\n  while i < 4096 do\n    c[i] = a[i]\n    i = i + 1\n  end",
+     "c[k]"},
+    {"find", "i = 0\n  while a[i] != m do\n    i = i + 1\n  end", "i"},
+};
+#define NIDIOMS (sizeof(idioms) / sizeof(Idiom))
+
+static void writeIdiom(const char *path, const Idiom *idiom) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    perror(path);
+    exit(1);
+  }
+
+  fprintf(f, "include stdlib/io.dang\n\n");
+  fprintf(f, "let a:int[4096]\nlet c:int[4096]\n");
+  fprintf(f, "let i:int = 0\nwhile i < 4096 do\n  a[i] = i + 1\n"
+             "  i = i + 1\nend\n\n");
+  fprintf(f, "let total:int = 0\nlet k:int = 0\nlet m:int = 0\n"
+             "let n:int = 0\n");
+  fprintf(f, "while n < 20000 do\n  k = n & 4095\n  m = k + 1\n  %s\n"
+             "  total = total + %s\n  n = n + 1\nend\n\n",
+          idiom->loop, idiom->result);
+  fprintf(f, "printint <| total\nprintln <| \"\"\n");
+  fclose(f);
+}
+
+// Whether the assembly calls the vector kernel
+static int callsKernel(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return 0;
+
+  char line[256];
+  int found = 0;
+  while (!found && fgets(line, sizeof(line), f) != NULL)
+    found = strstr(line, "call qword [_rt_vector_impl]") != NULL;
+  fclose(f);
+  return found;
+}
+
+static int benchIdioms() {
+  char dir[] = "/tmp/dang-idiom-XXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  printf("\n%-8s %12s %12s %8s\n", "idiom", "loop ms", "kernel ms",
+         "speedup");
+  int failed = 0;
+  for (size_t k = 0; k < NIDIOMS; k++) {
+    double best[2];
+    static Run runs[2];
+    int calls[2];
+
+    for (int kernel = 0; kernel < 2; kernel++) {
+      char source[256], binary[256], assembly[256], command[1024];
+      snprintf(source, sizeof(source), "%s/%s-%d.dang", dir, idioms[k].name,
+               kernel);
+      snprintf(binary, sizeof(binary), "%s/%s-%d", dir, idioms[k].name,
+               kernel);
+      snprintf(assembly, sizeof(assembly), "%s/%s-%d.asm", dir,
+               idioms[k].name, kernel);
+      writeIdiom(source, &idioms[k]);
+
+      snprintf(command, sizeof(command),
+               "./dang %s -asm %s >/dev/null 2>&1 && mv a.out %s", source,
+               kernel ? "" : "-fno-loop-idioms", binary);
+      best[kernel] = -1;
+      if (system(command) != 0)
+        continue;
+      calls[kernel] = callsKernel(assembly);
+      best[kernel] = fastest(binary, &runs[kernel]);
+    }
+
+    int ok = best[0] >= 0 && best[1] >= 0 &&
+             runs[0].length == runs[1].length &&
+             memcmp(runs[0].output, runs[1].output, runs[0].length) == 0;
+    if (!ok) {
+      printf("%-8s failed, the two programs disagree or didn't run\n",
+             idioms[k].name);
+      failed++;
+      continue;
+    }
+    if (calls[0] || !calls[1]) {
+      printf("%-8s failed, the loop wasn't replaced by the kernel\n",
+             idioms[k].name);
+      failed++;
+      continue;
+    }
+    printf("%-8s %12.3f %12.3f %7.2fx\n", idioms[k].name, best[0] * 1e3,
+           best[1] * 1e3, best[0] / best[1]);
+  }
+
+  char command[64];
+  snprintf(command, sizeof(command), "rm -rf %s", dir);
+  if (system(command) != 0)
+    fprintf(stderr, "couldn't remove %s\n", dir);
+  return failed;
+}
+
+int main() {
+  _rt_cpu_init();
+
+  for (int level = 0; level < 3; level++) {
+    if (!available(level))
+      continue;
+    if (!check(level)) {
+      fprintf(stderr, "%s array kernels disagree with C\n", levels[level]);
+      return 1;
+    }
+  }
+
+  int64_t sizes[] = {16, 256, 4096};
+  for (int s = 0; s < 3; s++)
+    benchKernels(sizes[s]);
+
+  int failed = benchPrograms();
+  return failed + benchIdioms() != 0;
+}
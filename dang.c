@@ -1,12 +1,21 @@
+// struct ucred, for the compile server to check who is connecting
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
 #include "src/utils.c"
+#include "src/stats.c"
 #include "src/lexer.c"
 #include "src/parser.c"
+#include "src/eval.c"
+#include "src/runtime.c"
 #include "src/codegen.c"
+#include "src/jit.c"
+#include "src/interp.c"
+#include "src/lto.c"
+#include "src/server.c"
 
 // --------------------------
 // Main ---------------------
@@ -47,16 +56,21 @@ void compileTarget(const str filename, const str outfile)
 	setTargetCompiling(filename);
 	
 	uint length = 0;
+	statsBegin(PHASE_PARSE);
 	TokenStream stream = parse(filename);
+	statsEnd();
 
+	statsBegin(PHASE_CODEGEN);
 	codegen(stream, outfile);
+	statsEnd();
 }
 
-int main(int argc, str argv[])
+/**
+ * @brief Compile what a command line asks for, main or a compile server fork
+ */
+int compileCommand(int argc, str argv[])
 {
-	// Ignore name of binary
-	argv = &argv[1];
-	argc--;
+	statsInit();
 
 	str *targets = malloc(argc * sizeof(str));
 	str *cflags = malloc(argc * sizeof(str));
@@ -74,10 +88,15 @@ int main(int argc, str argv[])
 			printf("[INFO] Ignoring unknown argument \"%s\"\n", arg);
 	}
 
-	for (size_t i = n_targets; i < argc; i++)
-		free(targets[i]);
-	for (size_t i = n_cflags; i < argc; i++)
-		free(cflags[i]);
+	__CFLAGS__ = cflags;
+	__N_CFLAGS__ = n_cflags;
+
+	if (hasCompilerFlag("-emit-runtime"))
+		emitRuntime("runtime.asm");
+
+	// The program gets stdout back right before it starts
+	if (hasCompilerFlag("-run") || hasCompilerFlag("-interp"))
+		jitQuietCompile();
 
 	// Initialize list of targets
 	__TARGETS__ = malloc(sizeof(str));
@@ -88,7 +107,7 @@ int main(int argc, str argv[])
 		const str target = *targets;
 
 		uint len = strcspn(target, ".");
-		char name[len];
+		char name[len + 1];
 		for (size_t i = 0; i < len; i++)
 			name[i] = target[i];
 		name[len] = '\0';
@@ -111,17 +130,80 @@ int main(int argc, str argv[])
 
 		compileTarget(target, ASM);
 
-		system(fstr("nasm -felf64 %s", ASM));
-		system(fstr("ld -o %s %s", OUT, OBJ));
-		system(fstr("rm %s", OBJ));
+		// -g turns the line table into DWARF
+		str debug = hasCompilerFlag("-g") ? "-g -F dwarf " : "";
+
+		// -separate only assembles the objects that changed
+		if (__N_OBJECTS__ > 0)
+		{
+			strbuf objects = createBuffer();
+			for (uint i = 0; i < __N_OBJECTS__; i++)
+			{
+				str source = shellQuote(fstr("%s.asm", __OBJECTS__[i]));
+				if (__STALE_OBJECTS__[i] &&
+						statsSystem(PHASE_NASM, fstr("nasm -felf64 %s%s", debug, source)) != 0)
+					CompilerError(fstr("Couldn't assemble \"%s.asm\".", __OBJECTS__[i]));
+				str object = fstr(" %s", shellQuote(fstr("%s.o", __OBJECTS__[i])));
+				appendBuffer(&objects, object, strlen(object));
+			}
+			if (statsSystem(PHASE_LD, fstr("ld -o %s%s", shellQuote(OUT), objects.ptr)) != 0)
+				CompilerError(fstr("Couldn't link \"%s\".", OUT));
+			free(objects.ptr);
+
+			targets = &targets[1];
+			n_targets--;
+			continue;
+		}
+
+		if (statsSystem(PHASE_NASM, fstr("nasm -felf64 %s%s", debug, shellQuote(ASM))) != 0)
+			CompilerError(fstr("Couldn't assemble \"%s\".", ASM));
+		if (statsSystem(PHASE_LD, fstr("ld -o %s %s", shellQuote(OUT), shellQuote(OBJ))) != 0)
+			CompilerError(fstr("Couldn't link \"%s\".", OUT));
+		system(fstr("rm %s", shellQuote(OBJ)));
 		
 		if (arrIncludes(cflags, n_cflags, "-asm") == false)
-			system(fstr("rm %s", ASM));
+			system(fstr("rm %s", shellQuote(ASM)));
 
 		// Shift base pointer ahead
 		targets = &targets[1];
 		n_targets--;
 	}
 
+	if (hasCompilerFlag("-ftime-report"))
+		printStatsReport(stdout);
+
+	str statsFile = compilerFlagValue("-stats-json");
+	if (statsFile != NULL)
+		writeStatsJson(statsFile);
+
+	// Everything compiled, a compile server may keep the includes warm
+	reportIncludes();
 	return 0;
 }
+
+int main(int argc, str argv[])
+{
+	// Ignore name of binary
+	argv = &argv[1];
+	argc--;
+
+	for (int i = 0; i < argc; i++)
+	{
+		if (strncmp(argv[i], "--server", strlen("--server")) == 0)
+			serveCompiles(serverSocketPath(argv[i]));
+
+		if (strncmp(argv[i], "--client", strlen("--client")) == 0)
+		{
+			str socketPath = serverSocketPath(argv[i]);
+			int status = clientCompile(socketPath, argc, argv);
+			if (status >= 0)
+				return status;
+
+			fprintf(stderr, "[INFO] No compile server on %s, compiling here\n",
+							socketPath);
+			break;
+		}
+	}
+
+	return compileCommand(argc, argv);
+}
@@ -1,11 +1,23 @@
 #include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "codestats.c"
+#include "eval.c"
+#include "jit.c"
 #include "lexer.c"
 #include "parser.c"
+#include "profile.c"
+#include "runtime.c"
+#include "size.c"
+#include "stats.c"
 #include "utils.c"
 
 #ifndef CODEGEN_C_INCLUDED
@@ -62,11 +74,53 @@ str syscall_argloc(uint narg) {
   }
 }
 
+/**
+ * @brief Whether a syscall ends the process, given its number
+ */
+bool isExitSyscall(Token *number) {
+  if (number->type != LiteralToken || number->value.__l.type != IntValue)
+    return false;
+  return number->value.__l.value.__i == SYS_EXIT ||
+         number->value.__l.value.__i == SYS_EXIT_GROUP;
+}
+
+/**
+ * @brief Whether what the io module buffered has to be written out before a
+ * syscall: it exits, writes, or its number is only known at run time
+ */
+bool flushesOutput(Token *number) {
+  if (number->type != LiteralToken || number->value.__l.type != IntValue)
+    return true;
+  int n = number->value.__l.value.__i;
+  return isExitSyscall(number) || n == SYS_WRITE || n == SYS_PWRITE64 ||
+         n == SYS_WRITEV;
+}
+
+// Routine every exit jumps to under -Os
+#define SHARED_EXIT "_exit_program"
+
+/**
+ * @brief Whether -Os can send a syscall to the shared exit sequence, which
+ * flushes what has to be and exits with the status in rdi
+ */
+bool isSharedExit(Token *number) {
+  return isExitSyscall(number) && number->value.__l.value.__i == SYS_EXIT;
+}
+
+/**
+ * @brief Label of a float literal in the constant pool, named by its bits
+ */
+str floatLiteralLabel(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return fstr("flt_%016lx", bits);
+}
+
 str _val_(Token token) {
   switch (token.type) {
   case DeclarationToken:
   case IdentifierToken:
-    return fstr("[%s]", token.value.__i.name);
+    return fstr("[%s]", mangledName(token.value.__i.name));
 
   case MemoryToken:
     return token.value.m;
@@ -75,7 +129,7 @@ str _val_(Token token) {
     return fstr("%d", token.value.__k);
 
   case ProcedureToken: // TBR
-    return fstr("%s", token.value.__f.name);
+    return mangledName(token.value.__f.name);
 
   case OperatorToken: // TBR
     return fstr("OP%d", token.value.__o);
@@ -83,8 +137,10 @@ str _val_(Token token) {
   case LiteralToken: {
     switch (token.value.__l.type) {
     case FloatValue:
+      return fstr("[%s]", floatLiteralLabel(token.value.__l.value.__f));
+
     case StringValue:
-      return fstr("%s", token.value.__l.value.__s);
+      return fstr("%s", symbolText(token.value.__l.value.__s));
 
     case IntValue:
       return fstr("%d", token.value.__l.value.__i);
@@ -103,7 +159,7 @@ str _addr_(Token token) {
   switch (token.type) {
   case DeclarationToken:
   case IdentifierToken:
-    return fstr("%s", token.value.__i.name);
+    return mangledName(token.value.__i.name);
 
   case MemoryToken:
     return token.value.m;
@@ -111,8 +167,10 @@ str _addr_(Token token) {
   case LiteralToken: {
     switch (token.value.__l.type) {
     case FloatValue:
+      return floatLiteralLabel(token.value.__l.value.__f);
+
     case StringValue:
-      return token.value.__l.value.__s;
+      return symbolText(token.value.__l.value.__s);
 
     case IntValue:
       return fstr("%d", token.value.__l.value.__i);
@@ -158,11 +216,547 @@ bool isNnaryOperator(Operator op) {
   return false;
 }
 
-void resolveOperator(str *ops, Token *operator);
+void resolveOperator(strbuf *ops, Token *operator);
+uint resolveCallArguments(strbuf *ops, Token *callee, Token *args);
+void interpret(TokenStream _stream_head);
+void optimizeWholeProgram(TokenStream *stream);
+
+// Text of each string literal, by the number of its strN label
+str *__STRING_LITERALS__;
+uint __N_STRING_LITERALS__;
+
+// Byte length of each string literal, for merging suffixes
+uint *__STRING_LENGTHS__;
+
+// strN label of each interned text, 0 until a literal uses it
+Symbol *__STRING_LABELS__;
+uint __STRING_LABELS_CAPACITY__;
+
+/**
+ * @brief Label of a string literal, shared by every literal with its text
+ */
+Symbol poolStringLiteral(Symbol text) {
+  if (text >= __STRING_LABELS_CAPACITY__) {
+    uint capacity =
+        __STRING_LABELS_CAPACITY__ ? __STRING_LABELS_CAPACITY__ : 256;
+    while (capacity <= text)
+      capacity *= 2;
+    __STRING_LABELS__ = realloc(__STRING_LABELS__, capacity * sizeof(Symbol));
+    memset(&__STRING_LABELS__[__STRING_LABELS_CAPACITY__], 0,
+           (capacity - __STRING_LABELS_CAPACITY__) * sizeof(Symbol));
+    __STRING_LABELS_CAPACITY__ = capacity;
+  }
+
+  if (__STRING_LABELS__[text] != 0)
+    return __STRING_LABELS__[text];
+
+  uint n = __N_STRING_LITERALS__++;
+  __STRING_LITERALS__ = realloc(__STRING_LITERALS__, (n + 1) * sizeof(str));
+  __STRING_LENGTHS__ = realloc(__STRING_LENGTHS__, (n + 1) * sizeof(uint));
+  __STRING_LITERALS__[n] = symbolText(text);
+  __STRING_LENGTHS__[n] = strlen(__STRING_LITERALS__[n]);
+
+  return __STRING_LABELS__[text] = intern(fstr("str%u", n));
+}
+
+/**
+ * @brief Order literals by their text read backwards, so a literal sorts
+ * right before the literals it ends
+ */
+int compareReversedLiterals(const void *a, const void *b) {
+  uint i = *(const uint *)a, j = *(const uint *)b;
+  uint m = __STRING_LENGTHS__[i], n = __STRING_LENGTHS__[j];
+
+  while (m > 0 && n > 0) {
+    unsigned char x = __STRING_LITERALS__[i][--m];
+    unsigned char y = __STRING_LITERALS__[j][--n];
+    if (x != y)
+      return x < y ? -1 : 1;
+  }
+  return m == n ? 0 : m < n ? -1 : 1;
+}
+
+bool isLiteralSuffix(uint suffix, uint of) {
+  uint m = __STRING_LENGTHS__[suffix], n = __STRING_LENGTHS__[of];
+  return m <= n && memcmp(&__STRING_LITERALS__[of][n - m],
+                          __STRING_LITERALS__[suffix], m) == 0;
+}
+
+// Bits of every float literal, in stream order and with repeats
+uint64_t *__FLOAT_LITERALS__;
+uint __N_FLOAT_LITERALS__;
+
+void poolFloatLiteral(double value) {
+  __FLOAT_LITERALS__ = realloc(__FLOAT_LITERALS__,
+                               (__N_FLOAT_LITERALS__ + 1) * sizeof(uint64_t));
+  memcpy(&__FLOAT_LITERALS__[__N_FLOAT_LITERALS__++], &value, sizeof(double));
+}
+
+int compareFloatBits(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Write each distinct float literal to .rodata, under the label
+ * floatLiteralLabel gives its value
+ */
+void emitFloatPool(strbuf *rodata) {
+  if (__N_FLOAT_LITERALS__ == 0)
+    return;
+
+  qsort(__FLOAT_LITERALS__, __N_FLOAT_LITERALS__, sizeof(uint64_t),
+        compareFloatBits);
+
+  wline(rodata, "align 8, db 0");
+  for (uint i = 0; i < __N_FLOAT_LITERALS__; i++)
+    if (i == 0 || __FLOAT_LITERALS__[i] != __FLOAT_LITERALS__[i - 1])
+      fline(rodata, "flt_%016lx: dq 0x%016lx", __FLOAT_LITERALS__[i],
+            __FLOAT_LITERALS__[i]);
+}
+
+/**
+ * @brief Write every string literal to .rodata once. A literal that ends
+ * another one is a label inside it, and each stored string starts on 16
+ * bytes for the vector string kernels, unless -Os packs them.
+ */
+void emitStringPool(strbuf *rodata) {
+  uint n = __N_STRING_LITERALS__;
+  if (n == 0)
+    return;
+
+  uint *order = malloc(n * sizeof(uint));
+  for (uint i = 0; i < n; i++)
+    order[i] = i;
+  qsort(order, n, sizeof(uint), compareReversedLiterals);
+
+  // Runs of literals each ending the next, the last one holds the bytes
+  uint *runStart = malloc(n * sizeof(uint));
+  uint *runEnd = malloc(n * sizeof(uint));
+  for (uint k = 0, start = 0; k < n; k++)
+    if (k + 1 == n || !isLiteralSuffix(order[k], order[k + 1])) {
+      runStart[order[k]] = start;
+      runEnd[order[k]] = k;
+      start = k + 1;
+    } else
+      runEnd[order[k]] = n; // stored inside a longer literal
+
+  for (uint i = 0; i < n; i++) {
+    if (runEnd[i] == n)
+      continue;
+
+    str text = __STRING_LITERALS__[i];
+    uint len = __STRING_LENGTHS__[i];
+    if (!hasCompilerFlag("-Os"))
+      wline(rodata, "align 16, db 0");
+
+    // Longest first, each label starts where the shorter suffix begins
+    for (uint k = runEnd[i] + 1; k-- > runStart[i];) {
+      uint from = len - __STRING_LENGTHS__[order[k]];
+      uint to = k > runStart[i] ? len - __STRING_LENGTHS__[order[k - 1]] : len;
+
+      if (from == to)
+        fline(rodata, "str%u: db 0x00", order[k]);
+      else if (k == runStart[i])
+        fline(rodata, "str%u: db \"%.*s\", 0x00", order[k], to - from,
+              &text[from]);
+      else
+        fline(rodata, "str%u: db \"%.*s\"", order[k], to - from, &text[from]);
+    }
+  }
+
+  free(order);
+  free(runStart);
+  free(runEnd);
+}
+
+// Procedures by name, set while units are lowered in parallel. Workers
+// can't walk back through tokens another worker is rewriting.
+Token **__PROCEDURE_INDEX__;
+uint __PROCEDURE_INDEX_CAPACITY__;
+
+/**
+ * @brief Slot of a procedure name in the index, empty if it isn't there
+ */
+Token **procedureIndexSlot(Name name) {
+  uint mask = __PROCEDURE_INDEX_CAPACITY__ - 1;
+  for (uint i = (name.symbol * 2654435761u) & mask;; i = (i + 1) & mask)
+    if (__PROCEDURE_INDEX__[i] == NULL ||
+        sameName(__PROCEDURE_INDEX__[i]->value.__f.name, name))
+      return &__PROCEDURE_INDEX__[i];
+}
+
+/**
+ * @brief Find the declaration of a procedure, looking back from a token
+ */
+Token *findProcedure(Token *from, Name name) {
+  if (__PROCEDURE_INDEX__ != NULL) {
+    Token *procedure = *procedureIndexSlot(name);
+    if (procedure != NULL)
+      return procedure;
+  }
+
+  TokenStream head = from;
+  while (head != NULL) {
+    if (head->type == ProcedureToken && sameName(head->value.__f.name, name))
+      return head;
+    head = head->prev;
+  }
+
+  CompilerError(
+      fstr("Use of un-declared function \"%s\".", symbolText(name.symbol)));
+}
+
+// --------------------------
+// Floating Point -----------
+//
+// float values are IEEE doubles. Expressions on them are computed in xmm0
+// and xmm1 and leave their result in xmm0, literals come from the constant
+// pool. The k-th float parameter of a procedure arrives in xmmk, a float
+// result is returned in xmm0. Ints meeting a float are converted, floats
+// stored as ints are truncated.
+
+#define MAX_FLOAT_ARGS 8
+
+bool isFloatOperand(Token *token) {
+  switch (token->type) {
+  case LiteralToken:
+    return token->value.__l.type == FloatValue;
+
+  case DeclarationToken:
+  case IdentifierToken:
+    return token->value.__i.type == FloatValue;
+
+  case MemoryToken:
+    return strncmp(token->value.m, "xmm", 3) == 0;
+
+  default:
+    return false;
+  }
+}
+
+/**
+ * @brief Load an operand into an xmm register, converting ints
+ */
+void loadFloat(strbuf *ops, str xmm, Token *token) {
+  if (token->type == MemoryToken) {
+    if (!isFloatOperand(token))
+      fline(ops, "cvtsi2sd %s, %s", xmm, token->value.m);
+    else if (strcmp(token->value.m, xmm) != 0)
+      fline(ops, "movapd %s, %s", xmm, token->value.m);
+  } else if (isFloatOperand(token))
+    fline(ops, "movsd %s, %s", xmm, _val_(*token));
+  else if (token->type == LiteralToken) {
+    fline(ops, "mov rax, %s", _val_(*token));
+    fline(ops, "cvtsi2sd %s, rax", xmm);
+  } else
+    fline(ops, "cvtsi2sd %s, qword %s", xmm, _val_(*token));
+}
+
+/**
+ * @brief Load an operand into a general purpose register, truncating floats
+ */
+void loadInteger(strbuf *ops, str reg, Token *token) {
+  if (!isFloatOperand(token))
+    fline(ops, "mov %s, %s", reg, _val_(*token));
+  else if (token->type == MemoryToken)
+    fline(ops, "cvttsd2si %s, %s", reg, token->value.m);
+  else
+    fline(ops, "cvttsd2si %s, qword %s", reg, _val_(*token));
+}
+
+/**
+ * @brief Binary operator with a float operand, arithmetic leaves its result
+ * in xmm0 and comparisons leave 1 or 0 in rdx
+ */
+void resolveFloatOperator(strbuf *ops, Token *operator) {
+  // The second operand can be a nested result in xmm0, so it goes first
+  loadFloat(ops, "xmm1", operator->next->next);
+  loadFloat(ops, "xmm0", operator->next);
+
+  Operator op = operator->value.__o;
+  switch (op) {
+  case ADD:
+  case SUB:
+  case MUL:
+  case DIV: {
+    str instructions[] = {"addsd", "subsd", "mulsd", "divsd"};
+    fline(ops, "%s xmm0, xmm1", instructions[op - ADD]);
+
+    operator->type = MemoryToken;
+    operator->value.m = fstr("xmm0");
+    rippleDeleteTokens(&operator, 2);
+    return;
+  }
+
+  // Unordered operands, a NaN on either side, compare false except for !=
+  case LOGICAL_GREATER_THAN:
+    wline(ops, "ucomisd xmm0, xmm1");
+    wline(ops, "seta al");
+    break;
+  case LOGICAL_LESS_THAN:
+    wline(ops, "ucomisd xmm1, xmm0");
+    wline(ops, "seta al");
+    break;
+  case LOGICAL_EQUAL:
+    wline(ops, "ucomisd xmm0, xmm1");
+    wline(ops, "sete al");
+    wline(ops, "setnp cl");
+    wline(ops, "and al, cl");
+    break;
+  case LOGICAL_NOT_EQUAL:
+    wline(ops, "ucomisd xmm0, xmm1");
+    wline(ops, "setne al");
+    wline(ops, "setp cl");
+    wline(ops, "or al, cl");
+    break;
+
+  default:
+    CompilerError(
+        fstr("Float operands aren't supported by operator %d.", op));
+  }
+
+  wline(ops, "movzx rdx, al");
+  operator->type = MemoryToken;
+  operator->value.m = fstr("rdx");
+  rippleDeleteTokens(&operator, 2);
+}
+
+// --------------------------
+// Arrays -------------------
+//
+// An array is a run of 64-bit elements in .bss, aligned for vector loads.
+// v[i] reads or writes one element, i being a literal or an int variable.
+// Assigning to a whole array combines arrays element by element through
+// the vector kernel of the runtime, which covers as many elements at once
+// as the CPU allows. Arrays are passed to procedures by address.
+
+Token *skipOperand(Token *token);
+
+bool isArray(Token *token) {
+  if (token->type != IdentifierToken && token->type != DeclarationToken)
+    return false;
+  return token->value.__i.name.kind != ProcedureName &&
+         token->value.__i.length > 0;
+}
+
+void rejectArray(Token *token) {
+  if (isArray(token))
+    CompilerError(fstr("Array \"%s\" can't be used as a single value.",
+                       symbolText(token->value.__i.name.symbol)));
+}
+
+/**
+ * @brief Memory operand of an element, a variable index is loaded into rax
+ */
+str elementOperand(strbuf *ops, Token *array, Token *index) {
+  Identifier iden = array->value.__i;
+  uint size = typeSize(iden.type);
+  if (index->type == LiteralToken)
+    return fstr("qword [%s + %u]", mangledName(iden.name),
+                size * index->value.__l.value.__i);
+
+  fline(ops, "mov rax, %s", _val_(*index));
+  return fstr("qword [%s + rax * %u]", mangledName(iden.name), size);
+}
+
+/**
+ * @brief Read an element into rdx or xmm0
+ *
+ * @param first The operator's second operand was computed first and holds
+ * those, the element goes to rdi or xmm2 instead
+ */
+void resolveIndex(strbuf *ops, Token *operator, bool first) {
+  Token *array = operator->next;
+  str element = elementOperand(ops, array, array->next);
+
+  str reg;
+  if (array->value.__i.type == FloatValue) {
+    reg = first ? "xmm2" : "xmm0";
+    fline(ops, "movsd %s, %s", reg, element);
+  } else {
+    reg = first ? "rdi" : "rdx";
+    fline(ops, "mov %s, %s", reg, element);
+  }
+
+  operator->type = MemoryToken;
+  operator->value.m = fstr(reg);
+  rippleDeleteTokens(&operator, 2);
+}
+
+/**
+ * @brief Store into an element, v[i] = value
+ * The value is computed first, the index then only costs rax.
+ */
+void resolveElementAssign(strbuf *ops, Token *operator) {
+  Token *index = operator->next;
+  if (index->value.__o != INDEX)
+    CompilerError("Assigning to non-identifier");
+
+  Token *array = index->next;
+  Token *value = skipOperand(index);
+  if (value->type == OperatorToken)
+    resolveOperator(ops, value);
+  if (!isTokenOperable(value))
+    CompilerError("Assignment should be from literal or variable.");
+  rejectArray(value);
+
+  Identifier dest = array->value.__i;
+  str src;
+  if (dest.type == FloatValue) {
+    loadFloat(ops, "xmm0", value);
+    src = "xmm0";
+  } else if (isFloatOperand(value) || value->type == IdentifierToken) {
+    loadInteger(ops, "rsi", value);
+    src = "rsi";
+  } else
+    src = _addr_(*value);
+
+  str element = elementOperand(ops, array, array->next);
+  fline(ops, "%s %s, %s", dest.type == FloatValue ? "movsd" : "mov", element,
+        src);
+
+  index->type = MemoryToken;
+  index->value.m = fstr(src);
+  rippleDeleteTokens(&index, 2);
+  rippleDeleteTokens(&(operator->prev), 3);
+}
 
-void resolveUnaryOperator(str *ops, Token *operator) {
+void checkArrayShape(Identifier dest, Token *array) {
+  Identifier iden = array->value.__i;
+  if (iden.type != dest.type || iden.length != dest.length)
+    CompilerError(fstr("Array \"%s\" doesn't match \"%s\" in type and length.",
+                       symbolText(iden.name.symbol),
+                       symbolText(dest.name.symbol)));
+}
+
+/**
+ * @brief Operation of the vector kernel for an operator on arrays of a type
+ */
+uint vectorOperation(Operator op, Type type) {
+  if (type == FloatValue) {
+    switch (op) {
+    case ADD:
+      return VECTOR_FADD;
+    case SUB:
+      return VECTOR_FSUB;
+    case MUL:
+      return VECTOR_FMUL;
+    case DIV:
+      return VECTOR_FDIV;
+    default:
+      break;
+    }
+  } else if (type == IntValue) {
+    switch (op) {
+    case ADD:
+      return VECTOR_ADD;
+    case SUB:
+      return VECTOR_SUB;
+    case MUL:
+      return VECTOR_MUL;
+    case BIT_AND:
+      return VECTOR_AND;
+    case BIT_OR:
+      return VECTOR_OR;
+    case BIT_XOR:
+      return VECTOR_XOR;
+    case BIT_SHIFT_LEFT:
+      return VECTOR_SHL;
+    case BIT_SHIFT_RIGHT:
+      return VECTOR_SAR;
+    default:
+      break;
+    }
+  }
+
+  CompilerError(fstr("Operator %d can't be applied to whole arrays.", op));
+}
+
+/**
+ * @brief Compute a whole array value into dest
+ * The right operand of an operator can be an array expression itself, it
+ * is computed into dest first and read back from there. Elements only
+ * depend on elements at the same index, so the left operand may be dest as
+ * long as nothing was computed into it before.
+ */
+void resolveArrayExpression(strbuf *ops, Identifier dest, Token *value) {
+  str label = mangledName(dest.name);
+
+  if (isArray(value)) {
+    checkArrayShape(dest, value);
+    if (sameName(value->value.__i.name, dest.name))
+      return;
+
+    fline(ops, "mov rdi, %s", label);
+    fline(ops, "mov rsi, %s", _addr_(*value));
+    fline(ops, "mov rcx, %u", dest.length);
+    fline(ops, "mov r8, %u", VECTOR_COPY);
+    wline(ops, "call qword [_rt_vector_impl]");
+    return;
+  }
+
+  if (value->type != OperatorToken || !isBinaryOperator(value->value.__o) ||
+      value->value.__o == INDEX)
+    CompilerError(fstr("Array \"%s\" should be assigned an array or an "
+                       "element-wise expression.",
+                       symbolText(dest.name.symbol)));
+
+  Operator op = value->value.__o;
+  Token *left = value->next;
+  Token *right = left->next;
+  if (!isArray(left))
+    CompilerError(fstr("Left operand of operator %d on arrays isn't an array.",
+                       op));
+  checkArrayShape(dest, left);
+  uint operation = vectorOperation(op, dest.type);
+
+  str other = NULL; // array of the right operand, the count of a shift
+  if (op == BIT_SHIFT_LEFT || op == BIT_SHIFT_RIGHT) {
+    if (right->type == OperatorToken)
+      resolveOperator(ops, right);
+    rejectArray(right);
+    if (isFloatOperand(right))
+      CompilerError("Arrays can only be shifted by an int.");
+    if (strcmp(_val_(*right), "rdx") != 0)
+      fline(ops, "mov rdx, %s", _val_(*right));
+  } else if (right->type == OperatorToken && right->value.__o != INDEX) {
+    if (sameName(left->value.__i.name, dest.name))
+      CompilerError(fstr("\"%s\" is overwritten before it is read, compute "
+                         "the nested expression into another array.",
+                         symbolText(dest.name.symbol)));
+    resolveArrayExpression(ops, dest, right);
+    other = label;
+  } else if (isArray(right)) {
+    checkArrayShape(dest, right);
+    other = _addr_(*right);
+  } else
+    CompilerError(fstr("Right operand of operator %d on arrays isn't an "
+                       "array.",
+                       op));
+
+  fline(ops, "mov rdi, %s", label);
+  fline(ops, "mov rsi, %s", _addr_(*left));
+  if (other != NULL)
+    fline(ops, "mov rdx, %s", other);
+  fline(ops, "mov rcx, %u", dest.length);
+  fline(ops, "mov r8, %u", operation);
+  wline(ops, "call qword [_rt_vector_impl]");
+
+  value->type = MemoryToken;
+  value->value.m = fstr("rax");
+  rippleDeleteTokens(&value, 2);
+}
+
+void resolveArrayAssign(strbuf *ops, Token *operator) {
+  resolveArrayExpression(ops, operator->next->value.__i, operator->next->next);
+  rippleDeleteTokens(&(operator->prev), 3);
+}
+
+void resolveUnaryOperator(strbuf *ops, Token *operator) {
   if (operator->next->type == OperatorToken)
     resolveOperator(ops, operator->next);
+  rejectArray(operator->next);
 
   Token op_arg1 = *operator->next;
 
@@ -174,6 +768,9 @@ void resolveUnaryOperator(str *ops, Token *operator) {
   if (!isTokenOperable(&op_arg1))
     CompilerError(
         fstr("Invalid first operand of type %d.", strTokenType(op_arg1.type)));
+  if (isFloatOperand(&op_arg1))
+    CompilerError(fstr("Float operands aren't supported by operator %d.",
+                       operator->value.__o));
 
   switch (operator->value.__o) {
   case BIT_NOT: {
@@ -189,11 +786,44 @@ void resolveUnaryOperator(str *ops, Token *operator) {
   }
 }
 
-void resolveBinaryOperator(str *ops, Token *operator) {
-  if (operator->next->type == OperatorToken)
-    resolveOperator(ops, operator->next);
-  if (operator->next->next->type == OperatorToken)
-    resolveOperator(ops, operator->next->next);
+/**
+ * @brief Compare two operands, leaving 1 or 0 in rdx
+ *
+ * @param cc Condition code of the setcc instruction
+ */
+void resolveComparison(strbuf *ops, Token *operator, str cc) {
+  fline(ops, "mov rax, %s", _val_(*operator->next));
+  fline(ops, "cmp rax, %s", _val_(*operator->next->next));
+  fline(ops, "set%s al", cc);
+  wline(ops, "movzx rdx, al");
+
+  operator->type = MemoryToken;
+  operator->value.m = fstr("rdx");
+  rippleDeleteTokens(&operator, 2);
+}
+
+void resolveBinaryOperator(strbuf *ops, Token *operator) {
+  Operator op = operator->value.__o;
+  if (op == INDEX)
+    return resolveIndex(ops, operator, false);
+  if (op == ASSIGN && isArray(operator->next))
+    return resolveArrayAssign(ops, operator);
+  if (op == ASSIGN && operator->next->type == OperatorToken)
+    return resolveElementAssign(ops, operator);
+
+  // An element on the left is read after the right operand, which is
+  // computed into the registers the element would go to
+  Token *first = operator->next;
+  bool indexed = first->type == OperatorToken && first->value.__o == INDEX;
+  if (first->type == OperatorToken && !indexed)
+    resolveOperator(ops, first);
+
+  Token *second = skipOperand(first);
+  bool computed = second->type == OperatorToken;
+  if (computed)
+    resolveOperator(ops, second);
+  if (indexed)
+    resolveIndex(ops, first, computed);
 
   Token op_arg1 = *operator->next;
   Token op_arg2 = *operator->next->next;
@@ -210,6 +840,13 @@ void resolveBinaryOperator(str *ops, Token *operator) {
   if (!isTokenOperable(&op_arg2))
     CompilerError(
         fstr("Invalid second operand of type %d.", strTokenType(op_arg2.type)));
+  rejectArray(&op_arg2);
+  if (op != ASSIGN)
+    rejectArray(&op_arg1);
+
+  if (operator->value.__o != ASSIGN &&
+      (isFloatOperand(&op_arg1) || isFloatOperand(&op_arg2)))
+    return resolveFloatOperator(ops, operator);
 
   switch (operator->value.__o) {
   case ASSIGN: {
@@ -218,13 +855,20 @@ void resolveBinaryOperator(str *ops, Token *operator) {
 
     Identifier dest = op_arg1.value.__i;
 
-    if (op_arg2.type == IdentifierToken) {
+    if (dest.type == FloatValue) {
+      loadFloat(ops, "xmm0", &op_arg2);
+      fline(ops, "movsd [%s], xmm0", mangledName(dest.name));
+    } else if (isFloatOperand(&op_arg2)) {
+      loadInteger(ops, "rax", &op_arg2);
+      fline(ops, "mov [%s], rax", mangledName(dest.name));
+    } else if (op_arg2.type == IdentifierToken) {
       fline(ops, "mov rsi, %s", _val_(op_arg2));
-      fline(ops, "mov qword [%s], rsi", dest.name);
+      fline(ops, "mov qword [%s], rsi", mangledName(dest.name));
     } else if (op_arg2.type == LiteralToken)
-      fline(ops, "mov qword [%s], %s", dest.name, _addr_(op_arg2));
+      fline(ops, "mov qword [%s], %s", mangledName(dest.name),
+            _addr_(op_arg2));
     else if (op_arg2.type == MemoryToken)
-      fline(ops, "mov [%s], %s", dest.name, _addr_(op_arg2));
+      fline(ops, "mov [%s], %s", mangledName(dest.name), _addr_(op_arg2));
     else
       CompilerError("Assignment should be from literal or variable.");
 
@@ -297,10 +941,70 @@ void resolveBinaryOperator(str *ops, Token *operator) {
     rippleDeleteTokens(&operator, 2);
     break;
   }
+
+  case DIV:
+  case MOD: {
+    // The divisor goes first, cqo overwrites rdx
+    fline(ops, "mov rcx, %s", _val_(op_arg2));
+    fline(ops, "mov rax, %s", _val_(op_arg1));
+    wline(ops, "cqo");
+    wline(ops, "idiv rcx");
+    if (operator->value.__o == DIV)
+      wline(ops, "mov rdx, rax");
+
+    operator->type = MemoryToken;
+    operator->value.m = fstr("rdx");
+    rippleDeleteTokens(&operator, 2);
+    break;
+  }
+
+  case BIT_SHIFT_LEFT:
+  case BIT_SHIFT_RIGHT: {
+    fline(ops, "mov rcx, %s", _val_(op_arg2));
+    fline(ops, "mov rax, %s", _val_(op_arg1));
+    fline(ops, "%s rax, cl",
+          operator->value.__o == BIT_SHIFT_LEFT ? "shl" : "sar");
+    wline(ops, "mov rdx, rax");
+
+    operator->type = MemoryToken;
+    operator->value.m = fstr("rdx");
+    rippleDeleteTokens(&operator, 2);
+    break;
+  }
+
+  case LOGICAL_GREATER_THAN:
+    resolveComparison(ops, operator, "g");
+    break;
+  case LOGICAL_LESS_THAN:
+    resolveComparison(ops, operator, "l");
+    break;
+  case LOGICAL_EQUAL:
+    resolveComparison(ops, operator, "e");
+    break;
+  case LOGICAL_NOT_EQUAL:
+    resolveComparison(ops, operator, "ne");
+    break;
+
+  case LOGICAL_AND:
+  case LOGICAL_OR: {
+    fline(ops, "mov rax, %s", _val_(op_arg1));
+    wline(ops, "test rax, rax");
+    wline(ops, "setne al");
+    fline(ops, "mov rcx, %s", _val_(op_arg2));
+    wline(ops, "test rcx, rcx");
+    wline(ops, "setne cl");
+    fline(ops, "%s al, cl", operator->value.__o == LOGICAL_AND ? "and" : "or");
+    wline(ops, "movzx rdx, al");
+
+    operator->type = MemoryToken;
+    operator->value.m = fstr("rdx");
+    rippleDeleteTokens(&operator, 2);
+    break;
+  }
   }
 }
 
-void resolveNnaryOperator(str *ops, Token *operator) {
+void resolveNnaryOperator(strbuf *ops, Token *operator) {
   if (operator->next->type == OperatorToken)
     resolveOperator(ops, operator->next);
 
@@ -315,197 +1019,637 @@ void resolveNnaryOperator(str *ops, Token *operator) {
     if (op_arg1.type != IdentifierToken)
       CompilerError("Call to non-function");
 
-    TokenStream head = operator;
-    while (head != NULL) {
-      head = head->prev;
-      if (head->type == ProcedureToken &&
-          strcmp(head->value.__f.name, op_arg1.value.__f.name) == 0) {
-        memcpy(&op_arg1.value, &(head->value), sizeof(TokenValue));
-        break;
-      }
-    }
-
-    Function fn = op_arg1.value.__f;
-    uint nargs = fn.nargs;
-    Token *args = op_arg1.next;
-
-    while (nargs > 0) {
-      if (args->type == OperatorToken)
-        resolveOperator(ops, args);
-      fline(ops, "push qword %s", _val_(*args));
-      args = args->next;
-      --nargs;
-    }
+    Token *callee = findProcedure(operator, op_arg1.value.__f.name);
+    Function fn = callee->value.__f;
+    uint spilled = resolveCallArguments(ops, callee, op_arg1.next);
 
-    fline(ops, "call %s", fn.name);
-    fline(ops, "pop rdx", fn.name);
-    // fline(ops, "mov rdx, [_rtn%s]", fn.name);
+    fline(ops, "call %s", mangledName(fn.name));
+    if (fn.type != FloatValue)
+      wline(ops, "pop rdx");
+    if (spilled > 0)
+      fline(ops, "add rsp, %u", spilled);
 
     operator->type = MemoryToken;
-    operator->value.m = fstr("rdx");
+    operator->value.m = fstr(fn.type == FloatValue ? "xmm0" : "rdx");
     rippleDeleteTokens(&operator, fn.nargs);
     break;
   }
   }
 }
 
-void resolveOperator(str *ops, Token *operator) {
-  if (isUnaryOperator(operator->value.__o))
-    return resolveUnaryOperator(ops, operator);
-  if (isBinaryOperator(operator->value.__o))
-    return resolveBinaryOperator(ops, operator);
-  if (isNnaryOperator(operator->value.__o))
-    return resolveNnaryOperator(ops, operator);
+/**
+ * @brief Get the declaration of a procedure's parameter by position
+ */
+Token *procedureParam(Token *procedure, uint index) {
+  Token *param = procedure->next;
+  while (index--)
+    param = param->next;
+  return param;
 }
 
-bool isBlockKeyword(Keyword key) {
-  switch (key) {
-  case FN:
-  case IF:
-  case WHILE:
-  case MACRO:
-    return true;
+/**
+ * @brief Whether a procedure is declared without a body
+ */
+bool isProcedureDeclaration(Token *procedure) {
+  Token *body = procedureParam(procedure, procedure->value.__f.nargs);
+  return body->type == KeywordToken && body->value.__k == END;
+}
 
-  default:
-    return false;
+bool isFloatParam(Token *procedure, uint index) {
+  return procedureParam(procedure, index)->value.__i.type == FloatValue;
+}
+
+/**
+ * @brief Token after a whole operand, an operator along with its operands
+ */
+Token *skipOperand(Token *token) {
+  if (token->type != OperatorToken)
+    return token->next;
+
+  Operator op = token->value.__o;
+  if (isUnaryOperator(op))
+    return skipOperand(token->next);
+  if (isBinaryOperator(op))
+    return skipOperand(skipOperand(token->next));
+
+  Token *callee = token->next;
+  uint nargs = findProcedure(callee, callee->value.__f.name)->value.__f.nargs;
+  token = callee->next;
+  while (nargs--)
+    token = skipOperand(token);
+  return token;
+}
+
+bool containsCall(Token *from, Token *to) {
+  for (Token *token = from; token != to; token = token->next)
+    if (token->type == OperatorToken && token->value.__o == CALL)
+      return true;
+  return false;
+}
+
+/**
+ * @brief Evaluate the arguments of a call in order
+ * Ints are pushed for the callee's prologue to pop. Floats are placed in
+ * xmm0 and up right before the call: a computed one waits in xmm8 and up,
+ * unless a later argument makes a call of its own, then it is spilled
+ * under the pushed ints. A float variable read before such a call is
+ * spilled too, the call could change it.
+ *
+ * @return Bytes of spilled floats, dropped by the caller after the call
+ */
+uint resolveCallArguments(strbuf *ops, Token *callee, Token *args) {
+  uint nargs = callee->value.__f.nargs;
+  Token *starts[nargs + 1];
+  int spill[nargs + 1];
+
+  Token *end = args;
+  for (uint i = 0; i < nargs; i++) {
+    starts[i] = end;
+    end = skipOperand(end);
   }
+
+  uint nfloats = 0, nspills = 0, npushed = 0;
+  for (uint i = 0; i < nargs; i++) {
+    spill[i] = -1;
+    if (!isFloatParam(callee, i))
+      continue;
+    if (nfloats++ == MAX_FLOAT_ARGS)
+      CompilerError(fstr("More than %d float parameters in \"%s\".",
+                         MAX_FLOAT_ARGS,
+                         symbolText(callee->value.__f.name.symbol)));
+
+    Token *arg = starts[i];
+    rejectArray(arg);
+    if (arg->type != LiteralToken &&
+        containsCall(i + 1 < nargs ? starts[i + 1] : end, end))
+      spill[i] = nspills++;
+  }
+
+  if (nspills > 0)
+    fline(ops, "sub rsp, %u", 8 * nspills);
+
+  for (uint i = 0, k = 0; i < nargs; i++) {
+    Token *arg = starts[i];
+    if (arg->type == OperatorToken)
+      resolveOperator(ops, arg);
+
+    if (!isFloatParam(callee, i)) {
+      if (isArray(arg))
+        fline(ops, "push qword %s", _addr_(*arg));
+      else if (isFloatOperand(arg)) {
+        loadInteger(ops, "rax", arg);
+        wline(ops, "push rax");
+      } else
+        fline(ops, "push qword %s", _val_(*arg));
+      npushed++;
+    } else if (spill[i] >= 0) {
+      loadFloat(ops, "xmm0", arg);
+      fline(ops, "movsd [rsp + %u], xmm0", 8 * (npushed + spill[i]));
+    } else if (arg->type == MemoryToken) {
+      loadFloat(ops, "xmm0", arg);
+      fline(ops, "movapd xmm%u, xmm0", 8 + k);
+    }
+    k += isFloatParam(callee, i);
+  }
+
+  for (uint i = 0, k = 0; i < nargs; i++) {
+    if (!isFloatParam(callee, i))
+      continue;
+
+    str xmm = fstr("xmm%u", k);
+    if (spill[i] >= 0)
+      fline(ops, "movsd %s, [rsp + %u]", xmm, 8 * (npushed + spill[i]));
+    else if (starts[i]->type == MemoryToken)
+      fline(ops, "movapd %s, xmm%u", xmm, 8 + k);
+    else
+      loadFloat(ops, xmm, starts[i]);
+    k++;
+  }
+
+  return 8 * nspills;
 }
 
-void resolveProcedureArgs(str *func, Token *token) {
-  Function fn = token->value.__f;
-  fline(func, "%s:", fn.name);
+/**
+ * @brief Push an argument the way a parameter of its type holds it
+ */
+void pushArgument(strbuf *ops, Token *arg, bool isFloat) {
+  if (isArray(arg)) {
+    if (isFloat)
+      rejectArray(arg);
+    fline(ops, "push qword %s", _addr_(*arg));
+  }
 
-  token = token->next;
+  // Bits are copied as they are when the types agree, except out of xmm0
+  else if (isFloat == isFloatOperand(arg) && !(isFloat && arg->type == MemoryToken))
+    fline(ops, "push qword %s", _val_(*arg));
+  else if (isFloat) {
+    loadFloat(ops, "xmm0", arg);
+    wline(ops, "sub rsp, 8");
+    wline(ops, "movsd [rsp], xmm0");
+  } else {
+    loadInteger(ops, "rax", arg);
+    wline(ops, "push rax");
+  }
+}
+
+/**
+ * @brief Return from a procedure, leaving the value under the return address
+ */
+void resolveReturn(strbuf *ops, str value) {
+  wline(ops, "pop rsi");
+  fline(ops, "push qword %s", value);
+  wline(ops, "push rsi");
+  wline(ops, "ret");
+}
+
+/**
+ * @brief Return a value in the convention of the procedure's type, 0 when
+ * there is none
+ */
+void resolveTypedReturn(strbuf *ops, Token *procedure, Token *value) {
+  if (hasCompilerFlag("-fframe-pointers"))
+    wline(ops, "pop rbp");
+
+  if (procedure->value.__f.type == FloatValue) {
+    if (value == NULL)
+      wline(ops, "xorpd xmm0, xmm0");
+    else
+      loadFloat(ops, "xmm0", value);
+    wline(ops, "ret");
+  } else if (value == NULL)
+    resolveReturn(ops, "0");
+  else if (isFloatOperand(value)) {
+    loadInteger(ops, "rdx", value);
+    resolveReturn(ops, "rdx");
+  } else
+    resolveReturn(ops, _val_(*value));
+}
+
+/**
+ * @brief Whether a returned call can be a jump: the callee has to return
+ * its value the same way the current procedure does, and be lowered by us.
+ * Runtime thunks read their arguments off the stack and have no .body
+ */
+bool isTailCall(Token *procedure, Token *token) {
+  if (token->type != OperatorToken || token->value.__o != CALL)
+    return false;
+
+  Token *callee = findProcedure(token, token->next->value.__f.name);
+  if (callee->value.__f.runtime)
+    return false;
+  return (callee->value.__f.type == FloatValue) ==
+         (procedure->value.__f.type == FloatValue);
+}
+
+/**
+ * @brief Lower a call in tail position to a jump
+ * Arguments are evaluated onto the stack and then popped straight into the
+ * callee's parameters, the same way its prologue would. The return address
+ * of the current procedure stays on top of the stack, so the callee returns
+ * directly to our caller and recursion runs in constant stack.
+ */
+void resolveTailCall(strbuf *ops, Token *operator) {
+  Token op_arg1 = *operator->next;
+  if (op_arg1.type != IdentifierToken)
+    CompilerError("Call to non-function");
+
+  Token *callee = findProcedure(operator, op_arg1.value.__f.name);
+  Function fn = callee->value.__f;
 
+  Token *args = op_arg1.next;
   for (size_t i = 0; i < fn.nargs; i++) {
-    wline(func, "pop rsi");
-    fline(func, "pop qword %s", _val_(*token));
-    wline(func, "push rsi");
-    token = token->next;
+    if (args->type == OperatorToken)
+      resolveOperator(ops, args);
+    pushArgument(ops, args, isFloatParam(callee, i));
+    args = args->next;
   }
-}
 
-void clean_codegen(str *code) {
-  for (size_t i = 0; i < strlen((*code)); i++)
-    if (isalnum((*code)[i]) == 0 && ispunct((*code)[i]) == 0 &&
-        isspace((*code)[i]) == 0)
-      (*code)[i] = ' ';
+  for (size_t i = fn.nargs; i > 0; i--)
+    fline(ops, "pop qword %s", _val_(*procedureParam(callee, i - 1)));
+
+  // The callee sets up its frame again
+  if (hasCompilerFlag("-fframe-pointers"))
+    wline(ops, "pop rbp");
+  fline(ops, "jmp %s.body", mangledName(fn.name));
+
+  operator->type = MemoryToken;
+  operator->value.m = fstr("rdx");
+  rippleDeleteTokens(&operator, fn.nargs + 1);
 }
 
-void codegen(TokenStream _stream_head, str outfile) {
-  str head = malloc(sizeof(char));
-  str text = malloc(sizeof(char));
-  str func = malloc(sizeof(char));
-  str data = malloc(sizeof(char));
-  str bss = malloc(sizeof(char));
+void resolveOperator(strbuf *ops, Token *operator) {
+  if (isUnaryOperator(operator->value.__o))
+    return resolveUnaryOperator(ops, operator);
+  if (isBinaryOperator(operator->value.__o))
+    return resolveBinaryOperator(ops, operator);
+  if (isNnaryOperator(operator->value.__o))
+    return resolveNnaryOperator(ops, operator);
+}
 
-  TokenStream HEAD = _stream_head;
+void resolveProcedureArgs(strbuf *func, Token *token) {
+  Function fn = token->value.__f;
+  fline(func, "%s:", mangledName(fn.name));
 
-  // Header
-  fline(&head, "BITS %d\n", 64);
-  wline(&head, "section .text");
+  for (size_t i = 0, k = 0; i < fn.nargs; i++)
+    if (isFloatParam(token, i))
+      fline(func, "movsd %s, xmm%u", _val_(*procedureParam(token, i)), k++);
 
-  wline(&data, "section .data");
-  wline(&bss, "section .bss");
+  // Integer arguments were pushed in order, so the last one is on top
+  for (size_t i = fn.nargs; i > 0; i--) {
+    if (isFloatParam(token, i - 1))
+      continue;
+    wline(func, "pop rsi");
+    fline(func, "pop qword %s", _val_(*procedureParam(token, i - 1)));
+    wline(func, "push rsi");
+  }
 
-  uint istr = 0, iflt = 0;
-  while (HEAD != NULL) {
-    Token *token = HEAD;
-    HEAD = HEAD->next;
+  // Tail calls jump here with the arguments already in place
+  wline(func, ".body:");
 
-    // Pre-allocate addresses for literals
-    if (token->type == LiteralToken) {
-      Literal *literal = &token->value.__l;
-      switch (literal->type) {
-      case StringValue: {
-        str str_name = fstr("str%u", istr++);
-        fline(&data, "%s: db \"%s\", 0x00", str_name, literal->value.__s);
-        literal->value.__s = malloc(strlen(str_name) * sizeof(char));
-        strcpy(literal->value.__s, str_name);
-        break;
-      }
+  // Parameters live in .bss, the frame only chains the return addresses
+  // for unwinders
+  if (hasCompilerFlag("-fframe-pointers")) {
+    wline(func, "push rbp");
+    wline(func, "mov rbp, rsp");
+  }
+}
 
-      case FloatValue:
+// --------------------------
+// Control Flow -------------
+
+typedef enum { IfBlock, WhileBlock } BlockKind;
+
+typedef struct {
+  BlockKind kind;
+  uint id;      // numbers the labels of this block
+  uint profile; // numbers its profile block and counters
+  uint branch; // next elif or else label of an if
+  uint depth;  // blockDepth the block was opened at
+} ControlBlock;
+
+#define MAX_CONTROL_DEPTH 64
+
+/**
+ * @brief Evaluate the condition starting at token and jump to label
+ *
+ * @param closer THEN or DO keyword expected after the condition
+ * @param jump jz to jump when the condition is false, jnz when it holds
+ * @return Token* The token after the closing keyword
+ */
+Token *resolveCondition(strbuf *ops, Token *token, Keyword closer, str jump,
+                        str label) {
+  if (token->type == OperatorToken)
+    resolveOperator(ops, token);
+
+  if (!isTokenOperable(token))
+    CompilerError("Expected a condition.");
+  rejectArray(token);
+
+  // A float holds unless it compares equal to zero, NaN included
+  if (isFloatOperand(token)) {
+    loadFloat(ops, "xmm0", token);
+    wline(ops, "xorpd xmm1, xmm1");
+    wline(ops, "ucomisd xmm0, xmm1");
+    wline(ops, "setne al");
+    wline(ops, "setp cl");
+    wline(ops, "or al, cl");
+    wline(ops, "movzx rax, al");
+  } else
+    fline(ops, "mov rax, %s", _val_(*token));
+  wline(ops, "test rax, rax");
+  fline(ops, "%s %s", jump, label);
 
-      default:
-        break;
-      }
-    }
+  token = token->next;
+  if (token == NULL || token->type != KeywordToken || token->value.__k != closer)
+    CompilerError(fstr("Expected \"%s\" after condition.",
+                       closer == THEN ? "then" : "do"));
+  return token->next;
+}
 
-    // Reserve memory for variables
-    else if (token->type == DeclarationToken) {
-      Identifier *iden = &token->value.__i;
-      strcpy(iden->name, fstr("_var_%s", iden->name));
-      fline(&bss, "%s: resb %d", iden->name, iden->msize);
-    }
+// --------------------------
+// Loop Idioms --------------
+//
+// Loops that fill an array, copy one array into another or search one for
+// a value are recognized from their tokens before they are lowered, and a
+// call to the vector kernel is put in front of them. It is guarded by the
+// bounds of the arrays: when the counter starts inside them, the kernel does
+// the work of the whole loop and skips it, otherwise the loop runs as
+// written. A search leaves the counter on the element it found, where the
+// loop's condition stops right away, or past the array, where the loop goes
+// on by itself.
+
+typedef enum {
+  NoIdiom,
+  FillIdiom, // while i < n do v[i] = x  i = i + 1 end
+  CopyIdiom, // while i < n do v[i] = w[i]  i = i + 1 end
+  FindIdiom, // while v[i] != x do i = i + 1 end
+} LoopIdiom;
+
+typedef struct {
+  LoopIdiom kind;
+  Token *counter;
+  Token *bound; // of the condition, NULL for a search
+  Token *array; // written, or searched
+  Token *value; // filled in or searched for, the array copied from
+} IdiomLoop;
+
+bool isOperatorToken(Token *token, Operator op) {
+  return token != NULL && token->type == OperatorToken &&
+         token->value.__o == op;
+}
 
-    // Reserve memory for variables
-    else if (token->type == ProcedureToken) {
-      Function *function = &(token->value.__f);
+bool isIntScalar(Token *token) {
+  return token != NULL && token->type == IdentifierToken &&
+         token->value.__i.name.kind != ProcedureName &&
+         token->value.__i.length == 0 && token->value.__i.type == IntValue;
+}
 
-      strcpy(function->name, fstr("_fn_%s", function->name));
-      // str rt_name = fstr("_rtn%s", function->name);
-      // fline(&bss, "%s: resb %d", rt_name, typeSize(function->type));
+/**
+ * @brief An int literal, or an int variable other than the counter
+ */
+bool isIdiomOperand(Token *token, Token *counter) {
+  if (token != NULL && token->type == LiteralToken)
+    return token->value.__l.type == IntValue;
+  return isIntScalar(token) &&
+         !sameName(token->value.__i.name, counter->value.__i.name);
+}
 
-      if (token->next->type != ExpressionStartToken)
-        continue; // no args
+/**
+ * @brief v[i] with the counter as index, the token after it or NULL
+ */
+Token *skipCounterElement(Token *token, Token *counter) {
+  if (!isOperatorToken(token, INDEX) || !isArray(token->next))
+    return NULL;
+  Token *index = token->next->next;
+  if (index->type != IdentifierToken ||
+      !sameName(index->value.__i.name, counter->value.__i.name))
+    return NULL;
+  return index->next;
+}
 
-      uint params = 0;
-      rippleDeleteTokens(&token, 1); // remove opening paren
-      while (token->next->type != ExpressionEndToken) {
-        token = token->next;
-        if (token->type != DeclarationToken)
-          CompilerError(fstr("Invalid %s token in function declaration",
-                             strTokenType(token->type)));
+/**
+ * @brief i = i + 1 closing the loop, the token after the end or NULL
+ */
+Token *skipCounterStep(Token *token, Token *counter) {
+  Token *tokens[6];
+  for (uint i = 0; i < 6; i++, token = token->next) {
+    if (token == NULL)
+      return NULL;
+    tokens[i] = token;
+  }
 
-        params++;
-        Identifier *arg = &token->value.__i;
-        strcpy(arg->name, fstr("_var%s_%s", function->name, arg->name));
-        fline(&bss, "%s: resb %d", arg->name, arg->msize);
-      }
+  bool step = isOperatorToken(tokens[0], ASSIGN) &&
+              isIntScalar(tokens[1]) && isOperatorToken(tokens[2], ADD) &&
+              isIntScalar(tokens[3]) && tokens[4]->type == LiteralToken &&
+              tokens[4]->value.__l.type == IntValue &&
+              tokens[4]->value.__l.value.__i == 1 &&
+              tokens[5]->type == KeywordToken && tokens[5]->value.__k == END;
+  if (!step ||
+      !sameName(tokens[1]->value.__i.name, counter->value.__i.name) ||
+      !sameName(tokens[3]->value.__i.name, counter->value.__i.name))
+    return NULL;
+  return token;
+}
 
-      rippleDeleteTokens(&token, 1); // remove closing paren
-      function->nargs = params;
-      HEAD = token->next;
+/**
+ * @brief Recognize the idiom of a while loop, the keyword is its first
+ * token
+ */
+IdiomLoop recognizeLoopIdiom(Token *token) {
+  IdiomLoop none = {.kind = NoIdiom};
+  if (hasCompilerFlag("-fno-loop-idioms") || __PROFILE_GENERATE__)
+    return none;
+
+  Token *condition = token->next;
+
+  // while v[i] != x do
+  if (isOperatorToken(condition, LOGICAL_NOT_EQUAL)) {
+    Token *element = condition->next;
+    if (!isOperatorToken(element, INDEX) || !isIntScalar(element->next->next))
+      return none;
+
+    Token *counter = element->next->next;
+    Token *value = skipCounterElement(element, counter);
+    if (value == NULL || element->next->value.__i.type != IntValue ||
+        !isIdiomOperand(value, counter))
+      return none;
+
+    Token *open = value->next;
+    if (open == NULL || open->type != KeywordToken || open->value.__k != DO ||
+        skipCounterStep(open->next, counter) == NULL)
+      return none;
+    return (IdiomLoop){FindIdiom, counter, NULL, element->next, value};
+  }
 
-      uint localBlockDepth = 0;
-      token = token->next;
-      while (true) {
-        if (token->type == KeywordToken) {
-          if (isBlockKeyword(token->value.__k))
-            localBlockDepth++;
-          else if (token->value.__k == END) {
-            if (localBlockDepth > 0)
-              localBlockDepth--;
-            else
-              break;
-          }
-        } else if (token->type == DeclarationToken)
-          strcpy(token->value.__i.name,
-                fstr("%s_%s", function->name, token->value.__i.name));
+  // while i < n do v[i] = ...
+  if (!isOperatorToken(condition, LOGICAL_LESS_THAN) ||
+      !isIntScalar(condition->next))
+    return none;
+
+  Token *counter = condition->next;
+  Token *bound = counter->next;
+  Token *open = bound->next;
+  if (!isIdiomOperand(bound, counter) || open == NULL ||
+      open->type != KeywordToken || open->value.__k != DO ||
+      !isOperatorToken(open->next, ASSIGN))
+    return none;
+
+  Token *element = open->next->next;
+  Token *value = skipCounterElement(element, counter);
+  if (value == NULL)
+    return none;
+
+  Identifier array = element->next->value.__i;
+  Token *step;
+  LoopIdiom kind;
+  if (isIdiomOperand(value, counter) && array.type == IntValue) {
+    kind = FillIdiom;
+    step = value->next;
+  } else if ((step = skipCounterElement(value, counter)) != NULL &&
+             value->next->value.__i.type == array.type &&
+             !sameName(value->next->value.__i.name, array.name)) {
+    kind = CopyIdiom;
+    value = value->next;
+  } else
+    return none;
+
+  if (skipCounterStep(step, counter) == NULL)
+    return none;
+  return (IdiomLoop){kind, counter, bound, element->next, value};
+}
 
-        token = token->next;
-      }
-    }
+/**
+ * @brief Put the kernel call of an idiom in front of its loop
+ * Falls through to the loop's label when the guards fail, and after a
+ * search.
+ */
+void resolveLoopIdiom(strbuf *ops, IdiomLoop loop, uint id) {
+  Identifier array = loop.array->value.__i;
+  str counter = _val_(*loop.counter);
+  str element = fstr("%s + rax * %u", mangledName(array.name),
+                     typeSize(array.type));
+
+  if (loop.kind == FindIdiom) {
+    fline(ops, "mov rax, %s", counter);
+    wline(ops, "test rax, rax");
+    fline(ops, "js .while%u", id);
+    fline(ops, "cmp rax, %u", array.length);
+    fline(ops, "jge .while%u", id);
+    fline(ops, "mov rcx, %u", array.length);
+    wline(ops, "sub rcx, rax");
+    fline(ops, "lea rsi, [%s]", element);
+    fline(ops, "mov rdx, %s", _val_(*loop.value));
+    fline(ops, "mov r8, %u", VECTOR_FIND);
+    wline(ops, "call qword [_rt_vector_impl]");
+    fline(ops, "add %s, rax", counter);
+    return;
   }
 
-  // Iterate through functions
-  wline(&text, "global _start");
-  wline(&text, "_start:");
+  // Every element from the counter up to the bound lies in the arrays
+  uint length = array.length;
+  if (loop.kind == CopyIdiom && loop.value->value.__i.length < length)
+    length = loop.value->value.__i.length;
+  fline(ops, "mov rax, %s", counter);
+  fline(ops, "mov rcx, %s", _val_(*loop.bound));
+  wline(ops, "cmp rax, rcx");
+  fline(ops, "jge .while%u", id);
+  wline(ops, "test rax, rax");
+  fline(ops, "js .while%u", id);
+  fline(ops, "cmp rcx, %u", length);
+  fline(ops, "jg .while%u", id);
+
+  fline(ops, "mov %s, rcx", counter);
+  wline(ops, "sub rcx, rax");
+  fline(ops, "lea rdi, [%s]", element);
+  if (loop.kind == CopyIdiom) {
+    fline(ops, "lea rsi, [%s + rax * %u]",
+          mangledName(loop.value->value.__i.name), typeSize(array.type));
+    fline(ops, "mov r8, %u", VECTOR_COPY);
+  } else {
+    fline(ops, "mov rdx, %s", _val_(*loop.value));
+    fline(ops, "mov r8, %u", VECTOR_FILL);
+  }
+  wline(ops, "call qword [_rt_vector_impl]");
+  fline(ops, "jmp .wend%u", id);
+}
 
-  // Iterate through tokens
-  HEAD = _stream_head;
+// --------------------------
+// Parallel Lowering --------
+
+/**
+ * @brief A run of the stream lowered on its own: one procedure body, or the
+ * top-level code between two of them
+ */
+typedef struct {
+  Token *first;  // first token visited
+  Token *last;   // END closing a procedure unit, NULL for top-level code
+  Token *stop;   // first token of the next unit, NULL at the end
+  uint labels;   // number of the unit's first if or while
+  uint base;     // number its labels start from in the output
+  bool procedure;
+
+  // Appended in the same order the serial walk appends them
+  strbuf func;
+  strbuf text;
+
+  // Cold arms, placed after their procedure or after the program's exit
+  strbuf coldFunc;
+  strbuf coldText;
+
+  // Token dump, replayed in order after a parallel run
+  FILE *trace;
+  char *traceBuffer;
+  size_t traceSize;
+} CodegenUnit;
+
+typedef struct {
+  CodegenUnit *units;
+  uint nunits;
+  uint next;
+} CodegenQueue;
+
+/**
+ * @brief Lower the tokens of a unit, starting from a clean walk state
+ */
+void lowerUnit(CodegenUnit *unit) {
+  Token *HEAD = unit->first;
   bool isProcedure = false;
+  Token *procedure = NULL; // being lowered, while isProcedure
   uint blockDepth = 0;
-  str *targ;
+  strbuf *targ;
 
-  printf("---Processed---\n");
-  while (HEAD != NULL) {
+  ControlBlock blocks[MAX_CONTROL_DEPTH];
+  uint nblocks = 0, nlabels = unit->labels;
+  uint coldArm = 0; // depth of the block whose arm is being lowered cold
+
+  // Source line markers, replaced by the annotated assembly or by the line
+  // table. Every buffer gets its own, cold arms are placed apart.
+  bool annotate =
+      hasCompilerFlag("-emit-annotated-asm") || hasCompilerFlag("-g");
+  Symbol lastModule = 0;
+  uint lastLine = 0;
+  strbuf *lastMarked = NULL;
+
+  while (HEAD != NULL && HEAD != unit->stop) {
     Token *token = HEAD;
-    HEAD = HEAD->next;
-    targ = (isProcedure) ? &func : &text;
+    HEAD = token == unit->last ? NULL : HEAD->next;
+    if (coldArm)
+      targ = (isProcedure) ? &unit->coldFunc : &unit->coldText;
+    else
+      targ = (isProcedure) ? &unit->func : &unit->text;
+
+    strbuf *marked = token->type == ProcedureToken ? &unit->func : targ;
+    if (annotate && token->line != 0 &&
+        (token->line != lastLine || token->module != lastModule ||
+         marked != lastMarked)) {
+      lastModule = token->module;
+      lastLine = token->line;
+      lastMarked = marked;
+      fline(marked, "; %s:%u", symbolText(lastModule), lastLine);
+    }
 
-    printf("[%x] %s -> %s\n", token, strTokenType(token->type), _val_(*token));
+    fprintf(unit->trace, "[%x] %s -> %s\n", token, strTokenType(token->type),
+            _val_(*token));
 
     switch (token->type) {
     case KeywordToken: {
@@ -517,49 +1661,181 @@ void codegen(TokenStream _stream_head, str outfile) {
       case SYSCALL: {
         uint _syscall_nargs = 0;
         token = token->next; // Move past this keyword
+
+        // -Os leaves the number out and jumps to the one exit sequence
+        bool shared = hasCompilerFlag("-Os") && isSharedExit(token);
+        if (flushesOutput(token) && isRuntimeModuleLinked("io") && !shared)
+          wline(targ, "call _rt_io_flush");
+        if (isExitSyscall(token) && __PROFILE_GENERATE__ && !shared)
+          wline(targ, "call _prof_dump");
+
         while (token->value.__k != END) {
           if (token->type == OperatorToken)
             resolveOperator(targ, token);
-          str loc = syscall_argloc(_syscall_nargs++);
-          fline(targ, "mov %s, %s", loc, _val_(*token));
+          rejectArray(token);
+          if (!shared || _syscall_nargs > 0)
+            loadInteger(targ, syscall_argloc(_syscall_nargs), token);
+          _syscall_nargs++;
           token = token->next;
         }
 
-        wline(targ, "syscall");
+        wline(targ, shared ? "jmp " SHARED_EXIT : "syscall");
         HEAD = token;
         break;
       }
 
+      case IF:
+      case WHILE: {
+        if (nblocks == MAX_CONTROL_DEPTH)
+          CompilerError("Control flow nested too deeply.");
+
+        ControlBlock *block = &blocks[nblocks++];
+        *block = (ControlBlock){
+            .kind = key == IF ? IfBlock : WhileBlock,
+            .id = nlabels - unit->labels + unit->base,
+            .profile = nlabels++,
+            .branch = 0,
+            .depth = blockDepth,
+        };
+
+        ProfileBlock *profile = __PROFILE_BLOCKS__ != NULL
+                                    ? &__PROFILE_BLOCKS__[block->profile]
+                                    : NULL;
+        if (__PROFILE_GENERATE__)
+          fline(targ, "inc qword [%s]",
+                profileBlockCounter(block->profile, -1));
+
+        if (key == WHILE) {
+          IdiomLoop idiom = recognizeLoopIdiom(token);
+          if (idiom.kind != NoIdiom)
+            resolveLoopIdiom(targ, idiom, block->id);
+
+          // -Os doesn't pad
+          if (profile != NULL && profile->align && !hasCompilerFlag("-Os"))
+            wline(targ, "align 16");
+          fline(targ, ".while%u:", block->id);
+          HEAD = resolveCondition(targ, token->next, DO, "jz",
+                                  fstr(".wend%u", block->id));
+        }
+
+        // A cold arm is lowered out of line, the next one falls through
+        else if (profile != NULL && profile->cold[0] && coldArm == 0) {
+          HEAD = resolveCondition(targ, token->next, THEN, "jnz",
+                                  fstr(".then%u_%u", block->id, 0));
+          coldArm = nblocks;
+          targ = (isProcedure) ? &unit->coldFunc : &unit->coldText;
+          fline(targ, ".then%u_%u:", block->id, 0);
+        } else
+          HEAD = resolveCondition(targ, token->next, THEN, "jz",
+                                  fstr(".else%u_%u", block->id, 0));
+
+        if (__PROFILE_GENERATE__)
+          fline(targ, "inc qword [%s]",
+                profileBlockCounter(block->profile, 0));
+        break;
+      }
+
+      case ELIF:
+      case ELSE: {
+        if (nblocks == 0 || blocks[nblocks - 1].kind != IfBlock)
+          CompilerError(fstr("\"%s\" outside of an if.",
+                             key == ELIF ? "elif" : "else"));
+
+        ControlBlock *block = &blocks[nblocks - 1];
+        bool *cold = __PROFILE_BLOCKS__ != NULL
+                         ? __PROFILE_BLOCKS__[block->profile].cold
+                         : NULL;
+        bool leaving = coldArm == nblocks;
+        bool entering = key == ELSE && coldArm == 0 && cold != NULL &&
+                        cold[block->branch + 1];
+
+        // A cold else is only reached by jumping to it, falling into it
+        // from the arm before would leave it in line
+        if (!entering)
+          fline(targ, "jmp .fi%u", block->id);
+        if (leaving) {
+          coldArm = 0;
+          targ = (isProcedure) ? &unit->func : &unit->text;
+        } else if (entering) {
+          coldArm = nblocks;
+          targ = (isProcedure) ? &unit->coldFunc : &unit->coldText;
+        }
+        fline(targ, ".else%u_%u:", block->id, block->branch++);
+
+        if (key == ELIF && coldArm == 0 && cold != NULL &&
+            cold[block->branch]) {
+          HEAD = resolveCondition(targ, token->next, THEN, "jnz",
+                                  fstr(".then%u_%u", block->id, block->branch));
+          coldArm = nblocks;
+          targ = (isProcedure) ? &unit->coldFunc : &unit->coldText;
+          fline(targ, ".then%u_%u:", block->id, block->branch);
+        } else if (key == ELIF)
+          HEAD = resolveCondition(targ, token->next, THEN, "jz",
+                                  fstr(".else%u_%u", block->id, block->branch));
+        if (__PROFILE_GENERATE__)
+          fline(targ, "inc qword [%s]",
+                profileBlockCounter(block->profile, block->branch));
+        break;
+      }
+
       case END: {
+        if (nblocks > 0 && blocks[nblocks - 1].depth == blockDepth) {
+          ControlBlock *block = &blocks[--nblocks];
+          if (block->kind == WhileBlock) {
+            fline(targ, "jmp .while%u", block->id);
+            fline(targ, ".wend%u:", block->id);
+          } else {
+            if (coldArm == nblocks + 1) {
+              fline(targ, "jmp .fi%u", block->id);
+              coldArm = 0;
+              targ = (isProcedure) ? &unit->func : &unit->text;
+            }
+            fline(targ, ".else%u_%u:", block->id, block->branch);
+            fline(targ, ".fi%u:", block->id);
+          }
+        }
+
         if (blockDepth > 0)
           blockDepth--;
 
         if (blockDepth == 0 && isProcedure) {
-          wline(targ, "ret");
+          resolveTypedReturn(targ, procedure, NULL);
           isProcedure = false;
+
+          // Cold arms of the procedure go behind its return
+          if (unit->coldFunc.len > 0) {
+            wline(&unit->func, unit->coldFunc.ptr);
+            unit->coldFunc.len = 0;
+            unit->coldFunc.ptr[0] = '\0';
+          }
         }
         break;
       }
 
       case RETURN: {
         token = token->next; // Move past this keyword
-        wline(targ, "pop rsi");
-        if (token->type == IdentifierToken)
-          fline(targ, "push qword %s", _val_(*token));
+        if (isProcedure && isTailCall(procedure, token) &&
+            !hasCompilerFlag("-fno-tail-calls")) {
+          resolveTailCall(targ, token);
+          HEAD = token->next;
+          break;
+        }
+
+        if (token->type == OperatorToken)
+          resolveOperator(targ, token);
+
+        bool operable = isTokenOperable(token);
+        rejectArray(token);
+        if (isProcedure)
+          resolveTypedReturn(targ, procedure, operable ? token : NULL);
         else
-          fline(targ, "push 0");
-        
-        wline(targ, "push rsi");
-        wline(targ, "ret");
-        HEAD = token->next;
+          resolveReturn(targ, operable ? _val_(*token) : "0");
+        HEAD = operable ? token->next : token;
         break;
       }
 
       case INCLUDE:
       case MACRO:
-      case IF:
-      case ELSE:
-      case WHILE:
 
       default:
         break;
@@ -577,18 +1853,983 @@ void codegen(TokenStream _stream_head, str outfile) {
       break;
 
     case ProcedureToken: {
-      resolveProcedureArgs(&func, token);
+      Function fn = token->value.__f;
+      if (fn.runtime) {
+        resolveRuntimeProcedure(&unit->func, mangledName(fn.name),
+                                symbolText(fn.name.symbol),
+                                fn.type == FloatValue);
+        HEAD = procedureParam(token, fn.nargs)->next; // past the end
+        break;
+      }
+
+      resolveProcedureArgs(&unit->func, token);
+      if (__PROFILE_GENERATE__)
+        fline(&unit->func, "inc qword [_prof%s]", mangledName(fn.name));
       isProcedure = true;
+      procedure = token;
       blockDepth++;
       break;
     }
     }
   }
 
-  // Add return 0 at end
-  wline(&text, "mov rax, 60");
-  wline(&text, "mov rdi, 0");
-  wline(&text, "syscall");
+}
+
+CodegenUnit *openCodegenUnit(CodegenUnit **units, uint *nunits, Token *first,
+                             uint labels, bool procedure) {
+  if (*nunits > 0)
+    (*units)[*nunits - 1].stop = first;
+
+  *units = realloc(*units, (*nunits + 1) * sizeof(CodegenUnit));
+  CodegenUnit *unit = &(*units)[(*nunits)++];
+  *unit = (CodegenUnit){
+      .first = first,
+      .labels = labels,
+      .base = labels,
+      .procedure = procedure,
+  };
+  return unit;
+}
+
+/**
+ * @brief Split the stream into units, at every procedure the serial walk
+ * would enter with no block open. Mirrors the walk's block tracking to know
+ * which END closes each procedure and how many labels came before it.
+ *
+ * @return Whether the units can be lowered apart, not when procedures share
+ * a name or one is left open
+ */
+bool partitionStream(TokenStream _stream_head, CodegenUnit **units,
+                     uint *nunits) {
+  uint blocks[MAX_CONTROL_DEPTH];
+  uint nblocks = 0, nlabels = 0, blockDepth = 0;
+  bool isProcedure = false;
+
+  *units = NULL;
+  *nunits = 0;
+  CodegenUnit *unit = openCodegenUnit(units, nunits, _stream_head, 0, false);
+
+  uint ndeclared = 0;
+  for (Token *token = _stream_head; token != NULL; token = token->next)
+    ndeclared += token->type == ProcedureToken;
+  __PROCEDURE_INDEX_CAPACITY__ = 64;
+  while (__PROCEDURE_INDEX_CAPACITY__ < 2 * ndeclared)
+    __PROCEDURE_INDEX_CAPACITY__ *= 2;
+  __PROCEDURE_INDEX__ = calloc(__PROCEDURE_INDEX_CAPACITY__, sizeof(Token *));
+
+  Token *token = _stream_head;
+  while (token != NULL) {
+    if (token->type == ProcedureToken) {
+      Function fn = token->value.__f;
+
+      // Calls resolve by name, so names have to be unique
+      Token **slot = procedureIndexSlot(fn.name);
+      if (*slot != NULL)
+        return false;
+      *slot = token;
+
+      // A thunk is a unit of its own, -separate puts it in its module
+      if (fn.runtime) {
+        Token *end = procedureParam(token, fn.nargs);
+        if (!isProcedure && blockDepth == 0 && nblocks == 0) {
+          unit = openCodegenUnit(units, nunits, token, nlabels, true);
+          unit->last = end;
+          unit = openCodegenUnit(units, nunits, end->next, nlabels, false);
+        }
+        token = end->next;
+        continue;
+      }
+
+      if (!isProcedure && blockDepth == 0 && nblocks == 0)
+        unit = openCodegenUnit(units, nunits, token, nlabels, true);
+      isProcedure = true;
+      blockDepth++;
+    } else if (token->type == KeywordToken) {
+      Keyword key = token->value.__k;
+      if (isBlockKeyword(key))
+        blockDepth++;
+
+      if (key == IF || key == WHILE) {
+        if (nblocks == MAX_CONTROL_DEPTH)
+          return false;
+        blocks[nblocks++] = blockDepth;
+        nlabels++;
+      } else if ((key == ELIF || key == ELSE) && nblocks == 0)
+        return false;
+      else if (key == END) {
+        if (nblocks > 0 && blocks[nblocks - 1] == blockDepth)
+          nblocks--;
+        if (blockDepth > 0)
+          blockDepth--;
+
+        if (blockDepth == 0 && isProcedure) {
+          isProcedure = false;
+          if (unit->procedure) {
+            if (nblocks != 0)
+              return false;
+            unit->last = token;
+            unit = openCodegenUnit(units, nunits, token->next, nlabels, false);
+          }
+        }
+      }
+    }
+
+    token = token->next;
+  }
+
+  // A procedure left open swallows the rest of the stream
+  return !unit->procedure;
+}
+
+/**
+ * @brief Append one buffer of every unit, at field, growing the buffer once
+ * Lines are joined the way wline joins them.
+ */
+void mergeCodegenUnits(strbuf *buf, CodegenUnit *units, uint nunits,
+                       size_t field) {
+  uint total = 0;
+  for (uint i = 0; i < nunits; i++)
+    total += ((strbuf *)((char *)&units[i] + field))->len + 1;
+  reserveBuffer(buf, total);
+
+  for (uint i = 0; i < nunits; i++) {
+    strbuf *code = (strbuf *)((char *)&units[i] + field);
+    if (code->len == 0)
+      continue;
+    if (buf->len > 0)
+      buf->ptr[buf->len++] = '\n';
+    appendBuffer(buf, code->ptr, code->len);
+    free(code->ptr);
+  }
+}
+
+void *codegenWorker(void *arg) {
+  CodegenQueue *queue = arg;
+  uint i;
+  while ((i = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) <
+         queue->nunits)
+    lowerUnit(&queue->units[i]);
+  return NULL;
+}
+
+/**
+ * @brief Lower every unit into its own buffers on a thread pool, then print
+ * their traces in stream order to trace, unless it is NULL
+ */
+void lowerUnits(CodegenUnit *units, uint nunits, FILE *trace) {
+  long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  str threads = compilerFlagValue("-codegen-threads");
+  if (threads != NULL)
+    nthreads = atoi(threads);
+  if (hasCompilerFlag("-fno-parallel-codegen"))
+    nthreads = 1;
+  if (nthreads > nunits)
+    nthreads = nunits;
+  if (nthreads < 1)
+    nthreads = 1;
+
+  for (uint i = 0; i < nunits; i++) {
+    units[i].func = createBuffer();
+    units[i].text = createBuffer();
+    units[i].coldFunc = createBuffer();
+    units[i].coldText = createBuffer();
+    units[i].trace = open_memstream(&units[i].traceBuffer, &units[i].traceSize);
+  }
+
+  // The calling thread works through the queue too
+  CodegenQueue queue = {.units = units, .nunits = nunits};
+  pthread_t workers[nthreads];
+  for (long i = 1; i < nthreads; i++)
+    if (pthread_create(&workers[i], NULL, codegenWorker, &queue) != 0)
+      CompilerError("Couldn't start a codegen thread.");
+  codegenWorker(&queue);
+  for (long i = 1; i < nthreads; i++)
+    pthread_join(workers[i], NULL);
+
+  for (uint i = 0; i < nunits; i++) {
+    fclose(units[i].trace);
+    if (trace != NULL)
+      fwrite(units[i].traceBuffer, 1, units[i].traceSize, trace);
+    free(units[i].traceBuffer);
+  }
+}
+
+/**
+ * @brief Lower the stream into func and text, and top-level cold arms into cold
+ * Procedure bodies and the code between them are lowered on a thread pool
+ * and merged in stream order, the result is the same as the serial walk's.
+ */
+void lowerStream(TokenStream _stream_head, strbuf *func, strbuf *text,
+                 strbuf *cold) {
+  CodegenUnit *units;
+  uint nunits;
+
+  // Line markers depend on the walk so far, annotating stays serial. Two
+  // procedures at least, each followed by top-level code, are worth threads.
+  if (hasCompilerFlag("-fno-parallel-codegen") ||
+      hasCompilerFlag("-emit-annotated-asm") || hasCompilerFlag("-g") ||
+      !partitionStream(_stream_head, &units, &nunits) || nunits < 5) {
+    free(__PROCEDURE_INDEX__);
+    __PROCEDURE_INDEX__ = NULL;
+
+    CodegenUnit unit = {.first = _stream_head, .trace = stdout};
+    unit.func = createBuffer();
+    unit.text = createBuffer();
+    unit.coldFunc = createBuffer();
+    unit.coldText = createBuffer();
+    lowerUnit(&unit);
+    mergeCodegenUnits(func, &unit, 1, offsetof(CodegenUnit, func));
+    mergeCodegenUnits(text, &unit, 1, offsetof(CodegenUnit, text));
+    mergeCodegenUnits(cold, &unit, 1, offsetof(CodegenUnit, coldText));
+    free(unit.coldFunc.ptr);
+    return;
+  }
+
+  lowerUnits(units, nunits, stdout);
+  mergeCodegenUnits(func, units, nunits, offsetof(CodegenUnit, func));
+  mergeCodegenUnits(text, units, nunits, offsetof(CodegenUnit, text));
+  mergeCodegenUnits(cold, units, nunits, offsetof(CodegenUnit, coldText));
+  for (uint i = 0; i < nunits; i++)
+    free(units[i].coldFunc.ptr);
+
+  free(units);
+  free(__PROCEDURE_INDEX__);
+  __PROCEDURE_INDEX__ = NULL;
+}
+
+/**
+ * @brief Declare every routine of a section as an ELF function, sized up to
+ * the next routine or to end, so profilers attribute samples to it. Without
+ * an end the last routine ends at its own .end label.
+ */
+void declareRoutineSymbols(strbuf *symbols, str code, str end) {
+  str routine = NULL;
+  uint length = 0;
+
+  str cursor = code;
+  while (*cursor != '\0') {
+    str start = cursor;
+    uint len = strcspn(cursor, "\n");
+    char line[len + 1];
+    memcpy(line, cursor, len);
+    line[len] = '\0';
+    cursor = cursor[len] == '\n' ? &cursor[len + 1] : &cursor[len];
+
+    bool global;
+    if (!isAsmLabel(line, &global) || !global)
+      continue;
+    if (routine != NULL)
+      fline(symbols, "global %.*s:function (%.*s - %.*s)", length, routine,
+            len - 1, line, length, routine);
+    routine = start;
+    length = len - 1;
+  }
+
+  if (routine != NULL && end == NULL)
+    fline(symbols, "global %.*s:function (%.*s.end - %.*s)", length, routine,
+          length, routine, length, routine);
+  else if (routine != NULL)
+    fline(symbols, "global %.*s:function (%s - %.*s)", length, routine, end,
+          length, routine);
+}
+
+void clean_codegen(strbuf *code) {
+  for (size_t i = 0; i < code->len; i++)
+    if (isalnum(code->ptr[i]) == 0 && ispunct(code->ptr[i]) == 0 &&
+        isspace(code->ptr[i]) == 0)
+      code->ptr[i] = ' ';
+}
+
+/**
+ * @brief Link the runtime modules the stream uses
+ */
+void linkStreamRuntime(TokenStream _stream_head) {
+  for (Token *token = _stream_head; token != NULL; token = token->next) {
+    // Whole array assignments run on the vector kernel
+    if (token->type == OperatorToken && token->value.__o == ASSIGN &&
+        isArray(token->next))
+      linkRuntimeModule("vector");
+
+    // So do loops recognized as one of its idioms
+    else if (token->type == KeywordToken && token->value.__k == WHILE &&
+             recognizeLoopIdiom(token).kind != NoIdiom)
+      linkRuntimeModule("vector");
+
+    // Runtime procedures that are still used link their kernels
+    else if (token->type == ProcedureToken && token->value.__f.runtime)
+      declareRuntimeProcedure(symbolText(token->value.__f.name.symbol),
+                              token->value.__f.nargs);
+  }
+}
+
+/**
+ * @brief Pool the literals of the tokens from first up to stop, and reserve
+ * memory for what they declare
+ */
+void reserveStorage(Token *first, Token *stop, strbuf *bss) {
+  for (Token *token = first; token != stop; token = token->next) {
+    // Pre-allocate addresses for literals
+    if (token->type == LiteralToken) {
+      Literal *literal = &token->value.__l;
+      switch (literal->type) {
+      case StringValue:
+        literal->value.__s = poolStringLiteral(literal->value.__s);
+        break;
+
+      case FloatValue:
+        poolFloatLiteral(literal->value.__f);
+        break;
+
+      default:
+        break;
+      }
+    }
+
+    // Reserve memory for variables
+    else if (token->type == DeclarationToken) {
+      // The vector kernels load unaligned, -Os leaves the padding out
+      Identifier *iden = &token->value.__i;
+      if (iden->length > 0 && !hasCompilerFlag("-Os"))
+        wline(bss, "alignb 32");
+      fline(bss, "%s: resb %d", mangledName(iden->name), iden->msize);
+    }
+  }
+}
+
+void emitLiteralPools(strbuf *rodata) {
+  if (__N_STRING_LITERALS__ > 0 || __N_FLOAT_LITERALS__ > 0)
+    wline(rodata, "section .rodata");
+  emitStringPool(rodata);
+  emitFloatPool(rodata);
+}
+
+/**
+ * @brief Forget the pooled literals, the next pool starts over
+ */
+void resetLiteralPools() {
+  __N_STRING_LITERALS__ = 0;
+  __N_FLOAT_LITERALS__ = 0;
+  if (__STRING_LABELS__ != NULL)
+    memset(__STRING_LABELS__, 0, __STRING_LABELS_CAPACITY__ * sizeof(Symbol));
+}
+
+void emitStart(strbuf *text) {
+  wline(text, "global _start:function (_start.end - _start)");
+  wline(text, "_start:");
+  if (hasCompilerFlag("-fframe-pointers"))
+    wline(text, "xor ebp, ebp"); // the outermost frame
+  if (isRuntimeLinked())
+    wline(text, "call _rt_init");
+}
+
+/**
+ * @brief Exit with status 0 after the top-level code, cold arms behind it
+ *
+ * @param shared Jump to the shared exit sequence instead
+ */
+void emitExit(strbuf *text, strbuf *cold, bool shared) {
+  if (shared) {
+    wline(text, "mov rdi, 0");
+    wline(text, "jmp " SHARED_EXIT);
+  } else {
+    if (isRuntimeModuleLinked("io"))
+      wline(text, "call _rt_io_flush");
+    if (__PROFILE_GENERATE__)
+      wline(text, "call _prof_dump");
+    wline(text, "mov rax, 60");
+    wline(text, "mov rdi, 0");
+    wline(text, "syscall");
+  }
+
+  // Cold arms of the top-level code, only reached by a jump
+  wline(text, cold->ptr);
+  wline(text, ".end:");
+}
+
+/**
+ * @brief The exit sequence -Os shares, status in rdi
+ */
+void emitSharedExit(strbuf *func) {
+  bool flush = isRuntimeModuleLinked("io") || __PROFILE_GENERATE__;
+  wline(func, SHARED_EXIT ":");
+  if (flush)
+    wline(func, "push rdi");
+  if (isRuntimeModuleLinked("io"))
+    wline(func, "call _rt_io_flush");
+  if (__PROFILE_GENERATE__)
+    wline(func, "call _prof_dump");
+  if (flush)
+    wline(func, "pop rdi");
+  fline(func, "mov rax, %d", SYS_EXIT);
+  wline(func, "syscall");
+}
+
+bool jumpsToSharedExit(str code) {
+  return strstr(code, "jmp " SHARED_EXIT) != NULL;
+}
+
+/**
+ * @brief -emit-stats over the code of the sections given
+ */
+void reportCodeStats(str *code, uint ncode) {
+  str statsFile = compilerFlagValue("-emit-stats");
+  if (!hasCompilerFlag("-emit-stats") && statsFile == NULL)
+    return;
+
+  CodeStats stats = {};
+  for (uint i = 0; i < ncode; i++)
+    collectCodeStats(&stats, code[i]);
+
+  if (hasCompilerFlag("-emit-stats"))
+    printCodeStats(&stats, stdout);
+  if (statsFile != NULL)
+    writeCodeStatsJson(&stats, statsFile);
+}
+
+// Sections of one assembly file
+typedef struct {
+  strbuf head;
+  strbuf symbols;
+  strbuf func;
+  uint generated; // length of func before the runtime routines
+  strbuf text;
+  strbuf rodata;
+  strbuf data;
+  strbuf bss;
+} Assembly;
+
+void writeAssembly(FILE *fout, str path, Assembly *code) {
+  if (hasCompilerFlag("-g")) {
+    uint lines = 0;
+    writeLineTable(fout, code->head.ptr, code->head.len, path, &lines);
+    writeLineTable(fout, code->symbols.ptr, code->symbols.len, path, &lines);
+    writeLineTable(fout, code->func.ptr, code->generated, path, &lines);
+    writeLineTable(fout, &code->func.ptr[code->generated],
+                   code->func.len - code->generated, path, &lines);
+    writeLineTable(fout, code->text.ptr, code->text.len, path, &lines);
+    fprintf(fout, "\n");
+  } else {
+    fprintf(fout, "%s\n", code->head.ptr);
+    if (code->symbols.len > 0)
+      fprintf(fout, "%s\n", code->symbols.ptr);
+    fprintf(fout, "%s\n", code->func.ptr);
+    fprintf(fout, "%s\n\n", code->text.ptr);
+  }
+  if (code->rodata.len > 0)
+    fprintf(fout, "%s\n\n", code->rodata.ptr);
+  fprintf(fout, "%s\n\n", code->data.ptr);
+  fprintf(fout, "%s\n\n", code->bss.ptr);
+}
+
+/**
+ * @brief Write <path without .asm>.annotated.asm under -emit-annotated-asm
+ */
+void writeAnnotatedAssembly(str path, Assembly *code) {
+  if (!hasCompilerFlag("-emit-annotated-asm"))
+    return;
+
+  str annotated =
+      fstr("%.*s.annotated.asm", strlen(path) - strlen(".asm"), path);
+  FILE *fann = fopen(annotated, "w");
+  if (fann == NULL)
+    CompilerError(fstr("Couldn't create \"%s\".", annotated));
+
+  fprintf(fann, "%s\n", code->head.ptr);
+  annotateSection(fann, code->func.ptr);
+  annotateSection(fann, code->text.ptr);
+  if (code->rodata.len > 0)
+    fprintf(fann, "\n%s\n", code->rodata.ptr);
+  fprintf(fann, "\n%s\n\n", code->data.ptr);
+  fprintf(fann, "%s\n\n", code->bss.ptr);
+  fclose(fann);
+}
+
+/**
+ * @brief Empty sections, with their headers
+ */
+Assembly createAssembly() {
+  Assembly code = {
+      .head = createBuffer(),
+      .symbols = createBuffer(),
+      .func = createBuffer(),
+      .text = createBuffer(),
+      .rodata = createBuffer(),
+      .data = createBuffer(),
+      .bss = createBuffer(),
+  };
+
+  fline(&code.head, "BITS %d\n", 64);
+  wline(&code.head, "section .text");
+  wline(&code.data, "section .data");
+  wline(&code.bss, "section .bss");
+  return code;
+}
+
+// --------------------------
+// Per-module Objects -------
+//
+// -separate[=DIR] splits the lowered program into one object per module in
+// DIR. A module's object holds the procedures and runtime thunks it
+// declares, _start.o the top-level code of every module, and _rt.o the
+// runtime. What an object defines is global, what it uses from another
+// object extern. Every build still lowers the whole program, only
+// assembling is saved: an object is assembled again when its assembly
+// changed, and then everything is linked.
+
+#define SEPARATE_DEFAULT_DIR "dang-objects"
+
+// Objects of the last separate build in link order, as paths without the
+// extension, and whether each has to be assembled
+str *__OBJECTS__;
+bool *__STALE_OBJECTS__;
+uint __N_OBJECTS__;
+
+typedef struct {
+  Symbol module;      // whose procedures it holds, 0 for _start
+  CodegenUnit *units; // lowered into it, in stream order
+  uint nunits;
+  Assembly code;
+} ObjectFile;
+
+/**
+ * @brief Object of a module, named after its path with / as -
+ */
+str objectName(Symbol module) {
+  str path = symbolText(module);
+  uint len = strlen(path);
+  if (len > 5 && strcmp(&path[len - 5], ".dang") == 0)
+    len -= 5;
+
+  str name = fstr("%.*s", len, path);
+  for (str c = name; *c != '\0'; c++)
+    if (*c == '/')
+      *c = '-';
+  return name;
+}
+
+/**
+ * @brief Names of the objects, unique within the build. Modules whose paths
+ * flatten to the same name, or to _start or _rt, get a hash of their path.
+ */
+str *objectNames(ObjectFile *objects, uint nobjects) {
+  str *flat = malloc(nobjects * sizeof(str));
+  for (uint k = 0; k < nobjects; k++)
+    flat[k] = objects[k].module ? objectName(objects[k].module) : "_start";
+
+  str *names = malloc(nobjects * sizeof(str));
+  for (uint k = 0; k < nobjects; k++) {
+    names[k] = flat[k];
+    if (objects[k].module == 0)
+      continue;
+
+    bool taken = strcmp(flat[k], "_start") == 0 || strcmp(flat[k], "_rt") == 0;
+    for (uint j = 0; j < nobjects && !taken; j++)
+      taken = j != k && strcmp(flat[j], flat[k]) == 0;
+    if (taken) {
+      str path = symbolText(objects[k].module);
+      names[k] = fstr("%s-%08x", flat[k], symbolHash(path, strlen(path)));
+    }
+  }
+
+  for (uint k = 0; k < nobjects; k++)
+    for (uint j = k + 1; j < nobjects; j++)
+      if (strcmp(names[j], names[k]) == 0)
+        CompilerError(fstr("Modules \"%s\" and \"%s\" both go to \"%s.o\".",
+                           symbolText(objects[k].module),
+                           symbolText(objects[j].module), names[k]));
+
+  free(flat);
+  return names;
+}
+
+bool isSymbolChar(char c) { return isalnum(c) || c == '_' || c == '$'; }
+
+/**
+ * @brief Mark a symbol in states, growing it to fit
+ *
+ * @return The symbol's state before
+ */
+char markSymbol(char **states, uint *capacity, Symbol symbol, char state) {
+  if (symbol >= *capacity) {
+    uint grown = *capacity ? *capacity : 1024;
+    while (grown <= symbol)
+      grown *= 2;
+    *states = realloc(*states, grown);
+    memset(&(*states)[*capacity], 0, grown - *capacity);
+    *capacity = grown;
+  }
+
+  char before = (*states)[symbol];
+  if (state > before)
+    (*states)[symbol] = state;
+  return before;
+}
+
+/**
+ * @brief Declare what an object's data defines global and what any of its
+ * sections use from other objects extern. Every symbol the compiler names
+ * starts with an underscore, code labels are declared as routines already.
+ */
+void declareObjectSymbols(strbuf *symbols, Assembly *code) {
+  enum { UNSEEN, USED, DATA, CODE };
+  char *states = NULL;
+  uint capacity = 0;
+
+  strbuf *sections[] = {&code->func, &code->text, &code->rodata, &code->data,
+                        &code->bss};
+  for (uint i = 0; i < 5; i++)
+    for (str line = sections[i]->ptr; *line != '\0';) {
+      uint len = 0;
+      while (isSymbolChar(line[len]))
+        len++;
+      if (line[0] == '_' && line[len] == ':') {
+        Symbol symbol = internView((strview){line, len});
+        char before =
+            markSymbol(&states, &capacity, symbol, i < 2 ? CODE : DATA);
+        if (before == UNSEEN && i >= 2)
+          fline(symbols, "global %s", symbolText(symbol));
+      }
+
+      line = strchr(line, '\n');
+      line = line == NULL ? "" : &line[1];
+    }
+
+  // Symbols used, outside of strings and comments
+  for (uint i = 0; i < 5; i++) {
+    str c = sections[i]->ptr;
+    while (*c != '\0') {
+      if (*c == '"') {
+        str close = strchr(&c[1], '"');
+        c = close == NULL ? "" : &close[1];
+      } else if (*c == ';') {
+        str eol = strchr(c, '\n');
+        c = eol == NULL ? "" : eol;
+      } else if (*c == '_' &&
+                 (c == sections[i]->ptr || !isSymbolChar(c[-1]))) {
+        uint len = 0;
+        while (isSymbolChar(c[len]))
+          len++;
+        Symbol symbol = internView((strview){c, len});
+        if (markSymbol(&states, &capacity, symbol, USED) == UNSEEN)
+          fline(symbols, "extern %s", symbolText(symbol));
+        c = &c[len];
+      } else
+        c++;
+    }
+  }
+
+  free(states);
+}
+
+/**
+ * @brief Whether the file holds exactly these bytes
+ */
+bool hasFileContents(str path, char *bytes, size_t size) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return false;
+
+  char chunk[65536];
+  size_t read, at = 0;
+  bool same = true;
+  while (same && (read = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    same = at + read <= size && memcmp(chunk, &bytes[at], read) == 0;
+    at += read;
+  }
+  fclose(f);
+  return same && at == size;
+}
+
+/**
+ * @brief Write an object's assembly, unless the object was assembled from
+ * the same assembly already, and add it to the objects to link
+ */
+void writeObject(str dir, str name, Assembly *code) {
+  str stem = fstr("%s/%s", dir, name);
+  str path = fstr("%s.asm", stem);
+  str object = fstr("%s.o", stem);
+
+  char *buffer;
+  size_t size;
+  FILE *memory = open_memstream(&buffer, &size);
+  writeAssembly(memory, path, code);
+  fclose(memory);
+
+  bool stale =
+      access(object, F_OK) != 0 || !hasFileContents(path, buffer, size);
+  if (stale) {
+    // Never left next to assembly it wasn't assembled from
+    unlink(object);
+
+    FILE *fout = fopen(path, "w");
+    if (fout == NULL)
+      CompilerError(fstr("Couldn't create \"%s\".", path));
+    fwrite(buffer, 1, size, fout);
+    fclose(fout);
+  }
+  free(buffer);
+  writeAnnotatedAssembly(path, code);
+
+  __OBJECTS__ = realloc(__OBJECTS__, (__N_OBJECTS__ + 1) * sizeof(str));
+  __STALE_OBJECTS__ =
+      realloc(__STALE_OBJECTS__, (__N_OBJECTS__ + 1) * sizeof(bool));
+  __OBJECTS__[__N_OBJECTS__] = stem;
+  __STALE_OBJECTS__[__N_OBJECTS__++] = stale;
+}
+
+/**
+ * @brief Lower the stream into one object per module in dir, plus _start.o
+ * and _rt.o
+ */
+void codegenSeparately(TokenStream _stream_head, str dir, str profileOut) {
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    CompilerError(fstr("Couldn't create \"%s\".", dir));
+
+  // Procedures sharing a name can't be told apart across objects
+  CodegenUnit *units;
+  uint nunits;
+  if (!partitionStream(_stream_head, &units, &nunits))
+    CompilerError("-separate needs procedure names unique across modules, "
+                  "and every procedure and block closed.");
+
+  // Labels of a procedure are local to it, top-level code shares _start
+  uint topLabels = 0;
+  for (uint i = 0; i < nunits; i++) {
+    units[i].base = units[i].procedure ? 0 : topLabels;
+    if (!units[i].procedure && i + 1 < nunits)
+      topLabels += units[i + 1].labels - units[i].labels;
+  }
+
+  ObjectFile *objects = calloc(1, sizeof(ObjectFile));
+  uint nobjects = 1;
+  for (uint i = 0; i < nunits; i++) {
+    Symbol module = units[i].procedure ? units[i].first->module : 0;
+    uint k = 0;
+    while (k < nobjects && objects[k].module != module)
+      k++;
+    if (k == nobjects) {
+      objects = realloc(objects, (nobjects + 1) * sizeof(ObjectFile));
+      objects[nobjects++] = (ObjectFile){.module = module};
+    }
+
+    ObjectFile *object = &objects[k];
+    object->units =
+        realloc(object->units, (object->nunits + 1) * sizeof(CodegenUnit));
+    object->units[object->nunits++] = units[i];
+  }
+
+  // Every object pools its own literals
+  for (uint k = 0; k < nobjects; k++) {
+    ObjectFile *object = &objects[k];
+    object->code = createAssembly();
+    resetLiteralPools();
+    for (uint i = 0; i < object->nunits; i++)
+      reserveStorage(object->units[i].first, object->units[i].stop,
+                     &object->code.bss);
+    emitLiteralPools(&object->code.rodata);
+  }
+
+  if (__PROFILE_GENERATE__ || __PROFILE_USE__)
+    planProfile(_stream_head);
+
+  for (uint k = 0, next = 0; k < nobjects; k++)
+    for (uint i = 0; i < objects[k].nunits; i++)
+      units[next++] = objects[k].units[i];
+  lowerUnits(units, nunits, NULL);
+
+  bool shared = false;
+  for (uint i = 0; i < nunits; i++)
+    shared = shared || jumpsToSharedExit(units[i].func.ptr) ||
+             jumpsToSharedExit(units[i].text.ptr) ||
+             jumpsToSharedExit(units[i].coldFunc.ptr) ||
+             jumpsToSharedExit(units[i].coldText.ptr);
+
+  str *code = malloc(2 * nobjects * sizeof(str));
+  for (uint k = 0, next = 0; k < nobjects; k++) {
+    ObjectFile *object = &objects[k];
+    CodegenUnit *mine = &units[next];
+    next += object->nunits;
+
+    Assembly *out = &object->code;
+    mergeCodegenUnits(&out->func, mine, object->nunits,
+                      offsetof(CodegenUnit, func));
+    if (object->module == 0) {
+      strbuf cold = createBuffer();
+      emitStart(&out->text);
+      mergeCodegenUnits(&out->text, mine, object->nunits,
+                        offsetof(CodegenUnit, text));
+      mergeCodegenUnits(&cold, mine, object->nunits,
+                        offsetof(CodegenUnit, coldText));
+      emitExit(&out->text, &cold, shared);
+      free(cold.ptr);
+      if (__PROFILE_GENERATE__)
+        emitProfileDump(&out->func, &out->data, &out->bss, profileOut);
+      if (shared)
+        emitSharedExit(&out->func);
+    }
+    for (uint i = 0; i < object->nunits; i++)
+      free(mine[i].coldFunc.ptr);
+
+    if (hasCompilerFlag("-Os")) {
+      shrinkCode(&out->func);
+      shrinkCode(&out->text);
+    }
+
+    code[2 * k] = out->func.ptr;
+    code[2 * k + 1] = out->text.ptr;
+    out->generated = out->func.len;
+  }
+  reportCodeStats(code, 2 * nobjects);
+  free(code);
+
+  str *names = objectNames(objects, nobjects);
+  for (uint k = 0; k < nobjects; k++) {
+    Assembly *out = &objects[k].code;
+    if (objects[k].module == 0)
+      declareRoutineSymbols(&out->symbols, out->func.ptr, "_start");
+    else {
+      wline(&out->func, ".end:");
+      declareRoutineSymbols(&out->symbols, out->func.ptr, NULL);
+    }
+    declareObjectSymbols(&out->symbols, out);
+    writeObject(dir, names[k], out);
+  }
+  free(names);
+
+  if (isRuntimeLinked()) {
+    Assembly runtime = createAssembly();
+    generateRuntime(&runtime.func, &runtime.data, &runtime.bss, false);
+    wline(&runtime.func, ".end:");
+    declareRoutineSymbols(&runtime.symbols, runtime.func.ptr, NULL);
+    declareObjectSymbols(&runtime.symbols, &runtime);
+    writeObject(dir, "_rt", &runtime);
+  }
+
+  free(units);
+  free(objects);
+  free(__PROCEDURE_INDEX__);
+  __PROCEDURE_INDEX__ = NULL;
+}
+
+void codegen(TokenStream _stream_head, str outfile) {
+  Assembly out = createAssembly();
+  __N_OBJECTS__ = 0;
+
+  TokenStream HEAD = _stream_head;
+
+  // Counters only make sense in a binary that runs on its own
+  str profileOut = compilerFlagValue("-fprofile-generate");
+  if (hasCompilerFlag("-fprofile-generate") || profileOut != NULL) {
+    if (hasCompilerFlag("-run") || hasCompilerFlag("-interp"))
+      CompilerError("-fprofile-generate needs a native build.");
+    __PROFILE_GENERATE__ = true;
+    if (profileOut == NULL)
+      profileOut = PROFILE_DEFAULT_PATH;
+  }
+
+  str profileIn = compilerFlagValue("-fprofile-use");
+  if (profileIn != NULL)
+    loadProfile(profileIn);
+
+  // So do objects
+  str objectDir = compilerFlagValue("-separate");
+  if (hasCompilerFlag("-separate") || objectDir != NULL) {
+    if (hasCompilerFlag("-run") || hasCompilerFlag("-interp"))
+      CompilerError("-separate needs a native build.");
+    if (objectDir == NULL)
+      objectDir = SEPARATE_DEFAULT_DIR;
+  }
+
+  // Resolve procedure signatures
+  while (HEAD != NULL) {
+    Token *token = HEAD;
+    HEAD = HEAD->next;
+    if (token->type != ProcedureToken)
+      continue;
+
+    Token *procedure = token;
+    Function *function = &(token->value.__f);
+    if (token->next->type == ExpressionStartToken) {
+      uint params = 0;
+      rippleDeleteTokens(&token, 1); // remove opening paren
+      while (token->next->type != ExpressionEndToken) {
+        token = token->next;
+        if (token->type != DeclarationToken)
+          CompilerError(fstr("Invalid %s token in function declaration",
+                             strTokenType(token->type)));
+        params++;
+      }
+
+      rippleDeleteTokens(&token, 1); // remove closing paren
+      function->nargs = params;
+      HEAD = token->next;
+    }
+
+    function->runtime =
+        isProcedureDeclaration(procedure) &&
+        findRuntimeRoutine(symbolText(function->name.symbol)) != NULL;
+  }
+
+  if (!hasCompilerFlag("-fno-const-eval")) {
+    statsBegin(PHASE_EVAL);
+    foldConstantCalls(_stream_head);
+    statsEnd();
+  }
+
+  if (!hasCompilerFlag("-fno-whole-program")) {
+    statsBegin(PHASE_WHOLE_PROGRAM);
+    optimizeWholeProgram(&_stream_head);
+    statsEnd();
+  }
+
+  linkStreamRuntime(_stream_head);
+  if (objectDir != NULL) {
+    codegenSeparately(_stream_head, objectDir, profileOut);
+    return;
+  }
+
+  reserveStorage(_stream_head, NULL, &out.bss);
+  emitLiteralPools(&out.rodata);
+
+  // -interp runs the stream as bytecode instead
+  if (hasCompilerFlag("-interp"))
+    interpret(_stream_head);
+
+  // Iterate through functions
+  emitStart(&out.text);
+
+  if (__PROFILE_GENERATE__ || __PROFILE_USE__)
+    planProfile(_stream_head);
+
+  strbuf cold = createBuffer();
+  printf("---Processed---\n");
+  lowerStream(_stream_head, &out.func, &out.text, &cold);
+
+  // Add return 0 at end, -Os shares it with the other exits
+  bool shared = jumpsToSharedExit(out.func.ptr) ||
+                jumpsToSharedExit(out.text.ptr) || jumpsToSharedExit(cold.ptr);
+  emitExit(&out.text, &cold, shared);
+  free(cold.ptr);
+  if (__PROFILE_GENERATE__)
+    emitProfileDump(&out.func, &out.data, &out.bss, profileOut);
+  if (shared)
+    emitSharedExit(&out.func);
+
+  if (hasCompilerFlag("-Os")) {
+    shrinkCode(&out.func);
+    shrinkCode(&out.text);
+  }
+
+  reportCodeStats((str[]){out.func.ptr, out.text.ptr}, 2);
+
+  // -run assembles in memory and serves the runtime from the host instead
+  if (hasCompilerFlag("-run"))
+    jitRun(out.head.ptr, out.func.ptr, out.text.ptr, out.rodata.ptr,
+           out.data.ptr, out.bss.ptr);
+
+  out.generated = out.func.len;
+  generateRuntime(&out.func, &out.data, &out.bss, false);
+  declareRoutineSymbols(&out.symbols, out.func.ptr, "_start");
 
   // Temporary clean to handle string corruption
   // @todo find why this is happening
@@ -602,13 +2843,10 @@ void codegen(TokenStream _stream_head, str outfile) {
     CompilerError(fstr("Couldn't create \"%s\".", outfile));
 
   // Write all strings to file
-  fprintf(fout, "%s\n", head);
-  fprintf(fout, "%s\n", func);
-  fprintf(fout, "%s\n\n", text);
-  fprintf(fout, "%s\n\n", data);
-  fprintf(fout, "%s\n\n", bss);
-
+  writeAssembly(fout, outfile, &out);
   fclose(fout);
+
+  writeAnnotatedAssembly(outfile, &out);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,392 @@
+#include <ctype.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lexer.c"
+#include "utils.c"
+
+#ifndef CODESTATS_C_INCLUDED
+#define CODESTATS_C_INCLUDED
+// --------------------------
+// Generated Code Statistics
+
+#define CODESTATS_MAX_MNEMONICS 64
+#define CODESTATS_MAX_MODULES 32
+
+typedef struct {
+  char name[16];
+  uint count;
+} MnemonicCount;
+
+typedef struct {
+  str name;
+  uint instructions;
+  uint memory;    // operands addressing memory
+  uint registers; // operands naming a register
+  uint immediates;
+  uint bssLoads;
+  uint bssStores;
+  uint pushes;
+  uint pops;
+  uint pushPopPairs; // a push immediately undone by a pop
+  uint calls;
+  uint syscalls;
+  uint branches;
+  MnemonicCount mnemonics[CODESTATS_MAX_MNEMONICS];
+  uint nmnemonics;
+} FunctionStats;
+
+typedef struct {
+  FunctionStats *functions;
+  uint nfunctions;
+  uint capacity;
+  bool afterPush;
+} CodeStats;
+
+const str REGISTERS[] = {
+    "rax", "rbx", "rcx", "rdx", "rsi", "rdi", "rbp",  "rsp", "r8",  "r9",
+    "r10", "r11", "r12", "r13", "r14", "r15", "eax",  "ebx", "ecx", "edx",
+    "esi", "edi", "al",  "bl",  "cl",  "dl",  "r8d",  "r9d", NULL,
+};
+
+bool isRegisterName(str operand) {
+  for (uint i = 0; REGISTERS[i] != NULL; i++)
+    if (strcmp(REGISTERS[i], operand) == 0)
+      return true;
+  return false;
+}
+
+/**
+ * @brief Whether an assembly line is a label, global ones start a function
+ */
+bool isAsmLabel(str line, bool *global) {
+  uint len = strlen(line);
+  if (len == 0 || line[len - 1] != ':' || strchr(line, ' ') != NULL)
+    return false;
+  *global = line[0] != '.';
+  return true;
+}
+
+bool isAsmInstruction(str line) {
+  bool global;
+  return line[0] != '\0' && line[0] != ';' && !isAsmLabel(line, &global) &&
+         strncmp(line, "global ", 7) != 0 && strncmp(line, "section ", 8) != 0;
+}
+
+FunctionStats *beginFunctionStats(CodeStats *stats, str name) {
+  if (stats->nfunctions == stats->capacity) {
+    stats->capacity = stats->capacity ? 2 * stats->capacity : 16;
+    stats->functions =
+        realloc(stats->functions, stats->capacity * sizeof(FunctionStats));
+  }
+
+  FunctionStats *function = &stats->functions[stats->nfunctions++];
+  *function = (FunctionStats){.name = name};
+  stats->afterPush = false;
+  return function;
+}
+
+void countMnemonic(FunctionStats *function, str mnemonic, uint count) {
+  for (uint i = 0; i < function->nmnemonics; i++)
+    if (strcmp(function->mnemonics[i].name, mnemonic) == 0) {
+      function->mnemonics[i].count += count;
+      return;
+    }
+
+  if (function->nmnemonics == CODESTATS_MAX_MNEMONICS)
+    return;
+
+  MnemonicCount *entry = &function->mnemonics[function->nmnemonics++];
+  snprintf(entry->name, sizeof(entry->name), "%s", mnemonic);
+  entry->count = count;
+}
+
+/**
+ * @brief Count a single instruction
+ *
+ * @return uint Its cost: one, plus one for each memory operand
+ */
+uint countInstruction(CodeStats *stats, FunctionStats *function, str line) {
+  char mnemonic[16];
+  uint split = strcspn(line, " ");
+  snprintf(mnemonic, sizeof(mnemonic), "%.*s", split, line);
+
+  uint cost = 1;
+  function->instructions++;
+  countMnemonic(function, mnemonic, 1);
+
+  bool push = strcmp(mnemonic, "push") == 0;
+  bool pop = strcmp(mnemonic, "pop") == 0;
+  bool store = pop || strcmp(mnemonic, "mov") == 0;
+
+  function->pushes += push;
+  function->pops += pop;
+  if (pop && stats->afterPush)
+    function->pushPopPairs++;
+  stats->afterPush = push;
+
+  if (strcmp(mnemonic, "call") == 0)
+    function->calls++;
+  else if (strcmp(mnemonic, "syscall") == 0)
+    function->syscalls++;
+  else if (mnemonic[0] == 'j')
+    function->branches++;
+
+  // Walk the comma separated operands
+  str operands = &line[split];
+  for (uint index = 0;; index++) {
+    while (*operands == ' ' || *operands == ',')
+      operands++;
+    if (*operands == '\0')
+      break;
+
+    uint len = strcspn(operands, ",");
+    char operand[128];
+    snprintf(operand, sizeof(operand), "%.*s", len, operands);
+    operands = &operands[len];
+
+    if (strchr(operand, '[') != NULL) {
+      function->memory++;
+      cost++;
+      if (strstr(operand, "[_var_") != NULL) {
+        if (index == 0 && store)
+          function->bssStores++;
+        else
+          function->bssLoads++;
+      }
+      continue;
+    }
+
+    // Drop size specifiers like qword
+    str value = strrchr(operand, ' ');
+    value = value != NULL ? &value[1] : operand;
+    if (isRegisterName(value))
+      function->registers++;
+    else
+      function->immediates++;
+  }
+
+  return cost;
+}
+
+/**
+ * @brief Count every instruction of a section, per function
+ */
+void collectCodeStats(CodeStats *stats, str code) {
+  FunctionStats *function = NULL;
+
+  str cursor = code;
+  while (*cursor != '\0') {
+    uint len = strcspn(cursor, "\n");
+    char line[len + 1];
+    memcpy(line, cursor, len);
+    line[len] = '\0';
+    cursor = cursor[len] == '\n' ? &cursor[len + 1] : &cursor[len];
+
+    bool global;
+    if (isAsmLabel(line, &global)) {
+      if (global)
+        function = beginFunctionStats(stats, fstr("%.*s", len - 1, line));
+    } else if (function != NULL && isAsmInstruction(line))
+      countInstruction(stats, function, line);
+  }
+}
+
+void addFunctionStats(FunctionStats *total, FunctionStats *f) {
+  total->instructions += f->instructions;
+  total->memory += f->memory;
+  total->registers += f->registers;
+  total->immediates += f->immediates;
+  total->bssLoads += f->bssLoads;
+  total->bssStores += f->bssStores;
+  total->pushes += f->pushes;
+  total->pops += f->pops;
+  total->pushPopPairs += f->pushPopPairs;
+  total->calls += f->calls;
+  total->syscalls += f->syscalls;
+  total->branches += f->branches;
+  for (uint m = 0; m < f->nmnemonics; m++)
+    countMnemonic(total, f->mnemonics[m].name, f->mnemonics[m].count);
+}
+
+void printFunctionStats(FunctionStats *f, FILE *out) {
+  fprintf(out, "%-20s %6u %5u %5u %5u %6u %6u %5u %5u %5u %5u %5u %5u\n",
+          f->name, f->instructions, f->memory, f->registers, f->immediates,
+          f->bssLoads, f->bssStores, f->pushes, f->pops, f->pushPopPairs,
+          f->calls, f->syscalls, f->branches);
+
+  fprintf(out, "%-20s", "");
+  for (uint m = 0; m < f->nmnemonics; m++)
+    fprintf(out, " %s:%u", f->mnemonics[m].name, f->mnemonics[m].count);
+  fprintf(out, "\n");
+}
+
+/**
+ * @brief Print the -emit-stats table, one row and mnemonic mix per function
+ */
+void printCodeStats(CodeStats *stats, FILE *out) {
+  fprintf(out, "\n%-20s %6s %5s %5s %5s %6s %6s %5s %5s %5s %5s %5s %5s\n",
+          "Function", "instr", "mem", "reg", "imm", "bss-ld", "bss-st", "push",
+          "pop", "pairs", "call", "sys", "jmp");
+
+  FunctionStats total = {.name = "total"};
+  for (uint i = 0; i < stats->nfunctions; i++) {
+    printFunctionStats(&stats->functions[i], out);
+    addFunctionStats(&total, &stats->functions[i]);
+  }
+  printFunctionStats(&total, out);
+}
+
+/**
+ * @brief Write the statistics as JSON, for -emit-stats=FILE
+ */
+void writeCodeStatsJson(CodeStats *stats, str filename) {
+  FILE *out = fopen(filename, "w");
+  if (out == NULL)
+    CompilerError(fstr("Couldn't open file \"%s\"", filename));
+
+  fprintf(out, "{\n  \"functions\": [\n");
+  for (uint i = 0; i < stats->nfunctions; i++) {
+    FunctionStats *f = &stats->functions[i];
+    fprintf(out,
+            "    {\"name\": \"%s\", \"instructions\": %u, \"memory\": %u, "
+            "\"registers\": %u, \"immediates\": %u, \"bss_loads\": %u, "
+            "\"bss_stores\": %u, \"pushes\": %u, \"pops\": %u, "
+            "\"push_pop_pairs\": %u, \"calls\": %u, \"syscalls\": %u, "
+            "\"branches\": %u, \"mnemonics\": {",
+            f->name, f->instructions, f->memory, f->registers, f->immediates,
+            f->bssLoads, f->bssStores, f->pushes, f->pops, f->pushPopPairs,
+            f->calls, f->syscalls, f->branches);
+    for (uint m = 0; m < f->nmnemonics; m++)
+      fprintf(out, "%s\"%s\": %u", m ? ", " : "", f->mnemonics[m].name,
+              f->mnemonics[m].count);
+    fprintf(out, "}}%s\n", i + 1 < stats->nfunctions ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+
+  fclose(out);
+}
+
+// --------------------------
+// Annotated Assembly -------
+
+typedef struct {
+  str name;
+  str *lines;
+  uint nlines;
+} SourceModule;
+
+SourceModule __SOURCES__[CODESTATS_MAX_MODULES];
+uint __N_SOURCES__;
+
+/**
+ * @brief Text of a source line, read once per module
+ */
+str sourceLine(str module, uint line) {
+  SourceModule *source = NULL;
+  for (uint i = 0; i < __N_SOURCES__; i++)
+    if (strcmp(__SOURCES__[i].name, module) == 0)
+      source = &__SOURCES__[i];
+
+  if (source == NULL) {
+    if (__N_SOURCES__ == CODESTATS_MAX_MODULES)
+      return "";
+
+    source = &__SOURCES__[__N_SOURCES__++];
+    *source = (SourceModule){.name = module};
+
+    str buffer;
+    uint size;
+    readTargetFile(module, &buffer, &size);
+
+    source->lines = malloc((size + 1) * sizeof(str));
+    str start = buffer;
+    for (uint i = 0; i <= size; i++)
+      if (i == size || buffer[i] == LF) {
+        source->lines[source->nlines++] = fstr("%.*s", &buffer[i] - start,
+                                               start);
+        start = &buffer[i + 1];
+      }
+  }
+
+  if (line == 0 || line > source->nlines)
+    return "";
+  return source->lines[line - 1];
+}
+
+/**
+ * @brief Write a section for nasm, turning each "; module:line" marker left
+ * by codegen into a %line directive. Code before the first marker keeps its
+ * own line in the assembly file.
+ *
+ * @param lines Lines written to out so far, counted on past the section
+ */
+void writeLineTable(FILE *out, str code, uint len, str asmFile, uint *lines) {
+  fprintf(out, "%%line %u+1 %s\n", *lines + 2, asmFile);
+  ++*lines;
+
+  str cursor = code, end = &code[len];
+  while (cursor < end) {
+    uint length = strcspn(cursor, "\n");
+    if (&cursor[length] > end)
+      length = end - cursor;
+
+    char module[length + 1];
+    uint line;
+    if (sscanf(cursor, "; %[^:\n]:%u", module, &line) == 2)
+      fprintf(out, "%%line %u+0 %s\n", line, module);
+    else
+      fprintf(out, "%.*s\n", length, cursor);
+    ++*lines;
+    cursor = &cursor[length + 1];
+  }
+}
+
+/**
+ * @brief Write a section, replacing each "; module:line" marker left by
+ * codegen with the source line and the cost of the code emitted for it
+ */
+void annotateSection(FILE *out, str code) {
+  CodeStats scratch = {};
+  FunctionStats function = {};
+
+  str cursor = code;
+  while (*cursor != '\0') {
+    uint len = strcspn(cursor, "\n");
+    str next = cursor[len] == '\n' ? &cursor[len + 1] : &cursor[len];
+
+    char module[len + 1];
+    uint line;
+    if (sscanf(cursor, "; %[^:\n]:%u", module, &line) != 2) {
+      fprintf(out, "%.*s\n", len, cursor);
+      cursor = next;
+      continue;
+    }
+
+    // Cost of everything up to the next marker
+    uint cost = 0, instructions = 0;
+    for (str scan = next; *scan != '\0' && *scan != ';';) {
+      uint slen = strcspn(scan, "\n");
+      char text[slen + 1];
+      memcpy(text, scan, slen);
+      text[slen] = '\0';
+
+      if (isAsmInstruction(text)) {
+        cost += countInstruction(&scratch, &function, text);
+        instructions++;
+      }
+      scan = scan[slen] == '\n' ? &scan[slen + 1] : &scan[slen];
+    }
+
+    str source = sourceLine(module, line);
+    while (isspace(*source))
+      source++;
+    fprintf(out, "; %s:%u %-48s ; %u instr, cost %u\n", module, line, source,
+            instructions, cost);
+    cursor = next;
+  }
+}
+
+#endif
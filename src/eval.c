@@ -0,0 +1,551 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser.c"
+#include "utils.c"
+
+#ifndef EVAL_C_INCLUDED
+#define EVAL_C_INCLUDED
+// --------------------------
+// Compile-time Evaluation --
+
+// Limits keeping a single evaluation bounded at compile time
+#define EVAL_MAX_STEPS 1000000
+#define EVAL_MAX_DEPTH 64
+#define EVAL_MAX_SLOTS 256
+#define EVAL_MAX_LOCALS 64
+
+typedef struct {
+  Name name;
+  __int64_t value;
+} EvalSlot;
+
+typedef struct {
+  Token *procedure;
+  Name locals[EVAL_MAX_LOCALS];
+  uint nlocals;
+} EvalFrame;
+
+typedef struct {
+  // Variables live in one flat table, like they do in .bss
+  EvalSlot slots[EVAL_MAX_SLOTS];
+  uint nslots;
+  uint steps;
+  uint depth;
+
+  // Literal each constant global holds, by symbol, NULL to read none
+  Token **constants;
+} EvalState;
+
+bool evalExpression(EvalState *state, EvalFrame *frame, Token **cursor,
+                    __int64_t *value);
+
+/**
+ * @brief Find the declaration of a procedure anywhere in the stream
+ */
+Token *evalFindProcedure(Token *from, Name name) {
+  while (from->prev != NULL)
+    from = from->prev;
+
+  for (; from != NULL; from = from->next)
+    if (from->type == ProcedureToken && sameName(from->value.__f.name, name))
+      return from;
+
+  return NULL;
+}
+
+/**
+ * @brief Collect the parameters and locals a procedure may touch
+ */
+bool evalCollectLocals(EvalFrame *frame, Token *procedure) {
+  frame->procedure = procedure;
+  frame->nlocals = 0;
+
+  uint depth = 0;
+  Token *token = procedure->next;
+  while (token != NULL) {
+    if (token->type == KeywordToken) {
+      if (isBlockKeyword(token->value.__k))
+        depth++;
+      else if (token->value.__k == END && depth-- == 0)
+        return true;
+    } else if (token->type == DeclarationToken) {
+      // Values are evaluated as single ints
+      if (frame->nlocals == EVAL_MAX_LOCALS ||
+          token->value.__i.type == FloatValue || token->value.__i.length > 0)
+        return false;
+      frame->locals[frame->nlocals++] = token->value.__i.name;
+    }
+    token = token->next;
+  }
+
+  return false;
+}
+
+bool evalIsLocal(EvalFrame *frame, Name name) {
+  for (uint i = 0; i < frame->nlocals; i++)
+    if (sameName(frame->locals[i], name))
+      return true;
+  return false;
+}
+
+EvalSlot *evalSlot(EvalState *state, Name name, bool create) {
+  for (uint i = 0; i < state->nslots; i++)
+    if (sameName(state->slots[i].name, name))
+      return &state->slots[i];
+
+  if (!create || state->nslots == EVAL_MAX_SLOTS)
+    return NULL;
+
+  EvalSlot *slot = &state->slots[state->nslots++];
+  slot->name = name;
+  slot->value = 0;
+  return slot;
+}
+
+/**
+ * @brief Step over a block, stopping at the ELIF, ELSE or END closing it
+ */
+Token *evalSkipBlock(Token *token) {
+  uint depth = 0;
+  while (token != NULL) {
+    if (token->type == KeywordToken) {
+      Keyword key = token->value.__k;
+      if (isBlockKeyword(key))
+        depth++;
+      else if (depth == 0 && (key == ELIF || key == ELSE || key == END))
+        return token;
+      else if (key == END)
+        depth--;
+    }
+    token = token->next;
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Literal a read of a global sees, NULL unless it is constant there
+ */
+Token *evalConstantGlobal(EvalState *state, Token *read) {
+  Name name = read->value.__i.name;
+  if (state->constants == NULL || name.kind != GlobalName)
+    return NULL;
+  return state->constants[name.symbol];
+}
+
+bool evalIsKeyword(Token *token, Keyword key) {
+  return token != NULL && token->type == KeywordToken && token->value.__k == key;
+}
+
+/**
+ * @brief Run statements until the ELIF, ELSE or END closing the block
+ *
+ * @param cursor Advanced to the closing keyword
+ * @param returned Set when a return statement was executed
+ */
+bool evalBlock(EvalState *state, EvalFrame *frame, Token **cursor,
+               bool *returned, __int64_t *value) {
+  while (*cursor != NULL) {
+    Token *token = *cursor;
+    if (++state->steps > EVAL_MAX_STEPS)
+      return false;
+
+    switch (token->type) {
+    case KeywordToken: {
+      switch (token->value.__k) {
+      case END:
+      case ELIF:
+      case ELSE:
+        return true;
+
+      case RETURN: {
+        *cursor = token->next;
+        *returned = true;
+        *value = 0;
+        if ((*cursor)->type == KeywordToken)
+          return true;
+        return evalExpression(state, frame, cursor, value);
+      }
+
+      case IF: {
+        Token *branch = token;
+        bool taken = false;
+
+        // Walk the IF / ELIF / ELSE chain until a branch is taken
+        while (!evalIsKeyword(branch, END)) {
+          Token *body = branch->next;
+          __int64_t condition = 1;
+
+          if (taken) {
+            body = evalSkipBlock(body);
+          } else {
+            if (!evalIsKeyword(branch, ELSE)) {
+              if (!evalExpression(state, frame, &body, &condition))
+                return false;
+              if (!evalIsKeyword(body, THEN))
+                return false;
+              body = body->next;
+            }
+
+            if (condition) {
+              taken = true;
+              if (!evalBlock(state, frame, &body, returned, value))
+                return false;
+              if (*returned)
+                return true;
+            } else
+              body = evalSkipBlock(body);
+          }
+
+          if (body == NULL)
+            return false;
+          branch = body;
+        }
+
+        *cursor = branch->next;
+        break;
+      }
+
+      case WHILE: {
+        Token *body;
+        while (true) {
+          __int64_t condition;
+          body = token->next;
+          if (!evalExpression(state, frame, &body, &condition))
+            return false;
+          if (!evalIsKeyword(body, DO))
+            return false;
+          body = body->next;
+
+          if (!condition)
+            break;
+          if (!evalBlock(state, frame, &body, returned, value))
+            return false;
+          if (*returned)
+            return true;
+          if (!evalIsKeyword(body, END))
+            return false;
+        }
+
+        body = evalSkipBlock(body);
+        if (!evalIsKeyword(body, END))
+          return false;
+        *cursor = body->next;
+        break;
+      }
+
+      default:
+        // Syscalls, macros and anything else with effects are not folded
+        return false;
+      }
+      break;
+    }
+
+    case DeclarationToken:
+      *cursor = token->next;
+      break;
+
+    case OperatorToken:
+    case LiteralToken:
+    case IdentifierToken: {
+      __int64_t discard;
+      if (!evalExpression(state, frame, cursor, &discard))
+        return false;
+      break;
+    }
+
+    default:
+      return false;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * @brief Evaluate a call to a procedure with known arguments
+ */
+bool evalCall(EvalState *state, Token *procedure, __int64_t *args,
+              __int64_t *value) {
+  if (++state->depth > EVAL_MAX_DEPTH)
+    return false;
+
+  EvalFrame frame;
+  if (!evalCollectLocals(&frame, procedure))
+    return false;
+
+  Token *param = procedure->next;
+  for (uint i = 0; i < procedure->value.__f.nargs; i++) {
+    EvalSlot *slot = evalSlot(state, param->value.__i.name, true);
+    if (slot == NULL)
+      return false;
+    slot->value = args[i];
+    param = param->next;
+  }
+
+  bool returned = false;
+  *value = 0;
+  if (!evalBlock(state, &frame, &param, &returned, value))
+    return false;
+
+  state->depth--;
+  return true;
+}
+
+/**
+ * @brief Whether a procedure is the runtime's strlen
+ */
+bool isStringLength(Token *procedure) {
+  Function fn = procedure->value.__f;
+  return fn.runtime && fn.nargs == 1 &&
+         strcmp(symbolText(fn.name.symbol), "strlen") == 0;
+}
+
+/**
+ * @brief Length of a string literal, or of a constant global holding one,
+ * as the parser measured it
+ *
+ * @param cursor Advanced past the argument
+ */
+bool evalStringLength(EvalState *state, Token **cursor, __int64_t *value) {
+  Token *arg = *cursor;
+  if (arg == NULL)
+    return false;
+  *cursor = arg->next;
+
+  if (arg->type == IdentifierToken)
+    arg = evalConstantGlobal(state, arg);
+  if (arg == NULL || arg->type != LiteralToken ||
+      arg->value.__l.type != StringValue)
+    return false;
+
+  *value = arg->value.__l.msize;
+  return true;
+}
+
+/**
+ * @brief Evaluate the expression starting at cursor
+ * Only reads and writes of the current procedure's own variables are
+ * allowed, anything else makes the expression non-constant.
+ *
+ * @param cursor Advanced past the expression
+ */
+bool evalExpression(EvalState *state, EvalFrame *frame, Token **cursor,
+                    __int64_t *value) {
+  Token *token = *cursor;
+  if (token == NULL || ++state->steps > EVAL_MAX_STEPS)
+    return false;
+  *cursor = token->next;
+
+  switch (token->type) {
+  case LiteralToken: {
+    if (token->value.__l.type == IntValue)
+      *value = token->value.__l.value.__i;
+    else if (token->value.__l.type == NullValue)
+      *value = 0;
+    else
+      return false;
+    return true;
+  }
+
+  case DeclarationToken:
+  case IdentifierToken: {
+    if (frame == NULL || !evalIsLocal(frame, token->value.__i.name)) {
+      Token *constant = evalConstantGlobal(state, token);
+      if (constant == NULL || constant->value.__l.type == StringValue)
+        return false;
+      *value = constant->value.__l.value.__i;
+      return true;
+    }
+
+    // Reading a variable before writing it depends on earlier runs
+    EvalSlot *slot = evalSlot(state, token->value.__i.name, false);
+    if (slot == NULL)
+      return false;
+    *value = slot->value;
+    return true;
+  }
+
+  case OperatorToken:
+    break;
+
+  default:
+    return false;
+  }
+
+  Operator op = token->value.__o;
+  if (op == ASSIGN) {
+    Token *dest = *cursor;
+    if (dest->type != DeclarationToken && dest->type != IdentifierToken)
+      return false;
+    if (frame == NULL || !evalIsLocal(frame, dest->value.__i.name))
+      return false;
+
+    *cursor = dest->next;
+    if (!evalExpression(state, frame, cursor, value))
+      return false;
+
+    EvalSlot *slot = evalSlot(state, dest->value.__i.name, true);
+    if (slot == NULL)
+      return false;
+    slot->value = *value;
+    return true;
+  }
+
+  if (op == CALL) {
+    Token *callee = *cursor;
+    if (callee->type != IdentifierToken)
+      return false;
+
+    Token *procedure = evalFindProcedure(callee, callee->value.__f.name);
+    *cursor = callee->next;
+    if (procedure != NULL && isStringLength(procedure))
+      return evalStringLength(state, cursor, value);
+    if (procedure == NULL || procedure->value.__f.runtime ||
+        procedure->value.__f.type == FloatValue)
+      return false;
+
+    uint nargs = procedure->value.__f.nargs;
+    __int64_t args[nargs + 1];
+    for (uint i = 0; i < nargs; i++)
+      if (!evalExpression(state, frame, cursor, &args[i]))
+        return false;
+
+    return evalCall(state, procedure, args, value);
+  }
+
+  __int64_t lhs, rhs;
+  if (!evalExpression(state, frame, cursor, &lhs))
+    return false;
+  if (!evalExpression(state, frame, cursor, &rhs))
+    return false;
+
+  switch (op) {
+  case ADD: *value = lhs + rhs; break;
+  case SUB: *value = lhs - rhs; break;
+  case MUL: *value = lhs * rhs; break;
+  case DIV:
+    if (rhs == 0)
+      return false;
+    *value = lhs / rhs;
+    break;
+  case MOD:
+    if (rhs == 0)
+      return false;
+    *value = lhs % rhs;
+    break;
+
+  case BIT_AND: *value = lhs & rhs; break;
+  case BIT_OR: *value = lhs | rhs; break;
+  case BIT_XOR: *value = lhs ^ rhs; break;
+  case BIT_SHIFT_LEFT: *value = lhs << (rhs & 63); break;
+  case BIT_SHIFT_RIGHT: *value = lhs >> (rhs & 63); break;
+
+  case LOGICAL_GREATER_THAN: *value = lhs > rhs; break;
+  case LOGICAL_LESS_THAN: *value = lhs < rhs; break;
+  case LOGICAL_EQUAL: *value = lhs == rhs; break;
+  case LOGICAL_NOT_EQUAL: *value = lhs != rhs; break;
+  case LOGICAL_AND: *value = lhs && rhs; break;
+  case LOGICAL_OR: *value = lhs || rhs; break;
+  case LOGICAL_XOR: *value = !lhs != !rhs; break;
+
+  default:
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Replace a call with the value it returns, if it can be evaluated
+ */
+void foldConstantCall(Token *token, Token **constants) {
+  EvalState state = {.constants = constants};
+  Token *end = token;
+  __int64_t value;
+
+  if (evalExpression(&state, NULL, &end, &value) && value == (int)value) {
+    token->type = LiteralToken;
+    token->value.__l = (Literal){
+        .type = IntValue,
+        .value = (LiteralValue)(int)value,
+        .msize = sizeof(__int64_t),
+    };
+
+    token->next = end;
+    if (end != NULL)
+      end->prev = token;
+  }
+}
+
+bool isCall(Token *token) {
+  return token != NULL && token->type == OperatorToken &&
+         token->value.__o == CALL;
+}
+
+/**
+ * @brief Global an assignment writes, NULL if it writes something else
+ */
+Token *assignedGlobal(Token *token) {
+  if (token->type != OperatorToken || token->value.__o != ASSIGN)
+    return NULL;
+
+  Token *dest = token->next;
+  if (dest->type != DeclarationToken && dest->type != IdentifierToken)
+    return NULL;
+  if (dest->value.__i.name.kind != GlobalName || dest->value.__i.length > 0)
+    return NULL;
+  return dest;
+}
+
+/**
+ * @brief Replace calls to side-effect free procedures on constant arguments
+ * with the value they return. Runs after procedure signatures are resolved.
+ * A global assigned only once, to a literal, by top-level code outside of
+ * every block, is constant everywhere after that assignment.
+ */
+void foldConstantCalls(TokenStream _stream_head) {
+  uint nsymbols = __N_SYMBOLS__ + 1;
+  uint *writes = calloc(nsymbols, sizeof(uint));
+  Token **constants = calloc(nsymbols, sizeof(Token *));
+
+  for (Token *token = _stream_head; token != NULL; token = token->next) {
+    Token *dest = assignedGlobal(token);
+    if (dest != NULL)
+      writes[dest->value.__i.name.symbol]++;
+  }
+
+  uint depth = 0;
+  Token *token = _stream_head;
+  while (token != NULL) {
+    if (token->type == ProcedureToken ||
+        (token->type == KeywordToken &&
+         (isBlockKeyword(token->value.__k) || token->value.__k == SYSCALL)))
+      depth++;
+    else if (token->type == KeywordToken && token->value.__k == END)
+      depth--;
+
+    Token *dest = assignedGlobal(token);
+    if (dest != NULL && depth == 0 &&
+        writes[dest->value.__i.name.symbol] == 1) {
+      // Fold the value first, so constants build on each other
+      if (isCall(dest->next))
+        foldConstantCall(dest->next, constants);
+      if (dest->next->type == LiteralToken &&
+          dest->next->value.__l.type != FloatValue)
+        constants[dest->value.__i.name.symbol] = dest->next;
+    }
+
+    if (isCall(token))
+      foldConstantCall(token, constants);
+    token = token->next;
+  }
+
+  free(writes);
+  free(constants);
+}
+
+#endif
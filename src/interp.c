@@ -0,0 +1,667 @@
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "codegen.c"
+#include "jit.c"
+#include "parser.c"
+#include "runtime.c"
+#include "utils.c"
+
+#ifndef INTERP_C_INCLUDED
+#define INTERP_C_INCLUDED
+// --------------------------
+// Bytecode Interpreter -----
+//
+// Compiles the token stream into direct-threaded bytecode for -interp and
+// runs it in place of the native backend. Variables live in one flat table
+// like they do in .bss, procedures take their arguments off the operand
+// stack the same way their native prologue does, and runtime procedures are
+// served by the host routines -run uses.
+
+#define INTERP_STACK_SIZE (1 << 20)
+#define INTERP_CALL_DEPTH (1 << 20)
+#define INTERP_STACK_SLACK 1024 // operands a single body may push
+
+typedef enum {
+  OP_PUSH,  // value
+  OP_LOAD,  // slot
+  OP_STORE, // slot
+  OP_POP,
+
+  // Binary operations take the left operand from the top of the stack
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_MOD,
+  OP_AND,
+  OP_OR,
+  OP_XOR,
+  OP_SHL,
+  OP_SAR,
+  OP_GT,
+  OP_LT,
+  OP_EQ,
+  OP_NE,
+  OP_LAND,
+  OP_LOR,
+
+  OP_JMP,     // target
+  OP_JZ,      // target
+  OP_CALL,    // target
+  OP_RET,
+  OP_HOST,    // function, nargs
+  OP_SYSCALL, // nargs, the number included
+  OP_FLUSH,
+  __OP_COUNT,
+} Opcode;
+
+const uint OP_OPERANDS[__OP_COUNT] = {
+    [OP_PUSH] = 1, [OP_LOAD] = 1,    [OP_STORE] = 1,   [OP_JMP] = 1,
+    [OP_JZ] = 1,   [OP_CALL] = 1,    [OP_HOST] = 2,    [OP_SYSCALL] = 1,
+};
+
+// One word of threaded code: a handler address or an operand
+typedef union {
+  void *handler;
+  int64_t value;
+} InterpWord;
+
+typedef struct {
+  Token *procedure;
+  uint entry; // pops the arguments into the parameters
+  uint body;  // tail calls jump here with the parameters set
+} InterpProcedure;
+
+typedef struct {
+  InterpWord *code;
+  uint size;
+  uint capacity;
+
+  // Variable name -> slot, open addressing
+  Name *names;
+  uint nameCapacity;
+  uint nslots;
+
+  InterpProcedure *procedures;
+  uint nprocedures;
+
+  bool inProcedure;
+} InterpCompiler;
+
+uint interpEmit(InterpCompiler *c, int64_t value) {
+  if (c->size == c->capacity) {
+    c->capacity = c->capacity ? 2 * c->capacity : 1024;
+    c->code = realloc(c->code, c->capacity * sizeof(InterpWord));
+  }
+  c->code[c->size].value = value;
+  return c->size++;
+}
+
+uint interpOp(InterpCompiler *c, Opcode op, int64_t operand) {
+  uint at = interpEmit(c, op);
+  if (OP_OPERANDS[op] > 0)
+    interpEmit(c, operand);
+  return at;
+}
+
+/**
+ * @brief Point the jump at instruction at to the current end of the code
+ */
+void interpPatch(InterpCompiler *c, uint at) {
+  c->code[at + 1].value = c->size;
+}
+
+uint interpHash(Name name) {
+  return (name.symbol * 2654435761u) ^ (name.scope * 40503u) ^ name.kind;
+}
+
+void interpRejectFloat(Type type) {
+  if (type == FloatValue)
+    CompilerError("Float values aren't supported by -interp.");
+}
+
+void interpRejectArray(Token *token) {
+  if (isArray(token) ||
+      (token->type == OperatorToken && token->value.__o == INDEX))
+    CompilerError("Arrays aren't supported by -interp.");
+}
+
+/**
+ * @brief Slot of a variable, by its name and the scope it was declared in
+ */
+int64_t interpSlot(InterpCompiler *c, Name name) {
+  if (2 * (c->nslots + 1) > c->nameCapacity) {
+    Name *old = c->names;
+    uint oldCapacity = c->nameCapacity;
+    int64_t *oldSlots = old ? (int64_t *)&old[oldCapacity] : NULL;
+
+    c->nameCapacity = oldCapacity ? 2 * oldCapacity : 256;
+    c->names = calloc(c->nameCapacity, sizeof(Name) + sizeof(int64_t));
+    for (uint i = 0; i < oldCapacity; i++)
+      if (old[i].symbol != 0) {
+        uint mask = c->nameCapacity - 1, j = interpHash(old[i]) & mask;
+        while (c->names[j].symbol != 0)
+          j = (j + 1) & mask;
+        c->names[j] = old[i];
+        ((int64_t *)&c->names[c->nameCapacity])[j] = oldSlots[i];
+      }
+    free(old);
+  }
+
+  // Slot numbers are stored after the names
+  int64_t *slots = (int64_t *)&c->names[c->nameCapacity];
+  uint mask = c->nameCapacity - 1;
+  for (uint i = interpHash(name) & mask;; i = (i + 1) & mask) {
+    if (c->names[i].symbol == 0) {
+      c->names[i] = name;
+      return slots[i] = c->nslots++;
+    }
+    if (sameName(c->names[i], name))
+      return slots[i];
+  }
+}
+
+InterpProcedure *interpProcedure(InterpCompiler *c, Token *procedure) {
+  for (uint i = 0; i < c->nprocedures; i++)
+    if (c->procedures[i].procedure == procedure)
+      return &c->procedures[i];
+  CompilerError(fstr("Procedure \"%s\" called before its body.",
+                     symbolText(procedure->value.__f.name.symbol)));
+}
+
+bool isInterpKeyword(Token *token, Keyword key) {
+  return token != NULL && token->type == KeywordToken && token->value.__k == key;
+}
+
+Token *interpExpression(InterpCompiler *c, Token *token);
+
+/**
+ * @brief Push arguments and call a procedure, user or runtime
+ */
+Token *interpCall(InterpCompiler *c, Token *operator) {
+  Token *callee = operator->next;
+  if (callee == NULL || callee->type != IdentifierToken)
+    CompilerError("Call to non-function");
+
+  Token *procedure = findProcedure(operator, callee->value.__f.name);
+  Function fn = procedure->value.__f;
+
+  Token *arg = callee->next;
+  for (uint i = 0; i < fn.nargs; i++)
+    arg = interpExpression(c, arg);
+
+  if (fn.runtime) {
+    interpRejectFloat(fn.type);
+    RuntimeRoutine *routine = findRuntimeRoutine(symbolText(fn.name.symbol));
+    interpEmit(c, OP_HOST);
+    interpEmit(c, (int64_t)jitHostAddress(routine->call));
+    interpEmit(c, fn.nargs);
+  } else
+    interpOp(c, OP_CALL, interpProcedure(c, procedure)->entry);
+
+  return arg;
+}
+
+/**
+ * @brief Compile the expression at token, leaving its value on the stack
+ * Operands that are operations run before the atoms are read, in the order
+ * the native backend resolves them.
+ *
+ * @return Token* The token after the expression
+ */
+Token *interpExpression(InterpCompiler *c, Token *token) {
+  if (token == NULL)
+    CompilerError("Expected an expression.");
+
+  switch (token->type) {
+  case LiteralToken: {
+    Literal literal = token->value.__l;
+    if (literal.type == IntValue)
+      interpOp(c, OP_PUSH, literal.value.__i);
+    else if (literal.type == NullValue)
+      interpOp(c, OP_PUSH, 0);
+    else if (literal.type == StringValue)
+      interpOp(c, OP_PUSH,
+               (int64_t)__STRING_LITERALS__[atoi(
+                   &symbolText(literal.value.__s)[strlen("str")])]);
+    else
+      CompilerError("Float values aren't supported by -interp.");
+    return token->next;
+  }
+
+  case DeclarationToken:
+  case IdentifierToken:
+    interpRejectArray(token);
+    interpRejectFloat(token->value.__i.type);
+    interpOp(c, OP_LOAD, interpSlot(c, token->value.__i.name));
+    return token->next;
+
+  case OperatorToken:
+    break;
+
+  default:
+    CompilerError(fstr("Invalid operand of type %s.", strTokenType(token->type)));
+  }
+
+  Operator op = token->value.__o;
+  interpRejectArray(token);
+  if (op == CALL)
+    return interpCall(c, token);
+  if (op == BIT_NOT) // like codegen, a copy of its operand
+    return interpExpression(c, token->next);
+  if (!isBinaryOperator(op) || op == ASSIGN)
+    CompilerError(fstr("Operator %d can't be used as a value.", op));
+
+  // Right operand first, the left one ends up on top
+  Token *lhs = token->next;
+  if (lhs == NULL || !isTokenOperable(lhs))
+    CompilerError("Expected a value left of the operator.");
+  Token *next = interpExpression(c, lhs->next);
+  interpExpression(c, lhs);
+
+  switch (op) {
+  case ADD: interpOp(c, OP_ADD, 0); break;
+  case SUB: interpOp(c, OP_SUB, 0); break;
+  case MUL: interpOp(c, OP_MUL, 0); break;
+  case DIV: interpOp(c, OP_DIV, 0); break;
+  case MOD: interpOp(c, OP_MOD, 0); break;
+  case BIT_AND: interpOp(c, OP_AND, 0); break;
+  case BIT_OR: interpOp(c, OP_OR, 0); break;
+  case BIT_XOR: interpOp(c, OP_XOR, 0); break;
+  case BIT_SHIFT_LEFT: interpOp(c, OP_SHL, 0); break;
+  case BIT_SHIFT_RIGHT: interpOp(c, OP_SAR, 0); break;
+  case LOGICAL_GREATER_THAN: interpOp(c, OP_GT, 0); break;
+  case LOGICAL_LESS_THAN: interpOp(c, OP_LT, 0); break;
+  case LOGICAL_EQUAL: interpOp(c, OP_EQ, 0); break;
+  case LOGICAL_NOT_EQUAL: interpOp(c, OP_NE, 0); break;
+  case LOGICAL_AND: interpOp(c, OP_LAND, 0); break;
+  case LOGICAL_OR: interpOp(c, OP_LOR, 0); break;
+  default:
+    CompilerError(fstr("Operator %d isn't supported by -interp.", op));
+  }
+
+  return next;
+}
+
+/**
+ * @brief Compile the condition at token and the jump taken when it's false
+ *
+ * @param jump Set to the jump, to be patched
+ * @return Token* The token after the closing THEN or DO
+ */
+Token *interpCondition(InterpCompiler *c, Token *token, Keyword closer,
+                       uint *jump) {
+  token = interpExpression(c, token);
+  if (!isInterpKeyword(token, closer))
+    CompilerError(fstr("Expected \"%s\" after condition.",
+                       closer == THEN ? "then" : "do"));
+
+  *jump = interpOp(c, OP_JZ, 0);
+  return token->next;
+}
+
+Token *interpBlock(InterpCompiler *c, Token *token);
+
+/**
+ * @brief Compile a procedure body, jumped over by the code around it
+ */
+Token *interpProcedureBody(InterpCompiler *c, Token *token) {
+  Function fn = token->value.__f;
+  Token *param = procedureParam(token, fn.nargs);
+
+  // Runtime procedures are only declarations
+  if (fn.runtime)
+    return param->next;
+  if (c->inProcedure)
+    CompilerError("Nested procedures aren't supported.");
+  interpRejectFloat(fn.type);
+  for (uint i = 0; i < fn.nargs; i++)
+    interpRejectFloat(procedureParam(token, i)->value.__i.type);
+
+  uint over = interpOp(c, OP_JMP, 0);
+  c->procedures = realloc(c->procedures,
+                          (c->nprocedures + 1) * sizeof(InterpProcedure));
+  InterpProcedure *procedure = &c->procedures[c->nprocedures++];
+  procedure->procedure = token;
+  procedure->entry = c->size;
+
+  // Arguments were pushed in order, so the last one is on top
+  for (uint i = fn.nargs; i > 0; i--)
+    interpOp(c, OP_STORE,
+             interpSlot(c, procedureParam(token, i - 1)->value.__i.name));
+  procedure->body = c->size;
+
+  c->inProcedure = true;
+  Token *end = interpBlock(c, param);
+  if (!isInterpKeyword(end, END))
+    CompilerError(fstr("Procedure \"%s\" isn't closed.",
+                       symbolText(fn.name.symbol)));
+  c->inProcedure = false;
+
+  interpOp(c, OP_PUSH, 0);
+  interpOp(c, OP_RET, 0);
+  interpPatch(c, over);
+  return end->next;
+}
+
+Token *interpReturn(InterpCompiler *c, Token *token) {
+  if (!c->inProcedure)
+    CompilerError("Return outside of a procedure.");
+
+  // Tail calls set the parameters and jump, like the native backend
+  if (token->type == OperatorToken && token->value.__o == CALL &&
+      !hasCompilerFlag("-fno-tail-calls")) {
+    Token *procedure = findProcedure(token, token->next->value.__f.name);
+    if (!procedure->value.__f.runtime) {
+      Token *next = token->next->next;
+      for (uint i = 0; i < procedure->value.__f.nargs; i++)
+        next = interpExpression(c, next);
+
+      InterpProcedure *callee = interpProcedure(c, procedure);
+      for (uint i = procedure->value.__f.nargs; i > 0; i--)
+        interpOp(c, OP_STORE,
+                 interpSlot(c, procedureParam(procedure, i - 1)->value.__i.name));
+      interpOp(c, OP_JMP, callee->body);
+      return next;
+    }
+  }
+
+  if (token->type == KeywordToken) {
+    interpOp(c, OP_PUSH, 0);
+    interpOp(c, OP_RET, 0);
+    return token;
+  }
+
+  token = interpExpression(c, token);
+  interpOp(c, OP_RET, 0);
+  return token;
+}
+
+Token *interpSyscall(InterpCompiler *c, Token *token) {
+  if (flushesOutput(token) && isRuntimeModuleLinked("io"))
+    interpOp(c, OP_FLUSH, 0);
+
+  uint nargs = 0;
+  while (token != NULL && !isInterpKeyword(token, END)) {
+    token = interpExpression(c, token);
+    nargs++;
+  }
+
+  if (token == NULL)
+    CompilerError("Syscall isn't closed.");
+  if (nargs == 0 || nargs > 7)
+    CompilerError(fstr("Invalid argument number \"%u\" for syscall.", nargs));
+
+  interpOp(c, OP_SYSCALL, nargs);
+  return token->next;
+}
+
+Token *interpIf(InterpCompiler *c, Token *token) {
+  uint exits[MAX_CONTROL_DEPTH], nexits = 0, jump;
+  bool pending = true; // jump to the next branch still to be placed
+
+  token = interpCondition(c, token->next, THEN, &jump);
+  while (true) {
+    token = interpBlock(c, token);
+    if (token == NULL)
+      CompilerError("If isn't closed.");
+    if (token->value.__k == END)
+      break;
+
+    if (nexits == MAX_CONTROL_DEPTH)
+      CompilerError("Too many elif branches.");
+    exits[nexits++] = interpOp(c, OP_JMP, 0);
+    if (pending)
+      interpPatch(c, jump);
+
+    pending = token->value.__k == ELIF;
+    if (pending)
+      token = interpCondition(c, token->next, THEN, &jump);
+    else
+      token = token->next;
+  }
+
+  if (pending)
+    interpPatch(c, jump);
+  for (uint i = 0; i < nexits; i++)
+    interpPatch(c, exits[i]);
+  return token->next;
+}
+
+Token *interpWhile(InterpCompiler *c, Token *token) {
+  uint top = c->size, jump;
+  token = interpCondition(c, token->next, DO, &jump);
+  token = interpBlock(c, token);
+  if (!isInterpKeyword(token, END))
+    CompilerError("While isn't closed.");
+
+  interpOp(c, OP_JMP, top);
+  interpPatch(c, jump);
+  return token->next;
+}
+
+/**
+ * @brief Compile statements until the ELIF, ELSE or END closing the block
+ *
+ * @return Token* The closing keyword, NULL at the end of the stream
+ */
+Token *interpBlock(InterpCompiler *c, Token *token) {
+  while (token != NULL) {
+    switch (token->type) {
+    case KeywordToken:
+      switch (token->value.__k) {
+      case END:
+      case ELIF:
+      case ELSE:
+        return token;
+      case IF:
+        token = interpIf(c, token);
+        break;
+      case WHILE:
+        token = interpWhile(c, token);
+        break;
+      case RETURN:
+        token = interpReturn(c, token->next);
+        break;
+      case SYSCALL:
+        token = interpSyscall(c, token->next);
+        break;
+      default:
+        token = token->next;
+        break;
+      }
+      break;
+
+    case ProcedureToken:
+      token = interpProcedureBody(c, token);
+      break;
+
+    case OperatorToken:
+      if (token->value.__o == ASSIGN) {
+        Token *dest = token->next;
+        interpRejectArray(dest);
+        if (dest->type != IdentifierToken && dest->type != DeclarationToken)
+          CompilerError("Assigning to non-identifier");
+        interpRejectFloat(dest->value.__i.type);
+        token = interpExpression(c, dest->next);
+        interpOp(c, OP_STORE, interpSlot(c, dest->value.__i.name));
+      } else {
+        token = interpExpression(c, token);
+        interpOp(c, OP_POP, 0);
+      }
+      break;
+
+    // A bare value or declaration does nothing
+    default:
+      token = token->next;
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+void interpStackOverflow() {
+  jitIoFlush();
+  fprintf(stderr, "Error: -interp stack overflow.\n");
+  exit(1);
+}
+
+/**
+ * @brief Thread the bytecode and run it, dispatching with computed goto
+ * Handler addresses replace the opcodes in place before the first
+ * instruction runs.
+ */
+void interpExecute(InterpWord *code, uint size, uint nslots) {
+  static void *handlers[__OP_COUNT] = {
+      [OP_PUSH] = &&push,       [OP_LOAD] = &&load,   [OP_STORE] = &&store,
+      [OP_POP] = &&pop,         [OP_ADD] = &&add,     [OP_SUB] = &&sub,
+      [OP_MUL] = &&mul,         [OP_DIV] = &&div,     [OP_MOD] = &&mod,
+      [OP_AND] = &&and,         [OP_OR] = &&or,       [OP_XOR] = &&xor,
+      [OP_SHL] = &&shl,         [OP_SAR] = &&sar,     [OP_GT] = &&gt,
+      [OP_LT] = &&lt,           [OP_EQ] = &&eq,       [OP_NE] = &&ne,
+      [OP_LAND] = &&land,       [OP_LOR] = &&lor,     [OP_JMP] = &&jmp,
+      [OP_JZ] = &&jz,           [OP_CALL] = &&call,   [OP_RET] = &&ret,
+      [OP_HOST] = &&host,       [OP_SYSCALL] = &&sys, [OP_FLUSH] = &&flush,
+  };
+
+  for (uint pc = 0; pc < size;) {
+    Opcode op = code[pc].value;
+    code[pc].handler = handlers[op];
+
+    // Jump targets become addresses too
+    if (op == OP_JMP || op == OP_JZ || op == OP_CALL)
+      code[pc + 1].handler = &code[code[pc + 1].value];
+    pc += 1 + OP_OPERANDS[op];
+  }
+
+  int64_t *vars = calloc(nslots + 1, sizeof(int64_t));
+  int64_t *stack = malloc(INTERP_STACK_SIZE * sizeof(int64_t));
+  InterpWord **calls = malloc(INTERP_CALL_DEPTH * sizeof(InterpWord *));
+  int64_t *stackLimit = &stack[INTERP_STACK_SIZE - INTERP_STACK_SLACK];
+  InterpWord **callLimit = &calls[INTERP_CALL_DEPTH];
+
+  register InterpWord *pc = code;
+  register int64_t *sp = stack; // next free
+  InterpWord **rp = calls;
+  int64_t lhs, rhs;
+
+#define NEXT goto *(pc++)->handler
+#define BINARY(expr)                                                           \
+  lhs = *--sp;                                                                 \
+  rhs = sp[-1];                                                                \
+  sp[-1] = (expr);                                                             \
+  NEXT
+
+  NEXT;
+
+push:
+  *sp++ = (pc++)->value;
+  NEXT;
+load:
+  *sp++ = vars[(pc++)->value];
+  NEXT;
+store:
+  vars[(pc++)->value] = *--sp;
+  NEXT;
+pop:
+  sp--;
+  NEXT;
+
+add: BINARY(lhs + rhs);
+sub: BINARY(lhs - rhs);
+mul: BINARY(lhs * rhs);
+div:
+  if (sp[-2] == 0)
+    raise(SIGFPE); // like idiv
+  BINARY(lhs / rhs);
+mod:
+  if (sp[-2] == 0)
+    raise(SIGFPE);
+  BINARY(lhs % rhs);
+and: BINARY(lhs & rhs);
+or: BINARY(lhs | rhs);
+xor: BINARY(lhs ^ rhs);
+shl: BINARY(lhs << (rhs & 63));
+sar: BINARY(lhs >> (rhs & 63));
+gt: BINARY(lhs > rhs);
+lt: BINARY(lhs < rhs);
+eq: BINARY(lhs == rhs);
+ne: BINARY(lhs != rhs);
+land: BINARY(lhs != 0 && rhs != 0);
+lor: BINARY(lhs != 0 || rhs != 0);
+
+jmp:
+  pc = pc->handler;
+  NEXT;
+jz:
+  pc = *--sp == 0 ? pc->handler : pc + 1;
+  NEXT;
+call:
+  if (rp == callLimit || sp > stackLimit)
+    interpStackOverflow();
+  *rp++ = pc + 1;
+  pc = pc->handler;
+  NEXT;
+ret:
+  pc = *--rp;
+  NEXT;
+
+host: {
+  int64_t (*routine)() = pc[0].handler;
+  int64_t nargs = pc[1].value;
+  pc += 2;
+
+  sp -= nargs;
+  int64_t *args = sp;
+  *sp++ = routine(nargs > 0 ? args[0] : 0, nargs > 1 ? args[1] : 0,
+                  nargs > 2 ? args[2] : 0);
+  NEXT;
+}
+
+sys: {
+  int64_t nargs = (pc++)->value;
+  sp -= nargs;
+  int64_t a[7] = {};
+  memcpy(a, sp, nargs * sizeof(int64_t));
+  syscall(a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+  NEXT;
+}
+
+flush:
+  jitIoFlush();
+  NEXT;
+
+#undef BINARY
+#undef NEXT
+}
+
+/**
+ * @brief Compile the stream to bytecode and run it, for -interp
+ * The program leaves through its exit syscall, so this never returns.
+ */
+void interpret(TokenStream _stream_head) {
+  InterpCompiler c = {};
+
+  Token *end = interpBlock(&c, _stream_head);
+  if (end != NULL)
+    CompilerError("Unexpected \"end\", \"elif\" or \"else\".");
+
+  // Same epilogue as _start
+  if (isRuntimeModuleLinked("io"))
+    interpOp(&c, OP_FLUSH, 0);
+  interpOp(&c, OP_PUSH, SYS_EXIT);
+  interpOp(&c, OP_PUSH, 0);
+  interpOp(&c, OP_SYSCALL, 2);
+
+  jitProgramStdout();
+  interpExecute(c.code, c.size, c.nslots);
+}
+
+#endif
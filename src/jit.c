@@ -0,0 +1,1297 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "runtime.c"
+#include "utils.c"
+
+#ifndef JIT_C_INCLUDED
+#define JIT_C_INCLUDED
+// --------------------------
+// In-memory Assembler ------
+//
+// Encodes the assembly codegen produces straight into an executable
+// mapping for -run. Only the instructions and directives the code generator
+// emits are understood. Runtime routines are served by the host process.
+
+#define JIT_STACK_SIZE (8 << 20)
+#define JIT_MAX_OPERANDS 3
+
+typedef enum {
+  JitCode,
+  JitRodata,
+  JitData,
+  JitBss,
+  __JIT_SECTIONS
+} JitSectionId;
+
+typedef enum { JitRel32, JitAbs32, JitAbs64 } JitFixupKind;
+
+typedef struct {
+  uint8_t *bytes;
+  size_t size;
+  size_t capacity;
+} JitSection;
+
+typedef struct {
+  str name;
+  JitSectionId section;
+  size_t offset;
+  bool defined;
+} JitSymbol;
+
+typedef struct {
+  JitSectionId section;
+  size_t offset; // of the field to patch
+  size_t end;    // end of the instruction, for relative fixups
+  JitFixupKind kind;
+  str symbol;
+  int64_t addend;
+} JitFixup;
+
+typedef enum { JitRegister, JitMemory, JitImmediate, JitLabel } JitOperandKind;
+
+typedef struct {
+  JitOperandKind kind;
+  uint reg;  // register number, or base of a memory operand
+  uint size; // register size in bytes
+  bool base; // memory operand has a base register
+  bool indexed; // memory operand has an index register
+  uint index;
+  uint scale; // 1, 2, 4 or 8
+  str symbol;
+  int64_t value; // immediate, or memory displacement
+} JitOperand;
+
+typedef struct {
+  JitSection sections[__JIT_SECTIONS];
+  JitSectionId current;
+  str scope; // last global label, owner of .local labels
+
+  JitSymbol *symbols; // open addressing on the name
+  uint capacity;
+  uint nsymbols;
+
+  JitFixup *fixups;
+  uint nfixups;
+  uint fixupCapacity;
+} JitAssembler;
+
+typedef struct {
+  str name;
+  uint number;
+  uint size;
+} JitRegisterName;
+
+const JitRegisterName JIT_REGISTERS[] = {
+    {"rax", 0, 8},  {"rcx", 1, 8},   {"rdx", 2, 8},   {"rbx", 3, 8},
+    {"rsp", 4, 8},  {"rbp", 5, 8},   {"rsi", 6, 8},   {"rdi", 7, 8},
+    {"r8", 8, 8},   {"r9", 9, 8},    {"r10", 10, 8},  {"r11", 11, 8},
+    {"r12", 12, 8}, {"r13", 13, 8},  {"r14", 14, 8},  {"r15", 15, 8},
+    {"eax", 0, 4},  {"ecx", 1, 4},   {"edx", 2, 4},   {"ebx", 3, 4},
+    {"ebp", 5, 4},  {"esi", 6, 4},   {"edi", 7, 4},   {"r8d", 8, 4},
+    {"r9d", 9, 4},  {"r10d", 10, 4}, {"r11d", 11, 4}, {"r12d", 12, 4},
+    {"r13d", 13, 4}, {"r14d", 14, 4}, {"r15d", 15, 4}, {"al", 0, 1},
+    {"cl", 1, 1},   {"dl", 2, 1},    {"bl", 3, 1},    {"xmm0", 0, 16},
+    {"xmm1", 1, 16}, {"xmm2", 2, 16}, {"xmm3", 3, 16}, {"xmm4", 4, 16},
+    {"xmm5", 5, 16}, {"xmm6", 6, 16}, {"xmm7", 7, 16}, {"xmm8", 8, 16},
+    {"xmm9", 9, 16},
+    {"xmm10", 10, 16}, {"xmm11", 11, 16}, {"xmm12", 12, 16},
+    {"xmm13", 13, 16}, {"xmm14", 14, 16}, {"xmm15", 15, 16}, {NULL, 0, 0},
+};
+
+typedef struct {
+  str name;
+  uint code;
+} JitCondition;
+
+const JitCondition JIT_CONDITIONS[] = {
+    {"o", 0},   {"no", 1},  {"b", 2},   {"c", 2},   {"ae", 3},  {"nc", 3},
+    {"e", 4},   {"z", 4},   {"ne", 5},  {"nz", 5},  {"be", 6},  {"a", 7},
+    {"s", 8},   {"ns", 9},  {"p", 10},  {"np", 11}, {"l", 12},  {"ge", 13},
+    {"le", 14}, {"g", 15},  {NULL, 0},
+};
+
+// Arithmetic instructions sharing one encoding, by their /digit
+const JitCondition JIT_ALU[] = {
+    {"add", 0}, {"or", 1}, {"and", 4}, {"sub", 5}, {"xor", 6}, {"cmp", 7},
+    {NULL, 0},
+};
+
+// SSE2 instructions from xmm or memory into xmm, by mandatory prefix and
+// opcode after 0F
+const JitCondition JIT_SSE2[] = {
+    {"addsd", 0xF258},   {"mulsd", 0xF259},  {"subsd", 0xF25C},
+    {"divsd", 0xF25E},   {"sqrtsd", 0xF251}, {"ucomisd", 0x662E},
+    {"movapd", 0x6628},  {"xorpd", 0x6657},  {NULL, 0},
+};
+
+// --------------------------
+// Host Runtime -------------
+
+int64_t jitNothing() { return 0; }
+
+int64_t jitMemcmp(const void *a, const void *b, size_t n) {
+  return memcmp(a, b, n);
+}
+
+char __JIT_IO_BUFFER__[65536];
+size_t __JIT_IO_LENGTH__;
+
+int64_t jitIoFlush() {
+  size_t written = 0;
+  while (written < __JIT_IO_LENGTH__) {
+    ssize_t n = write(STDOUT_FILENO, &__JIT_IO_BUFFER__[written],
+                      __JIT_IO_LENGTH__ - written);
+    if (n <= 0)
+      break;
+    written += n;
+  }
+  __JIT_IO_LENGTH__ = 0;
+  return 0;
+}
+
+int64_t jitIoWrite(const char *s, int64_t n) {
+  if (__JIT_IO_LENGTH__ + n > sizeof(__JIT_IO_BUFFER__))
+    jitIoFlush();
+
+  // Too big to buffer, hand it to the kernel directly
+  if (n >= (int64_t)sizeof(__JIT_IO_BUFFER__)) {
+    while (n > 0) {
+      ssize_t written = write(STDOUT_FILENO, s, n);
+      if (written <= 0)
+        break;
+      s += written;
+      n -= written;
+    }
+    return 0;
+  }
+
+  memcpy(&__JIT_IO_BUFFER__[__JIT_IO_LENGTH__], s, n);
+  __JIT_IO_LENGTH__ += n;
+  return 0;
+}
+
+int64_t jitIoPrint(const char *s) { return jitIoWrite(s, strlen(s)); }
+
+int64_t jitIoPrintln(const char *s) {
+  jitIoWrite(s, strlen(s));
+  return jitIoWrite("\n", 1);
+}
+
+int64_t jitIoPrintint(int64_t n) {
+  char digits[24];
+  return jitIoWrite(digits, snprintf(digits, sizeof(digits), "%ld", n));
+}
+
+int64_t jitMmap(size_t size) {
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return p == MAP_FAILED ? 0 : (int64_t)p;
+}
+
+int64_t jitMunmap(void *p, size_t size) { return munmap(p, size); }
+
+// Same layout as the alloc runtime module: chunks start with [next, size]
+#define JIT_ARENA_CHUNK (1 << 20)
+#define JIT_POOL_SLAB (1 << 16)
+
+int64_t *__JIT_ARENA_CHUNKS__, *__JIT_ARENA_FIRST__;
+char *__JIT_ARENA_PTR__, *__JIT_ARENA_END__;
+void *__JIT_POOL_FREE__[5];
+char *__JIT_POOL_NEXT__[5], *__JIT_POOL_END__[5];
+
+int64_t *jitArenaMap(size_t size) {
+  int64_t *chunk = (int64_t *)jitMmap(size);
+  if (chunk != NULL) {
+    chunk[0] = (int64_t)__JIT_ARENA_CHUNKS__;
+    chunk[1] = size;
+    __JIT_ARENA_CHUNKS__ = chunk;
+  }
+  return chunk;
+}
+
+int64_t jitArenaAlloc(size_t size) {
+  size = (size + 15) & ~(size_t)15;
+  if (size <= (size_t)(__JIT_ARENA_END__ - __JIT_ARENA_PTR__)) {
+    __JIT_ARENA_PTR__ += size;
+    return (int64_t)(__JIT_ARENA_PTR__ - size);
+  }
+
+  if (size > JIT_ARENA_CHUNK / 4) {
+    int64_t *chunk = jitArenaMap(size + 16);
+    return chunk == NULL ? 0 : (int64_t)&chunk[2];
+  }
+
+  int64_t *chunk = jitArenaMap(JIT_ARENA_CHUNK);
+  if (chunk == NULL)
+    return 0;
+  if (__JIT_ARENA_FIRST__ == NULL)
+    __JIT_ARENA_FIRST__ = chunk;
+
+  __JIT_ARENA_END__ = (char *)chunk + JIT_ARENA_CHUNK;
+  __JIT_ARENA_PTR__ = (char *)&chunk[2] + size;
+  return (int64_t)&chunk[2];
+}
+
+int64_t jitArenaReset() {
+  int64_t *chunk = __JIT_ARENA_CHUNKS__;
+  while (chunk != NULL) {
+    int64_t *next = (int64_t *)chunk[0];
+    if (chunk != __JIT_ARENA_FIRST__)
+      munmap(chunk, chunk[1]);
+    chunk = next;
+  }
+
+  __JIT_ARENA_CHUNKS__ = __JIT_ARENA_FIRST__;
+  if (__JIT_ARENA_FIRST__ != NULL) {
+    __JIT_ARENA_FIRST__[0] = 0;
+    __JIT_ARENA_PTR__ = (char *)&__JIT_ARENA_FIRST__[2];
+    __JIT_ARENA_END__ = (char *)__JIT_ARENA_FIRST__ + JIT_ARENA_CHUNK;
+  }
+  return 0;
+}
+
+int jitPoolClass(size_t size) {
+  int class = 0;
+  while ((size_t)16 << class < size)
+    class ++;
+  return class;
+}
+
+int64_t jitPoolAlloc(size_t size) {
+  if (size == 0 || size > 256)
+    return jitArenaAlloc(size);
+
+  int class = jitPoolClass(size);
+  void **block = __JIT_POOL_FREE__[class];
+  if (block != NULL) {
+    __JIT_POOL_FREE__[class] = *block;
+    return (int64_t)block;
+  }
+
+  size_t blockSize = (size_t)16 << class;
+  if (__JIT_POOL_NEXT__[class] + blockSize > __JIT_POOL_END__[class]) {
+    char *slab = (char *)jitMmap(JIT_POOL_SLAB);
+    if (slab == NULL)
+      return 0;
+    __JIT_POOL_NEXT__[class] = slab;
+    __JIT_POOL_END__[class] = slab + JIT_POOL_SLAB;
+  }
+
+  __JIT_POOL_NEXT__[class] += blockSize;
+  return (int64_t)(__JIT_POOL_NEXT__[class] - blockSize);
+}
+
+int64_t jitPoolRelease(void **block, size_t size) {
+  if (block == NULL || size == 0 || size > 256)
+    return 0;
+
+  int class = jitPoolClass(size);
+  *block = __JIT_POOL_FREE__[class];
+  __JIT_POOL_FREE__[class] = block;
+  return 0;
+}
+
+// Same operations as the vector kernel, ints wrap around
+int64_t jitVector(int64_t *dst, int64_t *a, int64_t *b, int64_t n,
+                  int64_t op) {
+  double *fdst = (double *)dst, *fa = (double *)a, *fb = (double *)b;
+  uint64_t count = (uint64_t)b & 63;
+
+  for (int64_t i = 0; i < n; i++)
+    switch (op) {
+    case VECTOR_COPY:
+      dst[i] = a[i];
+      break;
+    case VECTOR_ADD:
+      dst[i] = (uint64_t)a[i] + (uint64_t)b[i];
+      break;
+    case VECTOR_SUB:
+      dst[i] = (uint64_t)a[i] - (uint64_t)b[i];
+      break;
+    case VECTOR_MUL:
+      dst[i] = (uint64_t)a[i] * (uint64_t)b[i];
+      break;
+    case VECTOR_AND:
+      dst[i] = a[i] & b[i];
+      break;
+    case VECTOR_OR:
+      dst[i] = a[i] | b[i];
+      break;
+    case VECTOR_XOR:
+      dst[i] = a[i] ^ b[i];
+      break;
+    case VECTOR_SHL:
+      dst[i] = (uint64_t)a[i] << count;
+      break;
+    case VECTOR_SAR:
+      dst[i] = a[i] >> count;
+      break;
+    case VECTOR_FADD:
+      fdst[i] = fa[i] + fb[i];
+      break;
+    case VECTOR_FSUB:
+      fdst[i] = fa[i] - fb[i];
+      break;
+    case VECTOR_FMUL:
+      fdst[i] = fa[i] * fb[i];
+      break;
+    case VECTOR_FDIV:
+      fdst[i] = fa[i] / fb[i];
+      break;
+    case VECTOR_FILL:
+      dst[i] = (int64_t)b;
+      break;
+    case VECTOR_FIND:
+      if (a[i] == (int64_t)b)
+        return i;
+      break;
+    }
+  return op == VECTOR_FIND ? n : 0;
+}
+
+int64_t jitReduceSum(int64_t *v, int64_t n) {
+  uint64_t sum = 0;
+  for (int64_t i = 0; i < n; i++)
+    sum += v[i];
+  return sum;
+}
+
+int64_t jitReduceMin(int64_t *v, int64_t n) {
+  int64_t min = n > 0 ? v[0] : 0;
+  for (int64_t i = 1; i < n; i++)
+    min = v[i] < min ? v[i] : min;
+  return min;
+}
+
+int64_t jitReduceMax(int64_t *v, int64_t n) {
+  int64_t max = n > 0 ? v[0] : 0;
+  for (int64_t i = 1; i < n; i++)
+    max = v[i] > max ? v[i] : max;
+  return max;
+}
+
+// Four interleaved partial sums, the order the reduce kernel adds in
+double jitReduceFsum(double *v, int64_t n) {
+  double lanes[4] = {0, 0, 0, 0};
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    for (uint lane = 0; lane < 4; lane++)
+      lanes[lane] += v[i + lane];
+
+  double sum = (lanes[0] + lanes[2]) + (lanes[1] + lanes[3]);
+  for (; i < n; i++)
+    sum += v[i];
+  return sum;
+}
+
+// minsd and maxsd keep their second operand on NaNs, and so does this
+double jitReduceFmin(double *v, int64_t n) {
+  double min = n > 0 ? v[0] : 0;
+  for (int64_t i = 1; i < n; i++)
+    min = min < v[i] ? min : v[i];
+  return min;
+}
+
+double jitReduceFmax(double *v, int64_t n) {
+  double max = n > 0 ? v[0] : 0;
+  for (int64_t i = 1; i < n; i++)
+    max = max > v[i] ? max : v[i];
+  return max;
+}
+
+typedef struct {
+  str name;
+  void *address;
+  bool slot; // called through a pointer, like the dispatched kernels
+} JitHostSymbol;
+
+// Runtime symbols thunks and _start refer to, see src/runtime.c
+const JitHostSymbol JIT_HOST[] = {
+    {"_rt_init", jitNothing, false},
+    {"_rt_strlen_impl", strlen, true},
+    {"_rt_memchr_impl", memchr, true},
+    {"_rt_memcpy_impl", memcpy, true},
+    {"_rt_memset_impl", memset, true},
+    {"_rt_memcmp_impl", jitMemcmp, true},
+    {"_rt_io_flush", jitIoFlush, false},
+    {"_rt_io_write", jitIoWrite, false},
+    {"_rt_io_print", jitIoPrint, false},
+    {"_rt_io_println", jitIoPrintln, false},
+    {"_rt_io_printint", jitIoPrintint, false},
+    {"_rt_mmap", jitMmap, false},
+    {"_rt_munmap", jitMunmap, false},
+    {"_rt_arena_alloc", jitArenaAlloc, false},
+    {"_rt_arena_reset", jitArenaReset, false},
+    {"_rt_pool_alloc", jitPoolAlloc, false},
+    {"_rt_pool_release", jitPoolRelease, false},
+    {"_rt_vector_impl", jitVector, true},
+    {"_rt_reduce_sum", jitReduceSum, false},
+    {"_rt_reduce_min", jitReduceMin, false},
+    {"_rt_reduce_max", jitReduceMax, false},
+    {"_rt_reduce_fsum", jitReduceFsum, false},
+    {"_rt_reduce_fmin", jitReduceFmin, false},
+    {"_rt_reduce_fmax", jitReduceFmax, false},
+    {NULL, NULL, false},
+};
+
+/**
+ * @brief Host function behind the operand of a runtime thunk's call, such
+ * as "_rt_io_print" or "qword [_rt_strlen_impl]"
+ */
+void *jitHostAddress(str call) {
+  char name[64];
+  if (sscanf(call, "qword [%63[^]]]", name) != 1)
+    snprintf(name, sizeof(name), "%s", call);
+
+  for (uint i = 0; JIT_HOST[i].name != NULL; i++)
+    if (strcmp(JIT_HOST[i].name, name) == 0)
+      return JIT_HOST[i].address;
+
+  CompilerError(fstr("No host routine for \"%s\".", name));
+}
+
+// --------------------------
+// Symbols and Sections -----
+
+uint jitHash(str name) {
+  uint hash = 2166136261u;
+  for (; *name != '\0'; name++)
+    hash = (hash ^ (unsigned char)*name) * 16777619u;
+  return hash;
+}
+
+JitSymbol *jitSymbol(JitAssembler *as, str name) {
+  if (2 * (as->nsymbols + 1) > as->capacity) {
+    JitSymbol *old = as->symbols;
+    uint oldCapacity = as->capacity;
+
+    as->capacity = oldCapacity ? 2 * oldCapacity : 256;
+    as->symbols = calloc(as->capacity, sizeof(JitSymbol));
+    as->nsymbols = 0;
+    for (uint i = 0; i < oldCapacity; i++)
+      if (old[i].name != NULL)
+        *jitSymbol(as, old[i].name) = old[i];
+    free(old);
+  }
+
+  uint mask = as->capacity - 1;
+  for (uint i = jitHash(name) & mask;; i = (i + 1) & mask) {
+    if (as->symbols[i].name == NULL) {
+      as->symbols[i].name = name;
+      as->nsymbols++;
+      return &as->symbols[i];
+    }
+    if (strcmp(as->symbols[i].name, name) == 0)
+      return &as->symbols[i];
+  }
+}
+
+/**
+ * @brief Full name of a label, .local ones belong to the last global label
+ */
+str jitLabelName(JitAssembler *as, str name) {
+  if (name[0] == '.' && as->scope != NULL)
+    return fstr("%s%s", as->scope, name);
+  return fstr("%s", name);
+}
+
+void jitDefine(JitAssembler *as, str name) {
+  if (name[0] != '.')
+    as->scope = fstr("%s", name);
+
+  JitSymbol *symbol = jitSymbol(as, jitLabelName(as, name));
+  if (symbol->defined)
+    CompilerError(fstr("Label \"%s\" defined twice.", symbol->name));
+
+  symbol->defined = true;
+  symbol->section = as->current;
+  symbol->offset = as->current == JitBss
+                       ? as->sections[JitBss].size
+                       : as->sections[as->current].size;
+}
+
+void jitEmit(JitAssembler *as, const void *bytes, size_t n) {
+  JitSection *section = &as->sections[as->current];
+  if (as->current == JitBss)
+    CompilerError("Initialized data in .bss.");
+
+  if (section->size + n > section->capacity) {
+    section->capacity = section->capacity ? 2 * section->capacity : 4096;
+    while (section->size + n > section->capacity)
+      section->capacity *= 2;
+    section->bytes = realloc(section->bytes, section->capacity);
+  }
+
+  memcpy(&section->bytes[section->size], bytes, n);
+  section->size += n;
+}
+
+void jitByte(JitAssembler *as, uint8_t byte) { jitEmit(as, &byte, 1); }
+
+void jitImm32(JitAssembler *as, int64_t value) {
+  int32_t imm = value;
+  jitEmit(as, &imm, 4);
+}
+
+void jitImm64(JitAssembler *as, int64_t value) { jitEmit(as, &value, 8); }
+
+/**
+ * @brief Reserve a field for the address of a symbol, patched after layout
+ */
+void jitFixup(JitAssembler *as, JitFixupKind kind, str symbol, int64_t addend) {
+  if (as->nfixups == as->fixupCapacity) {
+    as->fixupCapacity = as->fixupCapacity ? 2 * as->fixupCapacity : 256;
+    as->fixups = realloc(as->fixups, as->fixupCapacity * sizeof(JitFixup));
+  }
+
+  as->fixups[as->nfixups++] = (JitFixup){
+      .section = as->current,
+      .offset = as->sections[as->current].size,
+      .end = 0,
+      .kind = kind,
+      .symbol = jitLabelName(as, symbol),
+      .addend = addend,
+  };
+
+  if (kind == JitAbs64)
+    jitImm64(as, 0);
+  else
+    jitImm32(as, 0);
+}
+
+// --------------------------
+// Operands -----------------
+
+const JitRegisterName *jitRegister(str name) {
+  for (uint i = 0; JIT_REGISTERS[i].name != NULL; i++)
+    if (strcmp(JIT_REGISTERS[i].name, name) == 0)
+      return &JIT_REGISTERS[i];
+  return NULL;
+}
+
+str jitTrim(str text) {
+  while (isspace(*text))
+    text++;
+  uint len = strlen(text);
+  while (len > 0 && isspace(text[len - 1]))
+    text[--len] = '\0';
+  return text;
+}
+
+bool jitParseNumber(str text, int64_t *value) {
+  if (!isdigit(text[0]) && !(text[0] == '-' && isdigit(text[1])))
+    return false;
+
+  // Unsigned, so 64-bit patterns like the bits of a negative double fit
+  str end;
+  *value = text[0] == '-' ? strtoll(text, &end, 0)
+                          : (int64_t)strtoull(text, &end, 0);
+  return *end == '\0';
+}
+
+void jitParseOperand(str text, JitOperand *op) {
+  text = jitTrim(text);
+  *op = (JitOperand){};
+
+  // Size specifiers don't change any encoding the code generator needs
+  str sizes[] = {"qword ", "dword ", "word ", "byte "};
+  for (uint i = 0; i < 4; i++)
+    if (strncmp(text, sizes[i], strlen(sizes[i])) == 0)
+      text = jitTrim(&text[strlen(sizes[i])]);
+
+  const JitRegisterName *reg = jitRegister(text);
+  if (reg != NULL) {
+    op->kind = JitRegister;
+    op->reg = reg->number;
+    op->size = reg->size;
+    return;
+  }
+
+  if (jitParseNumber(text, &op->value)) {
+    op->kind = JitImmediate;
+    return;
+  }
+
+  if (text[0] != '[') {
+    op->kind = JitLabel;
+    op->symbol = fstr("%s", text);
+    return;
+  }
+
+  // [base + disp], [symbol + disp] or [symbol], any of them with an
+  // index register scaled by 1, 2, 4 or 8
+  op->kind = JitMemory;
+  uint len = strcspn(text, "]");
+  char inner[len];
+  snprintf(inner, len, "%s", &text[1]);
+
+  int sign = 1;
+  bool scaled = false;
+  for (str term = strtok(inner, " "); term != NULL; term = strtok(NULL, " ")) {
+    int64_t value;
+    if (strcmp(term, "+") == 0)
+      sign = 1;
+    else if (strcmp(term, "-") == 0)
+      sign = -1;
+    else if (strcmp(term, "*") == 0)
+      scaled = true;
+    else if ((reg = jitRegister(term)) != NULL) {
+      if (op->base) {
+        op->indexed = true;
+        op->index = reg->number;
+        op->scale = 1;
+      } else {
+        op->base = true;
+        op->reg = reg->number;
+      }
+    } else if (jitParseNumber(term, &value) && scaled) {
+      // Scales the register right before it, which is then the index
+      if (!op->indexed) {
+        op->indexed = true;
+        op->index = op->reg;
+        op->base = false;
+      }
+      op->scale = value;
+      scaled = false;
+    } else if (jitParseNumber(term, &value))
+      op->value += sign * value;
+    else
+      op->symbol = fstr("%s", term);
+  }
+
+  if (op->indexed && (op->index == 4 || (op->scale != 1 && op->scale != 2 &&
+                                         op->scale != 4 && op->scale != 8)))
+    CompilerError(fstr("Unsupported memory operand \"%s\".", text));
+
+  if (op->base && op->symbol != NULL)
+    CompilerError(fstr("Unsupported memory operand \"%s\".", text));
+}
+
+bool jitFitsInt8(int64_t value) { return value >= -128 && value <= 127; }
+
+bool jitFitsInt32(int64_t value) {
+  return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// --------------------------
+// Encoding -----------------
+
+/**
+ * @brief Emit REX, opcode and ModRM for an instruction with an r/m operand
+ *
+ * @param wide 64-bit operand size
+ * @param reg Register or /digit of the ModRM reg field
+ */
+void jitModRM(JitAssembler *as, bool wide, const uint8_t *opcode, uint n,
+              uint reg, JitOperand *rm) {
+  uint base = rm->kind == JitRegister || rm->base ? rm->reg : 0;
+  uint index = rm->kind == JitMemory && rm->indexed ? rm->index : 0;
+  uint8_t rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) |
+                (base >> 3);
+  if (rex != 0x40)
+    jitByte(as, rex);
+  jitEmit(as, opcode, n);
+
+  reg &= 7;
+  if (rm->kind == JitRegister) {
+    jitByte(as, 0xC0 | (reg << 3) | (rm->reg & 7));
+    return;
+  }
+
+  if (rm->indexed) {
+    uint scale = rm->scale == 8 ? 3 : rm->scale == 4 ? 2 : rm->scale == 2;
+    uint8_t sib = (scale << 6) | ((index & 7) << 3);
+    if (!rm->base) {
+      // No base, the displacement is the absolute address
+      jitByte(as, (reg << 3) | 4);
+      jitByte(as, sib | 5);
+      if (rm->symbol != NULL)
+        jitFixup(as, JitAbs32, rm->symbol, rm->value);
+      else
+        jitImm32(as, rm->value);
+      return;
+    }
+
+    uint mod = rm->value == 0 && (base & 7) != 5 ? 0
+               : jitFitsInt8(rm->value)          ? 1
+                                                 : 2;
+    jitByte(as, (mod << 6) | (reg << 3) | 4);
+    jitByte(as, sib | (base & 7));
+    if (mod == 1)
+      jitByte(as, rm->value);
+    else if (mod == 2)
+      jitImm32(as, rm->value);
+    return;
+  }
+
+  if (!rm->base) {
+    // RIP relative, everything lives in one mapping
+    jitByte(as, (reg << 3) | 5);
+    jitFixup(as, JitRel32, rm->symbol, rm->value);
+    return;
+  }
+
+  uint mod = rm->value == 0 && (base & 7) != 5 ? 0
+             : jitFitsInt8(rm->value)          ? 1
+                                               : 2;
+  jitByte(as, (mod << 6) | (reg << 3) | (base & 7));
+  if ((base & 7) == 4)
+    jitByte(as, 0x24); // SIB with rsp or r12 as base
+  if (mod == 1)
+    jitByte(as, rm->value);
+  else if (mod == 2)
+    jitImm32(as, rm->value);
+}
+
+void jitOpcode1(JitAssembler *as, bool wide, uint8_t opcode, uint reg,
+                JitOperand *rm) {
+  jitModRM(as, wide, &opcode, 1, reg, rm);
+}
+
+void jitOpcode2(JitAssembler *as, bool wide, uint8_t opcode, uint reg,
+                JitOperand *rm) {
+  uint8_t bytes[] = {0x0F, opcode};
+  jitModRM(as, wide, bytes, 2, reg, rm);
+}
+
+/**
+ * @brief Immediate that is either a number or the address of a label
+ * The mapping sits in the low 2 GiB, so addresses fit sign-extended imm32.
+ */
+void jitImmediate32(JitAssembler *as, JitOperand *op) {
+  if (op->kind == JitLabel)
+    jitFixup(as, JitAbs32, op->symbol, 0);
+  else if (jitFitsInt32(op->value))
+    jitImm32(as, op->value);
+  else
+    CompilerError(fstr("Immediate %ld doesn't fit 32 bits.", op->value));
+}
+
+bool isJitImmediate(JitOperand *op) {
+  return op->kind == JitImmediate || op->kind == JitLabel;
+}
+
+bool jitLookup(const JitCondition *table, str name, uint *code) {
+  for (uint i = 0; table[i].name != NULL; i++)
+    if (strcmp(table[i].name, name) == 0) {
+      *code = table[i].code;
+      return true;
+    }
+  return false;
+}
+
+void jitUnsupported(str mnemonic) {
+  CompilerError(fstr("Can't encode \"%s\" for -run.", mnemonic));
+}
+
+void jitInstruction(JitAssembler *as, str mnemonic, JitOperand *ops,
+                    uint nops) {
+  uint firstFixup = as->nfixups;
+  JitOperand *dst = &ops[0], *src = &ops[1];
+  bool wide = nops > 0 && !(dst->kind == JitRegister && dst->size == 4);
+  uint code;
+
+  if (jitLookup(JIT_ALU, mnemonic, &code) && nops == 2) {
+    if (src->kind == JitRegister)
+      jitOpcode1(as, wide, code * 8 + 1, src->reg, dst);
+    else if (src->kind == JitMemory)
+      jitOpcode1(as, wide, code * 8 + 3, dst->reg, src);
+    else if (src->kind == JitImmediate && jitFitsInt8(src->value)) {
+      jitOpcode1(as, wide, 0x83, code, dst);
+      jitByte(as, src->value);
+    } else {
+      jitOpcode1(as, wide, 0x81, code, dst);
+      jitImmediate32(as, src);
+    }
+  } else if (strcmp(mnemonic, "mov") == 0 && nops == 2) {
+    if (src->kind == JitRegister)
+      jitOpcode1(as, wide, 0x89, src->reg, dst);
+    else if (src->kind == JitMemory)
+      jitOpcode1(as, wide, 0x8B, dst->reg, src);
+    else if (dst->kind == JitRegister && src->kind == JitImmediate &&
+             (!wide || !jitFitsInt32(src->value))) {
+      // mov r, imm32 zero-extends and mov r64, imm64 covers the rest
+      if (wide || dst->reg >= 8)
+        jitByte(as, 0x40 | (wide << 3) | (dst->reg >> 3));
+      jitByte(as, 0xB8 + (dst->reg & 7));
+      if (wide)
+        jitImm64(as, src->value);
+      else
+        jitImm32(as, src->value);
+    } else {
+      jitOpcode1(as, wide, 0xC7, 0, dst);
+      jitImmediate32(as, src);
+    }
+  } else if (strcmp(mnemonic, "test") == 0 && nops == 2) {
+    if (src->kind == JitRegister)
+      jitOpcode1(as, wide, 0x85, src->reg, dst);
+    else {
+      jitOpcode1(as, wide, 0xF7, 0, dst);
+      jitImmediate32(as, src);
+    }
+  } else if (strcmp(mnemonic, "imul") == 0 && nops == 2) {
+    if (isJitImmediate(src)) {
+      jitOpcode1(as, wide, 0x69, dst->reg, dst);
+      jitImmediate32(as, src);
+    } else
+      jitOpcode2(as, wide, 0xAF, dst->reg, src);
+  } else if (strcmp(mnemonic, "lea") == 0 && nops == 2)
+    jitOpcode1(as, true, 0x8D, dst->reg, src);
+  else if (strcmp(mnemonic, "movzx") == 0 && nops == 2)
+    jitOpcode2(as, wide, 0xB6, dst->reg, src);
+  else if (strncmp(mnemonic, "set", 3) == 0 &&
+           jitLookup(JIT_CONDITIONS, &mnemonic[3], &code) && nops == 1)
+    jitOpcode2(as, false, 0x90 + code, 0, dst);
+  else if (strncmp(mnemonic, "cmov", 4) == 0 &&
+           jitLookup(JIT_CONDITIONS, &mnemonic[4], &code) && nops == 2)
+    jitOpcode2(as, wide, 0x40 + code, dst->reg, src);
+  else if (jitLookup(JIT_SSE2, mnemonic, &code) && nops == 2) {
+    jitByte(as, code >> 8);
+    jitOpcode2(as, false, code & 0xFF, dst->reg, src);
+  } else if (strcmp(mnemonic, "movsd") == 0 && nops == 2) {
+    jitByte(as, 0xF2);
+    if (dst->kind == JitMemory)
+      jitOpcode2(as, false, 0x11, src->reg, dst);
+    else
+      jitOpcode2(as, false, 0x10, dst->reg, src);
+  } else if ((strcmp(mnemonic, "cvtsi2sd") == 0 ||
+              strcmp(mnemonic, "cvttsd2si") == 0) &&
+             nops == 2) {
+    jitByte(as, 0xF2);
+    jitOpcode2(as, true, mnemonic[3] == 's' ? 0x2A : 0x2C, dst->reg, src);
+  } else if (strcmp(mnemonic, "cqo") == 0)
+    jitEmit(as, "\x48\x99", 2);
+  else if (strcmp(mnemonic, "not") == 0 && nops == 1)
+    jitOpcode1(as, wide, 0xF7, 2, dst);
+  else if (strcmp(mnemonic, "neg") == 0 && nops == 1)
+    jitOpcode1(as, wide, 0xF7, 3, dst);
+  else if (strcmp(mnemonic, "div") == 0 && nops == 1)
+    jitOpcode1(as, wide, 0xF7, 6, dst);
+  else if (strcmp(mnemonic, "idiv") == 0 && nops == 1)
+    jitOpcode1(as, wide, 0xF7, 7, dst);
+  else if ((strcmp(mnemonic, "shl") == 0 || strcmp(mnemonic, "shr") == 0 ||
+            strcmp(mnemonic, "sar") == 0) &&
+           nops == 2) {
+    uint digit = mnemonic[1] == 'h' ? (mnemonic[2] == 'l' ? 4 : 5) : 7;
+    if (src->kind == JitRegister)
+      jitOpcode1(as, wide, 0xD3, digit, dst);
+    else {
+      jitOpcode1(as, wide, 0xC1, digit, dst);
+      jitByte(as, src->value);
+    }
+  } else if (strcmp(mnemonic, "push") == 0 && nops == 1) {
+    if (dst->kind == JitRegister) {
+      if (dst->reg >= 8)
+        jitByte(as, 0x41);
+      jitByte(as, 0x50 + (dst->reg & 7));
+    } else if (dst->kind == JitMemory)
+      jitOpcode1(as, false, 0xFF, 6, dst);
+    else if (dst->kind == JitImmediate && jitFitsInt8(dst->value)) {
+      jitByte(as, 0x6A);
+      jitByte(as, dst->value);
+    } else {
+      jitByte(as, 0x68);
+      jitImmediate32(as, dst);
+    }
+  } else if (strcmp(mnemonic, "pop") == 0 && nops == 1) {
+    if (dst->kind == JitRegister) {
+      if (dst->reg >= 8)
+        jitByte(as, 0x41);
+      jitByte(as, 0x58 + (dst->reg & 7));
+    } else
+      jitOpcode1(as, false, 0x8F, 0, dst);
+  } else if ((strcmp(mnemonic, "call") == 0 || strcmp(mnemonic, "jmp") == 0) &&
+             nops == 1) {
+    bool call = mnemonic[0] == 'c';
+    if (dst->kind == JitLabel) {
+      jitByte(as, call ? 0xE8 : 0xE9);
+      jitFixup(as, JitRel32, dst->symbol, 0);
+    } else
+      jitOpcode1(as, false, 0xFF, call ? 2 : 4, dst);
+  } else if (mnemonic[0] == 'j' && jitLookup(JIT_CONDITIONS, &mnemonic[1], &code) &&
+             nops == 1 && dst->kind == JitLabel) {
+    jitByte(as, 0x0F);
+    jitByte(as, 0x80 + code);
+    jitFixup(as, JitRel32, dst->symbol, 0);
+  } else if (strcmp(mnemonic, "ret") == 0)
+    jitByte(as, 0xC3);
+  else if (strcmp(mnemonic, "syscall") == 0)
+    jitEmit(as, "\x0F\x05", 2);
+  else if (strcmp(mnemonic, "nop") == 0)
+    jitByte(as, 0x90);
+  else
+    jitUnsupported(mnemonic);
+
+  // Relative fields count from the end of the whole instruction
+  for (uint i = firstFixup; i < as->nfixups; i++)
+    as->fixups[i].end = as->sections[as->current].size;
+}
+
+/**
+ * @brief Split operands on commas outside of quotes
+ */
+uint jitSplitOperands(str text, str *parts, uint max) {
+  uint n = 0;
+  bool quoted = false;
+  str start = text;
+
+  for (str c = text;; c++) {
+    if (*c == '"')
+      quoted = !quoted;
+    if ((*c == ',' && !quoted) || *c == '\0') {
+      bool last = *c == '\0';
+      *c = '\0';
+      if (*jitTrim(start) != '\0') {
+        if (n == max)
+          CompilerError("Too many operands.");
+        parts[n++] = jitTrim(start);
+      }
+      if (last)
+        break;
+      start = c + 1;
+    }
+  }
+  return n;
+}
+
+void jitData(JitAssembler *as, str directive, str args) {
+  str items[256];
+
+  if (strcmp(directive, "db") == 0) {
+    uint n = jitSplitOperands(args, items, 256);
+    for (uint i = 0; i < n; i++) {
+      int64_t value;
+      uint len = strlen(items[i]);
+      if (items[i][0] == '"' && len >= 2 && items[i][len - 1] == '"')
+        jitEmit(as, &items[i][1], len - 2); // nasm copies "" strings verbatim
+      else if (jitParseNumber(items[i], &value))
+        jitByte(as, value);
+      else
+        CompilerError(fstr("Invalid db item \"%s\".", items[i]));
+    }
+  } else if (strcmp(directive, "dq") == 0) {
+    uint n = jitSplitOperands(args, items, 256);
+    for (uint i = 0; i < n; i++) {
+      int64_t value;
+      if (jitParseNumber(items[i], &value))
+        jitImm64(as, value);
+      else
+        jitFixup(as, JitAbs64, items[i], 0);
+    }
+  } else {
+    int64_t count;
+    if (!jitParseNumber(jitTrim(args), &count))
+      CompilerError(fstr("Invalid %s count \"%s\".", directive, args));
+
+    uint unit = directive[3] == 'b' ? 1 : directive[3] == 'w' ? 2
+                : directive[3] == 'd' ? 4 : 8;
+    if (as->current == JitBss)
+      as->sections[JitBss].size += count * unit;
+    else
+      for (int64_t i = 0; i < count * unit; i++)
+        jitByte(as, 0);
+  }
+}
+
+/**
+ * @brief Pad the current section to a multiple of the alignment, with nops
+ * in code and zeros elsewhere
+ */
+void jitAlign(JitAssembler *as, str args) {
+  str items[2];
+  int64_t alignment;
+  if (jitSplitOperands(args, items, 2) == 0 ||
+      !jitParseNumber(items[0], &alignment) || alignment <= 0)
+    CompilerError(fstr("Invalid alignment \"%s\".", args));
+
+  JitSection *section = &as->sections[as->current];
+  while (section->size % alignment)
+    if (as->current == JitBss)
+      section->size++;
+    else
+      jitByte(as, as->current == JitCode ? 0x90 : 0);
+}
+
+bool isJitDataDirective(str word) {
+  return strcmp(word, "db") == 0 || strcmp(word, "dq") == 0 ||
+         (strncmp(word, "res", 3) == 0 && strlen(word) == 4);
+}
+
+/**
+ * @brief Assemble one line of generated assembly
+ */
+void jitLine(JitAssembler *as, str line) {
+  // Strip the comment, unless the ; is quoted
+  bool quoted = false;
+  for (str c = line; *c != '\0'; c++) {
+    if (*c == '"')
+      quoted = !quoted;
+    else if (*c == ';' && !quoted) {
+      *c = '\0';
+      break;
+    }
+  }
+
+  line = jitTrim(line);
+  if (*line == '\0')
+    return;
+
+  // Leading label, possibly followed by data
+  uint word = strcspn(line, " \t:\"");
+  if (line[word] == ':') {
+    line[word] = '\0';
+    jitDefine(as, line);
+    line = jitTrim(&line[word + 1]);
+    if (*line == '\0')
+      return;
+  }
+
+  uint split = strcspn(line, " \t");
+  char mnemonic[split + 1];
+  snprintf(mnemonic, split + 1, "%s", line);
+  str rest = jitTrim(&line[split]);
+
+  if (strcmp(mnemonic, "section") == 0) {
+    if (strcmp(rest, ".text") == 0)
+      as->current = JitCode;
+    else if (strcmp(rest, ".rodata") == 0)
+      as->current = JitRodata;
+    else if (strcmp(rest, ".data") == 0)
+      as->current = JitData;
+    else if (strcmp(rest, ".bss") == 0)
+      as->current = JitBss;
+    else
+      CompilerError(fstr("Unknown section \"%s\".", rest));
+    return;
+  }
+
+  if (strcmp(mnemonic, "global") == 0 || strcmp(mnemonic, "BITS") == 0 ||
+      strcmp(mnemonic, "extern") == 0)
+    return;
+
+  if (isJitDataDirective(mnemonic))
+    return jitData(as, mnemonic, rest);
+
+  if (strcmp(mnemonic, "align") == 0 || strcmp(mnemonic, "alignb") == 0)
+    return jitAlign(as, rest);
+
+  if (as->current != JitCode)
+    CompilerError(fstr("Instruction \"%s\" outside of .text.", mnemonic));
+
+  str parts[JIT_MAX_OPERANDS];
+  JitOperand ops[JIT_MAX_OPERANDS];
+  uint nops = jitSplitOperands(rest, parts, JIT_MAX_OPERANDS);
+  for (uint i = 0; i < nops; i++)
+    jitParseOperand(parts[i], &ops[i]);
+
+  jitInstruction(as, mnemonic, ops, nops);
+}
+
+void jitAssemble(JitAssembler *as, str code) {
+  str cursor = code;
+  while (*cursor != '\0') {
+    uint len = strcspn(cursor, "\n");
+    char line[len + 1];
+    memcpy(line, cursor, len);
+    line[len] = '\0';
+    jitLine(as, line);
+    cursor = cursor[len] == '\n' ? &cursor[len + 1] : &cursor[len];
+  }
+}
+
+/**
+ * @brief Serve runtime symbols nothing defined from the host process
+ * Calls go through a stub aligning the stack for C, the kernels reached
+ * through an _impl pointer get a slot holding the stub's address.
+ */
+void jitLinkHost(JitAssembler *as) {
+  for (uint i = 0; JIT_HOST[i].name != NULL; i++) {
+    JitSymbol *symbol = jitSymbol(as, JIT_HOST[i].name);
+    if (symbol->defined)
+      continue;
+
+    str stub = JIT_HOST[i].slot ? fstr("%s.host", JIT_HOST[i].name)
+                                : JIT_HOST[i].name;
+
+    as->current = JitCode;
+    jitDefine(as, stub);
+    jitEmit(as, "\x55\x48\x89\xE5\x48\x83\xE4\xF0\x48\xB8", 10);
+    jitImm64(as, (int64_t)JIT_HOST[i].address);
+    jitEmit(as, "\xFF\xD0\xC9\xC3", 4); // call rax; leave; ret
+
+    if (JIT_HOST[i].slot) {
+      as->current = JitData;
+      while (as->sections[JitData].size % 8)
+        jitByte(as, 0);
+      jitDefine(as, JIT_HOST[i].name);
+      jitFixup(as, JitAbs64, stub, 0);
+    }
+  }
+}
+
+size_t jitPageAlign(size_t size) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  return (size + page - 1) / page * page;
+}
+
+// fd of the real stdout while the compiler's chatter goes to /dev/null
+int __JIT_STDOUT__ = -1;
+
+/**
+ * @brief Silence the compiler on stdout, the program owns it under -run
+ */
+void jitQuietCompile() {
+  fflush(stdout);
+  __JIT_STDOUT__ = dup(STDOUT_FILENO);
+  int null = open("/dev/null", O_WRONLY);
+  if (null >= 0) {
+    dup2(null, STDOUT_FILENO);
+    close(null);
+  }
+}
+
+// Tells a compile server what the compile included, defined in server.c
+void reportIncludes();
+
+/**
+ * @brief Give stdout back to the program, right before it starts
+ */
+void jitProgramStdout() {
+  // The compile is done, and the program's exit never returns to it
+  reportIncludes();
+
+  fflush(stdout);
+  fflush(stderr);
+  if (__JIT_STDOUT__ >= 0)
+    dup2(__JIT_STDOUT__, STDOUT_FILENO);
+}
+
+int jitCompareSymbols(const void *a, const void *b) {
+  size_t x = (*(JitSymbol **)a)->offset, y = (*(JitSymbol **)b)->offset;
+  return (x > y) - (x < y);
+}
+
+/**
+ * @brief Write /tmp/perf-PID.map, where perf looks up the routines of code
+ * it finds in anonymous memory. Each one spans up to the next.
+ */
+void jitWritePerfMap(JitAssembler *as, uint8_t *code) {
+  JitSymbol **routines = malloc((as->nsymbols + 1) * sizeof(JitSymbol *));
+  uint nroutines = 0;
+  for (uint i = 0; i < as->capacity; i++) {
+    JitSymbol *symbol = &as->symbols[i];
+    if (symbol->name != NULL && symbol->defined &&
+        symbol->section == JitCode && strchr(symbol->name, '.') == NULL)
+      routines[nroutines++] = symbol;
+  }
+  qsort(routines, nroutines, sizeof(JitSymbol *), jitCompareSymbols);
+
+  FILE *map = fopen(fstr("/tmp/perf-%d.map", getpid()), "w");
+  if (map == NULL)
+    CompilerError("Couldn't write the perf map.");
+  for (uint i = 0; i < nroutines; i++) {
+    size_t end = i + 1 < nroutines ? routines[i + 1]->offset
+                                   : as->sections[JitCode].size;
+    fprintf(map, "%lx %lx %s\n", (unsigned long)(code + routines[i]->offset),
+            (unsigned long)(end - routines[i]->offset), routines[i]->name);
+  }
+  fclose(map);
+  free(routines);
+}
+
+/**
+ * @brief Assemble the program into memory and jump to _start on a fresh
+ * stack. The program leaves through its exit syscall, so this never returns.
+ */
+void jitRun(str head, str func, str text, str rodata, str data, str bss) {
+  JitAssembler as = {};
+  as.current = JitCode;
+
+  jitAssemble(&as, head);
+  jitAssemble(&as, func);
+  jitAssemble(&as, text);
+  jitAssemble(&as, rodata);
+  jitAssemble(&as, data);
+  jitAssemble(&as, bss);
+  jitLinkHost(&as);
+
+  // [code] [rodata] [data | bss], code and rodata lose write access once
+  // they're written
+  size_t codeSize = jitPageAlign(as.sections[JitCode].size);
+  size_t rodataSize = jitPageAlign(as.sections[JitRodata].size);
+  size_t dataSize = (as.sections[JitData].size + 31) & ~(size_t)31;
+  size_t total = codeSize + rodataSize +
+                 jitPageAlign(dataSize + as.sections[JitBss].size);
+
+  uint8_t *region = mmap(NULL, total, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+  if (region == MAP_FAILED)
+    CompilerError("Couldn't map memory for -run.");
+
+  uint8_t *bases[__JIT_SECTIONS] = {
+      region, region + codeSize, region + codeSize + rodataSize,
+      region + codeSize + rodataSize + dataSize};
+  for (JitSectionId id = JitCode; id < JitBss; id++)
+    if (as.sections[id].size > 0)
+      memcpy(bases[id], as.sections[id].bytes, as.sections[id].size);
+
+  for (uint i = 0; i < as.nfixups; i++) {
+    JitFixup *fixup = &as.fixups[i];
+    JitSymbol *symbol = jitSymbol(&as, fixup->symbol);
+    if (!symbol->defined)
+      CompilerError(fstr("Undefined symbol \"%s\".", fixup->symbol));
+
+    uint8_t *field = bases[fixup->section] + fixup->offset;
+    int64_t target =
+        (int64_t)(bases[symbol->section] + symbol->offset) + fixup->addend;
+
+    if (fixup->kind == JitAbs64) {
+      memcpy(field, &target, 8);
+      continue;
+    }
+
+    int64_t value = fixup->kind == JitRel32
+                        ? target - (int64_t)(bases[fixup->section] + fixup->end)
+                        : target;
+    if (!jitFitsInt32(value))
+      CompilerError(fstr("Address of \"%s\" out of range.", fixup->symbol));
+
+    int32_t imm = value;
+    memcpy(field, &imm, 4);
+  }
+
+  if (mprotect(region, codeSize, PROT_READ | PROT_EXEC) != 0)
+    CompilerError("Couldn't make -run code executable.");
+  if (rodataSize > 0 && mprotect(bases[JitRodata], rodataSize, PROT_READ) != 0)
+    CompilerError("Couldn't make -run constants read-only.");
+  if (hasCompilerFlag("-emit-perf-map"))
+    jitWritePerfMap(&as, bases[JitCode]);
+
+  JitSymbol *start = jitSymbol(&as, "_start");
+  if (!start->defined)
+    CompilerError("No _start to run.");
+  void *entry = bases[start->section] + start->offset;
+
+  uint8_t *stack = mmap(NULL, JIT_STACK_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (stack == MAP_FAILED)
+    CompilerError("Couldn't map a stack for -run.");
+
+  jitProgramStdout();
+  __asm__ volatile("mov %0, %%rsp\n\t"
+                   "jmp *%1"
+                   :
+                   : "r"(stack + JIT_STACK_SIZE), "r"(entry)
+                   : "memory");
+  __builtin_unreachable();
+}
+
+#endif
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "stats.c"
 #include "utils.c"
 
 #ifndef LEXER_C_INCLUDED
@@ -36,6 +37,7 @@ bool isPunctGrammar(char c) {
 void readTargetFile(str filename, str *buffer, uint *size) {
   /**
    * @brief Read file into buffer as string
+   * The buffer is null-terminated and never freed, words point into it.
    */
 
   FILE *f_ptr = fopen(filename, "r");
@@ -49,49 +51,55 @@ void readTargetFile(str filename, str *buffer, uint *size) {
   fseek(f_ptr, 0L, SEEK_SET);
 
   // Allocate that many bytes and read
-  *buffer = malloc((*size) * sizeof(char));
-
-  uint index = 0;
-  while (index < *size) {
-    char c = fgetc(f_ptr);
-    if (c != EOF)
-      (*buffer)[index++] = c;
-    else {
-      if (index != *size)
-        fprintf(stderr, "\nEncountered EOF after %u bytes.\n", index);
-      break;
-    }
+  *buffer = malloc((*size + 1) * sizeof(char));
+
+  uint index = fread(*buffer, sizeof(char), *size, f_ptr);
+  if (index != *size) {
+    fprintf(stderr, "\nEncountered EOF after %u bytes.\n", index);
+    *size = index;
   }
+  (*buffer)[*size] = '\0';
 
   fclose(f_ptr);
 }
 
-void lex(const str filename, str **lexicon, uint *lexsize) {
+bool isWordDelimiter(char c) {
+  return c == LF || c == CR || c == TAB || c == SPACE || c == DELIM;
+}
+
+void lex(const str filename, strview **lexicon, uint **lines, uint *lexsize) {
   /**
    * @brief Lex file into logical words
+   * Words are views into the file buffer. Each word's line number goes to
+   * the same index of lines.
    */
 
   str buffer;
   uint size;
 
+  statsBegin(PHASE_READ);
   readTargetFile(filename, &buffer, &size);
+  statsEnd();
   printf("\b\b\b, %d bytes.\n", size);
 
-  str *__lexicon;
-  size_t length = 0;
-  str current = "";
-  uint __ci = 0;
+  strview *words = NULL;
+  uint *wordLines = NULL;
+  uint length = 0, capacity = 0;
 
-  while (size) {
-    const char c = *buffer;
+  strview current = {buffer, 0};
+  uint line = 1, wordLine = 1;
+
+  for (uint i = 0; i < size; i++) {
+    const char c = buffer[i];
 
     if (
         // Add new lex on LF, CR, TAB, SPACE, DELIM (;)
-        (c != LF && c != CR && c != TAB && c != SPACE && c != DELIM) ||
+        !isWordDelimiter(c) ||
 
         // unless first char of current word is quote
         // and the quote isnt closed yet; for strings
-        (current[0] == '\"' && (__ci > 0 ? current[__ci - 1] != '\"' : true)) ||
+        (current.len > 0 && current.ptr[0] == '\"' &&
+         current.ptr[current.len - 1] != '\"') ||
 
         /**
          * @todo add conditions for condensed expressions
@@ -100,61 +108,34 @@ void lex(const str filename, str **lexicon, uint *lexsize) {
 				// (isPunctGrammar(c) == false) ||
 
         // Unless handling comments: ignore line until you see LF or CR
-        (current[0] == COMMENT && c != LF && c != CR)) {
-      char new[++__ci];
-      for (size_t i = 0; i < __ci - 1; i++)
-        new[i] = current[i];
-
-      new[__ci - 1] = c;
-      new[__ci] = '\0';
-
-      current = malloc((__ci + 1) * sizeof(char));
-      strcpy(current, new);
-    }
-    // Time to add a new lex
-    else if (strcmp(current, "") != 0) {
-      if (current[0] == COMMENT) {
-        current = malloc(sizeof(char));
-        strcpy(current, "");
-        __ci = 0;
-        continue;
+        (current.len > 0 && current.ptr[0] == COMMENT && c != LF && c != CR)) {
+      if (current.len == 0) {
+        current.ptr = &buffer[i];
+        wordLine = line;
       }
-
-      str __lexes[++length];
-      // Save previous entries
-      if (length > 1)
-        for (size_t i = 0; i < length - 1; i++) {
-          __lexes[i] = malloc(strlen(__lexicon[i]) * sizeof(char));
-          strcpy(__lexes[i], __lexicon[i]);
+      current.len++;
+    }
+    // Time to add a new lex, comments are dropped
+    else if (current.len > 0) {
+      if (current.ptr[0] != COMMENT) {
+        if (length == capacity) {
+          capacity = capacity ? 2 * capacity : 1024;
+          words = realloc(words, capacity * sizeof(strview));
+          wordLines = realloc(wordLines, capacity * sizeof(uint));
         }
-
-      // Add new entry
-      __lexes[length - 1] = malloc((__ci + 1) * sizeof(char));
-      strcpy(__lexes[length - 1], current);
-
-      // Copy all to new location
-      __lexicon = malloc((length) * sizeof(str));
-      for (size_t i = 0; i < length; i++) {
-        __lexicon[i] = malloc(strlen(__lexes[i]) * sizeof(char));
-        strcpy(__lexicon[i], __lexes[i]);
-        free(__lexes[i]);
+        words[length] = current;
+        wordLines[length++] = wordLine;
       }
-
-      current = malloc(sizeof(char));
-      strcpy(current, "");
-      __ci = 0;
+      current.len = 0;
     }
 
-    buffer = &buffer[1];
-    size--;
+    if (c == LF)
+      line++;
   }
 
+  *lexicon = words;
+  *lines = wordLines;
   *lexsize = length;
-  *lexicon = malloc((*lexsize) * sizeof(str *));
-  for (size_t i = 0; i < *lexsize; i++) {
-    (*lexicon)[i] = malloc(strlen(__lexicon[i]) * sizeof(char));
-    strcpy((*lexicon)[i], __lexicon[i]);
-  }
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,472 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codegen.c"
+#include "eval.c"
+#include "parser.c"
+#include "profile.c"
+#include "symbols.c"
+#include "utils.c"
+
+#ifndef LTO_C_INCLUDED
+#define LTO_C_INCLUDED
+// --------------------------
+// Whole Program ------------
+//
+// Includes splice every module into one stream, so the whole program is
+// known before anything is emitted. Procedures that only return an int
+// expression of their parameters are inlined where they are called with
+// plain arguments, and the constants passed in are folded. Then procedures
+// nothing reaches any more are dropped along with the storage, strings and
+// runtime kernels only they used, and so are globals that are never read.
+// Every label but _start is local to the one object written, there is
+// nothing left to internalize.
+
+// Tokens of an expression a procedure may return to be inlined, scaled by
+// profileInlineBudget under -fprofile-use
+#define INLINE_MAX_TOKENS 16
+
+// One operation on two operands, what -Os inlines at most
+#define INLINE_SIZE_TOKENS 3
+
+typedef struct {
+  Token *procedure;
+  Token *end;
+  uint next; // index of the next procedure of the same name, from 1
+  bool reachable;
+} WholeProcedure;
+
+/**
+ * @brief END closing a procedure whose signature is resolved
+ */
+Token *procedureEnd(Token *procedure) {
+  uint depth = 0;
+  Token *token = procedureParam(procedure, procedure->value.__f.nargs);
+  while (token != NULL) {
+    if (token->type == KeywordToken) {
+      if (isBlockKeyword(token->value.__k))
+        depth++;
+      else if (token->value.__k == END && depth-- == 0)
+        return token;
+    }
+    token = token->next;
+  }
+
+  CompilerError(fstr("Procedure \"%s\" has no end.",
+                     symbolText(procedure->value.__f.name.symbol)));
+}
+
+bool isKeyword(Token *token, Keyword key) {
+  return token != NULL && token->type == KeywordToken &&
+         token->value.__k == key;
+}
+
+/**
+ * @brief An int literal or int variable, nothing to evaluate
+ */
+bool isPlainOperand(Token *token) {
+  if (token->type == LiteralToken)
+    return token->value.__l.type == IntValue;
+  if (token->type != IdentifierToken)
+    return false;
+
+  Identifier iden = token->value.__i;
+  return iden.name.kind != ProcedureName && iden.type == IntValue &&
+         iden.length == 0;
+}
+
+bool isInlineOperator(Operator op) {
+  switch (op) {
+  case ADD:
+  case SUB:
+  case MUL:
+  case DIV:
+  case MOD:
+  case LOGICAL_GREATER_THAN:
+  case LOGICAL_LESS_THAN:
+  case LOGICAL_EQUAL:
+  case LOGICAL_NOT_EQUAL:
+  case LOGICAL_AND:
+  case LOGICAL_OR:
+  case LOGICAL_XOR:
+  case BIT_SHIFT_LEFT:
+  case BIT_SHIFT_RIGHT:
+  case BIT_AND:
+  case BIT_OR:
+  case BIT_XOR:
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+/**
+ * @brief Token after an expression of plain operands and side-effect free
+ * binary operators, NULL if it is something else or grows too big
+ */
+Token *skipInlineExpression(Token *token, uint *size, uint budget) {
+  if (token == NULL || ++*size > budget)
+    return NULL;
+  if (isPlainOperand(token))
+    return token->next;
+  if (token->type != OperatorToken || !isInlineOperator(token->value.__o))
+    return NULL;
+
+  Token *rhs = skipInlineExpression(token->next, size, budget);
+  return rhs == NULL ? NULL : skipInlineExpression(rhs, size, budget);
+}
+
+/**
+ * @brief Position of a parameter of the procedure, nargs if it isn't one
+ */
+uint parameterIndex(Token *procedure, Name name) {
+  uint nargs = procedure->value.__f.nargs;
+  for (uint i = 0; i < nargs; i++)
+    if (sameName(procedureParam(procedure, i)->value.__i.name, name))
+      return i;
+  return nargs;
+}
+
+/**
+ * @brief Expression returned by a procedure made of `return EXPR end`
+ * Everything has to be an int, and EXPR may only read its parameters and
+ * globals. NULL if the procedure is anything else.
+ */
+Token *inlineExpression(Token *procedure) {
+  Function fn = procedure->value.__f;
+  if (fn.runtime || fn.type != IntValue)
+    return NULL;
+
+  for (uint i = 0; i < fn.nargs; i++) {
+    Identifier param = procedureParam(procedure, i)->value.__i;
+    if (param.type != IntValue || param.length > 0)
+      return NULL;
+  }
+
+  Token *ret = procedureParam(procedure, fn.nargs);
+  if (!isKeyword(ret, RETURN))
+    return NULL;
+
+  // -Os only inlines what is no bigger than the call
+  uint budget = profileInlineBudget(fn, INLINE_MAX_TOKENS);
+  if (hasCompilerFlag("-Os") && budget > INLINE_SIZE_TOKENS)
+    budget = INLINE_SIZE_TOKENS;
+
+  uint size = 0;
+  Token *end = skipInlineExpression(ret->next, &size, budget);
+  if (!isKeyword(end, END))
+    return NULL;
+
+  for (Token *token = ret->next; token != end; token = token->next) {
+    if (token->type != IdentifierToken)
+      continue;
+    Name name = token->value.__i.name;
+    if (name.kind != GlobalName && parameterIndex(procedure, name) == fn.nargs)
+      return NULL;
+  }
+
+  return ret->next;
+}
+
+/**
+ * @brief Replace constant operations in from up to stop by their value
+ */
+void foldInlinedConstants(Token *from, Token *stop) {
+  Token *token = from;
+  while (token != stop) {
+    if (token->type != OperatorToken) {
+      token = token->next;
+      continue;
+    }
+
+    EvalState state = {};
+    Token *end = token;
+    __int64_t value;
+    if (evalExpression(&state, NULL, &end, &value) && value == (int)value) {
+      token->type = LiteralToken;
+      token->value.__l = (Literal){
+          .type = IntValue,
+          .value = (LiteralValue)(int)value,
+          .msize = sizeof(__int64_t),
+      };
+      token->next = end;
+      if (end != NULL)
+        end->prev = token;
+    }
+    token = token->next;
+  }
+}
+
+/**
+ * @brief Put a copy of the expression in place of the call, arguments in
+ * place of the parameters
+ *
+ * @return First token of the copy
+ */
+Token *inlineCall(TokenStream *stream, Token *call, Token *procedure,
+                  Token *expression) {
+  uint nargs = procedure->value.__f.nargs;
+  Token *args[nargs + 1];
+  Token *after = call->next->next;
+  for (uint i = 0; i < nargs; i++) {
+    args[i] = after;
+    after = after->next;
+  }
+
+  Token *first = NULL, *last = NULL;
+  for (Token *token = expression; !isKeyword(token, END);
+       token = token->next) {
+    Token *source = token;
+    if (token->type == IdentifierToken) {
+      uint index = parameterIndex(procedure, token->value.__i.name);
+      if (index < nargs)
+        source = args[index];
+    }
+
+    Token *copy = malloc(sizeof(Token));
+    *copy = *source;
+    copy->module = call->module;
+    copy->line = call->line;
+    copy->prev = last;
+    copy->next = NULL;
+    if (last != NULL)
+      last->next = copy;
+    else
+      first = copy;
+    last = copy;
+  }
+
+  first->prev = call->prev;
+  if (call->prev != NULL)
+    call->prev->next = first;
+  else
+    *stream = first;
+  last->next = after;
+  if (after != NULL)
+    after->prev = last;
+
+  Token *before = first->prev;
+  foldInlinedConstants(first, after);
+  return before != NULL ? before->next : *stream;
+}
+
+/**
+ * @brief Inline calls to procedures that only return an expression
+ * Arguments have to be plain operands, so evaluating them in a different
+ * order or more than once can't be told apart from the call.
+ */
+void inlineProcedures(TokenStream *stream) {
+  uint nsymbols = __N_SYMBOLS__ + 1;
+  Token **procedures = calloc(nsymbols, sizeof(Token *));
+  bool *ambiguous = calloc(nsymbols, sizeof(bool));
+
+  for (Token *token = *stream; token != NULL; token = token->next)
+    if (token->type == ProcedureToken) {
+      Symbol name = token->value.__f.name.symbol;
+      ambiguous[name] = procedures[name] != NULL;
+      procedures[name] = token;
+    }
+
+  Token *token = *stream;
+  while (token != NULL) {
+    if (token->type != OperatorToken || token->value.__o != CALL ||
+        token->next->type != IdentifierToken) {
+      token = token->next;
+      continue;
+    }
+
+    Symbol name = token->next->value.__f.name.symbol;
+    Token *procedure = procedures[name];
+    Token *expression =
+        procedure != NULL && !ambiguous[name] ? inlineExpression(procedure)
+                                              : NULL;
+
+    bool plain = expression != NULL;
+    Token *arg = token->next->next;
+    for (uint i = 0; plain && i < procedure->value.__f.nargs; i++) {
+      plain = arg != NULL && isPlainOperand(arg);
+      arg = arg != NULL ? arg->next : NULL;
+    }
+
+    if (plain)
+      token = inlineCall(stream, token, procedure, expression);
+    else
+      token = token->next;
+  }
+
+  free(procedures);
+  free(ambiguous);
+}
+
+/**
+ * @brief Mark a procedure name reached, and queue what wasn't yet
+ */
+void reachProcedures(WholeProcedure *procedures, uint *byName, Symbol name,
+                     uint *queue, uint *nqueue) {
+  for (uint i = byName[name]; i != 0; i = procedures[i - 1].next)
+    if (!procedures[i - 1].reachable) {
+      procedures[i - 1].reachable = true;
+      queue[(*nqueue)++] = i - 1;
+    }
+}
+
+/**
+ * @brief Drop procedures the top-level code can't reach
+ * A procedure is reached when its name is used, by a call or otherwise.
+ */
+void stripProcedures(TokenStream *stream) {
+  uint nprocedures = 0, capacity = 64;
+  WholeProcedure *procedures = malloc(capacity * sizeof(WholeProcedure));
+  uint *byName = calloc(__N_SYMBOLS__ + 1, sizeof(uint));
+
+  for (Token *token = *stream; token != NULL; token = token->next)
+    if (token->type == ProcedureToken) {
+      if (nprocedures == capacity) {
+        capacity *= 2;
+        procedures = realloc(procedures, capacity * sizeof(WholeProcedure));
+      }
+
+      Symbol name = token->value.__f.name.symbol;
+      procedures[nprocedures] = (WholeProcedure){
+          .procedure = token,
+          .end = procedureEnd(token),
+          .next = byName[name],
+      };
+      byName[name] = ++nprocedures;
+      token = procedures[nprocedures - 1].end;
+    }
+
+  // Uses outside of every procedure are the roots
+  uint *queue = malloc((nprocedures + 1) * sizeof(uint));
+  uint nqueue = 0;
+  for (Token *token = *stream; token != NULL; token = token->next) {
+    if (token->type == ProcedureToken)
+      token = procedureEnd(token);
+    else if (token->type == IdentifierToken &&
+             token->value.__i.name.kind == ProcedureName)
+      reachProcedures(procedures, byName, token->value.__i.name.symbol, queue,
+                      &nqueue);
+  }
+
+  while (nqueue > 0) {
+    WholeProcedure *procedure = &procedures[queue[--nqueue]];
+    for (Token *token = procedure->procedure->next; token != procedure->end;
+         token = token->next)
+      if (token->type == IdentifierToken &&
+          token->value.__i.name.kind == ProcedureName)
+        reachProcedures(procedures, byName, token->value.__i.name.symbol,
+                        queue, &nqueue);
+  }
+
+  for (uint i = 0; i < nprocedures; i++) {
+    if (procedures[i].reachable)
+      continue;
+
+    Token *before = procedures[i].procedure->prev;
+    Token *after = procedures[i].end->next;
+    if (before != NULL)
+      before->next = after;
+    else
+      *stream = after;
+    if (after != NULL)
+      after->prev = before;
+  }
+
+  free(procedures);
+  free(byName);
+  free(queue);
+}
+
+/**
+ * @brief Token after a top-level statement
+ */
+Token *skipStatement(Token *token) {
+  if (token->type == ProcedureToken)
+    return procedureEnd(token)->next;
+  if (token->type != KeywordToken)
+    return skipOperand(token);
+
+  switch (token->value.__k) {
+  case SYSCALL:
+    token = token->next;
+    while (!isKeyword(token, END))
+      token = skipOperand(token);
+    return token->next;
+
+  case IF:
+  case ELIF:
+  case WHILE:
+  case RETURN:
+    if (token->next != NULL && token->next->type != KeywordToken)
+      return skipOperand(token->next);
+    return token->next;
+
+  default:
+    return token->next;
+  }
+}
+
+/**
+ * @brief Drop globals that are never read, with the constant or variable
+ * stored in them where they are declared
+ *
+ * @return Whether anything was dropped
+ */
+bool stripGlobals(TokenStream *stream) {
+  uint *uses = calloc(__N_SYMBOLS__ + 1, sizeof(uint));
+  for (Token *token = *stream; token != NULL; token = token->next)
+    if (token->type == IdentifierToken &&
+        token->value.__i.name.kind == GlobalName)
+      uses[token->value.__i.name.symbol]++;
+
+  bool stripped = false;
+  Token *token = *stream;
+  while (token != NULL) {
+    Token *next = skipStatement(token);
+
+    // `let x:int` on its own, or `let x:int = 5` or `= y`
+    Token *declaration = NULL, *value = NULL;
+    if (token->type == DeclarationToken)
+      declaration = token;
+    else if (token->type == OperatorToken && token->value.__o == ASSIGN &&
+             token->next->type == DeclarationToken &&
+             (token->next->next->type == LiteralToken ||
+              isPlainOperand(token->next->next))) {
+      declaration = token->next;
+      value = declaration->next;
+    }
+
+    if (declaration != NULL &&
+        declaration->value.__i.name.kind == GlobalName &&
+        uses[declaration->value.__i.name.symbol] == 0) {
+      if (value != NULL && value->type == IdentifierToken &&
+          value->value.__i.name.kind == GlobalName)
+        uses[value->value.__i.name.symbol]--;
+
+      Token *before = token->prev;
+      if (before != NULL)
+        before->next = next;
+      else
+        *stream = next;
+      if (next != NULL)
+        next->prev = before;
+      stripped = true;
+    }
+    token = next;
+  }
+
+  free(uses);
+  return stripped;
+}
+
+void optimizeWholeProgram(TokenStream *stream) {
+  inlineProcedures(stream);
+  stripProcedures(stream);
+  while (*stream != NULL && stripGlobals(stream))
+    ;
+}
+
+#endif
@@ -1,10 +1,14 @@
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "lexer.c"
+#include "stats.c"
+#include "symbols.c"
 #include "utils.c"
 
 #ifndef PARSER_C_INCLUDED
@@ -66,6 +70,8 @@ typedef enum OperatorTypes {
   BIT_OR,  // |
   BIT_XOR, // ^
   // ACCESSOR, // .
+
+  INDEX, // v[i], an array and an int variable or literal
   __BINARY_OPERATIONS,
 
   // Nnary Ops -------------
@@ -85,9 +91,8 @@ typedef enum ValueTypes {
 
 typedef union {
   int __i;
-  float __f;
-  str __s;
-  void *n;
+  double __f;
+  Symbol __s;
 } LiteralValue;
 
 typedef struct {
@@ -96,16 +101,33 @@ typedef struct {
   uint msize;
 } Literal;
 
+// Where a name was declared, which decides its label in the output
+typedef enum {
+  GlobalName,
+  ParameterName,
+  LocalName,
+  ProcedureName,
+} NameKind;
+
 typedef struct {
-  str name;
+  Symbol symbol;
+  uint scope : 30; // symbol of the declaring procedure, for parameters and
+                   // locals
+  uint kind : 2;   // NameKind
+} Name;
+
+typedef struct {
+  Name name;
   Type type;
   uint msize;
+  uint length; // elements of an array, 0 for a single value
 } Identifier;
 
 typedef struct {
-  str name;
+  Name name;
   Type type;
   uint nargs;
+  bool runtime; // body is provided by the compiler runtime
 } Function;
 
 // Tokenization Types ----
@@ -135,6 +157,11 @@ typedef union {
 
 struct TokenStreamNode {
   TokenType type;
+
+  // Where the token was written
+  Symbol module;
+  uint line;
+
   TokenValue value;
 
   struct TokenStreamNode *next;
@@ -182,13 +209,13 @@ void pushToken(TokenStream *stream, uint *len) {
 
 Token *popToken(TokenStream stream, uint *len) { return &stream[--(*len)]; }
 
-bool isInteger(str word) {
+bool isInteger(strview word) {
   uint __i = 0;
-  if (word[0] == '-')
+  if (word.ptr[0] == '-')
     __i++;
 
-  while (word[__i] != '\0')
-    if (!isdigit(word[__i++]))
+  while (__i < word.len)
+    if (!isdigit(word.ptr[__i++]))
       return false;
 
   // str INT64_MAX_STR = "9223372036854775807";
@@ -202,42 +229,54 @@ bool isInteger(str word) {
   return true;
 }
 
-bool isFloat(str word) {
-  uint __i = 0;
-  if (word[0] == '-')
+/**
+ * @brief Decimal with a point and an optional exponent, like -1.5 or 2.0e-3
+ */
+bool isFloat(strview word) {
+  uint __i = 0, digits = 0;
+  if (word.ptr[0] == '-')
     __i++;
 
-  uint point = strcspn(word, ".");
+  while (__i < word.len && isdigit(word.ptr[__i]))
+    __i++, digits++;
+  if (__i == word.len || word.ptr[__i++] != '.')
+    return false;
+  while (__i < word.len && isdigit(word.ptr[__i]))
+    __i++, digits++;
+  if (digits == 0)
+    return false;
 
-  /**
-   * @todo Check floatable
-   */
-
-  while (word[__i] != '\0')
-    if (!isdigit(word[__i]))
+  if (__i < word.len && (word.ptr[__i] == 'e' || word.ptr[__i] == 'E')) {
+    __i++;
+    if (__i < word.len && (word.ptr[__i] == '-' || word.ptr[__i] == '+'))
+      __i++;
+    if (__i == word.len)
       return false;
+    while (__i < word.len && isdigit(word.ptr[__i]))
+      __i++;
+  }
 
-  return true;
+  return __i == word.len;
 }
 
-Type parseStringType(str type) {
-  if (strcmp(type, "int") == 0)
+Type parseStringType(strview type) {
+  if (viewIs(type, "int"))
     return IntValue;
-  else if (strcmp(type, "float") == 0)
+  else if (viewIs(type, "float") || viewIs(type, "double"))
     return FloatValue;
-  else if (strcmp(type, "str") == 0)
+  else if (viewIs(type, "str"))
     return StringValue;
-  else if (strcmp(type, "null") == 0)
+  else if (viewIs(type, "null"))
     return NullValue;
   /* Fallback */ return IntValue;
 }
 
-uint parseTypeSize(str type) {
-  if (strcmp(type, "int") == 0)
+uint parseTypeSize(strview type) {
+  if (viewIs(type, "int"))
     return sizeof(__int64_t);
-  if (strcmp(type, "float") == 0)
-    return sizeof(float);
-  if (strcmp(type, "str") == 0)
+  if (viewIs(type, "float") || viewIs(type, "double"))
+    return sizeof(double);
+  if (viewIs(type, "str"))
     return sizeof(char *);
   /* Fallback */ return sizeof(char *);
 }
@@ -246,16 +285,60 @@ uint typeSize(Type type) {
   if (type == IntValue)
     return sizeof(__int64_t);
   if (type == FloatValue)
-    return sizeof(float);
+    return sizeof(double);
   if (type == StringValue)
     return sizeof(char *);
   /* Fallback */ return sizeof(char *);
 }
 
+bool isBlockKeyword(Keyword key) {
+  switch (key) {
+  case FN:
+  case IF:
+  case WHILE:
+  case MACRO:
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+// Stream of a module kept parsed by the compile server, src/server.c
+TokenStream warmModule(str filename);
+
+// Source position of the word being parsed, stamped on new tokens
+Symbol __PARSE_MODULE__;
+uint __PARSE_LINE__;
+
+/**
+ * @brief Label of a name in the generated assembly, built when it is emitted
+ */
+str mangledName(Name name) {
+  switch (name.kind) {
+  case ParameterName:
+    return fstr("_var_fn_%s_%s", symbolText(name.scope),
+                symbolText(name.symbol));
+  case LocalName:
+    return fstr("_var__fn_%s_%s", symbolText(name.scope),
+                symbolText(name.symbol));
+  case ProcedureName:
+    return fstr("_fn_%s", symbolText(name.symbol));
+  default:
+    return fstr("_var_%s", symbolText(name.symbol));
+  }
+}
+
+bool sameName(Name a, Name b) {
+  return a.symbol == b.symbol && a.scope == b.scope && a.kind == b.kind;
+}
+
 Token *createToken(TokenType type, TokenValue value) {
   Token *token = malloc(sizeof(Token));
   token->type = type;
   token->value = value;
+  token->module = __PARSE_MODULE__;
+  token->line = __PARSE_LINE__;
   return token;
 }
 
@@ -269,15 +352,355 @@ void pushBack(TokenStream *head, Token *node) {
   *head = node;
 }
 
+/**
+ * @brief Whether the token closes an array element, the index of INDEX v i
+ */
+bool isIndexTail(Token *token) {
+  Token *operator = token->prev != NULL ? token->prev->prev : NULL;
+  return operator != NULL && operator->type == OperatorToken &&
+         operator->value.__o == INDEX;
+}
+
 void pushInsertPrevious(TokenStream *head, Token *node) {
-  Token *prev = (*head)->prev;
+  // An array element is one operand, the operator goes in front of INDEX
+  Token *operand = isIndexTail(*head) ? (*head)->prev->prev : *head;
+  Token *prev = operand->prev;
   prev->next = node;
 
-  node->next = *head;
+  node->next = operand;
   node->prev = prev;
 
   (*head)->next = NULL;
-  (*head)->prev = node;
+  operand->prev = node;
+}
+
+/**
+ * @brief Token naming the variable or procedure declared before as word
+ */
+Token *identifierToken(TokenStream stream, strview word) {
+  Symbol symbol = internView(word);
+  bool found = false;
+
+  TokenStream head = stream;
+  Token curr = *head;
+  while (head != NULL && !found) {
+    curr = *head;
+    head = head->prev;
+
+    if (curr.type == DeclarationToken && curr.value.__i.name.symbol == symbol)
+      found = true;
+    else if (curr.type == ProcedureToken &&
+             curr.value.__f.name.symbol == symbol)
+      found = true;
+  }
+
+  if (!found)
+    CompilerError(fstr("Un-declared identifier \"%.*s\".", word.len, word.ptr));
+
+  Token *token = createToken(IdentifierToken, (TokenValue)NULL);
+  memcpy(&(token->value), &curr.value, sizeof(TokenValue));
+  return token;
+}
+
+// Longest array whose size in bytes still fits a resb operand
+#define ARRAY_MAX_LENGTH (INT_MAX / 8)
+
+/**
+ * @brief Elements of an array type like int[1024], 0 for other types
+ */
+uint parseArrayLength(strview type) {
+  uint open = viewFind(type, '[');
+  if (open == type.len)
+    return 0;
+
+  strview element = viewSlice(type, 0, open);
+  if (!viewIs(element, "int") && !viewIs(element, "float"))
+    CompilerError(fstr("Array of \"%.*s\", arrays hold int or float.",
+                       element.len, element.ptr));
+
+  strview length = viewSlice(type, open + 1, type.len - 1);
+  if (type.ptr[type.len - 1] != ']' || length.len == 0 ||
+      !isInteger(length) || length.ptr[0] == '-')
+    CompilerError(
+        fstr("Invalid array type \"%.*s\".", type.len, type.ptr));
+
+  // Stops at the bracket
+  errno = 0;
+  unsigned long n = strtoul(length.ptr, NULL, 10);
+  if (errno == ERANGE || n == 0 || n > ARRAY_MAX_LENGTH)
+    CompilerError(fstr("Array length of \"%.*s\" has to be 1 to %d.",
+                       type.len, type.ptr, ARRAY_MAX_LENGTH));
+  return n;
+}
+
+// --------------------------
+// Macros -------------------
+//
+// `macro NAME [ WORDS ] end` names a run of words. Every later NAME is
+// replaced by them before it is parsed, so a syscall wrapper compiles to the
+// same instructions as the syscall written out. `$` in the words takes the
+// next word after NAME, `$1` to `$9` a given one. Names the words declare
+// with let get a new suffix for every expansion and can't collide with the
+// code around them.
+
+#define MACRO_MAX_DEPTH 64
+#define MACRO_MAX_PARAMS 9
+
+typedef struct {
+  uint param; // argument the word stands for, from 1, 0 for none
+  uint local; // local named before the ':' or '[', from 1, 0 for none
+  uint index; // local named between the brackets, from 1, 0 for none
+} MacroWord;
+
+typedef struct {
+  strview *args;
+  strview *words; // NULL for an empty slot
+  uint hash;
+} MacroExpansion;
+
+typedef struct {
+  Symbol name;
+  strview *body;
+  MacroWord *template; // one entry per word of the body
+  uint nbody;
+  uint nparams;
+  strview *locals; // declared in the body, renamed in each expansion
+  uint nlocals;
+
+  // Expansions by their arguments, only kept when there are no locals. Open
+  // addressing on a hash of the arguments, always at most half full.
+  MacroExpansion *cache;
+  uint ncache;
+  uint cacheCapacity;
+} Macro;
+
+// Words parsed in place of a macro, and where to go on after them
+typedef struct {
+  strview *lexicon;
+  uint lexsize;
+  uint line;
+} MacroFrame;
+
+// Defined so far, a redefinition hides the earlier one
+Macro *__MACROS__;
+uint __N_MACROS__;
+
+// Numbers the locals of each expansion
+uint __MACRO_EXPANSIONS__;
+
+const str reservedWords[] = {"let",    "fn",      "if",      "then",
+                             "elif",   "else",    "end",     "while",
+                             "do",     "return",  "include", "syscall",
+                             "macro",  "null"};
+
+void registerMacro(Macro macro) {
+  __MACROS__ = realloc(__MACROS__, (__N_MACROS__ + 1) * sizeof(Macro));
+  __MACROS__[__N_MACROS__++] = macro;
+}
+
+Macro *findMacro(strview word) {
+  if (__N_MACROS__ == 0)
+    return NULL;
+
+  Symbol name = internView(word);
+  for (uint i = __N_MACROS__; i > 0; i--)
+    if (__MACROS__[i - 1].name == name)
+      return &__MACROS__[i - 1];
+  return NULL;
+}
+
+/**
+ * @brief Length of the name a word starts with, up to a ':' or '['
+ */
+uint macroNameLength(strview word) {
+  uint colon = viewFind(word, ':'), bracket = viewFind(word, '[');
+  return colon < bracket ? colon : bracket;
+}
+
+uint findMacroLocal(Macro *macro, strview name) {
+  for (uint i = 0; i < macro->nlocals; i++)
+    if (macro->locals[i].len == name.len &&
+        memcmp(macro->locals[i].ptr, name.ptr, name.len) == 0)
+      return i + 1;
+  return 0;
+}
+
+/**
+ * @brief Read `macro NAME [ WORDS ] end` and compile its template
+ * Returns how many words the definition took.
+ */
+uint defineMacro(strview *words, uint nwords) {
+  if (nwords < 4)
+    CompilerError("Unfinished macro definition.");
+
+  strview name = words[1];
+  if (!isalpha(name.ptr[0]) || name.len > 32 || viewFind(name, ':') < name.len ||
+      viewFind(name, '[') < name.len)
+    CompilerError(fstr("Invalid macro name \"%.*s\".", name.len, name.ptr));
+  for (uint i = 0; i < sizeof(reservedWords) / sizeof(str); i++)
+    if (viewIs(name, reservedWords[i]))
+      CompilerError(fstr("Macro named like the keyword \"%.*s\".", name.len,
+                         name.ptr));
+
+  if (!viewIs(words[2], "["))
+    CompilerError(fstr("Body of macro \"%.*s\" has to start with \"[\".",
+                       name.len, name.ptr));
+
+  // Brackets inside the body nest
+  uint close = 3, depth = 0;
+  while (close < nwords && (depth > 0 || !viewIs(words[close], "]"))) {
+    if (viewIs(words[close], "["))
+      depth++;
+    else if (viewIs(words[close], "]"))
+      depth--;
+    close++;
+  }
+  if (close + 1 >= nwords || !viewIs(words[close + 1], "end"))
+    CompilerError(fstr("Macro \"%.*s\" has to end with \"] end\".", name.len,
+                       name.ptr));
+
+  Macro macro = {
+      .name = internView(name),
+      .body = &words[3],
+      .nbody = close - 3,
+  };
+  macro.template = calloc(macro.nbody, sizeof(MacroWord));
+  macro.locals = malloc(macro.nbody * sizeof(strview));
+
+  for (uint i = 0; i + 1 < macro.nbody; i++)
+    if (viewIs(macro.body[i], "let")) {
+      strview local = macro.body[i + 1];
+      local.len = macroNameLength(local);
+      if (findMacroLocal(&macro, local) == 0)
+        macro.locals[macro.nlocals++] = local;
+    }
+
+  uint next = 0;
+  for (uint i = 0; i < macro.nbody; i++) {
+    strview word = macro.body[i];
+    MacroWord *slot = &macro.template[i];
+
+    if (viewIs(word, "$"))
+      slot->param = ++next;
+    else if (word.len == 2 && word.ptr[0] == '$' && word.ptr[1] >= '1' &&
+             word.ptr[1] <= '9')
+      slot->param = word.ptr[1] - '0';
+    else if (macro.nlocals > 0 && isalpha(word.ptr[0])) {
+      uint base = macroNameLength(word);
+      slot->local = findMacroLocal(&macro, viewSlice(word, 0, base));
+      if (base < word.len && word.ptr[base] == '[' &&
+          word.ptr[word.len - 1] == ']')
+        slot->index =
+            findMacroLocal(&macro, viewSlice(word, base + 1, word.len - 1));
+    }
+
+    if (slot->param > macro.nparams)
+      macro.nparams = slot->param;
+  }
+  if (macro.nparams > MACRO_MAX_PARAMS)
+    CompilerError(fstr("Macro \"%.*s\" takes more than %d arguments.",
+                       name.len, name.ptr, MACRO_MAX_PARAMS));
+
+  registerMacro(macro);
+  return close + 2;
+}
+
+/**
+ * @brief Word of an expansion with the locals it names renamed
+ */
+strview renameMacroLocals(strview word, MacroWord slot, uint expansion) {
+  uint base = macroNameLength(word);
+  str text = slot.local ? fstr("%.*s.%u", base, word.ptr, expansion)
+                        : fstr("%.*s", base, word.ptr);
+
+  strview rest = viewSlice(word, base, word.len);
+  if (slot.index)
+    text = fstr("%s[%.*s.%u]", text, rest.len - 2, &rest.ptr[1], expansion);
+  else
+    text = fstr("%s%.*s", text, rest.len, rest.ptr);
+  return viewOf(text);
+}
+
+uint macroArgsHash(strview *args, uint nargs) {
+  uint hash = 2166136261u;
+  for (uint a = 0; a < nargs; a++)
+    hash = (hash ^ symbolHash(args[a].ptr, args[a].len)) * 16777619u;
+  return hash;
+}
+
+/**
+ * @brief Slot of the expansion for these arguments, empty if there is none
+ */
+MacroExpansion *macroCacheSlot(Macro *macro, strview *args, uint hash) {
+  uint mask = macro->cacheCapacity - 1;
+  for (uint i = hash & mask;; i = (i + 1) & mask) {
+    MacroExpansion *slot = &macro->cache[i];
+    if (slot->words == NULL)
+      return slot;
+    if (slot->hash != hash)
+      continue;
+
+    bool same = true;
+    for (uint a = 0; a < macro->nparams && same; a++)
+      same = slot->args[a].len == args[a].len &&
+             memcmp(slot->args[a].ptr, args[a].ptr, args[a].len) == 0;
+    if (same)
+      return slot;
+  }
+}
+
+void growMacroCache(Macro *macro) {
+  MacroExpansion *old = macro->cache;
+  uint oldCapacity = macro->cacheCapacity;
+
+  macro->cacheCapacity = oldCapacity ? 2 * oldCapacity : 16;
+  macro->cache = calloc(macro->cacheCapacity, sizeof(MacroExpansion));
+  for (uint i = 0; i < oldCapacity; i++)
+    if (old[i].words != NULL)
+      *macroCacheSlot(macro, old[i].args, old[i].hash) = old[i];
+  free(old);
+}
+
+/**
+ * @brief Words a macro stands for with these arguments
+ * Without locals the same arguments always give the same words, those are
+ * built once.
+ */
+strview *expandMacro(Macro *macro, strview *args) {
+  if (macro->nparams == 0 && macro->nlocals == 0)
+    return macro->body;
+
+  MacroExpansion *cached = NULL;
+  uint hash = 0;
+  if (macro->nlocals == 0) {
+    if (2 * (macro->ncache + 1) >= macro->cacheCapacity)
+      growMacroCache(macro);
+
+    hash = macroArgsHash(args, macro->nparams);
+    cached = macroCacheSlot(macro, args, hash);
+    if (cached->words != NULL)
+      return cached->words;
+  }
+
+  uint expansion = ++__MACRO_EXPANSIONS__;
+  strview *words = malloc(macro->nbody * sizeof(strview));
+  for (uint i = 0; i < macro->nbody; i++) {
+    MacroWord slot = macro->template[i];
+    if (slot.param)
+      words[i] = args[slot.param - 1];
+    else if (slot.local || slot.index)
+      words[i] = renameMacroLocals(macro->body[i], slot, expansion);
+    else
+      words[i] = macro->body[i];
+  }
+
+  if (cached != NULL) {
+    strview *kept = malloc(macro->nparams * sizeof(strview));
+    memcpy(kept, args, macro->nparams * sizeof(strview));
+    *cached = (MacroExpansion){kept, words, hash};
+    macro->ncache++;
+  }
+  return words;
 }
 
 TokenStream parse(const str filename) {
@@ -286,113 +709,182 @@ TokenStream parse(const str filename) {
    */
 
   uint lexsize = 0;
-  str *lexicon;
-  lex(filename, &lexicon, &lexsize);
+  strview *lexicon;
+  uint *lines;
+  statsBegin(PHASE_LEX);
+  lex(filename, &lexicon, &lines, &lexsize);
+  statsEnd();
+
+  const uint nwords = lexsize;
+  const Symbol module = intern(filename);
 
   Token *_stream_head = NULL;
 
-  while (lexsize) {
-    const str word = *lexicon;
-    const uint len = strlen(word);
+  // Procedure whose parameter list or body is being read, the names declared
+  // there are mangled with its name
+  Name scope = {.kind = GlobalName};
+  uint scopeDepth = 0;
+
+  // Expansions being parsed, innermost last
+  MacroFrame frames[MACRO_MAX_DEPTH];
+  uint expanding = 0;
+
+  while (true) {
+    // Go on after the macro once its words are parsed
+    while (lexsize == 0 && expanding > 0) {
+      expanding--;
+      lexicon = frames[expanding].lexicon;
+      lexsize = frames[expanding].lexsize;
+    }
+    if (lexsize == 0)
+      break;
 
-    if /* Handle comments */ (word[0] == COMMENT) {
+    const strview word = *lexicon;
+    const uint len = word.len;
+    Macro *macro;
+
+    // Tokens of an expansion belong to the line that used the macro
+    __PARSE_MODULE__ = module;
+    __PARSE_LINE__ =
+        expanding > 0 ? frames[0].line : lines[nwords - lexsize];
+
+    if /* Handle comments */ (word.ptr[0] == COMMENT) {
       // Ignore for now
-    } else if /* Delimiter */ (strcmp(word, ";") == 0) {
+    } else if /* Delimiter */ (viewIs(word, ";")) {
       // Ignore for now, auto splitting
-    } else if /* Expression Start */ (strcmp(word, "[") == 0 ||
-                                      strcmp(word, "{") == 0 ||
-                                      strcmp(word, "(") == 0) {
+    } else if /* Expression Start */ (viewIs(word, "[") ||
+                                      viewIs(word, "{") ||
+                                      viewIs(word, "(")) {
+      if (_stream_head != NULL && _stream_head->type == ProcedureToken)
+        scope = (Name){.symbol = _stream_head->value.__f.name.symbol,
+                       .kind = ParameterName};
+
       // check previous
       Token *tail = createToken(ExpressionStartToken, (TokenValue)NULL);
       pushBack(&_stream_head, tail);
-    } else if /* Expression End */ (strcmp(word, "]") == 0 ||
-                                    strcmp(word, "}") == 0 ||
-                                    strcmp(word, ")") == 0) {
+    } else if /* Expression End */ (viewIs(word, "]") ||
+                                    viewIs(word, "}") ||
+                                    viewIs(word, ")")) {
+      if (scope.kind == ParameterName) {
+        scope.kind = LocalName;
+        scopeDepth = 0;
+      }
+
       // check previous
       Token *tail = createToken(ExpressionEndToken, (TokenValue)NULL);
       pushBack(&_stream_head, tail);
     }
     // Keywords ---------------------------------------------------------------
-    else if /* Include other files */ (strcmp(word, "include") == 0) {
+    else if /* Include other files */ (viewIs(word, "include")) {
       lexicon = &lexicon[1];
       lexsize--;
 
-      str arg = *lexicon;
+      // Module paths are interned, they outlive the tokens naming them
+      str arg = symbolText(internView(*lexicon));
       setTargetCompiling(arg);
 
-      TokenStream _include_ = parse(arg);
-      _include_->prev = _stream_head;
-      _stream_head->next = _include_;
-
-      while (_include_->next != NULL)
-        _stream_head = _include_->next;
-    } else if /* End */ (strcmp(word, "while") == 0) {
+      TokenStream _include_ = warmModule(arg);
+      if (_include_ == NULL)
+        _include_ = parse(arg);
+      if (_include_ != NULL) {
+        _include_->prev = _stream_head;
+        if (_stream_head != NULL)
+          _stream_head->next = _include_;
+
+        // Continue after the last token of the included module
+        _stream_head = _include_;
+        while (_stream_head->next != NULL)
+          _stream_head = _stream_head->next;
+      }
+    } else if /* End */ (viewIs(word, "while")) {
+      scopeDepth++;
       Token *tail = createToken(KeywordToken, (TokenValue)(Keyword)WHILE);
       pushBack(&_stream_head, tail);
-    } else if /* End */ (strcmp(word, "if") == 0) {
+    } else if /* End */ (viewIs(word, "if")) {
+      scopeDepth++;
       Token *tail = createToken(KeywordToken, (TokenValue)(Keyword)IF);
       pushBack(&_stream_head, tail);
-    } else if /* End */ (strcmp(word, "then") == 0) {
+    } else if /* End */ (viewIs(word, "then")) {
       Token *tail = createToken(KeywordToken, (TokenValue)(Keyword)THEN);
       pushBack(&_stream_head, tail);
-    } else if /* End */ (strcmp(word, "elif") == 0) {
+    } else if /* End */ (viewIs(word, "elif")) {
       Token *tail = createToken(KeywordToken, (TokenValue)(Keyword)ELIF);
       pushBack(&_stream_head, tail);
-    } else if /* Else */ (strcmp(word, "else") == 0) {
+    } else if /* Else */ (viewIs(word, "else")) {
       Token *tail = createToken(KeywordToken, (TokenValue)(Keyword)ELSE);
       pushBack(&_stream_head, tail);
-    } else if /* Do */ (strcmp(word, "do") == 0) {
+    } else if /* Do */ (viewIs(word, "do")) {
       Token *tail = createToken(KeywordToken, (TokenValue)(Keyword)DO);
       pushBack(&_stream_head, tail);
-    } else if /* End */ (strcmp(word, "end") == 0) {
+    } else if /* End */ (viewIs(word, "end")) {
+      // The first unmatched end closes the procedure body
+      if (scope.kind == LocalName && scopeDepth-- == 0)
+        scope = (Name){.kind = GlobalName};
+
       Token *tail = createToken(KeywordToken, (TokenValue)(Keyword)END);
       pushBack(&_stream_head, tail);
-    } else if /* Return */ (strcmp(word, "return") == 0) {
+    } else if /* Return */ (viewIs(word, "return")) {
       Token *tail = createToken(KeywordToken, (TokenValue)(Keyword)RETURN);
       pushBack(&_stream_head, tail);
-    } else if /* Syscall */ (strcmp(word, "syscall") == 0) {
+    } else if /* Syscall */ (viewIs(word, "syscall")) {
       Token *tail = createToken(KeywordToken, (TokenValue)(Keyword)SYSCALL);
       pushBack(&_stream_head, tail);
-    } else if /* Macro */ (strcmp(word, "macro") == 0) {
-      Token *tail = createToken(KeywordToken, (TokenValue)(Keyword)MACRO);
-      pushBack(&_stream_head, tail);
+    } else if /* Macro */ (viewIs(word, "macro")) {
+      // Only kept in the macro table, the end is consumed below
+      uint used = defineMacro(lexicon, lexsize);
+      lexicon = &lexicon[used - 1];
+      lexsize -= used - 1;
     }
     // Declarations -----------------------------------------------------------
-    else if /* Variable declaration */ (strcmp(word, "let") == 0) {
+    else if /* Variable declaration */ (viewIs(word, "let")) {
       lexicon = &lexicon[1];
       lexsize--;
 
-      str arg = *lexicon;
-      uint split = strcspn(arg, ":");
-      if (split == strlen(arg))
-        CompilerError(fstr("Untyped variable \"%s\" not supported yet.", arg));
-
-      arg[split++] = '\0';
-      str type = &arg[split];
+      strview arg = *lexicon;
+      uint split = viewFind(arg, ':');
+      if (split == arg.len)
+        CompilerError(fstr("Untyped variable \"%.*s\" not supported yet.",
+                           arg.len, arg.ptr));
+
+      strview name = viewSlice(arg, 0, split);
+      strview type = viewSlice(arg, split + 1, arg.len);
+
+      // Arrays are the element type with the length in brackets, int[1024]
+      uint length = parseArrayLength(type);
+      if (length > 0) {
+        if (scope.kind == ParameterName)
+          CompilerError(fstr("Array parameter \"%.*s\", arrays are passed "
+                             "by address as a ptr.",
+                             name.len, name.ptr));
+        type = viewSlice(type, 0, viewFind(type, '['));
+      }
 
       Token *tail = createToken(DeclarationToken, 
         (TokenValue)(Identifier){
-          .name = fstr(arg),
-          .msize = parseTypeSize(type),
+          .name = {.symbol = internView(name), .scope = scope.symbol,
+                   .kind = scope.kind},
+          .msize = parseTypeSize(type) * (length > 0 ? length : 1),
           .type = parseStringType(type),
+          .length = length,
         });
 
       pushBack(&_stream_head, tail);
-    } else if /* Function Declarations */ (strcmp(word, "fn") == 0) {
+    } else if /* Function Declarations */ (viewIs(word, "fn")) {
       lexicon = &lexicon[1];
       lexsize--;
 
-      str arg = *lexicon;
-      uint split = strcspn(arg, ":");
-      if (split == strlen(arg))
-        CompilerError(fstr("Untyped function \"%s\" not supported yet.", arg));
+      strview arg = *lexicon;
+      uint split = viewFind(arg, ':');
+      if (split == arg.len)
+        CompilerError(fstr("Untyped function \"%.*s\" not supported yet.",
+                           arg.len, arg.ptr));
 
-      arg[split++] = '\0';
-      str type = &arg[split];
+      strview name = viewSlice(arg, 0, split);
+      strview type = viewSlice(arg, split + 1, arg.len);
 
       Token *tail = createToken(ProcedureToken, 
         (TokenValue)(Function){
-          .name = fstr(arg),
+          .name = {.symbol = internView(name), .kind = ProcedureName},
           .type = parseStringType(type),
           .nargs = 0,
         });
@@ -400,44 +892,66 @@ TokenStream parse(const str filename) {
       pushBack(&_stream_head, tail);
     }
     // Operations -------------------------------------------------------------
-    else if /* Assignment Operation */ (strcmp(word, "=") == 0) {
+    else if /* Assignment Operation */ (viewIs(word, "=")) {
       Token *prev = _stream_head;
-      if (prev->type != DeclarationToken && prev->type != IdentifierToken)
+      if (prev->type != DeclarationToken && prev->type != IdentifierToken &&
+          !isIndexTail(prev))
         CompilerError(fstr("Assigning to non-identifier \"%d\".", prev->type));
 
       Token *tail = createToken(OperatorToken, (TokenValue)(Operator)ASSIGN);
       pushInsertPrevious(&_stream_head, tail);
-    } else if /* Addition Operation */ (strcmp(word, "+") == 0) {
+    } else if /* Addition Operation */ (viewIs(word, "+")) {
       Token *tail = createToken(OperatorToken, (TokenValue)(Operator)ADD);
       pushInsertPrevious(&_stream_head, tail);
-    } else if /* Subtraction Operation */ (strcmp(word, "-") == 0) {
+    } else if /* Subtraction Operation */ (viewIs(word, "-")) {
       Token *tail = createToken(OperatorToken, (TokenValue)(Operator)SUB);
       pushInsertPrevious(&_stream_head, tail);
-    } else if /* Multiplication Operation */ (strcmp(word, "*") == 0) {
+    } else if /* Multiplication Operation */ (viewIs(word, "*")) {
       Token *tail = createToken(OperatorToken, (TokenValue)(Operator)MUL);
       pushInsertPrevious(&_stream_head, tail);
-    } else if /* Division Operation */ (strcmp(word, "/") == 0) {
+    } else if /* Division Operation */ (viewIs(word, "/")) {
       Token *tail = createToken(OperatorToken, (TokenValue)(Operator)DIV);
       pushInsertPrevious(&_stream_head, tail);
-    } else if /* Division Operation */ (strcmp(word, "%") == 0) {
+    } else if /* Division Operation */ (viewIs(word, "%")) {
       Token *tail = createToken(OperatorToken, (TokenValue)(Operator)MOD);
       pushInsertPrevious(&_stream_head, tail);
-    } else if /* Logical AND Operation */ (strcmp(word, "&&") == 0) {
+    } else if /* Logical AND Operation */ (viewIs(word, "&&")) {
       Token *tail = createToken(OperatorToken, (TokenValue)(Operator)LOGICAL_AND);
       pushInsertPrevious(&_stream_head, tail);
-    } else if /* Logical OR Operation */ (strcmp(word, "||") == 0) {
+    } else if /* Logical OR Operation */ (viewIs(word, "||")) {
       Token *tail = createToken(OperatorToken, (TokenValue)(Operator)LOGICAL_OR);
       pushInsertPrevious(&_stream_head, tail);
-    } else if /* Logical OR Operation */ (strcmp(word, "!!") == 0) {
+    } else if /* Logical OR Operation */ (viewIs(word, "!!")) {
       Token *tail = createToken(OperatorToken, (TokenValue)(Operator)LOGICAL_NOT);
       pushInsertPrevious(&_stream_head, tail);
-    } else if /* Bit shift right Operation */ (strcmp(word, ">>") == 0) {
+    } else if /* Bit shift right Operation */ (viewIs(word, ">>")) {
       Token *tail = createToken(OperatorToken, (TokenValue)(Operator)BIT_SHIFT_RIGHT);
       pushInsertPrevious(&_stream_head, tail);
-    } else if /* Bit shift right Operation */ (strcmp(word, "<<") == 0) {
+    } else if /* Bit shift right Operation */ (viewIs(word, "<<")) {
       Token *tail = createToken(OperatorToken, (TokenValue)(Operator)BIT_SHIFT_LEFT);
       pushInsertPrevious(&_stream_head, tail);
-    } else if /* Call Operation */ (strcmp(word, "<|") == 0) {
+    } else if /* Bitwise AND Operation */ (viewIs(word, "&")) {
+      Token *tail = createToken(OperatorToken, (TokenValue)(Operator)BIT_AND);
+      pushInsertPrevious(&_stream_head, tail);
+    } else if /* Bitwise OR Operation */ (viewIs(word, "|")) {
+      Token *tail = createToken(OperatorToken, (TokenValue)(Operator)BIT_OR);
+      pushInsertPrevious(&_stream_head, tail);
+    } else if /* Bitwise XOR Operation */ (viewIs(word, "^")) {
+      Token *tail = createToken(OperatorToken, (TokenValue)(Operator)BIT_XOR);
+      pushInsertPrevious(&_stream_head, tail);
+    } else if /* Greater than Operation */ (viewIs(word, ">")) {
+      Token *tail = createToken(OperatorToken, (TokenValue)(Operator)LOGICAL_GREATER_THAN);
+      pushInsertPrevious(&_stream_head, tail);
+    } else if /* Less than Operation */ (viewIs(word, "<")) {
+      Token *tail = createToken(OperatorToken, (TokenValue)(Operator)LOGICAL_LESS_THAN);
+      pushInsertPrevious(&_stream_head, tail);
+    } else if /* Equality Operation */ (viewIs(word, "==")) {
+      Token *tail = createToken(OperatorToken, (TokenValue)(Operator)LOGICAL_EQUAL);
+      pushInsertPrevious(&_stream_head, tail);
+    } else if /* Inequality Operation */ (viewIs(word, "!=")) {
+      Token *tail = createToken(OperatorToken, (TokenValue)(Operator)LOGICAL_NOT_EQUAL);
+      pushInsertPrevious(&_stream_head, tail);
+    } else if /* Call Operation */ (viewIs(word, "<|")) {
       Function callee = _stream_head->value.__f;
       TokenStream head = _stream_head;
 
@@ -445,7 +959,8 @@ TokenStream parse(const str filename) {
       bool found = false;
       while (head->prev != NULL) {
         Token *curr = head->prev;
-        if (curr->type == ProcedureToken && strcmp(curr->value.__f.name, callee.name) == 0) {
+        if (curr->type == ProcedureToken &&
+            curr->value.__f.name.symbol == callee.name.symbol) {
           found = true;
           break;
         }
@@ -453,7 +968,8 @@ TokenStream parse(const str filename) {
       }
 
       if (!found)
-        CompilerError(fstr("Use of un-declared function \"%s\".", callee.name));
+        CompilerError(fstr("Use of un-declared function \"%s\".",
+                           symbolText(callee.name.symbol)));
 
       Token *tail = createToken(OperatorToken, (TokenValue)(Operator)CALL);
       pushInsertPrevious(&_stream_head, tail);
@@ -463,34 +979,33 @@ TokenStream parse(const str filename) {
       Token *tail = createToken(LiteralToken,
         (TokenValue)(Literal){
           .type = IntValue,
-          .value = (LiteralValue)(int)atoi(word),
+          .value = (LiteralValue)(int)atoi(word.ptr), // stops at the delimiter
           .msize = sizeof(__int64_t),
         });
 
       pushBack(&_stream_head, tail);
-    } else if /* String Literals */ (word[0] == '\"' && word[len - 1] == '\"') {
-      str value = &word[1];
-      value[len - 2] = '\0';
+    } else if /* String Literals */ (len >= 2 && word.ptr[0] == '\"' &&
+                                     word.ptr[len - 1] == '\"') {
+      strview value = viewSlice(word, 1, len - 1);
 
       Token *tail = createToken(LiteralToken,
         (TokenValue)(Literal){
           .type = StringValue,
-          .value = (LiteralValue)(str)value,
+          .value = (LiteralValue)internView(value),
           .msize = (len - 2) * sizeof(char),
         });
 
-      strcpy(tail->value.__l.value.__s, value);
       pushBack(&_stream_head, tail);
     } else if /* Float Literals */ (isFloat(word)) {
       Token *tail = createToken(LiteralToken,
         (TokenValue)(Literal){
           .type = FloatValue,
-          .value = (LiteralValue)(float)atof(word),
-          .msize = sizeof(float),
+          .value = (LiteralValue)strtod(word.ptr, NULL), // stops at the delimiter
+          .msize = sizeof(double),
         });
 
       pushBack(&_stream_head, tail);
-    } else if /* NULL Literals */ (strcmp(word, "null") == 0) {
+    } else if /* NULL Literals */ (viewIs(word, "null")) {
       Token *tail = createToken(LiteralToken,
         (TokenValue)(Literal){
           .type = NullValue,
@@ -501,41 +1016,83 @@ TokenStream parse(const str filename) {
       pushBack(&_stream_head, tail);
     }
     // Word or Identifier -----------------------------------------------------
-    else if (isalpha(word[0]) && strlen(word) <= 32) {
-      bool found = false;
-
-      TokenStream head = _stream_head;
-      Token curr = *head;
-      while (head != NULL && !found) {
-        curr = *head;
-        head = head->prev;
-
-        if (curr.type == DeclarationToken &&
-            strcmp(curr.value.__i.name, word) == 0)
-          found = true;
-        else if (curr.type == ProcedureToken &&
-                 strcmp(curr.value.__f.name, word) == 0)
-          found = true;
-      }
-
-      if (!found)
-        CompilerError(fstr("Un-declared identifier \"%s\".", word));
-
-      Token *tail = malloc(sizeof(Token));
-      tail->type = IdentifierToken;
-      memcpy(&(tail->value), &curr.value, sizeof(TokenValue));
-
+    else if /* Macro use */ (isalpha(word.ptr[0]) &&
+                             (macro = findMacro(word)) != NULL) {
+      if (lexsize - 1 < macro->nparams)
+        CompilerError(fstr("Macro \"%.*s\" takes %u arguments.", len,
+                           word.ptr, macro->nparams));
+      if (expanding == MACRO_MAX_DEPTH)
+        CompilerError(fstr("Macro \"%.*s\" expands more than %d levels deep.",
+                           len, word.ptr, MACRO_MAX_DEPTH));
+
+      strview *args = &lexicon[1];
+      frames[expanding] = (MacroFrame){
+          .lexicon = &lexicon[1 + macro->nparams],
+          .lexsize = lexsize - 1 - macro->nparams,
+          .line = __PARSE_LINE__,
+      };
+      expanding++;
+
+      lexicon = expandMacro(macro, args);
+      lexsize = macro->nbody;
+      continue;
+    } else if /* Array Element */ (isalpha(word.ptr[0]) &&
+                                 word.ptr[len - 1] == ']' &&
+                                 viewFind(word, '[') < len) {
+      uint open = viewFind(word, '[');
+      strview name = viewSlice(word, 0, open);
+      strview index = viewSlice(word, open + 1, len - 1);
+
+      Token *array = identifierToken(_stream_head, name);
+      Identifier iden = array->value.__i;
+      if (iden.name.kind == ProcedureName || iden.length == 0)
+        CompilerError(fstr("\"%.*s\" isn't an array.", name.len, name.ptr));
+
+      // Elements are read and written at v + 8 * i, the index stays simple
+      Token *at;
+      if (index.len > 0 && isInteger(index)) {
+        int value = atoi(index.ptr); // stops at the bracket
+        if (value < 0 || value >= iden.length)
+          CompilerError(fstr("Index %d out of bounds of \"%.*s\".", value,
+                             name.len, name.ptr));
+        at = createToken(LiteralToken,
+          (TokenValue)(Literal){
+            .type = IntValue,
+            .value = (LiteralValue)value,
+            .msize = sizeof(__int64_t),
+          });
+      } else if (index.len > 0 && isalpha(index.ptr[0])) {
+        at = identifierToken(_stream_head, index);
+        Identifier var = at->value.__i;
+        if (var.name.kind == ProcedureName || var.length > 0 ||
+            var.type != IntValue)
+          CompilerError(fstr("Index of \"%.*s\" has to be an int.", name.len,
+                             name.ptr));
+      } else
+        CompilerError(fstr("Index of \"%.*s\" has to be an int variable or "
+                           "literal.",
+                           name.len, name.ptr));
+
+      pushBack(&_stream_head,
+               createToken(OperatorToken, (TokenValue)(Operator)INDEX));
+      pushBack(&_stream_head, array);
+      pushBack(&_stream_head, at);
+    } else if (isalpha(word.ptr[0]) && len <= 32) {
+      Token *tail = identifierToken(_stream_head, word);
       pushBack(&_stream_head, tail);
     }
 
     else /* Something unrecognised was thrown own way */
-      CompilerError(fstr("Unknown word \"%s\".", word));
+      CompilerError(fstr("Unknown word \"%.*s\".", word.len, word.ptr));
 
     // Advance to next lex
     lexicon = &lexicon[1];
     lexsize--;
   }
 
+  if (_stream_head == NULL)
+    return NULL;
+
   // Roll pointer back to begenning of stream
   while (_stream_head->prev != NULL)
     _stream_head = _stream_head->prev;
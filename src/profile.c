@@ -0,0 +1,325 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser.c"
+#include "symbols.c"
+#include "utils.c"
+
+#ifndef PROFILE_C_INCLUDED
+#define PROFILE_C_INCLUDED
+// --------------------------
+// Profiles -----------------
+//
+// -fprofile-generate counts in .bss how often each procedure is entered,
+// each if and while is reached, each arm of an if runs and each loop body
+// runs. At exit the program writes the counts to a profile, one `KEY COUNT`
+// line each. -fprofile-use=FILE reads them back: arms that rarely run move
+// behind the code of their procedure so the common path falls through, hot
+// loops get an aligned head and hot procedures a bigger inlining budget.
+// Keys name a block by its module, line and
+// place on the line, so they hold whatever the optimizer drops or inlines
+// around it.
+
+#define PROFILE_DEFAULT_PATH "dang.profile"
+
+// An arm is cold when it runs at most once per this many times its if is
+// reached
+#define PROFILE_COLD_RATIO 16
+
+// Loop bodies run at least this often are aligned
+#define PROFILE_HOT_LOOP 4096
+
+// Procedures entered at least this often may inline bigger expressions
+#define PROFILE_HOT_CALLS 1024
+
+// Ifs and whiles open at once, as deep as codegen nests them
+#define PROFILE_MAX_DEPTH 64
+
+typedef struct {
+  str key;    // if: or while: with module, line and place on the line
+  uint arms;  // of an if: then, every elif and the else; 1 for a while
+  bool *cold; // arms that rarely run, by the profile
+  bool align; // a while runs its body at least PROFILE_HOT_LOOP times
+} ProfileBlock;
+
+// Blocks by the number of their labels, every if and while in stream order
+ProfileBlock *__PROFILE_BLOCKS__;
+uint __N_PROFILE_BLOCKS__;
+
+// Set when building with -fprofile-generate or -fprofile-use
+bool __PROFILE_GENERATE__;
+bool __PROFILE_USE__;
+
+// Counts read from the profile, by the symbol of their key
+uint64_t *__PROFILE_COUNTS__;
+bool *__PROFILE_KNOWN__;
+uint __PROFILE_SYMBOLS__;
+
+// Counters of the instrumented build, dumped in this order
+str *__PROFILE_KEYS__;
+str *__PROFILE_LABELS__;
+uint __N_PROFILE_COUNTERS__;
+
+void loadProfile(str path) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    CompilerError(fstr("Couldn't open profile \"%s\".", path));
+
+  char key[1024];
+  unsigned long long count;
+  while (fscanf(f, "%1023s %llu", key, &count) == 2) {
+    Symbol symbol = intern(key);
+    if (symbol >= __PROFILE_SYMBOLS__) {
+      uint capacity = __PROFILE_SYMBOLS__ ? __PROFILE_SYMBOLS__ : 256;
+      while (capacity <= symbol)
+        capacity *= 2;
+      __PROFILE_COUNTS__ =
+          realloc(__PROFILE_COUNTS__, capacity * sizeof(uint64_t));
+      __PROFILE_KNOWN__ = realloc(__PROFILE_KNOWN__, capacity * sizeof(bool));
+      memset(&__PROFILE_KNOWN__[__PROFILE_SYMBOLS__], 0,
+             capacity - __PROFILE_SYMBOLS__);
+      __PROFILE_SYMBOLS__ = capacity;
+    }
+    __PROFILE_COUNTS__[symbol] = count;
+    __PROFILE_KNOWN__[symbol] = true;
+  }
+
+  fclose(f);
+  __PROFILE_USE__ = true;
+}
+
+/**
+ * @brief Count of a key in the profile, false when it has none
+ */
+bool profileCount(str key, uint64_t *count) {
+  Symbol symbol = intern(key);
+  if (symbol >= __PROFILE_SYMBOLS__ || !__PROFILE_KNOWN__[symbol])
+    return false;
+  *count = __PROFILE_COUNTS__[symbol];
+  return true;
+}
+
+/**
+ * @brief Tokens an inlined expression of the procedure may have
+ */
+uint profileInlineBudget(Function fn, uint budget) {
+  uint64_t calls;
+  if (!profileCount(fstr("fn:%s", symbolText(fn.name.symbol)), &calls))
+    return budget;
+  if (calls == 0)
+    return 3; // one operation, never bigger than the call
+  return calls >= PROFILE_HOT_CALLS ? 4 * budget : budget;
+}
+
+void addProfileCounter(str key, str label) {
+  __PROFILE_KEYS__ = realloc(__PROFILE_KEYS__,
+                             (__N_PROFILE_COUNTERS__ + 1) * sizeof(str));
+  __PROFILE_LABELS__ = realloc(__PROFILE_LABELS__,
+                               (__N_PROFILE_COUNTERS__ + 1) * sizeof(str));
+  __PROFILE_KEYS__[__N_PROFILE_COUNTERS__] = key;
+  __PROFILE_LABELS__[__N_PROFILE_COUNTERS__++] = label;
+}
+
+/**
+ * @brief Counter of an if or while being reached, or of its arm running
+ */
+str profileBlockCounter(uint block, int arm) {
+  if (arm < 0)
+    return fstr("_prof_b%u", block);
+  return fstr("_prof_b%u_%d", block, arm);
+}
+
+/**
+ * @brief Decide the layout of an if or while from its counts
+ */
+void planProfileBlock(ProfileBlock *block, Keyword key) {
+  block->cold = calloc(block->arms, sizeof(bool));
+
+  uint64_t reached, runs;
+  if (!__PROFILE_USE__ || !profileCount(block->key, &reached))
+    return;
+
+  for (uint arm = 0; arm < block->arms; arm++) {
+    str name = key == WHILE ? fstr("%s/body", block->key)
+                            : fstr("%s/%u", block->key, arm);
+    if (!profileCount(name, &runs))
+      continue;
+
+    if (key == WHILE)
+      block->align = runs >= PROFILE_HOT_LOOP;
+    else
+      block->cold[arm] = runs * PROFILE_COLD_RATIO <= reached;
+  }
+}
+
+/**
+ * @brief Number every if and while the way lowering does, name them by
+ * position and read their counts. Instrumented builds get their counters.
+ */
+void planProfile(TokenStream stream) {
+  uint open[PROFILE_MAX_DEPTH], depths[PROFILE_MAX_DEPTH];
+  uint nopen = 0, depth = 0, nblocks = 0;
+  Symbol module = 0;
+  uint line = 0, onLine = 0;
+
+  for (Token *token = stream; token != NULL; token = token->next)
+    nblocks += token->type == KeywordToken &&
+               (token->value.__k == IF || token->value.__k == WHILE);
+  __PROFILE_BLOCKS__ = calloc(nblocks + 1, sizeof(ProfileBlock));
+  __N_PROFILE_BLOCKS__ = 0;
+
+  Token *token = stream;
+  while (token != NULL) {
+    if (token->type == ProcedureToken) {
+      Function fn = token->value.__f;
+      for (uint i = 0; i <= fn.nargs; i++)
+        token = token->next;
+
+      // Runtime procedures are only a signature, skip their end
+      if (fn.runtime) {
+        token = token->next;
+        continue;
+      }
+
+      depth++;
+      if (__PROFILE_GENERATE__) {
+        str key = fstr("fn:%s", symbolText(fn.name.symbol));
+        addProfileCounter(key, fstr("_prof%s", mangledName(fn.name)));
+      }
+      continue;
+    }
+
+    if (token->type == KeywordToken) {
+      Keyword key = token->value.__k;
+      if (isBlockKeyword(key))
+        depth++;
+
+      if (key == IF || key == WHILE) {
+        if (nopen == PROFILE_MAX_DEPTH)
+          CompilerError("Control flow nested too deeply.");
+
+        if (token->module != module || token->line != line)
+          onLine = 0;
+        module = token->module;
+        line = token->line;
+
+        uint id = __N_PROFILE_BLOCKS__++;
+        __PROFILE_BLOCKS__[id] = (ProfileBlock){
+            .key = fstr("%s:%s:%u:%u", key == IF ? "if" : "while",
+                        symbolText(module), line, onLine++),
+            .arms = 1,
+        };
+        depths[nopen] = depth;
+        open[nopen++] = id;
+        if (key == WHILE)
+          planProfileBlock(&__PROFILE_BLOCKS__[id], WHILE);
+      } else if ((key == ELIF || key == ELSE) && nopen > 0)
+        __PROFILE_BLOCKS__[open[nopen - 1]].arms++;
+      else if (key == END) {
+        if (nopen > 0 && depths[nopen - 1] == depth) {
+          ProfileBlock *block = &__PROFILE_BLOCKS__[open[--nopen]];
+          if (block->key[0] == 'i')
+            planProfileBlock(block, IF);
+        }
+        if (depth > 0)
+          depth--;
+      }
+    }
+
+    token = token->next;
+  }
+
+  if (!__PROFILE_GENERATE__)
+    return;
+
+  for (uint id = 0; id < __N_PROFILE_BLOCKS__; id++) {
+    ProfileBlock *block = &__PROFILE_BLOCKS__[id];
+    bool loop = block->key[0] == 'w';
+    addProfileCounter(block->key, profileBlockCounter(id, -1));
+    for (uint arm = 0; arm < block->arms; arm++)
+      addProfileCounter(loop ? fstr("%s/body", block->key)
+                             : fstr("%s/%u", block->key, arm),
+                        profileBlockCounter(id, arm));
+  }
+}
+
+/**
+ * @brief Counters, their keys, and the routine writing them to the profile
+ * Called before the program exits, it may use any register.
+ */
+void emitProfileDump(strbuf *func, strbuf *data, strbuf *bss, str path) {
+  uint size = 0;
+  for (uint i = 0; i < __N_PROFILE_COUNTERS__; i++) {
+    fline(bss, "%s: resq 1", __PROFILE_LABELS__[i]);
+    fline(data, "_prof_key%u: db \"%s \"", i, __PROFILE_KEYS__[i]);
+    size += strlen(__PROFILE_KEYS__[i]) + 1 + 21;
+  }
+
+  wline(data, "_prof_table:");
+  for (uint i = 0; i < __N_PROFILE_COUNTERS__; i++)
+    fline(data, "dq _prof_key%u, %u, %s", i,
+          (uint)strlen(__PROFILE_KEYS__[i]) + 1, __PROFILE_LABELS__[i]);
+  fline(data, "_prof_path: db \"%s\", 0", path);
+  fline(bss, "_prof_buffer: resb %u", size + 1);
+  wline(bss, "_prof_digits: resb 24");
+
+  wline(func, "_prof_dump:");
+  wline(func, "mov rdi, _prof_buffer");
+  wline(func, "mov rbx, _prof_table");
+  fline(func, "mov r12, %u", __N_PROFILE_COUNTERS__);
+  wline(func, ".entry:");
+  wline(func, "test r12, r12");
+  wline(func, "jz .write");
+  wline(func, "mov rsi, [rbx]");
+  wline(func, "mov rcx, [rbx + 8]");
+  wline(func, "rep movsb");
+  wline(func, "mov rax, [rbx + 16]");
+  wline(func, "mov rax, [rax]");
+  wline(func, "mov r8, _prof_digits + 24");
+  wline(func, "mov r9, r8");
+  wline(func, "mov r10, 10");
+  wline(func, ".digit:");
+  wline(func, "xor edx, edx");
+  wline(func, "div r10");
+  wline(func, "add dl, 48");
+  wline(func, "dec r8");
+  wline(func, "mov [r8], dl");
+  wline(func, "test rax, rax");
+  wline(func, "jnz .digit");
+  wline(func, "mov rsi, r8");
+  wline(func, "mov rcx, r9");
+  wline(func, "sub rcx, r8");
+  wline(func, "rep movsb");
+  wline(func, "mov byte [rdi], 10");
+  wline(func, "inc rdi");
+  wline(func, "add rbx, 24");
+  wline(func, "dec r12");
+  wline(func, "jmp .entry");
+
+  // open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644), write, close
+  wline(func, ".write:");
+  wline(func, "mov r12, rdi");
+  wline(func, "mov rax, _prof_buffer");
+  wline(func, "sub r12, rax");
+  wline(func, "mov rax, 2");
+  wline(func, "mov rdi, _prof_path");
+  wline(func, "mov rsi, 577");
+  wline(func, "mov rdx, 420");
+  wline(func, "syscall");
+  wline(func, "test rax, rax");
+  wline(func, "js .done");
+  wline(func, "mov rdi, rax");
+  wline(func, "mov rax, 1");
+  wline(func, "mov rsi, _prof_buffer");
+  wline(func, "mov rdx, r12");
+  wline(func, "syscall");
+  wline(func, "mov rax, 3");
+  wline(func, "syscall");
+  wline(func, ".done:");
+  wline(func, "ret");
+}
+
+#endif
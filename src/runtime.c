@@ -0,0 +1,1747 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.c"
+
+#ifndef RUNTIME_C_INCLUDED
+#define RUNTIME_C_INCLUDED
+// --------------------------
+// Runtime ------------------
+
+/**
+ * Runtime routines back stdlib procedures declared with an empty body, e.g.
+ * `fn strlen:int ( let s:str ) end`. Kernels follow the System V calling
+ * convention (args in rdi, rsi, rdx, rcx, r8, r9 and result in rax, only
+ * caller-saved registers clobbered), so they can be linked against C as
+ * well. The compiler emits a thunk translating the stack based procedure
+ * protocol into a call to the kernel.
+ *
+ * Dispatched routines have a word-at-a-time, an SSE2 and an AVX2 kernel,
+ * named <kernel>_word, <kernel>_sse2 and <kernel>_avx2. _rt_init picks one
+ * through CPUID at startup and stores it in <kernel>_impl.
+ */
+
+// Linux x86_64 syscall numbers the runtime is built on or watches for
+#define SYS_WRITE 1
+#define SYS_PWRITE64 18
+#define SYS_WRITEV 20
+#define SYS_MMAP 9
+#define SYS_MUNMAP 11
+#define SYS_EXIT 60
+#define SYS_EXIT_GROUP 231
+
+#define __RUNTIME_STR(x) #x
+#define RUNTIME_STR(x) __RUNTIME_STR(x)
+
+char RUNTIME_CPU_INIT[] =
+    "_rt_cpu_init:\n"
+    "push rbx\n"
+    "xor r8d, r8d\n"
+    "xor eax, eax\n"
+    "cpuid\n"
+    "mov r9d, eax\n"
+    "mov eax, 1\n"
+    "xor ecx, ecx\n"
+    "cpuid\n"
+    "bt edx, 26\n" // SSE2
+    "jnc .done\n"
+    "or r8d, 1\n"
+    "and ecx, 0x18000000\n" // OSXSAVE and AVX
+    "cmp ecx, 0x18000000\n"
+    "jne .done\n"
+    "cmp r9d, 7\n"
+    "jb .done\n"
+    "xor ecx, ecx\n"
+    "xgetbv\n"
+    "and eax, 6\n" // XMM and YMM state enabled by the OS
+    "cmp eax, 6\n"
+    "jne .done\n"
+    "mov eax, 7\n"
+    "xor ecx, ecx\n"
+    "cpuid\n"
+    "bt ebx, 5\n" // AVX2
+    "jnc .done\n"
+    "or r8d, 2\n"
+    ".done:\n"
+    "mov [_rt_cpu_features], r8\n"
+    "pop rbx\n"
+    "ret";
+
+// Kernels scanning for a byte only ever load aligned blocks, which never
+// straddle a page boundary, and discard the bytes outside the string.
+
+char RUNTIME_STRLEN[] =
+    "_rt_strlen_word:\n"
+    "mov rax, rdi\n"
+    "mov rcx, rdi\n"
+    "and rax, -8\n"
+    "and ecx, 7\n"
+    "shl ecx, 3\n"
+    "mov r8, 0x0101010101010101\n"
+    "mov r9, 0x8080808080808080\n"
+    "mov rsi, -1\n"
+    "shl rsi, cl\n"
+    "not rsi\n"
+    "mov rdx, [rax]\n"
+    "or rdx, rsi\n" // bytes before s can't be the terminator
+    ".check:\n"
+    "mov r10, rdx\n"
+    "sub r10, r8\n"
+    "not rdx\n"
+    "and r10, rdx\n"
+    "and r10, r9\n"
+    "jnz .found\n"
+    "add rax, 8\n"
+    "mov rdx, [rax]\n"
+    "jmp .check\n"
+    ".found:\n"
+    "bsf r10, r10\n"
+    "shr r10, 3\n"
+    "add rax, r10\n"
+    "sub rax, rdi\n"
+    "ret\n"
+
+    "_rt_strlen_sse2:\n"
+    "mov rax, rdi\n"
+    "mov rcx, rdi\n"
+    "and rax, -16\n"
+    "and ecx, 15\n"
+    "pxor xmm0, xmm0\n"
+    "movdqa xmm1, [rax]\n"
+    "pcmpeqb xmm1, xmm0\n"
+    "pmovmskb edx, xmm1\n"
+    "shr edx, cl\n"
+    "test edx, edx\n"
+    "jnz .first\n"
+    ".loop:\n"
+    "add rax, 16\n"
+    "movdqa xmm1, [rax]\n"
+    "pcmpeqb xmm1, xmm0\n"
+    "pmovmskb edx, xmm1\n"
+    "test edx, edx\n"
+    "jz .loop\n"
+    "bsf edx, edx\n"
+    "add rax, rdx\n"
+    "sub rax, rdi\n"
+    "ret\n"
+    ".first:\n"
+    "bsf eax, edx\n"
+    "ret\n"
+
+    "_rt_strlen_avx2:\n"
+    "mov rax, rdi\n"
+    "mov rcx, rdi\n"
+    "and rax, -32\n"
+    "and ecx, 31\n"
+    "vpxor ymm0, ymm0, ymm0\n"
+    "vpcmpeqb ymm1, ymm0, [rax]\n"
+    "vpmovmskb edx, ymm1\n"
+    "shr edx, cl\n"
+    "test edx, edx\n"
+    "jnz .first\n"
+    ".loop:\n"
+    "add rax, 32\n"
+    "vpcmpeqb ymm1, ymm0, [rax]\n"
+    "vpmovmskb edx, ymm1\n"
+    "test edx, edx\n"
+    "jz .loop\n"
+    "bsf edx, edx\n"
+    "add rax, rdx\n"
+    "sub rax, rdi\n"
+    "vzeroupper\n"
+    "ret\n"
+    ".first:\n"
+    "bsf eax, edx\n"
+    "vzeroupper\n"
+    "ret";
+
+char RUNTIME_MEMCHR[] =
+    "_rt_memchr_word:\n"
+    "test rdx, rdx\n"
+    "jz .none\n"
+    "lea r9, [rdi + rdx]\n"
+    "mov r8, 0x0101010101010101\n"
+    "movzx esi, sil\n"
+    "imul rsi, r8\n"
+    "mov rax, rdi\n"
+    "mov rcx, rdi\n"
+    "and rax, -8\n"
+    "and ecx, 7\n"
+    "shl ecx, 3\n"
+    "mov r10, -1\n"
+    "shl r10, cl\n"
+    "not r10\n"
+    "mov rdx, [rax]\n"
+    "xor rdx, rsi\n"
+    "or rdx, r10\n" // bytes before s can't match
+    ".check:\n"
+    "mov r10, rdx\n"
+    "sub r10, r8\n"
+    "not rdx\n"
+    "and r10, rdx\n"
+    "mov rdx, 0x8080808080808080\n"
+    "and r10, rdx\n"
+    "jnz .found\n"
+    "add rax, 8\n"
+    "cmp rax, r9\n"
+    "jae .none\n"
+    "mov rdx, [rax]\n"
+    "xor rdx, rsi\n"
+    "jmp .check\n"
+    ".found:\n"
+    "bsf r10, r10\n"
+    "shr r10, 3\n"
+    "add rax, r10\n"
+    "cmp rax, r9\n"
+    "jae .none\n"
+    "ret\n"
+    ".none:\n"
+    "xor eax, eax\n"
+    "ret\n"
+
+    "_rt_memchr_sse2:\n"
+    "test rdx, rdx\n"
+    "jz .none\n"
+    "lea r9, [rdi + rdx]\n"
+    "movd xmm0, esi\n"
+    "punpcklbw xmm0, xmm0\n"
+    "punpcklwd xmm0, xmm0\n"
+    "pshufd xmm0, xmm0, 0\n"
+    "mov rax, rdi\n"
+    "mov rcx, rdi\n"
+    "and rax, -16\n"
+    "and ecx, 15\n"
+    "movdqa xmm1, [rax]\n"
+    "pcmpeqb xmm1, xmm0\n"
+    "pmovmskb r8d, xmm1\n"
+    "shr r8d, cl\n"
+    "test r8d, r8d\n"
+    "jz .loop\n"
+    "bsf r8d, r8d\n"
+    "lea rax, [rdi + r8]\n"
+    "jmp .bound\n"
+    ".loop:\n"
+    "add rax, 16\n"
+    "cmp rax, r9\n"
+    "jae .none\n"
+    "movdqa xmm1, [rax]\n"
+    "pcmpeqb xmm1, xmm0\n"
+    "pmovmskb r8d, xmm1\n"
+    "test r8d, r8d\n"
+    "jz .loop\n"
+    "bsf r8d, r8d\n"
+    "add rax, r8\n"
+    ".bound:\n"
+    "cmp rax, r9\n"
+    "jae .none\n"
+    "ret\n"
+    ".none:\n"
+    "xor eax, eax\n"
+    "ret\n"
+
+    "_rt_memchr_avx2:\n"
+    "test rdx, rdx\n"
+    "jz .none\n"
+    "lea r9, [rdi + rdx]\n"
+    "movd xmm0, esi\n"
+    "vpbroadcastb ymm0, xmm0\n"
+    "mov rax, rdi\n"
+    "mov rcx, rdi\n"
+    "and rax, -32\n"
+    "and ecx, 31\n"
+    "vpcmpeqb ymm1, ymm0, [rax]\n"
+    "vpmovmskb r8d, ymm1\n"
+    "shr r8d, cl\n"
+    "test r8d, r8d\n"
+    "jz .loop\n"
+    "bsf r8d, r8d\n"
+    "lea rax, [rdi + r8]\n"
+    "jmp .bound\n"
+    ".loop:\n"
+    "add rax, 32\n"
+    "cmp rax, r9\n"
+    "jae .none\n"
+    "vpcmpeqb ymm1, ymm0, [rax]\n"
+    "vpmovmskb r8d, ymm1\n"
+    "test r8d, r8d\n"
+    "jz .loop\n"
+    "bsf r8d, r8d\n"
+    "add rax, r8\n"
+    ".bound:\n"
+    "cmp rax, r9\n"
+    "jae .none\n"
+    "vzeroupper\n"
+    "ret\n"
+    ".none:\n"
+    "xor eax, eax\n"
+    "vzeroupper\n"
+    "ret";
+
+// Sized kernels never touch memory outside [p, p + n). Blocks are copied
+// with unaligned moves and the tail is covered by one overlapping move.
+
+char RUNTIME_MEMCPY[] =
+    "_rt_memcpy_word:\n"
+    "mov rax, rdi\n"
+    "xor ecx, ecx\n"
+    "cmp rdx, 8\n"
+    "jb .tail\n"
+    ".loop:\n"
+    "mov r8, [rsi + rcx]\n"
+    "mov [rdi + rcx], r8\n"
+    "add rcx, 8\n"
+    "lea r9, [rcx + 8]\n"
+    "cmp r9, rdx\n"
+    "jbe .loop\n"
+    ".tail:\n"
+    "cmp rcx, rdx\n"
+    "jae .done\n"
+    "mov r8b, [rsi + rcx]\n"
+    "mov [rdi + rcx], r8b\n"
+    "inc rcx\n"
+    "jmp .tail\n"
+    ".done:\n"
+    "ret\n"
+
+    "_rt_memcpy_sse2:\n"
+    "mov rax, rdi\n"
+    "cmp rdx, 16\n"
+    "jb .small\n"
+    "cmp rdx, 4096\n"
+    "jae .large\n"
+    "movdqu xmm1, [rsi + rdx - 16]\n"
+    "xor ecx, ecx\n"
+    ".loop:\n"
+    "movdqu xmm0, [rsi + rcx]\n"
+    "movdqu [rdi + rcx], xmm0\n"
+    "add rcx, 16\n"
+    "lea r8, [rcx + 16]\n"
+    "cmp r8, rdx\n"
+    "jbe .loop\n"
+    "movdqu [rdi + rdx - 16], xmm1\n"
+    "ret\n"
+    ".large:\n"
+    "mov rcx, rdx\n"
+    "rep movsb\n"
+    "ret\n"
+    ".small:\n"
+    "cmp edx, 8\n"
+    "jb .lt8\n"
+    "mov rcx, [rsi]\n"
+    "mov r8, [rsi + rdx - 8]\n"
+    "mov [rdi], rcx\n"
+    "mov [rdi + rdx - 8], r8\n"
+    "ret\n"
+    ".lt8:\n"
+    "cmp edx, 4\n"
+    "jb .lt4\n"
+    "mov ecx, [rsi]\n"
+    "mov r8d, [rsi + rdx - 4]\n"
+    "mov [rdi], ecx\n"
+    "mov [rdi + rdx - 4], r8d\n"
+    "ret\n"
+    ".lt4:\n"
+    "test rdx, rdx\n"
+    "jz .done\n"
+    ".bytes:\n"
+    "mov cl, [rsi + rdx - 1]\n"
+    "mov [rdi + rdx - 1], cl\n"
+    "dec rdx\n"
+    "jnz .bytes\n"
+    ".done:\n"
+    "ret\n"
+
+    "_rt_memcpy_avx2:\n"
+    "cmp rdx, 32\n"
+    "jb _rt_memcpy_sse2\n"
+    "cmp rdx, 4096\n"
+    "jae _rt_memcpy_sse2\n"
+    "mov rax, rdi\n"
+    "vmovdqu ymm1, [rsi + rdx - 32]\n"
+    "xor ecx, ecx\n"
+    ".loop:\n"
+    "vmovdqu ymm0, [rsi + rcx]\n"
+    "vmovdqu [rdi + rcx], ymm0\n"
+    "add rcx, 32\n"
+    "lea r8, [rcx + 32]\n"
+    "cmp r8, rdx\n"
+    "jbe .loop\n"
+    "vmovdqu [rdi + rdx - 32], ymm1\n"
+    "vzeroupper\n"
+    "ret";
+
+char RUNTIME_MEMSET[] =
+    "_rt_memset_word:\n"
+    "mov rax, rdi\n"
+    "movzx esi, sil\n"
+    "mov r8, 0x0101010101010101\n"
+    "imul rsi, r8\n"
+    "xor ecx, ecx\n"
+    "cmp rdx, 8\n"
+    "jb .tail\n"
+    ".loop:\n"
+    "mov [rdi + rcx], rsi\n"
+    "add rcx, 8\n"
+    "lea r9, [rcx + 8]\n"
+    "cmp r9, rdx\n"
+    "jbe .loop\n"
+    ".tail:\n"
+    "cmp rcx, rdx\n"
+    "jae .done\n"
+    "mov [rdi + rcx], sil\n"
+    "inc rcx\n"
+    "jmp .tail\n"
+    ".done:\n"
+    "ret\n"
+
+    "_rt_memset_sse2:\n"
+    "mov rax, rdi\n"
+    "movzx esi, sil\n"
+    "mov r8, 0x0101010101010101\n"
+    "imul rsi, r8\n"
+    "cmp rdx, 16\n"
+    "jb .small\n"
+    "movq xmm0, rsi\n"
+    "punpcklqdq xmm0, xmm0\n"
+    "xor ecx, ecx\n"
+    ".loop:\n"
+    "movdqu [rdi + rcx], xmm0\n"
+    "add rcx, 16\n"
+    "lea r8, [rcx + 16]\n"
+    "cmp r8, rdx\n"
+    "jbe .loop\n"
+    "movdqu [rdi + rdx - 16], xmm0\n"
+    "ret\n"
+    ".small:\n"
+    "cmp edx, 8\n"
+    "jb .lt8\n"
+    "mov [rdi], rsi\n"
+    "mov [rdi + rdx - 8], rsi\n"
+    "ret\n"
+    ".lt8:\n"
+    "cmp edx, 4\n"
+    "jb .lt4\n"
+    "mov [rdi], esi\n"
+    "mov [rdi + rdx - 4], esi\n"
+    "ret\n"
+    ".lt4:\n"
+    "test rdx, rdx\n"
+    "jz .done\n"
+    ".bytes:\n"
+    "mov [rdi + rdx - 1], sil\n"
+    "dec rdx\n"
+    "jnz .bytes\n"
+    ".done:\n"
+    "ret\n"
+
+    "_rt_memset_avx2:\n"
+    "cmp rdx, 32\n"
+    "jb _rt_memset_sse2\n"
+    "mov rax, rdi\n"
+    "movzx esi, sil\n"
+    "mov r8, 0x0101010101010101\n"
+    "imul rsi, r8\n"
+    "movq xmm0, rsi\n"
+    "vpbroadcastq ymm0, xmm0\n"
+    "xor ecx, ecx\n"
+    ".loop:\n"
+    "vmovdqu [rdi + rcx], ymm0\n"
+    "add rcx, 32\n"
+    "lea r8, [rcx + 32]\n"
+    "cmp r8, rdx\n"
+    "jbe .loop\n"
+    "vmovdqu [rdi + rdx - 32], ymm0\n"
+    "vzeroupper\n"
+    "ret";
+
+char RUNTIME_MEMCMP[] =
+    "_rt_memcmp_word:\n"
+    "xor ecx, ecx\n"
+    "cmp rdx, 8\n"
+    "jb .tail\n"
+    ".loop:\n"
+    "mov r8, [rdi + rcx]\n"
+    "xor r8, [rsi + rcx]\n"
+    "jnz .diff\n"
+    "add rcx, 8\n"
+    "lea r9, [rcx + 8]\n"
+    "cmp r9, rdx\n"
+    "jbe .loop\n"
+    ".tail:\n"
+    "cmp rcx, rdx\n"
+    "jae .equal\n"
+    "movzx eax, byte [rdi + rcx]\n"
+    "movzx r8d, byte [rsi + rcx]\n"
+    "sub eax, r8d\n"
+    "jnz .out\n"
+    "inc rcx\n"
+    "jmp .tail\n"
+    ".diff:\n"
+    "bsf r8, r8\n"
+    "shr r8, 3\n"
+    "add rcx, r8\n"
+    "movzx eax, byte [rdi + rcx]\n"
+    "movzx r8d, byte [rsi + rcx]\n"
+    "sub eax, r8d\n"
+    ".out:\n"
+    "movsxd rax, eax\n"
+    "ret\n"
+    ".equal:\n"
+    "xor eax, eax\n"
+    "ret\n"
+
+    "_rt_memcmp_sse2:\n"
+    "xor ecx, ecx\n"
+    "cmp rdx, 16\n"
+    "jb .tail\n"
+    ".loop:\n"
+    "movdqu xmm0, [rdi + rcx]\n"
+    "movdqu xmm1, [rsi + rcx]\n"
+    "pcmpeqb xmm0, xmm1\n"
+    "pmovmskb r8d, xmm0\n"
+    "xor r8d, 0xFFFF\n"
+    "jnz .diff\n"
+    "add rcx, 16\n"
+    "lea r9, [rcx + 16]\n"
+    "cmp r9, rdx\n"
+    "jbe .loop\n"
+    ".tail:\n"
+    "cmp rcx, rdx\n"
+    "jae .equal\n"
+    "movzx eax, byte [rdi + rcx]\n"
+    "movzx r8d, byte [rsi + rcx]\n"
+    "sub eax, r8d\n"
+    "jnz .out\n"
+    "inc rcx\n"
+    "jmp .tail\n"
+    ".diff:\n"
+    "bsf r8d, r8d\n"
+    "add rcx, r8\n"
+    "movzx eax, byte [rdi + rcx]\n"
+    "movzx r8d, byte [rsi + rcx]\n"
+    "sub eax, r8d\n"
+    ".out:\n"
+    "movsxd rax, eax\n"
+    "ret\n"
+    ".equal:\n"
+    "xor eax, eax\n"
+    "ret\n"
+
+    "_rt_memcmp_avx2:\n"
+    "xor ecx, ecx\n"
+    "cmp rdx, 32\n"
+    "jb _rt_memcmp_sse2\n"
+    ".loop:\n"
+    "vmovdqu ymm0, [rdi + rcx]\n"
+    "vpcmpeqb ymm0, ymm0, [rsi + rcx]\n"
+    "vpmovmskb r8d, ymm0\n"
+    "cmp r8d, -1\n"
+    "jne .diff\n"
+    "add rcx, 32\n"
+    "lea r9, [rcx + 32]\n"
+    "cmp r9, rdx\n"
+    "jbe .loop\n"
+    // Finish the last partial block with the SSE2 kernel
+    "add rdi, rcx\n"
+    "add rsi, rcx\n"
+    "sub rdx, rcx\n"
+    "vzeroupper\n"
+    "jmp _rt_memcmp_sse2\n"
+    ".diff:\n"
+    "not r8d\n"
+    "bsf r8d, r8d\n"
+    "add rcx, r8\n"
+    "movzx eax, byte [rdi + rcx]\n"
+    "movzx r8d, byte [rsi + rcx]\n"
+    "sub eax, r8d\n"
+    "movsxd rax, eax\n"
+    "vzeroupper\n"
+    "ret";
+
+// Output is collected in .bss and written once the buffer fills up, on
+// flush, or right before the program exits
+#define RUNTIME_IO_BUFSIZE "65536"
+
+char RUNTIME_IO[] =
+    "_rt_io_flush:\n"
+    "mov rdx, [_rt_io_length]\n"
+    "mov rsi, _rt_io_buffer\n"
+    "mov qword [_rt_io_length], 0\n"
+    ".write:\n"
+    "test rdx, rdx\n"
+    "jz .done\n"
+    "mov eax, " RUNTIME_STR(SYS_WRITE) "\n"
+    "mov edi, 1\n"
+    "syscall\n"
+    "test rax, rax\n"
+    "jle .done\n"
+    "add rsi, rax\n"
+    "sub rdx, rax\n"
+    "jmp .write\n"
+    ".done:\n"
+    "ret\n"
+
+    "_rt_io_write:\n"
+    "mov rax, [_rt_io_length]\n"
+    "lea rcx, [rax + rsi]\n"
+    "cmp rcx, " RUNTIME_IO_BUFSIZE "\n"
+    "jbe .append\n"
+    "push rdi\n"
+    "push rsi\n"
+    "call _rt_io_flush\n"
+    "pop rsi\n"
+    "pop rdi\n"
+    "xor eax, eax\n"
+    "cmp rsi, " RUNTIME_IO_BUFSIZE "\n"
+    "jb .append\n"
+    // Larger than the whole buffer, write it out directly
+    "mov rdx, rsi\n"
+    "mov rsi, rdi\n"
+    ".write:\n"
+    "mov eax, " RUNTIME_STR(SYS_WRITE) "\n"
+    "mov edi, 1\n"
+    "syscall\n"
+    "test rax, rax\n"
+    "jle .done\n"
+    "add rsi, rax\n"
+    "sub rdx, rax\n"
+    "jnz .write\n"
+    ".done:\n"
+    "ret\n"
+    ".append:\n"
+    "lea rcx, [rax + rsi]\n"
+    "mov [_rt_io_length], rcx\n"
+    "mov rdx, rsi\n"
+    "mov rsi, rdi\n"
+    "mov rdi, _rt_io_buffer\n"
+    "add rdi, rax\n"
+    "jmp qword [_rt_memcpy_impl]\n"
+
+    "_rt_io_print:\n"
+    "push rdi\n"
+    "call qword [_rt_strlen_impl]\n"
+    "pop rdi\n"
+    "mov rsi, rax\n"
+    "jmp _rt_io_write\n"
+
+    "_rt_io_println:\n"
+    "call _rt_io_print\n"
+    "mov rax, [_rt_io_length]\n"
+    "cmp rax, " RUNTIME_IO_BUFSIZE "\n"
+    "jb .put\n"
+    "call _rt_io_flush\n"
+    "xor eax, eax\n"
+    ".put:\n"
+    "mov rcx, _rt_io_buffer\n"
+    "mov byte [rcx + rax], 10\n"
+    "inc rax\n"
+    "mov [_rt_io_length], rax\n"
+    "ret\n"
+
+    // Digits are produced two at a time from a table, dividing by 100
+    // through a multiplication with its reciprocal
+    "_rt_io_printint:\n"
+    "mov rax, [_rt_io_length]\n"
+    "cmp rax, " RUNTIME_IO_BUFSIZE " - 24\n"
+    "jbe .room\n"
+    "push rdi\n"
+    "call _rt_io_flush\n"
+    "pop rdi\n"
+    ".room:\n"
+    "sub rsp, 24\n"
+    "lea r8, [rsp + 24]\n"
+    "mov r9, rdi\n"
+    "mov rax, rdi\n"
+    "test rax, rax\n"
+    "jns .digits\n"
+    "neg rax\n"
+    ".digits:\n"
+    "mov r10, _rt_io_digits\n"
+    "mov r11, 0x28F5C28F5C28F5C3\n"
+    ".pair:\n"
+    "cmp rax, 100\n"
+    "jb .last\n"
+    "mov rcx, rax\n"
+    "shr rax, 2\n"
+    "mul r11\n"
+    "shr rdx, 2\n"
+    "imul rax, rdx, 100\n"
+    "sub rcx, rax\n"
+    "mov rax, rdx\n"
+    "movzx ecx, word [r10 + rcx * 2]\n"
+    "sub r8, 2\n"
+    "mov [r8], cx\n"
+    "jmp .pair\n"
+    ".last:\n"
+    "cmp rax, 10\n"
+    "jb .single\n"
+    "movzx ecx, word [r10 + rax * 2]\n"
+    "sub r8, 2\n"
+    "mov [r8], cx\n"
+    "jmp .sign\n"
+    ".single:\n"
+    "add al, 48\n"
+    "dec r8\n"
+    "mov [r8], al\n"
+    ".sign:\n"
+    "test r9, r9\n"
+    "jns .append\n"
+    "dec r8\n"
+    "mov byte [r8], 45\n"
+    ".append:\n"
+    "lea rsi, [rsp + 24]\n"
+    "sub rsi, r8\n"
+    "mov rdi, r8\n"
+    "call _rt_io_write\n"
+    "add rsp, 24\n"
+    "ret";
+
+char RUNTIME_IO_DATA[] =
+    "_rt_io_digits: db \"0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849\"\n"
+    "db \"5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899\"";
+
+char RUNTIME_IO_BSS[] =
+    "_rt_io_length: resq 1\n"
+    "_rt_io_buffer: resb " RUNTIME_IO_BUFSIZE;
+
+// Anonymous mappings come straight from mmap(2). The arena bumps through
+// 1 MiB chunks, requests above a quarter chunk get a mapping of their own,
+// and reset unmaps everything but the first chunk. Pools hand out blocks of
+// 16 to 256 bytes from per size class free lists, refilled from 64 KiB slabs.
+#define RUNTIME_ARENA_CHUNK "1048576"
+#define RUNTIME_ARENA_LARGE "262144"
+#define RUNTIME_POOL_SLAB "65536"
+
+char RUNTIME_LINUX[] =
+    "_rt_mmap:\n"
+    "mov rsi, rdi\n"
+    "xor edi, edi\n"
+    "mov edx, 3\n"     // PROT_READ | PROT_WRITE
+    "mov r10d, 34\n"   // MAP_PRIVATE | MAP_ANONYMOUS
+    "mov r8, -1\n"
+    "xor r9d, r9d\n"
+    "mov eax, " RUNTIME_STR(SYS_MMAP) "\n"
+    "syscall\n"
+    "cmp rax, -4096\n" // errors are returned as -errno
+    "jbe .done\n"
+    "xor eax, eax\n"
+    ".done:\n"
+    "ret\n"
+
+    "_rt_munmap:\n"
+    "mov eax, " RUNTIME_STR(SYS_MUNMAP) "\n"
+    "syscall\n"
+    "ret";
+
+char RUNTIME_ALLOC[] =
+    // Map a chunk and link it into the arena, header is [next, size]
+    "_rt_arena_map:\n"
+    "push rdi\n"
+    "call _rt_mmap\n"
+    "pop rdx\n"
+    "test rax, rax\n"
+    "jz .done\n"
+    "mov rcx, [_rt_arena_chunks]\n"
+    "mov [rax], rcx\n"
+    "mov [rax + 8], rdx\n"
+    "mov [_rt_arena_chunks], rax\n"
+    ".done:\n"
+    "ret\n"
+
+    "_rt_arena_alloc:\n"
+    "add rdi, 15\n"
+    "and rdi, -16\n"
+    "mov rax, [_rt_arena_ptr]\n"
+    "mov rcx, [_rt_arena_end]\n"
+    "sub rcx, rax\n"
+    "cmp rdi, rcx\n"
+    "ja .refill\n"
+    "lea rcx, [rax + rdi]\n"
+    "mov [_rt_arena_ptr], rcx\n"
+    "ret\n"
+    ".refill:\n"
+    "cmp rdi, " RUNTIME_ARENA_LARGE "\n"
+    "ja .large\n"
+    "push rdi\n"
+    "mov rdi, " RUNTIME_ARENA_CHUNK "\n"
+    "call _rt_arena_map\n"
+    "pop rdi\n"
+    "test rax, rax\n"
+    "jz .done\n"
+    "cmp qword [_rt_arena_first], 0\n"
+    "jne .bump\n"
+    "mov [_rt_arena_first], rax\n"
+    ".bump:\n"
+    "lea rcx, [rax + " RUNTIME_ARENA_CHUNK "]\n"
+    "mov [_rt_arena_end], rcx\n"
+    "add rax, 16\n"
+    "lea rcx, [rax + rdi]\n"
+    "mov [_rt_arena_ptr], rcx\n"
+    "ret\n"
+    ".large:\n"
+    "add rdi, 16\n"
+    "call _rt_arena_map\n"
+    "test rax, rax\n"
+    "jz .done\n"
+    "add rax, 16\n"
+    ".done:\n"
+    "ret\n"
+
+    "_rt_arena_reset:\n"
+    "push rbx\n"
+    "mov rbx, [_rt_arena_chunks]\n"
+    ".unmap:\n"
+    "test rbx, rbx\n"
+    "jz .rewind\n"
+    "mov rdi, rbx\n"
+    "mov rsi, [rbx + 8]\n"
+    "mov rbx, [rbx]\n"
+    "cmp rdi, [_rt_arena_first]\n"
+    "je .unmap\n"
+    "call _rt_munmap\n"
+    "jmp .unmap\n"
+    ".rewind:\n"
+    "mov rax, [_rt_arena_first]\n"
+    "mov [_rt_arena_chunks], rax\n"
+    "test rax, rax\n"
+    "jz .done\n"
+    "mov qword [rax], 0\n"
+    "lea rcx, [rax + " RUNTIME_ARENA_CHUNK "]\n"
+    "mov [_rt_arena_end], rcx\n"
+    "add rax, 16\n"
+    "mov [_rt_arena_ptr], rax\n"
+    ".done:\n"
+    "xor eax, eax\n"
+    "pop rbx\n"
+    "ret\n"
+
+    // Size class of 1 to 256 bytes in rcx: 16 << rcx is the block size
+    "_rt_pool_alloc:\n"
+    "lea rcx, [rdi - 1]\n"
+    "cmp rcx, 255\n"
+    "ja _rt_arena_alloc\n"
+    "or rcx, 15\n"
+    "bsr rcx, rcx\n"
+    "sub ecx, 3\n"
+    "mov rdx, _rt_pool_free\n"
+    "mov rax, [rdx + rcx * 8]\n"
+    "test rax, rax\n"
+    "jz .bump\n"
+    "mov r8, [rax]\n"
+    "mov [rdx + rcx * 8], r8\n"
+    "ret\n"
+    ".bump:\n"
+    "mov r8d, 16\n"
+    "shl r8, cl\n"
+    "mov rdx, _rt_pool_next\n"
+    "mov r10, _rt_pool_end\n"
+    "mov rax, [rdx + rcx * 8]\n"
+    "lea r9, [rax + r8]\n"
+    "cmp r9, [r10 + rcx * 8]\n"
+    "ja .slab\n"
+    "mov [rdx + rcx * 8], r9\n"
+    "ret\n"
+    ".slab:\n"
+    "push rcx\n"
+    "push r8\n"
+    "mov rdi, " RUNTIME_POOL_SLAB "\n"
+    "call _rt_mmap\n"
+    "pop r8\n"
+    "pop rcx\n"
+    "test rax, rax\n"
+    "jz .done\n"
+    "mov rdx, _rt_pool_next\n"
+    "mov r10, _rt_pool_end\n"
+    "lea r9, [rax + " RUNTIME_POOL_SLAB "]\n"
+    "mov [r10 + rcx * 8], r9\n"
+    "lea r9, [rax + r8]\n"
+    "mov [rdx + rcx * 8], r9\n"
+    ".done:\n"
+    "ret\n"
+
+    "_rt_pool_release:\n"
+    "lea rcx, [rsi - 1]\n"
+    "cmp rcx, 255\n"
+    "ja .done\n" // arena memory goes back on reset
+    "test rdi, rdi\n"
+    "jz .done\n"
+    "or rcx, 15\n"
+    "bsr rcx, rcx\n"
+    "sub ecx, 3\n"
+    "mov rdx, _rt_pool_free\n"
+    "mov rax, [rdx + rcx * 8]\n"
+    "mov [rdi], rax\n"
+    "mov [rdx + rcx * 8], rdi\n"
+    ".done:\n"
+    "xor eax, eax\n"
+    "ret";
+
+char RUNTIME_ALLOC_BSS[] =
+    "_rt_arena_chunks: resq 1\n"
+    "_rt_arena_first: resq 1\n"
+    "_rt_arena_ptr: resq 1\n"
+    "_rt_arena_end: resq 1\n"
+    "_rt_pool_free: resq 5\n"
+    "_rt_pool_next: resq 5\n"
+    "_rt_pool_end: resq 5";
+
+// Array kernels work on 64-bit elements: ints wrap around and floats are
+// doubles. Vector loops cover whole blocks with unaligned moves, then the
+// scalar kernel finishes the elements left over.
+
+// Operation of the vector kernel, in r8
+#define VECTOR_COPY 0
+#define VECTOR_ADD 1
+#define VECTOR_SUB 2
+#define VECTOR_MUL 3
+#define VECTOR_AND 4
+#define VECTOR_OR 5
+#define VECTOR_XOR 6
+#define VECTOR_SHL 7 // rdx is the count, not an array
+#define VECTOR_SAR 8
+#define VECTOR_FADD 9
+#define VECTOR_FSUB 10
+#define VECTOR_FMUL 11
+#define VECTOR_FDIV 12
+#define VECTOR_FILL 13 // rdx is the value, there is no a
+#define VECTOR_FIND 14 // a is searched for rdx, there is no dst
+
+#define RUNTIME_VECTOR_CASE(op, label)                                         \
+  "cmp r8d, " RUNTIME_STR(op) "\n"                                             \
+  "je " label "\n"
+
+#define RUNTIME_VECTOR_DISPATCH                                                \
+  RUNTIME_VECTOR_CASE(VECTOR_COPY, ".copy")                                    \
+  RUNTIME_VECTOR_CASE(VECTOR_ADD, ".add")                                      \
+  RUNTIME_VECTOR_CASE(VECTOR_SUB, ".sub")                                      \
+  RUNTIME_VECTOR_CASE(VECTOR_MUL, ".mul")                                      \
+  RUNTIME_VECTOR_CASE(VECTOR_AND, ".and")                                      \
+  RUNTIME_VECTOR_CASE(VECTOR_OR, ".or")                                        \
+  RUNTIME_VECTOR_CASE(VECTOR_XOR, ".xor")                                      \
+  RUNTIME_VECTOR_CASE(VECTOR_SHL, ".shl")                                      \
+  RUNTIME_VECTOR_CASE(VECTOR_SAR, ".sar")                                      \
+  RUNTIME_VECTOR_CASE(VECTOR_FADD, ".fadd")                                    \
+  RUNTIME_VECTOR_CASE(VECTOR_FSUB, ".fsub")                                    \
+  RUNTIME_VECTOR_CASE(VECTOR_FMUL, ".fmul")                                    \
+  RUNTIME_VECTOR_CASE(VECTOR_FDIV, ".fdiv")                                    \
+  RUNTIME_VECTOR_CASE(VECTOR_FILL, ".fill")                                    \
+  RUNTIME_VECTOR_CASE(VECTOR_FIND, ".find")                                    \
+  "ret\n"
+
+// One element per iteration, r9 counts up to rcx
+#define RUNTIME_VECTOR_WORD(label, body)                                       \
+  label ":\n"                                                                  \
+  "cmp r9, rcx\n"                                                              \
+  "jae .done\n" body "inc r9\n"                                                \
+  "jmp " label "\n"
+
+#define RUNTIME_VECTOR_WORD_INT(label, op)                                     \
+  RUNTIME_VECTOR_WORD(label, "mov rax, [rsi + r9 * 8]\n"                       \
+                             op " rax, [rdx + r9 * 8]\n"                       \
+                             "mov [rdi + r9 * 8], rax\n")
+
+#define RUNTIME_VECTOR_WORD_FLOAT(label, op)                                   \
+  RUNTIME_VECTOR_WORD(label, "movsd xmm0, [rsi + r9 * 8]\n"                    \
+                             op " xmm0, [rdx + r9 * 8]\n"                      \
+                             "movsd [rdi + r9 * 8], xmm0\n")
+
+// Whole blocks, r9 counts bytes up to rax. Shifts have no second array and
+// leave through .rest.
+#define RUNTIME_VECTOR_BLOCK(label, width, body, exit)                         \
+  label ":\n"                                                                  \
+  "cmp r9, rax\n"                                                              \
+  "jae " exit "\n" body "add r9, " width "\n"                                  \
+  "jmp " label "\n"
+
+#define RUNTIME_VECTOR_SSE2(label, op)                                         \
+  RUNTIME_VECTOR_BLOCK(label, "16",                                            \
+                       "movdqu xmm0, [rsi + r9]\n"                             \
+                       "movdqu xmm1, [rdx + r9]\n" op " xmm0, xmm1\n"          \
+                       "movdqu [rdi + r9], xmm0\n",                            \
+                       ".tail")
+
+#define RUNTIME_VECTOR_AVX2(label, op)                                         \
+  RUNTIME_VECTOR_BLOCK(label, "32",                                            \
+                       "vmovdqu ymm0, [rsi + r9]\n" op                         \
+                       " ymm0, ymm0, [rdx + r9]\n"                             \
+                       "vmovdqu [rdi + r9], ymm0\n",                           \
+                       ".tail")
+
+// The element count not covered by blocks goes to the scalar kernel
+#define RUNTIME_VECTOR_TAIL(leave)                                             \
+  ".tail:\n"                                                                   \
+  "add rdx, r9\n"                                                              \
+  ".rest:\n"                                                                   \
+  "add rdi, r9\n"                                                              \
+  "add rsi, r9\n"                                                              \
+  "shr r9, 3\n"                                                                \
+  "sub rcx, r9\n" leave "jmp _rt_vector_word"
+
+// A search returns an index from the start, so it finishes its own elements
+// instead of leaving them to the scalar kernel
+#define RUNTIME_VECTOR_FIND_WORD(leave)                                        \
+  ".find_word:\n"                                                              \
+  "cmp r9, rcx\n"                                                              \
+  "jae .find_end\n"                                                            \
+  "cmp [rsi + r9 * 8], rdx\n"                                                  \
+  "je .find_end\n"                                                             \
+  "inc r9\n"                                                                   \
+  "jmp .find_word\n"                                                           \
+  ".find_end:\n"                                                               \
+  "mov rax, r9\n" leave "ret\n"
+
+// r10 has a bit for every lane of the block at r9 that matched
+#define RUNTIME_VECTOR_FOUND(leave)                                            \
+  ".found:\n"                                                                  \
+  "bsf r10d, r10d\n"                                                           \
+  "shr r9, 3\n"                                                                \
+  "lea rax, [r9 + r10]\n" leave "ret\n"                                        \
+  ".find_rest:\n"                                                              \
+  "shr r9, 3\n" RUNTIME_VECTOR_FIND_WORD(leave)
+
+/**
+ * _rt_vector_<level>(dst, a, b, n, op) computes dst[i] = a[i] op b[i] for
+ * the first n elements, or a[i] shifted by the count in b. dst may be a or
+ * b. VECTOR_FILL stores b itself into every element of dst, VECTOR_FIND
+ * returns the index of the first element of a equal to b, or n. Neither
+ * SSE2 nor AVX2 multiplies 64-bit lanes or shifts them arithmetically, so
+ * products are put together from 32-bit halves and a right shift flips
+ * negative lanes around a logical one.
+ */
+char RUNTIME_VECTOR[] =
+    "_rt_vector_word:\n"
+    "xor r9d, r9d\n"
+    RUNTIME_VECTOR_DISPATCH
+    RUNTIME_VECTOR_WORD(".copy", "mov rax, [rsi + r9 * 8]\n"
+                                 "mov [rdi + r9 * 8], rax\n")
+    RUNTIME_VECTOR_WORD_INT(".add", "add")
+    RUNTIME_VECTOR_WORD_INT(".sub", "sub")
+    RUNTIME_VECTOR_WORD_INT(".mul", "imul")
+    RUNTIME_VECTOR_WORD_INT(".and", "and")
+    RUNTIME_VECTOR_WORD_INT(".or", "or")
+    RUNTIME_VECTOR_WORD_INT(".xor", "xor")
+    ".shl:\n"
+    "mov r10, rcx\n"
+    "mov rcx, rdx\n"
+    ".shl_loop:\n"
+    "cmp r9, r10\n"
+    "jae .done\n"
+    "mov rax, [rsi + r9 * 8]\n"
+    "shl rax, cl\n"
+    "mov [rdi + r9 * 8], rax\n"
+    "inc r9\n"
+    "jmp .shl_loop\n"
+    ".sar:\n"
+    "mov r10, rcx\n"
+    "mov rcx, rdx\n"
+    ".sar_loop:\n"
+    "cmp r9, r10\n"
+    "jae .done\n"
+    "mov rax, [rsi + r9 * 8]\n"
+    "sar rax, cl\n"
+    "mov [rdi + r9 * 8], rax\n"
+    "inc r9\n"
+    "jmp .sar_loop\n"
+    RUNTIME_VECTOR_WORD_FLOAT(".fadd", "addsd")
+    RUNTIME_VECTOR_WORD_FLOAT(".fsub", "subsd")
+    RUNTIME_VECTOR_WORD_FLOAT(".fmul", "mulsd")
+    RUNTIME_VECTOR_WORD_FLOAT(".fdiv", "divsd")
+    RUNTIME_VECTOR_WORD(".fill", "mov [rdi + r9 * 8], rdx\n")
+    ".find:\n"
+    RUNTIME_VECTOR_FIND_WORD("")
+    ".done:\n"
+    "ret\n"
+
+    "_rt_vector_sse2:\n"
+    "mov rax, rcx\n"
+    "and rax, -2\n"
+    "shl rax, 3\n"
+    "xor r9d, r9d\n"
+    RUNTIME_VECTOR_DISPATCH
+    RUNTIME_VECTOR_BLOCK(".copy", "16",
+                         "movdqu xmm0, [rsi + r9]\n"
+                         "movdqu [rdi + r9], xmm0\n", ".tail")
+    RUNTIME_VECTOR_SSE2(".add", "paddq")
+    RUNTIME_VECTOR_SSE2(".sub", "psubq")
+    RUNTIME_VECTOR_BLOCK(".mul", "16",
+                         "movdqu xmm0, [rsi + r9]\n"
+                         "movdqu xmm1, [rdx + r9]\n"
+                         "movdqa xmm2, xmm0\n"
+                         "psrlq xmm2, 32\n"
+                         "pmuludq xmm2, xmm1\n" // high a * low b
+                         "movdqa xmm3, xmm1\n"
+                         "psrlq xmm3, 32\n"
+                         "pmuludq xmm3, xmm0\n" // low a * high b
+                         "paddq xmm2, xmm3\n"
+                         "psllq xmm2, 32\n"
+                         "pmuludq xmm0, xmm1\n" // low a * low b
+                         "paddq xmm0, xmm2\n"
+                         "movdqu [rdi + r9], xmm0\n", ".tail")
+    RUNTIME_VECTOR_SSE2(".and", "pand")
+    RUNTIME_VECTOR_SSE2(".or", "por")
+    RUNTIME_VECTOR_SSE2(".xor", "pxor")
+    ".shl:\n"
+    "and edx, 63\n"
+    "movq xmm1, rdx\n"
+    RUNTIME_VECTOR_BLOCK(".shl_loop", "16",
+                         "movdqu xmm0, [rsi + r9]\n"
+                         "psllq xmm0, xmm1\n"
+                         "movdqu [rdi + r9], xmm0\n", ".rest")
+    ".sar:\n"
+    "and edx, 63\n"
+    "movq xmm1, rdx\n"
+    RUNTIME_VECTOR_BLOCK(".sar_loop", "16",
+                         "movdqu xmm0, [rsi + r9]\n"
+                         "movdqa xmm2, xmm0\n"
+                         "psrad xmm2, 31\n"
+                         "pshufd xmm2, xmm2, 0xF5\n" // sign of each lane
+                         "pxor xmm0, xmm2\n"
+                         "psrlq xmm0, xmm1\n"
+                         "pxor xmm0, xmm2\n"
+                         "movdqu [rdi + r9], xmm0\n", ".rest")
+    RUNTIME_VECTOR_SSE2(".fadd", "addpd")
+    RUNTIME_VECTOR_SSE2(".fsub", "subpd")
+    RUNTIME_VECTOR_SSE2(".fmul", "mulpd")
+    RUNTIME_VECTOR_SSE2(".fdiv", "divpd")
+    ".fill:\n"
+    "movq xmm1, rdx\n"
+    "punpcklqdq xmm1, xmm1\n"
+    RUNTIME_VECTOR_BLOCK(".fill_loop", "16",
+                         "movdqu [rdi + r9], xmm1\n", ".rest")
+    ".find:\n"
+    "movq xmm1, rdx\n"
+    "punpcklqdq xmm1, xmm1\n"
+    RUNTIME_VECTOR_BLOCK(".find_loop", "16",
+                         "movdqu xmm0, [rsi + r9]\n"
+                         "pcmpeqd xmm0, xmm1\n"
+                         "pshufd xmm2, xmm0, 0xB1\n" // both halves equal
+                         "pand xmm0, xmm2\n"
+                         "movmskpd r10d, xmm0\n"
+                         "test r10d, r10d\n"
+                         "jnz .found\n", ".find_rest")
+    RUNTIME_VECTOR_FOUND("")
+    RUNTIME_VECTOR_TAIL("")
+    "\n"
+
+    "_rt_vector_avx2:\n"
+    "mov rax, rcx\n"
+    "and rax, -4\n"
+    "shl rax, 3\n"
+    "xor r9d, r9d\n"
+    RUNTIME_VECTOR_DISPATCH
+    RUNTIME_VECTOR_BLOCK(".copy", "32",
+                         "vmovdqu ymm0, [rsi + r9]\n"
+                         "vmovdqu [rdi + r9], ymm0\n", ".tail")
+    RUNTIME_VECTOR_AVX2(".add", "vpaddq")
+    RUNTIME_VECTOR_AVX2(".sub", "vpsubq")
+    RUNTIME_VECTOR_BLOCK(".mul", "32",
+                         "vmovdqu ymm0, [rsi + r9]\n"
+                         "vmovdqu ymm1, [rdx + r9]\n"
+                         "vpsrlq ymm2, ymm0, 32\n"
+                         "vpmuludq ymm2, ymm2, ymm1\n"
+                         "vpsrlq ymm3, ymm1, 32\n"
+                         "vpmuludq ymm3, ymm3, ymm0\n"
+                         "vpaddq ymm2, ymm2, ymm3\n"
+                         "vpsllq ymm2, ymm2, 32\n"
+                         "vpmuludq ymm0, ymm0, ymm1\n"
+                         "vpaddq ymm0, ymm0, ymm2\n"
+                         "vmovdqu [rdi + r9], ymm0\n", ".tail")
+    RUNTIME_VECTOR_AVX2(".and", "vpand")
+    RUNTIME_VECTOR_AVX2(".or", "vpor")
+    RUNTIME_VECTOR_AVX2(".xor", "vpxor")
+    ".shl:\n"
+    "and edx, 63\n"
+    "vmovq xmm1, rdx\n"
+    RUNTIME_VECTOR_BLOCK(".shl_loop", "32",
+                         "vmovdqu ymm0, [rsi + r9]\n"
+                         "vpsllq ymm0, ymm0, xmm1\n"
+                         "vmovdqu [rdi + r9], ymm0\n", ".rest")
+    ".sar:\n"
+    "and edx, 63\n"
+    "vmovq xmm1, rdx\n"
+    RUNTIME_VECTOR_BLOCK(".sar_loop", "32",
+                         "vmovdqu ymm0, [rsi + r9]\n"
+                         "vpsrad ymm2, ymm0, 31\n"
+                         "vpshufd ymm2, ymm2, 0xF5\n"
+                         "vpxor ymm0, ymm0, ymm2\n"
+                         "vpsrlq ymm0, ymm0, xmm1\n"
+                         "vpxor ymm0, ymm0, ymm2\n"
+                         "vmovdqu [rdi + r9], ymm0\n", ".rest")
+    RUNTIME_VECTOR_AVX2(".fadd", "vaddpd")
+    RUNTIME_VECTOR_AVX2(".fsub", "vsubpd")
+    RUNTIME_VECTOR_AVX2(".fmul", "vmulpd")
+    RUNTIME_VECTOR_AVX2(".fdiv", "vdivpd")
+    ".fill:\n"
+    "vmovq xmm1, rdx\n"
+    "vpbroadcastq ymm1, xmm1\n"
+    RUNTIME_VECTOR_BLOCK(".fill_loop", "32",
+                         "vmovdqu [rdi + r9], ymm1\n", ".rest")
+    ".find:\n"
+    "vmovq xmm1, rdx\n"
+    "vpbroadcastq ymm1, xmm1\n"
+    RUNTIME_VECTOR_BLOCK(".find_loop", "32",
+                         "vpcmpeqq ymm0, ymm1, [rsi + r9]\n"
+                         "vmovmskpd r10d, ymm0\n"
+                         "test r10d, r10d\n"
+                         "jnz .found\n", ".find_rest")
+    RUNTIME_VECTOR_FOUND("vzeroupper\n")
+    RUNTIME_VECTOR_TAIL("vzeroupper\n");
+
+// Reduction of the reduce kernel, in edx
+#define REDUCE_SUM 0
+#define REDUCE_MIN 1
+#define REDUCE_MAX 2
+#define REDUCE_FSUM 3
+#define REDUCE_FMIN 4
+#define REDUCE_FMAX 5
+
+#define RUNTIME_REDUCE_CASE(op, label)                                         \
+  "cmp edx, " RUNTIME_STR(op) "\n"                                             \
+  "je " label "\n"
+
+#define RUNTIME_REDUCE_DISPATCH                                                \
+  RUNTIME_REDUCE_CASE(REDUCE_SUM, ".sum")                                      \
+  RUNTIME_REDUCE_CASE(REDUCE_MIN, ".min")                                      \
+  RUNTIME_REDUCE_CASE(REDUCE_MAX, ".max")                                      \
+  RUNTIME_REDUCE_CASE(REDUCE_FSUM, ".fsum")                                    \
+  RUNTIME_REDUCE_CASE(REDUCE_FMIN, ".fmin")                                    \
+  RUNTIME_REDUCE_CASE(REDUCE_FMAX, ".fmax")                                    \
+  "ret\n"
+
+// Folds the elements from r9 on into rax or xmm0
+#define RUNTIME_REDUCE_TAIL(label, body)                                       \
+  label ":\n"                                                                  \
+  "cmp r9, rsi\n"                                                              \
+  "jae .done\n" body "inc r9\n"                                                \
+  "jmp " label "\n"
+
+#define RUNTIME_REDUCE_TAIL_CMOV(label, cc)                                    \
+  RUNTIME_REDUCE_TAIL(label, "mov rcx, [rdi + r9 * 8]\n"                       \
+                             "cmp rcx, rax\n"                                  \
+                             "cmov" cc " rax, rcx\n")
+
+// Blocks of 4 elements from r9 = 0 while r9 is below rcx
+#define RUNTIME_REDUCE_BLOCKS                                                  \
+  "mov rcx, rsi\n"                                                             \
+  "and rcx, -4\n"                                                              \
+  "xor r9d, r9d\n"
+
+/**
+ * _rt_reduce_<level>(v, n, op) folds the first n elements of v into rax, or
+ * xmm0 for floats, and gives 0 for n = 0. Float sums are added in four
+ * interleaved partial sums on every level, so the rounding doesn't depend on
+ * the CPU. SSE2 can't compare 64-bit ints, their min and max stay scalar
+ * below AVX2. NaNs aren't ordered by min and max.
+ */
+char RUNTIME_REDUCE[] =
+    "_rt_reduce_sum:\n"
+    "mov edx, " RUNTIME_STR(REDUCE_SUM) "\n"
+    "jmp qword [_rt_reduce_impl]\n"
+    "_rt_reduce_min:\n"
+    "mov edx, " RUNTIME_STR(REDUCE_MIN) "\n"
+    "jmp qword [_rt_reduce_impl]\n"
+    "_rt_reduce_max:\n"
+    "mov edx, " RUNTIME_STR(REDUCE_MAX) "\n"
+    "jmp qword [_rt_reduce_impl]\n"
+    "_rt_reduce_fsum:\n"
+    "mov edx, " RUNTIME_STR(REDUCE_FSUM) "\n"
+    "jmp qword [_rt_reduce_impl]\n"
+    "_rt_reduce_fmin:\n"
+    "mov edx, " RUNTIME_STR(REDUCE_FMIN) "\n"
+    "jmp qword [_rt_reduce_impl]\n"
+    "_rt_reduce_fmax:\n"
+    "mov edx, " RUNTIME_STR(REDUCE_FMAX) "\n"
+    "jmp qword [_rt_reduce_impl]\n"
+
+    "_rt_reduce_word:\n"
+    "xor eax, eax\n"
+    "xorpd xmm0, xmm0\n"
+    "test rsi, rsi\n"
+    "jz .done\n"
+    RUNTIME_REDUCE_DISPATCH
+    ".sum:\n"
+    "xor r9d, r9d\n"
+    RUNTIME_REDUCE_TAIL(".sum_loop", "add rax, [rdi + r9 * 8]\n")
+    ".min:\n"
+    "mov rax, [rdi]\n"
+    "mov r9d, 1\n"
+    RUNTIME_REDUCE_TAIL_CMOV(".min_loop", "l")
+    ".max:\n"
+    "mov rax, [rdi]\n"
+    "mov r9d, 1\n"
+    RUNTIME_REDUCE_TAIL_CMOV(".max_loop", "g")
+    ".fsum:\n"
+    "xorpd xmm1, xmm1\n"
+    "xorpd xmm2, xmm2\n"
+    "xorpd xmm3, xmm3\n"
+    RUNTIME_REDUCE_BLOCKS
+    ".fsum_loop:\n"
+    "cmp r9, rcx\n"
+    "jae .fsum_lanes\n"
+    "addsd xmm0, [rdi + r9 * 8]\n"
+    "addsd xmm1, [rdi + r9 * 8 + 8]\n"
+    "addsd xmm2, [rdi + r9 * 8 + 16]\n"
+    "addsd xmm3, [rdi + r9 * 8 + 24]\n"
+    "add r9, 4\n"
+    "jmp .fsum_loop\n"
+    ".fsum_lanes:\n"
+    "addsd xmm0, xmm2\n"
+    "addsd xmm1, xmm3\n"
+    "addsd xmm0, xmm1\n"
+    RUNTIME_REDUCE_TAIL(".fsum_tail", "addsd xmm0, [rdi + r9 * 8]\n")
+    ".fmin:\n"
+    "movsd xmm0, [rdi]\n"
+    "mov r9d, 1\n"
+    RUNTIME_REDUCE_TAIL(".fmin_loop", "minsd xmm0, [rdi + r9 * 8]\n")
+    ".fmax:\n"
+    "movsd xmm0, [rdi]\n"
+    "mov r9d, 1\n"
+    RUNTIME_REDUCE_TAIL(".fmax_loop", "maxsd xmm0, [rdi + r9 * 8]\n")
+    ".done:\n"
+    "ret\n"
+
+    "_rt_reduce_sse2:\n"
+    "cmp rsi, 4\n"
+    "jb _rt_reduce_word\n"
+    "cmp edx, " RUNTIME_STR(REDUCE_MIN) "\n"
+    "je _rt_reduce_word\n"
+    "cmp edx, " RUNTIME_STR(REDUCE_MAX) "\n"
+    "je _rt_reduce_word\n"
+    RUNTIME_REDUCE_BLOCKS
+    "pxor xmm0, xmm0\n"
+    "pxor xmm1, xmm1\n"
+    RUNTIME_REDUCE_DISPATCH
+    ".sum:\n"
+    "cmp r9, rcx\n"
+    "jae .sum_lanes\n"
+    "movdqu xmm2, [rdi + r9 * 8]\n"
+    "paddq xmm0, xmm2\n"
+    "movdqu xmm3, [rdi + r9 * 8 + 16]\n"
+    "paddq xmm1, xmm3\n"
+    "add r9, 4\n"
+    "jmp .sum\n"
+    ".sum_lanes:\n"
+    "paddq xmm0, xmm1\n"
+    "pshufd xmm1, xmm0, 0xEE\n"
+    "paddq xmm0, xmm1\n"
+    "movq rax, xmm0\n"
+    RUNTIME_REDUCE_TAIL(".sum_tail", "add rax, [rdi + r9 * 8]\n")
+    ".fsum:\n"
+    "cmp r9, rcx\n"
+    "jae .fsum_lanes\n"
+    "movupd xmm2, [rdi + r9 * 8]\n"
+    "addpd xmm0, xmm2\n"
+    "movupd xmm3, [rdi + r9 * 8 + 16]\n"
+    "addpd xmm1, xmm3\n"
+    "add r9, 4\n"
+    "jmp .fsum\n"
+    ".fsum_lanes:\n"
+    "addpd xmm0, xmm1\n"
+    "movapd xmm1, xmm0\n"
+    "unpckhpd xmm1, xmm1\n"
+    "addsd xmm0, xmm1\n"
+    RUNTIME_REDUCE_TAIL(".fsum_tail", "addsd xmm0, [rdi + r9 * 8]\n")
+    ".fmin:\n"
+    "movupd xmm0, [rdi]\n"
+    "mov r9d, 2\n"
+    ".fmin_loop:\n"
+    "cmp r9, rcx\n"
+    "jae .fmin_lanes\n"
+    "movupd xmm1, [rdi + r9 * 8]\n"
+    "minpd xmm0, xmm1\n"
+    "add r9, 2\n"
+    "jmp .fmin_loop\n"
+    ".fmin_lanes:\n"
+    "movapd xmm1, xmm0\n"
+    "unpckhpd xmm1, xmm1\n"
+    "minsd xmm0, xmm1\n"
+    RUNTIME_REDUCE_TAIL(".fmin_tail", "minsd xmm0, [rdi + r9 * 8]\n")
+    ".fmax:\n"
+    "movupd xmm0, [rdi]\n"
+    "mov r9d, 2\n"
+    ".fmax_loop:\n"
+    "cmp r9, rcx\n"
+    "jae .fmax_lanes\n"
+    "movupd xmm1, [rdi + r9 * 8]\n"
+    "maxpd xmm0, xmm1\n"
+    "add r9, 2\n"
+    "jmp .fmax_loop\n"
+    ".fmax_lanes:\n"
+    "movapd xmm1, xmm0\n"
+    "unpckhpd xmm1, xmm1\n"
+    "maxsd xmm0, xmm1\n"
+    RUNTIME_REDUCE_TAIL(".fmax_tail", "maxsd xmm0, [rdi + r9 * 8]\n")
+    ".min:\n"
+    ".max:\n"
+    ".done:\n"
+    "ret\n"
+
+    "_rt_reduce_avx2:\n"
+    "cmp rsi, 4\n"
+    "jb _rt_reduce_word\n"
+    RUNTIME_REDUCE_BLOCKS
+    "vpxor ymm0, ymm0, ymm0\n"
+    RUNTIME_REDUCE_DISPATCH
+    ".sum:\n"
+    "cmp r9, rcx\n"
+    "jae .sum_lanes\n"
+    "vpaddq ymm0, ymm0, [rdi + r9 * 8]\n"
+    "add r9, 4\n"
+    "jmp .sum\n"
+    ".sum_lanes:\n"
+    "vextracti128 xmm1, ymm0, 1\n"
+    "vpaddq xmm0, xmm0, xmm1\n"
+    "vpshufd xmm1, xmm0, 0xEE\n"
+    "vpaddq xmm0, xmm0, xmm1\n"
+    "vmovq rax, xmm0\n"
+    "vzeroupper\n"
+    RUNTIME_REDUCE_TAIL(".sum_tail", "add rax, [rdi + r9 * 8]\n")
+    ".min:\n"
+    "vmovdqu ymm0, [rdi]\n"
+    "mov r9d, 4\n"
+    ".min_loop:\n"
+    "cmp r9, rcx\n"
+    "jae .min_lanes\n"
+    "vmovdqu ymm1, [rdi + r9 * 8]\n"
+    "vpcmpgtq ymm2, ymm0, ymm1\n"
+    "vblendvpd ymm0, ymm0, ymm1, ymm2\n"
+    "add r9, 4\n"
+    "jmp .min_loop\n"
+    ".min_lanes:\n"
+    "vextracti128 xmm1, ymm0, 1\n"
+    "vpcmpgtq xmm2, xmm0, xmm1\n"
+    "vblendvpd xmm0, xmm0, xmm1, xmm2\n"
+    "vmovq rax, xmm0\n"
+    "vpextrq rcx, xmm0, 1\n"
+    "cmp rcx, rax\n"
+    "cmovl rax, rcx\n"
+    "vzeroupper\n"
+    RUNTIME_REDUCE_TAIL_CMOV(".min_tail", "l")
+    ".max:\n"
+    "vmovdqu ymm0, [rdi]\n"
+    "mov r9d, 4\n"
+    ".max_loop:\n"
+    "cmp r9, rcx\n"
+    "jae .max_lanes\n"
+    "vmovdqu ymm1, [rdi + r9 * 8]\n"
+    "vpcmpgtq ymm2, ymm1, ymm0\n"
+    "vblendvpd ymm0, ymm0, ymm1, ymm2\n"
+    "add r9, 4\n"
+    "jmp .max_loop\n"
+    ".max_lanes:\n"
+    "vextracti128 xmm1, ymm0, 1\n"
+    "vpcmpgtq xmm2, xmm1, xmm0\n"
+    "vblendvpd xmm0, xmm0, xmm1, xmm2\n"
+    "vmovq rax, xmm0\n"
+    "vpextrq rcx, xmm0, 1\n"
+    "cmp rcx, rax\n"
+    "cmovg rax, rcx\n"
+    "vzeroupper\n"
+    RUNTIME_REDUCE_TAIL_CMOV(".max_tail", "g")
+    ".fsum:\n"
+    "cmp r9, rcx\n"
+    "jae .fsum_lanes\n"
+    "vaddpd ymm0, ymm0, [rdi + r9 * 8]\n"
+    "add r9, 4\n"
+    "jmp .fsum\n"
+    ".fsum_lanes:\n"
+    "vextractf128 xmm1, ymm0, 1\n"
+    "vaddpd xmm0, xmm0, xmm1\n"
+    "vunpckhpd xmm1, xmm0, xmm0\n"
+    "vaddsd xmm0, xmm0, xmm1\n"
+    "vzeroupper\n"
+    RUNTIME_REDUCE_TAIL(".fsum_tail", "addsd xmm0, [rdi + r9 * 8]\n")
+    ".fmin:\n"
+    "vmovupd ymm0, [rdi]\n"
+    "mov r9d, 4\n"
+    ".fmin_loop:\n"
+    "cmp r9, rcx\n"
+    "jae .fmin_lanes\n"
+    "vminpd ymm0, ymm0, [rdi + r9 * 8]\n"
+    "add r9, 4\n"
+    "jmp .fmin_loop\n"
+    ".fmin_lanes:\n"
+    "vextractf128 xmm1, ymm0, 1\n"
+    "vminpd xmm0, xmm0, xmm1\n"
+    "vunpckhpd xmm1, xmm0, xmm0\n"
+    "vminsd xmm0, xmm0, xmm1\n"
+    "vzeroupper\n"
+    RUNTIME_REDUCE_TAIL(".fmin_tail", "minsd xmm0, [rdi + r9 * 8]\n")
+    ".fmax:\n"
+    "vmovupd ymm0, [rdi]\n"
+    "mov r9d, 4\n"
+    ".fmax_loop:\n"
+    "cmp r9, rcx\n"
+    "jae .fmax_lanes\n"
+    "vmaxpd ymm0, ymm0, [rdi + r9 * 8]\n"
+    "add r9, 4\n"
+    "jmp .fmax_loop\n"
+    ".fmax_lanes:\n"
+    "vextractf128 xmm1, ymm0, 1\n"
+    "vmaxpd xmm0, xmm0, xmm1\n"
+    "vunpckhpd xmm1, xmm0, xmm0\n"
+    "vmaxsd xmm0, xmm0, xmm1\n"
+    "vzeroupper\n"
+    RUNTIME_REDUCE_TAIL(".fmax_tail", "maxsd xmm0, [rdi + r9 * 8]\n")
+    ".done:\n"
+    "ret";
+
+typedef struct {
+  str name;
+  str kernel; // prefix of the per-CPU kernels, NULL if not dispatched
+  char *text;
+  char *data;
+  char *bss;
+  str requires[3];
+
+  bool linked; // has to be emitted
+} RuntimeModule;
+
+typedef struct {
+  str name; // procedure name in dang
+  uint nargs;
+  str call; // operand of the call made by the thunk
+  str module;
+
+  bool declared; // backs a procedure of the program being compiled
+} RuntimeRoutine;
+
+RuntimeModule __RUNTIME_MODULES__[] = {
+    {.name = "strlen", .kernel = "_rt_strlen", .text = RUNTIME_STRLEN},
+    {.name = "memchr", .kernel = "_rt_memchr", .text = RUNTIME_MEMCHR},
+    {.name = "memcpy", .kernel = "_rt_memcpy", .text = RUNTIME_MEMCPY},
+    {.name = "memset", .kernel = "_rt_memset", .text = RUNTIME_MEMSET},
+    {.name = "memcmp", .kernel = "_rt_memcmp", .text = RUNTIME_MEMCMP},
+    {.name = "io",
+     .text = RUNTIME_IO,
+     .data = RUNTIME_IO_DATA,
+     .bss = RUNTIME_IO_BSS,
+     .requires = {"strlen", "memcpy"}},
+    {.name = "linux", .text = RUNTIME_LINUX},
+    {.name = "alloc",
+     .text = RUNTIME_ALLOC,
+     .bss = RUNTIME_ALLOC_BSS,
+     .requires = {"linux"}},
+    {.name = "vector", .kernel = "_rt_vector", .text = RUNTIME_VECTOR},
+    {.name = "reduce", .kernel = "_rt_reduce", .text = RUNTIME_REDUCE},
+};
+
+RuntimeRoutine __RUNTIME__[] = {
+    // stdlib/string.dang
+    {"strlen", 1, "qword [_rt_strlen_impl]", "strlen"},
+    {"memchr", 3, "qword [_rt_memchr_impl]", "memchr"},
+    {"memcpy", 3, "qword [_rt_memcpy_impl]", "memcpy"},
+    {"memset", 3, "qword [_rt_memset_impl]", "memset"},
+    {"memcmp", 3, "qword [_rt_memcmp_impl]", "memcmp"},
+
+    // stdlib/io.dang
+    {"print", 1, "_rt_io_print", "io"},
+    {"println", 1, "_rt_io_println", "io"},
+    {"write", 2, "_rt_io_write", "io"},
+    {"printint", 1, "_rt_io_printint", "io"},
+    {"flush", 0, "_rt_io_flush", "io"},
+
+    // stdlib/linux.dang
+    {"mmap", 1, "_rt_mmap", "linux"},
+    {"munmap", 2, "_rt_munmap", "linux"},
+    {"alloc", 1, "_rt_arena_alloc", "alloc"},
+    {"reset", 0, "_rt_arena_reset", "alloc"},
+    {"palloc", 1, "_rt_pool_alloc", "alloc"},
+    {"pfree", 2, "_rt_pool_release", "alloc"},
+
+    // stdlib/array.dang
+    {"sum", 2, "_rt_reduce_sum", "reduce"},
+    {"min", 2, "_rt_reduce_min", "reduce"},
+    {"max", 2, "_rt_reduce_max", "reduce"},
+    {"fsum", 2, "_rt_reduce_fsum", "reduce"},
+    {"fmin", 2, "_rt_reduce_fmin", "reduce"},
+    {"fmax", 2, "_rt_reduce_fmax", "reduce"},
+};
+
+#define __RUNTIME_MODULES_COUNT                                                \
+  (sizeof(__RUNTIME_MODULES__) / sizeof(RuntimeModule))
+#define __RUNTIME_COUNT (sizeof(__RUNTIME__) / sizeof(RuntimeRoutine))
+
+RuntimeModule *findRuntimeModule(str name) {
+  for (size_t i = 0; i < __RUNTIME_MODULES_COUNT; i++)
+    if (strcmp(__RUNTIME_MODULES__[i].name, name) == 0)
+      return &__RUNTIME_MODULES__[i];
+
+  CompilerError(fstr("Unknown runtime module \"%s\".", name));
+}
+
+RuntimeRoutine *findRuntimeRoutine(str name) {
+  for (size_t i = 0; i < __RUNTIME_COUNT; i++)
+    if (strcmp(__RUNTIME__[i].name, name) == 0)
+      return &__RUNTIME__[i];
+  return NULL;
+}
+
+/**
+ * @brief Mark a module, and the modules it calls into, as needed
+ */
+void linkRuntimeModule(str name) {
+  RuntimeModule *module = findRuntimeModule(name);
+  if (module->linked)
+    return;
+
+  module->linked = true;
+  for (size_t i = 0; i < 3 && module->requires[i] != NULL; i++)
+    linkRuntimeModule(module->requires[i]);
+}
+
+/**
+ * @brief Back a procedure declaration with a runtime routine, if one exists
+ *
+ * @return Whether the procedure is now provided by the runtime
+ */
+bool declareRuntimeProcedure(str name, uint nargs) {
+  RuntimeRoutine *routine = findRuntimeRoutine(name);
+  if (routine == NULL)
+    return false;
+
+  if (routine->nargs != nargs)
+    CompilerError(fstr("Runtime procedure \"%s\" takes %u arguments.", name,
+                       routine->nargs));
+
+  routine->declared = true;
+  linkRuntimeModule(routine->module);
+  return true;
+}
+
+bool isRuntimeModuleLinked(str name) {
+  return findRuntimeModule(name)->linked;
+}
+
+bool isRuntimeLinked() {
+  for (size_t i = 0; i < __RUNTIME_MODULES_COUNT; i++)
+    if (__RUNTIME_MODULES__[i].linked)
+      return true;
+  return false;
+}
+
+/**
+ * @brief Emit a procedure that calls into a runtime kernel
+ * Arguments were pushed in order below the return address, the result is
+ * left under it like any other procedure does, or in xmm0 for a float one.
+ */
+void resolveRuntimeProcedure(strbuf *func, str label, str name,
+                             bool returnsFloat) {
+  RuntimeRoutine *routine = findRuntimeRoutine(name);
+  str argloc[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+
+  fline(func, "%s:", label);
+  for (uint i = 0; i < routine->nargs; i++)
+    fline(func, "mov %s, [rsp + %u]", argloc[i], 8 * (routine->nargs - i));
+
+  fline(func, "call %s", routine->call);
+  wline(func, "pop rcx");
+  if (routine->nargs > 0)
+    fline(func, "add rsp, %u", 8 * routine->nargs);
+  if (!returnsFloat)
+    wline(func, "push rax");
+  wline(func, "push rcx");
+  wline(func, "ret");
+}
+
+/**
+ * @brief Emit kernels of all linked modules and the startup dispatcher
+ *
+ * @param exported Make every kernel visible to the linker
+ */
+void generateRuntime(strbuf *func, strbuf *data, strbuf *bss, bool exported) {
+  if (!isRuntimeLinked())
+    return;
+
+  str levels[] = {"word", "sse2", "avx2"};
+
+  wline(func, "_rt_init:");
+  wline(func, "call _rt_cpu_init");
+  wline(func, "mov rcx, [_rt_cpu_features]");
+  for (size_t i = 0; i < __RUNTIME_MODULES_COUNT; i++) {
+    RuntimeModule *module = &__RUNTIME_MODULES__[i];
+    if (!module->linked || module->kernel == NULL)
+      continue;
+
+    // Best level the CPU supports, without branching
+    fline(func, "mov rax, %s_word", module->kernel);
+    for (uint level = 1; level < 3; level++) {
+      fline(func, "mov rdx, %s_%s", module->kernel, levels[level]);
+      fline(func, "test ecx, %u", 1 << (level - 1));
+      wline(func, "cmovnz rax, rdx");
+    }
+    fline(func, "mov [%s_impl], rax", module->kernel);
+  }
+  wline(func, "ret");
+
+  wline(func, RUNTIME_CPU_INIT);
+  wline(bss, "_rt_cpu_features: resq 1");
+  if (exported) {
+    wline(func, "global _rt_init");
+    wline(func, "global _rt_cpu_init");
+    wline(func, "global _rt_cpu_features");
+  }
+
+  for (size_t i = 0; i < __RUNTIME_MODULES_COUNT; i++) {
+    RuntimeModule *module = &__RUNTIME_MODULES__[i];
+    if (!module->linked)
+      continue;
+
+    wline(func, module->text);
+    if (module->data != NULL)
+      wline(data, module->data);
+    if (module->bss != NULL)
+      wline(bss, module->bss);
+
+    if (module->kernel != NULL)
+      fline(bss, "%s_impl: resq 1", module->kernel);
+
+    if (exported && module->kernel != NULL) {
+      for (uint level = 0; level < 3; level++)
+        fline(func, "global %s_%s", module->kernel, levels[level]);
+      fline(func, "global %s_impl", module->kernel);
+    }
+  }
+
+  if (!exported)
+    return;
+
+  for (size_t i = 0; i < __RUNTIME_COUNT; i++) {
+    RuntimeRoutine *routine = &__RUNTIME__[i];
+    if (strchr(routine->call, '[') == NULL)
+      fline(func, "global %s", routine->call);
+  }
+}
+
+/**
+ * @brief Write every runtime kernel to a standalone assembly file
+ * Used to link the kernels against C, e.g. by the benchmarks.
+ */
+void emitRuntime(str outfile) {
+  strbuf func = createBuffer();
+  strbuf data = createBuffer();
+  strbuf bss = createBuffer();
+
+  wline(&func, "section .text");
+  wline(&data, "section .data");
+  wline(&bss, "section .bss");
+
+  for (size_t i = 0; i < __RUNTIME_MODULES_COUNT; i++)
+    __RUNTIME_MODULES__[i].linked = true;
+  generateRuntime(&func, &data, &bss, true);
+
+  FILE *fout = fopen(outfile, "w");
+  if (fout == NULL)
+    CompilerError(fstr("Couldn't create \"%s\".", outfile));
+
+  fprintf(fout, "BITS 64\n\n");
+  fprintf(fout, "%s\n\n", func.ptr);
+  fprintf(fout, "%s\n\n", data.ptr);
+  fprintf(fout, "%s\n\n", bss.ptr);
+  fprintf(fout, "section .note.GNU-stack noalloc noexec nowrite progbits\n");
+  fclose(fout);
+}
+
+#endif
@@ -0,0 +1,668 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "parser.c"
+#include "stats.c"
+#include "utils.c"
+
+#ifndef SERVER_C_INCLUDED
+#define SERVER_C_INCLUDED
+// --------------------------
+// Compile Server -----------
+//
+// `dang --server` listens on a Unix socket. A request carries the client's
+// working directory, its command line and its stdin, stdout and stderr. The
+// server forks a compile for it, which runs exactly like a plain `dang`
+// invocation on those descriptors, and sends back its exit status. Modules
+// that compiles include are parsed once more in the server itself. Every
+// later fork inherits those token streams and splices them in instead of
+// reading, lexing and parsing again.
+
+// Runs one command line, without the binary name, defined in dang.c
+int compileCommand(int argc, str argv[]);
+
+#define SERVER_MAX_REQUEST 65536
+#define SERVER_MAX_JOBS 64
+
+typedef struct {
+  str path; // as written in the include
+  str real; // what it resolved to when the module was parsed
+  struct timespec mtime;
+  off_t size;
+  uint64_t hash;
+} WarmFile;
+
+typedef struct {
+  str real;
+  TokenStream stream;
+  WarmFile *files; // the module first, then everything it includes
+  uint nfiles;
+  Macro *macros; // defined while parsing it, again for every compile using it
+  uint nmacros;
+  bool cold; // doesn't parse on its own, compiles parse it themselves
+} WarmModule;
+
+typedef struct {
+  pid_t pid;
+  int client; // gets the exit status
+  int report; // the compile lists the modules it included here
+  str cwd;
+  strbuf included;
+} ServerJob;
+
+WarmModule *__WARM_MODULES__;
+uint __N_WARM_MODULES__;
+
+// Set in the compiles the server forks, the server parses cold
+bool __SERVING__;
+int __SERVER_REPORT__ = -1;
+str __SERVER_SOCKET__;
+
+// Command line of the compile running in this fork
+str *__REQUEST_ARGS__;
+int __N_REQUEST_ARGS__;
+
+/**
+ * @brief Directory for the default socket, $XDG_RUNTIME_DIR or /tmp/dang-UID
+ * made for it. Either has to belong to this user and be closed to everyone
+ * else, or someone else could be listening in its place.
+ */
+str privateSocketDir() {
+  str dir = getenv("XDG_RUNTIME_DIR");
+  if (dir == NULL || dir[0] != '/') {
+    dir = fstr("/tmp/dang-%u", getuid());
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST)
+      CompilerError(fstr("Couldn't create \"%s\".", dir));
+  }
+
+  struct stat st;
+  if (lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode) ||
+      st.st_uid != getuid() || (st.st_mode & 077) != 0)
+    CompilerError(fstr("\"%s\" has to be a directory only you can access.",
+                       dir));
+  return dir;
+}
+
+/**
+ * @brief Socket of --server or --client, either =PATH or one per user
+ */
+str serverSocketPath(str flag) {
+  str value = strchr(flag, '=');
+  if (value != NULL)
+    return &value[1];
+  return fstr("%s/dang.sock", privateSocketDir());
+}
+
+/**
+ * @brief Whether the other end of a connection runs as this user, requests
+ * carry descriptors and paths that only they may hand over
+ */
+bool isOwnPeer(int fd) {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+         len == sizeof(cred) && cred.uid == getuid();
+}
+
+bool hashFile(str path, uint64_t *hash) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return false;
+
+  char chunk[8192];
+  size_t n;
+  *hash = 0xcbf29ce484222325ull;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    for (size_t i = 0; i < n; i++)
+      *hash = (*hash ^ (unsigned char)chunk[i]) * 0x100000001b3ull;
+
+  fclose(f);
+  return true;
+}
+
+bool recordWarmFile(WarmFile *file, str path) {
+  char real[PATH_MAX];
+  struct stat st;
+  if (realpath(path, real) == NULL || stat(real, &st) != 0)
+    return false;
+
+  *file = (WarmFile){
+      .path = fstr("%s", path),
+      .real = fstr("%s", real),
+      .mtime = st.st_mtim,
+      .size = st.st_size,
+  };
+  return hashFile(real, &file->hash);
+}
+
+/**
+ * @brief Whether a file still resolves to and contains what was parsed
+ * A new mtime alone doesn't count, only a different hash.
+ */
+bool isWarmFileFresh(WarmFile *file) {
+  char real[PATH_MAX];
+  struct stat st;
+  if (realpath(file->path, real) == NULL || strcmp(real, file->real) != 0 ||
+      stat(real, &st) != 0 || st.st_size != file->size)
+    return false;
+
+  if (st.st_mtim.tv_sec == file->mtime.tv_sec &&
+      st.st_mtim.tv_nsec == file->mtime.tv_nsec)
+    return true;
+
+  uint64_t hash;
+  if (!hashFile(real, &hash) || hash != file->hash)
+    return false;
+
+  file->mtime = st.st_mtim;
+  return true;
+}
+
+bool isWarmModuleFresh(WarmModule *module) {
+  for (uint i = 0; i < module->nfiles; i++)
+    if (!isWarmFileFresh(&module->files[i]))
+      return false;
+  return true;
+}
+
+WarmModule *findWarmModule(str real) {
+  for (uint i = 0; i < __N_WARM_MODULES__; i++)
+    if (strcmp(__WARM_MODULES__[i].real, real) == 0)
+      return &__WARM_MODULES__[i];
+  return NULL;
+}
+
+/**
+ * @brief Stream of an included module, if the server has it parsed and
+ * nothing it was parsed from changed. Each stream is handed out once per
+ * compile, splicing relinks its tokens.
+ */
+TokenStream warmModule(str filename) {
+  if (!__SERVING__)
+    return NULL;
+
+  char real[PATH_MAX];
+  if (realpath(filename, real) == NULL)
+    return NULL;
+
+  WarmModule *module = findWarmModule(real);
+  if (module == NULL || module->stream == NULL || !isWarmModuleFresh(module))
+    return NULL;
+
+  // Modules it includes count as compiling, like parsing it would mark them
+  for (uint i = 1; i < module->nfiles; i++)
+    setTargetCompiling(module->files[i].path);
+  for (uint i = 0; i < module->nmacros; i++)
+    registerMacro(module->macros[i]);
+
+  TokenStream stream = module->stream;
+  module->stream = NULL;
+  return stream;
+}
+
+/**
+ * @brief Where to keep a module, the one it replaces if there is one
+ */
+WarmModule *warmModuleSlot(WarmModule *module) {
+  if (module != NULL)
+    return module;
+
+  __WARM_MODULES__ = realloc(__WARM_MODULES__,
+                             (__N_WARM_MODULES__ + 1) * sizeof(WarmModule));
+  return &__WARM_MODULES__[__N_WARM_MODULES__++];
+}
+
+/**
+ * @brief Whether a module parses on its own, tried in a child first
+ * CompilerError exits, so a module that only parses with its includer's
+ * macros must not be parsed in the server.
+ */
+bool parsesAlone(str path) {
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0)
+      dup2(null, STDERR_FILENO);
+    parse(path);
+    _exit(0);
+  }
+
+  int status;
+  return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0;
+}
+
+/**
+ * @brief Parse a module in the server, unless it is warm already
+ * Relative includes resolve against the directory of the compile that
+ * used it.
+ */
+void warmUp(str cwd, str path) {
+  if (chdir(cwd) != 0)
+    return;
+
+  char real[PATH_MAX];
+  if (realpath(path, real) == NULL)
+    return;
+
+  WarmModule *module = findWarmModule(real);
+  if (module != NULL && isWarmModuleFresh(module))
+    return;
+
+  // Parse on an empty include stack, what it pushes are the nested includes
+  __TARGETS__ = malloc(sizeof(str));
+  __TARGETS__[0] = NULL;
+  setTargetCompiling(path);
+  if (!parsesAlone(path)) {
+    // It stays cold without being tried again, until the module changes
+    fprintf(stderr, "[INFO] Not keeping %s warm, it doesn't parse on its own\n",
+            real);
+    WarmFile *file = malloc(sizeof(WarmFile));
+    if (recordWarmFile(file, path))
+      *warmModuleSlot(module) = (WarmModule){
+          .real = fstr("%s", real),
+          .files = file,
+          .nfiles = 1,
+          .cold = true,
+      };
+    return;
+  }
+
+  uint defined = __N_MACROS__;
+  TokenStream stream = parse(path);
+
+  // Its macros are only visible to compiles that include it
+  uint nmacros = __N_MACROS__ - defined;
+  Macro *macros = malloc(nmacros * sizeof(Macro));
+  memcpy(macros, &__MACROS__[defined], nmacros * sizeof(Macro));
+  __N_MACROS__ = defined;
+
+  uint nfiles = 0;
+  while (__TARGETS__[nfiles] != NULL)
+    nfiles++;
+
+  // The include stack is newest first, the module itself is last
+  WarmFile *files = malloc(nfiles * sizeof(WarmFile));
+  for (uint i = 0; i < nfiles; i++)
+    if (!recordWarmFile(&files[i], __TARGETS__[nfiles - 1 - i]))
+      return;
+
+  *warmModuleSlot(module) = (WarmModule){
+      .real = fstr("%s", real),
+      .stream = stream,
+      .files = files,
+      .nfiles = nfiles,
+      .macros = macros,
+      .nmacros = nmacros,
+  };
+}
+
+void warmStdlib(str cwd) {
+  DIR *dir = opendir("stdlib");
+  if (dir == NULL)
+    return;
+
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    uint len = strlen(entry->d_name);
+    if (len > 5 && strcmp(&entry->d_name[len - 5], ".dang") == 0)
+      warmUp(cwd, fstr("stdlib/%s", entry->d_name));
+  }
+  closedir(dir);
+}
+
+/**
+ * @brief Tell the server which modules this compile included, once it
+ * succeeded. The pipe stays open until the compile exits, which is how the
+ * server learns it finished.
+ */
+void reportIncludes() {
+  if (__SERVER_REPORT__ < 0 || __TARGETS__ == NULL)
+    return;
+
+  for (uint i = 0; __TARGETS__[i] != NULL; i++) {
+    // Targets of the command line change between compiles, don't keep them
+    bool target = false;
+    for (int a = 0; a < __N_REQUEST_ARGS__; a++)
+      if (strcmp(__REQUEST_ARGS__[a], __TARGETS__[i]) == 0)
+        target = true;
+    if (!target)
+      dprintf(__SERVER_REPORT__, "%s\n", __TARGETS__[i]);
+  }
+  __SERVER_REPORT__ = -1;
+}
+
+bool readFully(int fd, void *buffer, size_t size) {
+  while (size > 0) {
+    ssize_t n = read(fd, buffer, size);
+    if (n <= 0)
+      return false;
+    buffer = (char *)buffer + n;
+    size -= n;
+  }
+  return true;
+}
+
+bool writeFully(int fd, void *buffer, size_t size) {
+  while (size > 0) {
+    ssize_t n = write(fd, buffer, size);
+    if (n <= 0)
+      return false;
+    buffer = (char *)buffer + n;
+    size -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief Read a request: its length along with the client's stdin, stdout
+ * and stderr, then the working directory and arguments, null-separated
+ */
+bool receiveRequest(int client, int fds[3], str *payload, uint *size) {
+  char control[CMSG_SPACE(3 * sizeof(int))];
+  struct iovec iov = {.iov_base = size, .iov_len = sizeof(uint)};
+  struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = control,
+      .msg_controllen = sizeof(control),
+  };
+
+  if (recvmsg(client, &msg, 0) != sizeof(uint))
+    return false;
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+    return false;
+  memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+
+  if (*size == 0 || *size > SERVER_MAX_REQUEST) {
+    for (uint i = 0; i < 3; i++)
+      close(fds[i]);
+    return false;
+  }
+
+  *payload = malloc(*size);
+  if (!readFully(client, *payload, *size) || (*payload)[*size - 1] != '\0') {
+    for (uint i = 0; i < 3; i++)
+      close(fds[i]);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Fork a compile for a request, it runs on the client's descriptors
+ */
+bool startJob(ServerJob *job, int client, int listener, ServerJob *jobs,
+              uint njobs) {
+  int fds[3];
+  str payload;
+  uint size;
+  if (!receiveRequest(client, fds, &payload, &size))
+    return false;
+
+  // Working directory first, then the arguments
+  str cwd = payload;
+  int argc = 0;
+  str *argv = malloc(size * sizeof(str));
+  for (str arg = &cwd[strlen(cwd) + 1]; arg < &payload[size];
+       arg = &arg[strlen(arg) + 1])
+    argv[argc++] = arg;
+
+  int report[2];
+  if (pipe(report) != 0) {
+    for (uint i = 0; i < 3; i++)
+      close(fds[i]);
+    return false;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(listener);
+    close(report[0]);
+    for (uint i = 0; i < njobs; i++) {
+      close(jobs[i].client);
+      close(jobs[i].report);
+    }
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    for (int i = 0; i < 3; i++) {
+      dup2(fds[i], i);
+      close(fds[i]);
+    }
+    close(client);
+    setvbuf(stdout, NULL, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF, BUFSIZ);
+
+    if (chdir(cwd) != 0)
+      CompilerError(fstr("Couldn't enter \"%s\".", cwd));
+
+    __SERVING__ = true;
+    __SERVER_REPORT__ = report[1];
+    __REQUEST_ARGS__ = argv;
+    __N_REQUEST_ARGS__ = argc;
+    exit(compileCommand(argc, argv));
+  }
+
+  close(report[1]);
+  for (uint i = 0; i < 3; i++)
+    close(fds[i]);
+
+  if (pid < 0) {
+    close(report[0]);
+    return false;
+  }
+
+  *job = (ServerJob){
+      .pid = pid,
+      .client = client,
+      .report = report[0],
+      .cwd = cwd,
+      .included = createBuffer(),
+  };
+  return true;
+}
+
+/**
+ * @brief Send the exit status of a finished compile and keep what it
+ * included warm. Only compiles that succeeded report their includes, under
+ * -run and -interp the status is the program's.
+ */
+void finishJob(ServerJob *job) {
+  int status;
+  waitpid(job->pid, &status, 0);
+  int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+  writeFully(job->client, &code, sizeof(int));
+  close(job->client);
+  close(job->report);
+
+  for (str line = job->included.ptr; *line != '\0';) {
+    uint len = strcspn(line, "\n");
+    str next = line[len] == '\n' ? &line[len + 1] : &line[len];
+    line[len] = '\0';
+    warmUp(job->cwd, line);
+    line = next;
+  }
+  free(job->included.ptr);
+}
+
+void stopServer(int sig) {
+  unlink(__SERVER_SOCKET__);
+  _exit(0);
+}
+
+/**
+ * @brief Serve compile requests until interrupted, several at once
+ */
+void serveCompiles(str socketPath) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(socketPath) >= sizeof(addr.sun_path))
+    CompilerError(fstr("Socket path \"%s\" is too long.", socketPath));
+  strcpy(addr.sun_path, socketPath);
+
+  // Only this user may connect, whatever the directory allows
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(socketPath);
+  mode_t mask = umask(077);
+  bool bound = listener >= 0 &&
+               bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+  umask(mask);
+  if (!bound || chmod(socketPath, 0600) != 0 ||
+      listen(listener, SOMAXCONN) != 0)
+    CompilerError(fstr("Couldn't listen on \"%s\".", socketPath));
+
+  __SERVER_SOCKET__ = socketPath;
+  signal(SIGINT, stopServer);
+  signal(SIGTERM, stopServer);
+  signal(SIGPIPE, SIG_IGN);
+
+  // Parsing reports progress on stdout, only compiles should talk there
+  fflush(stdout);
+  int null = open("/dev/null", O_WRONLY);
+  if (null >= 0) {
+    dup2(null, STDOUT_FILENO);
+    close(null);
+  }
+
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
+    CompilerError("Couldn't read the working directory.");
+  warmStdlib(cwd);
+  uint warm = 0;
+  for (uint i = 0; i < __N_WARM_MODULES__; i++)
+    warm += !__WARM_MODULES__[i].cold;
+  fprintf(stderr, "[INFO] Serving compiles on %s, %u module(s) warm\n",
+          socketPath, warm);
+
+  ServerJob jobs[SERVER_MAX_JOBS];
+  uint njobs = 0;
+  while (true) {
+    struct pollfd fds[SERVER_MAX_JOBS + 1];
+    for (uint i = 0; i < njobs; i++)
+      fds[i] = (struct pollfd){.fd = jobs[i].report, .events = POLLIN};
+    // Requests wait in the backlog while every slot is busy
+    fds[njobs] = (struct pollfd){.fd = listener, .events = POLLIN};
+    bool listening = njobs < SERVER_MAX_JOBS;
+    uint nfds = listening ? njobs + 1 : njobs;
+
+    if (poll(fds, nfds, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      CompilerError("Couldn't wait for compile requests.");
+    }
+
+    // Collect reports, a closed one means the compile exited
+    for (uint i = njobs; i > 0; i--) {
+      if (fds[i - 1].revents == 0)
+        continue;
+
+      char chunk[4096];
+      ssize_t n = read(jobs[i - 1].report, chunk, sizeof(chunk));
+      if (n > 0) {
+        appendBuffer(&jobs[i - 1].included, chunk, n);
+        continue;
+      }
+
+      finishJob(&jobs[i - 1]);
+      jobs[i - 1] = jobs[--njobs];
+    }
+
+    // Reaping shrinks njobs, the listener is still the last one polled
+    if (listening && (fds[nfds - 1].revents & POLLIN)) {
+      int client = accept(listener, NULL, NULL);
+      if (client < 0)
+        continue;
+      if (!isOwnPeer(client)) {
+        fprintf(stderr, "[INFO] Refused a request from another user\n");
+        close(client);
+        continue;
+      }
+      if (startJob(&jobs[njobs], client, listener, jobs, njobs))
+        njobs++;
+      else
+        close(client);
+    }
+  }
+}
+
+/**
+ * @brief Have the server run this command line
+ *
+ * @return int Exit status of the compile, -1 when no server is listening
+ */
+int clientCompile(str socketPath, int argc, str argv[]) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(socketPath) >= sizeof(addr.sun_path))
+    return -1;
+  strcpy(addr.sun_path, socketPath);
+
+  int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server < 0 ||
+      connect(server, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    if (server >= 0)
+      close(server);
+    return -1;
+  }
+  if (!isOwnPeer(server))
+    CompilerError(fstr("The compile server on \"%s\" isn't yours.",
+                       socketPath));
+
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
+    CompilerError("Couldn't read the working directory.");
+
+  strbuf payload = createBuffer();
+  appendBuffer(&payload, cwd, strlen(cwd) + 1);
+  for (int i = 0; i < argc; i++)
+    if (strncmp(argv[i], "--client", strlen("--client")) != 0)
+      appendBuffer(&payload, argv[i], strlen(argv[i]) + 1);
+
+  int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  char control[CMSG_SPACE(sizeof(fds))] = {};
+  struct iovec iov = {.iov_base = &payload.len, .iov_len = sizeof(uint)};
+  struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = control,
+      .msg_controllen = sizeof(control),
+  };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  fflush(stdout);
+  int code;
+  if (sendmsg(server, &msg, 0) != sizeof(uint) ||
+      !writeFully(server, payload.ptr, payload.len) ||
+      !readFully(server, &code, sizeof(int)))
+    CompilerError("Lost the connection to the compile server.");
+
+  close(server);
+  return code;
+}
+
+#endif
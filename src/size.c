@@ -0,0 +1,337 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codestats.c"
+#include "utils.c"
+
+#ifndef SIZE_C_INCLUDED
+#define SIZE_C_INCLUDED
+// --------------------------
+// Size Optimization --------
+//
+// -Os rewrites the code lowering produced, line by line, into shorter
+// encodings of the same thing: a register that gets zero is cleared with a
+// 32-bit xor, other constants and addresses that fit are moved into the
+// 32-bit register, which zero-extends, comparisons with zero become a test
+// and byte sized constants are stored through a push of a sign-extended
+// imm8. Code after an unconditional jump is dropped, and blocks of a
+// routine that end in the same way, like its returns, share one copy of
+// their tail.
+
+// Instructions searched ahead for a read of the flags an xor would change
+#define SIZE_FLAGS_WINDOW 32
+
+// Bytes a tail has to have to be shared, the jump to it takes up to 5
+#define SIZE_MIN_TAIL 6
+
+typedef struct {
+  str wide;
+  str narrow;
+} RegisterWidth;
+
+const RegisterWidth SIZE_REGISTERS[] = {
+    {"rax", "eax"},   {"rbx", "ebx"},   {"rcx", "ecx"},   {"rdx", "edx"},
+    {"rsi", "esi"},   {"rdi", "edi"},   {"rbp", "ebp"},   {"r8", "r8d"},
+    {"r9", "r9d"},    {"r10", "r10d"},  {"r11", "r11d"},  {"r12", "r12d"},
+    {"r13", "r13d"},  {"r14", "r14d"},  {"r15", "r15d"},  {NULL, NULL},
+};
+
+typedef struct {
+  str *lines;  // NULL once dropped
+  uint *tails; // shared tail label in front of each line, 0 for none
+  uint n;
+} CodeLines;
+
+/**
+ * @brief 32-bit name of a 64-bit register, NULL for anything else
+ */
+str narrowRegister(str operand) {
+  for (uint i = 0; SIZE_REGISTERS[i].wide != NULL; i++)
+    if (strcmp(SIZE_REGISTERS[i].wide, operand) == 0)
+      return SIZE_REGISTERS[i].narrow;
+  return NULL;
+}
+
+/**
+ * @brief Mnemonic and up to two operands of an instruction, each buffer at
+ * least as long as the line
+ *
+ * @return Number of operands
+ */
+uint splitInstruction(str line, str mnemonic, str dst, str src) {
+  uint split = strcspn(line, " ");
+  sprintf(mnemonic, "%.*s", split, line);
+  dst[0] = src[0] = '\0';
+  if (line[split] == '\0')
+    return 0;
+
+  str operands = &line[split + 1];
+  str comma = strchr(operands, ',');
+  if (comma == NULL) {
+    strcpy(dst, operands);
+    return 1;
+  }
+
+  sprintf(dst, "%.*s", (int)(comma - operands), operands);
+  strcpy(src, comma[1] == ' ' ? &comma[2] : &comma[1]);
+  return 2;
+}
+
+/**
+ * @brief Whether a line is code that only runs after the one before it
+ */
+bool isStraightLine(str line) {
+  return isAsmInstruction(line) && strncmp(line, "align", 5) != 0;
+}
+
+bool isTransparentLine(str line) {
+  return line == NULL || line[0] == '\0' || line[0] == ';';
+}
+
+bool isFlagReader(str mnemonic) {
+  return (mnemonic[0] == 'j' && strcmp(mnemonic, "jmp") != 0) ||
+         strncmp(mnemonic, "set", 3) == 0 ||
+         strncmp(mnemonic, "cmov", 4) == 0 || strcmp(mnemonic, "adc") == 0 ||
+         strcmp(mnemonic, "sbb") == 0;
+}
+
+bool isFlagWriter(str mnemonic) {
+  const str writers[] = {"cmp", "test", "add",  "sub",     "and",    "or",
+                         "xor", "neg",  "imul", "ucomisd", "comisd", NULL};
+  for (uint i = 0; writers[i] != NULL; i++)
+    if (strcmp(writers[i], mnemonic) == 0)
+      return true;
+  return false;
+}
+
+/**
+ * @brief Whether the flags are written again before anything reads them,
+ * after the line at. Procedures never expect flags from their caller.
+ */
+bool areFlagsDead(CodeLines *code, uint at) {
+  uint seen = 0;
+  for (uint i = at + 1; i < code->n && seen < SIZE_FLAGS_WINDOW; i++) {
+    str line = code->lines[i];
+    if (code->tails[i] != 0)
+      return false; // other paths join
+    if (isTransparentLine(line))
+      continue;
+    if (!isStraightLine(line))
+      return false;
+    seen++;
+
+    uint len = strlen(line) + 1;
+    char mnemonic[len], dst[len], src[len];
+    splitInstruction(line, mnemonic, dst, src);
+    if (isFlagReader(mnemonic) || strcmp(mnemonic, "jmp") == 0)
+      return false;
+    if (isFlagWriter(mnemonic) || strcmp(mnemonic, "ret") == 0 ||
+        strcmp(mnemonic, "call") == 0 || strcmp(mnemonic, "syscall") == 0)
+      return true;
+  }
+  return false;
+}
+
+bool isTerminator(str line) {
+  return strcmp(line, "ret") == 0 || strncmp(line, "jmp ", 4) == 0;
+}
+
+bool isBranch(str line) { return line[0] == 'j' || isTerminator(line); }
+
+/**
+ * @brief Drop the code between an unconditional jump or return and the
+ * next label, nothing can reach it
+ */
+void dropUnreachable(CodeLines *code) {
+  bool reachable = true;
+  for (uint i = 0; i < code->n; i++) {
+    str line = code->lines[i];
+    if (isTransparentLine(line) || strncmp(line, "align", 5) == 0)
+      continue;
+    if (!isStraightLine(line))
+      reachable = true;
+    else if (!reachable)
+      code->lines[i] = NULL;
+    else if (isTerminator(line))
+      reachable = false;
+  }
+}
+
+/**
+ * @brief Rough length of an instruction, to tell if its tail is worth
+ * sharing
+ */
+uint estimateSize(str line) {
+  if (strchr(line, '[') != NULL)
+    return 7;
+  if (strcmp(line, "ret") == 0 || strncmp(line, "push r", 6) == 0 ||
+      strncmp(line, "pop r", 5) == 0)
+    return 1;
+  return 4;
+}
+
+/**
+ * @brief Line before from in its block, or code->n where the block starts
+ */
+uint previousStraightLine(CodeLines *code, uint from) {
+  uint i = from;
+  while (i-- > 0) {
+    str line = code->lines[i];
+    if (isTransparentLine(line))
+      continue;
+    if (!isStraightLine(line) || isBranch(line))
+      return code->n;
+    return i;
+  }
+  return code->n;
+}
+
+/**
+ * @brief Identical lines the blocks ending at a and b end with
+ *
+ * @param from Set to where the tail starts in the block ending at a
+ * @param to Set to where it starts in the block ending at b
+ * @return Rough bytes of the tail
+ */
+uint commonTail(CodeLines *code, uint a, uint b, uint *from, uint *to) {
+  uint bytes = 0;
+  uint i = a, j = b;
+  *from = a;
+  *to = b;
+  while (i != code->n && j != code->n &&
+         strcmp(code->lines[i], code->lines[j]) == 0) {
+    bytes += estimateSize(code->lines[i]);
+    *from = i;
+    *to = j;
+    i = previousStraightLine(code, i);
+    j = previousStraightLine(code, j);
+  }
+  return bytes;
+}
+
+/**
+ * @brief Replace the tail of a block by a jump to the same lines earlier in
+ * its routine
+ */
+void shareTails(CodeLines *code) {
+  uint *ends = malloc(code->n * sizeof(uint));
+  uint nends = 0, routine = 0, tails = 0;
+
+  for (uint b = 0; b < code->n; b++) {
+    str line = code->lines[b];
+    bool global;
+    if (line != NULL && isAsmLabel(line, &global) && global) {
+      routine = nends; // tail labels are local to a routine
+      continue;
+    }
+    if (isTransparentLine(line) || !isTerminator(line))
+      continue;
+
+    uint best = 0, from = 0, to = 0;
+    for (uint k = routine; k < nends; k++) {
+      uint start, mine;
+      uint bytes = commonTail(code, ends[k], b, &start, &mine);
+      if (bytes > best) {
+        best = bytes;
+        from = start;
+        to = mine;
+      }
+    }
+
+    if (best < SIZE_MIN_TAIL) {
+      ends[nends++] = b;
+      continue;
+    }
+
+    if (code->tails[from] == 0)
+      code->tails[from] = ++tails;
+    for (uint i = to; i < b; i++)
+      if (!isTransparentLine(code->lines[i]))
+        code->lines[i] = NULL;
+    code->lines[b] = fstr("jmp .tail%u", code->tails[from]);
+  }
+
+  free(ends);
+}
+
+/**
+ * @brief Shorter encoding of the instruction at a line, or the line itself
+ */
+str shrinkInstruction(CodeLines *code, uint at) {
+  str line = code->lines[at];
+  uint len = strlen(line) + 1;
+  char mnemonic[len], dst[len], src[len];
+  if (splitInstruction(line, mnemonic, dst, src) != 2)
+    return line;
+
+  str narrow = narrowRegister(dst);
+  char *end;
+  long long value = strtoll(src, &end, 0);
+  bool number = src[0] != '\0' && *end == '\0';
+
+  if (strcmp(mnemonic, "mov") == 0 && narrow != NULL) {
+    // xor r32, r32 clears all 64 bits, but changes the flags
+    if (number && value == 0 && areFlagsDead(code, at))
+      return fstr("xor %s, %s", narrow, narrow);
+
+    // Writing the 32-bit register zero-extends, addresses are below 4 GiB
+    bool label = (isalpha(src[0]) || src[0] == '_') &&
+                 strpbrk(src, "[ ") == NULL && !isRegisterName(src) &&
+                 narrowRegister(src) == NULL && strncmp(src, "xmm", 3) != 0;
+    if ((number && value > 0 && value <= UINT32_MAX) || label)
+      return fstr("mov %s, %s", narrow, src);
+  }
+
+  if (strcmp(mnemonic, "cmp") == 0 && (narrow != NULL || isRegisterName(dst)) &&
+      number && value == 0)
+    return fstr("test %s, %s", dst, dst);
+
+  if (strcmp(mnemonic, "movzx") == 0 && narrow != NULL &&
+      strchr(src, '[') == NULL)
+    return fstr("movzx %s, %s", narrow, src);
+
+  // mov m64 only takes an imm32, push sign-extends an imm8
+  if (strcmp(mnemonic, "mov") == 0 && strncmp(dst, "qword [", 7) == 0 &&
+      strstr(dst, "rsp") == NULL && number && value >= -128 && value <= 127)
+    return fstr("push qword %lld\npop %s", value, dst);
+
+  return line;
+}
+
+/**
+ * @brief Rewrite a section of lowered code for size
+ */
+void shrinkCode(strbuf *section) {
+  CodeLines code = {};
+  for (str c = section->ptr; *c != '\0';) {
+    uint len = strcspn(c, "\n");
+    if ((code.n & (code.n - 1)) == 0)
+      code.lines = realloc(code.lines, (code.n ? 2 * code.n : 1) * sizeof(str));
+    code.lines[code.n++] = fstr("%.*s", len, c);
+    c = c[len] == '\n' ? &c[len + 1] : &c[len];
+  }
+  code.tails = calloc(code.n + 1, sizeof(uint));
+
+  dropUnreachable(&code);
+  shareTails(&code);
+  for (uint i = 0; i < code.n; i++)
+    if (!isTransparentLine(code.lines[i]) && isStraightLine(code.lines[i]))
+      code.lines[i] = shrinkInstruction(&code, i);
+
+  strbuf shrunk = createBuffer();
+  for (uint i = 0; i < code.n; i++) {
+    if (code.tails[i] != 0)
+      fline(&shrunk, ".tail%u:", code.tails[i]);
+    if (code.lines[i] != NULL)
+      wline(&shrunk, code.lines[i]);
+  }
+
+  free(section->ptr);
+  *section = shrunk;
+  free(code.lines);
+  free(code.tails);
+}
+
+#endif
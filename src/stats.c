@@ -0,0 +1,174 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "utils.c"
+
+#ifndef STATS_C_INCLUDED
+#define STATS_C_INCLUDED
+// --------------------------
+// Compiler Statistics ------
+
+typedef enum {
+  PHASE_READ,
+  PHASE_LEX,
+  PHASE_PARSE,
+  PHASE_EVAL,
+  PHASE_WHOLE_PROGRAM,
+  PHASE_CODEGEN,
+  PHASE_NASM,
+  PHASE_LD,
+  PHASE_OTHER,
+  __PHASE_COUNT,
+} Phase;
+
+const str PHASE_NAMES[] = {"read",          "lex",     "parse", "const-eval",
+                           "whole-program", "codegen", "nasm",  "ld",
+                           "other"};
+
+typedef struct {
+  double seconds;
+  size_t bytes;
+  size_t allocations;
+  uint calls;
+  long maxrss; // high-water mark in KiB when the phase last ran
+} PhaseStats;
+
+#define STATS_MAX_DEPTH 64
+
+// Time and allocations are charged to the innermost running phase, so a
+// parse that lexes an included module doesn't count the lexing twice.
+PhaseStats __PHASES__[__PHASE_COUNT];
+Phase __PHASE_STACK__[STATS_MAX_DEPTH];
+uint __PHASE_DEPTH__;
+
+double __STATS_START__;
+double __STATS_MARK__;
+size_t __STATS_MARK_BYTES__;
+size_t __STATS_MARK_COUNT__;
+
+double monotonicSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+long maxResidentKilobytes(int who) {
+  struct rusage usage;
+  if (getrusage(who, &usage) != 0)
+    return 0;
+  return usage.ru_maxrss;
+}
+
+/**
+ * @brief Charge everything since the last transition to the running phase
+ */
+void statsCharge() {
+  double now = monotonicSeconds();
+  Phase phase =
+      __PHASE_DEPTH__ > 0 ? __PHASE_STACK__[__PHASE_DEPTH__ - 1] : PHASE_OTHER;
+
+  __PHASES__[phase].seconds += now - __STATS_MARK__;
+  __PHASES__[phase].bytes += __ALLOC_BYTES__ - __STATS_MARK_BYTES__;
+  __PHASES__[phase].allocations += __ALLOC_COUNT__ - __STATS_MARK_COUNT__;
+  __PHASES__[phase].maxrss = maxResidentKilobytes(
+      phase == PHASE_NASM || phase == PHASE_LD ? RUSAGE_CHILDREN : RUSAGE_SELF);
+
+  __STATS_MARK__ = now;
+  __STATS_MARK_BYTES__ = __ALLOC_BYTES__;
+  __STATS_MARK_COUNT__ = __ALLOC_COUNT__;
+}
+
+void statsInit() {
+  // A forked compile starts over from what the server counted
+  memset(__PHASES__, 0, sizeof(__PHASES__));
+  __PHASE_DEPTH__ = 0;
+
+  __STATS_START__ = monotonicSeconds();
+  __STATS_MARK__ = __STATS_START__;
+  __STATS_MARK_BYTES__ = __ALLOC_BYTES__;
+  __STATS_MARK_COUNT__ = __ALLOC_COUNT__;
+}
+
+void statsBegin(Phase phase) {
+  if (__PHASE_DEPTH__ == STATS_MAX_DEPTH)
+    CompilerError("Compiler phases nested too deeply.");
+
+  statsCharge();
+  __PHASES__[phase].calls++;
+  __PHASE_STACK__[__PHASE_DEPTH__++] = phase;
+}
+
+void statsEnd() {
+  statsCharge();
+  __PHASE_DEPTH__--;
+}
+
+/**
+ * @brief Run an external tool as its own phase
+ */
+int statsSystem(Phase phase, str command) {
+  statsBegin(phase);
+  int status = system(command);
+  statsEnd();
+  return status;
+}
+
+/**
+ * @brief Print the -ftime-report table
+ */
+void printStatsReport(FILE *out) {
+  statsCharge();
+  double total = __STATS_MARK__ - __STATS_START__;
+
+  fprintf(out, "\n%-13s %10s %7s %10s %12s %6s\n", "Phase", "Time (ms)", "%",
+          "Allocs", "Bytes", "Calls");
+  for (uint i = 0; i < __PHASE_COUNT; i++) {
+    PhaseStats *phase = &__PHASES__[i];
+    fprintf(out, "%-13s %10.3f %6.1f%% %10zu %12zu %6u\n", PHASE_NAMES[i],
+            phase->seconds * 1e3,
+            total > 0 ? 100 * phase->seconds / total : 0.0,
+            phase->allocations, phase->bytes, phase->calls);
+  }
+  fprintf(out, "%-13s %10.3f %6.1f%% %10zu %12zu\n", "total", total * 1e3,
+          100.0, __ALLOC_COUNT__, __ALLOC_BYTES__);
+  fprintf(out, "Peak RSS: compiler %ld KiB, nasm/ld %ld KiB\n",
+          maxResidentKilobytes(RUSAGE_SELF),
+          maxResidentKilobytes(RUSAGE_CHILDREN));
+}
+
+/**
+ * @brief Write the statistics as JSON, for -stats-json=FILE
+ */
+void writeStatsJson(str filename) {
+  statsCharge();
+
+  FILE *out = fopen(filename, "w");
+  if (out == NULL)
+    CompilerError(fstr("Couldn't open file \"%s\"", filename));
+
+  fprintf(out, "{\n  \"phases\": {\n");
+  for (uint i = 0; i < __PHASE_COUNT; i++) {
+    PhaseStats *phase = &__PHASES__[i];
+    fprintf(out,
+            "    \"%s\": {\"seconds\": %.9f, \"allocations\": %zu, "
+            "\"bytes\": %zu, \"calls\": %u, \"max_rss_kb\": %ld}%s\n",
+            PHASE_NAMES[i], phase->seconds, phase->allocations, phase->bytes,
+            phase->calls, phase->maxrss, i + 1 < __PHASE_COUNT ? "," : "");
+  }
+  fprintf(out, "  },\n");
+  fprintf(out, "  \"seconds\": %.9f,\n", __STATS_MARK__ - __STATS_START__);
+  fprintf(out, "  \"allocations\": %zu,\n", __ALLOC_COUNT__);
+  fprintf(out, "  \"bytes\": %zu,\n", __ALLOC_BYTES__);
+  fprintf(out, "  \"max_rss_kb\": %ld,\n", maxResidentKilobytes(RUSAGE_SELF));
+  fprintf(out, "  \"children_max_rss_kb\": %ld\n",
+          maxResidentKilobytes(RUSAGE_CHILDREN));
+  fprintf(out, "}\n");
+
+  fclose(out);
+}
+
+#endif
@@ -0,0 +1,89 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.c"
+
+#ifndef SYMBOLS_C_INCLUDED
+#define SYMBOLS_C_INCLUDED
+// --------------------------
+// Symbol Table -------------
+
+// Index of an interned string, 0 is never handed out
+typedef uint Symbol;
+
+// Text of every symbol, in interning order
+str *__SYMBOLS__;
+uint __N_SYMBOLS__;
+
+// Open addressing index over the text, always at most half full
+Symbol *__SYMBOL_INDEX__;
+uint __SYMBOL_INDEX_CAPACITY__;
+
+uint symbolHash(str text, uint len) {
+  uint hash = 2166136261u;
+  for (uint i = 0; i < len; i++)
+    hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+  return hash;
+}
+
+void growSymbolIndex() {
+  Symbol *old = __SYMBOL_INDEX__;
+  uint oldCapacity = __SYMBOL_INDEX_CAPACITY__;
+
+  __SYMBOL_INDEX_CAPACITY__ = oldCapacity ? 2 * oldCapacity : 1024;
+  __SYMBOL_INDEX__ = calloc(__SYMBOL_INDEX_CAPACITY__, sizeof(Symbol));
+  __SYMBOLS__ = realloc(__SYMBOLS__, (__SYMBOL_INDEX_CAPACITY__ / 2 + 1) *
+                                         sizeof(str));
+
+  uint mask = __SYMBOL_INDEX_CAPACITY__ - 1;
+  for (uint i = 0; i < oldCapacity; i++)
+    if (old[i] != 0) {
+      str text = __SYMBOLS__[old[i]];
+      uint j = symbolHash(text, strlen(text)) & mask;
+      while (__SYMBOL_INDEX__[j] != 0)
+        j = (j + 1) & mask;
+      __SYMBOL_INDEX__[j] = old[i];
+    }
+  free(old);
+}
+
+/**
+ * @brief Symbol of the text, the same one every time
+ */
+Symbol internView(strview view) {
+  str text = view.ptr;
+  uint len = view.len;
+
+  if (2 * (__N_SYMBOLS__ + 1) >= __SYMBOL_INDEX_CAPACITY__)
+    growSymbolIndex();
+
+  uint mask = __SYMBOL_INDEX_CAPACITY__ - 1;
+  for (uint i = symbolHash(text, len) & mask;; i = (i + 1) & mask) {
+    Symbol symbol = __SYMBOL_INDEX__[i];
+    if (symbol == 0) {
+      str copy = malloc(len + 1);
+      memcpy(copy, text, len);
+      copy[len] = '\0';
+
+      symbol = ++__N_SYMBOLS__;
+      __SYMBOLS__[symbol] = copy;
+      return __SYMBOL_INDEX__[i] = symbol;
+    }
+
+    str known = __SYMBOLS__[symbol];
+    if (strncmp(known, text, len) == 0 && known[len] == '\0')
+      return symbol;
+  }
+}
+
+Symbol intern(str text) { return internView(viewOf(text)); }
+
+str symbolText(Symbol symbol) {
+  if (symbol == 0 || symbol > __N_SYMBOLS__)
+    CompilerError(fstr("Invalid symbol %u.", symbol));
+  return __SYMBOLS__[symbol];
+}
+
+#endif
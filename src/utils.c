@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 
 #ifndef UTILS_C_INCLUDED
 #define UTILS_C_INCLUDED
@@ -10,9 +11,61 @@ typedef enum { false, true } bool;
 typedef unsigned int uint;
 typedef char *str;
 
+/**
+ * @brief Text owned by someone else, like a word inside the source buffer
+ * Not null-terminated, the length always travels with it.
+ */
+typedef struct {
+  str ptr;
+  uint len;
+} strview;
+
+/**
+ * @brief Growable text that knows its length, always null-terminated
+ */
+typedef struct {
+  str ptr;
+  uint len;
+  uint capacity;
+} strbuf;
+
 // Stack of module paths being compiled
 str *__TARGETS__;
 
+// Flags passed to the compiler on the command line
+str *__CFLAGS__;
+uint __N_CFLAGS__;
+
+// Heap usage of the compiler, counted by every malloc, calloc and realloc
+// below. A realloc counts as an allocation of its new size.
+size_t __ALLOC_BYTES__;
+size_t __ALLOC_COUNT__;
+
+void countAllocation(size_t size) {
+  // Codegen workers allocate concurrently
+  __atomic_fetch_add(&__ALLOC_BYTES__, size, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&__ALLOC_COUNT__, 1, __ATOMIC_RELAXED);
+}
+
+void *trackedMalloc(size_t size) {
+  countAllocation(size);
+  return malloc(size);
+}
+
+void *trackedCalloc(size_t count, size_t size) {
+  countAllocation(count * size);
+  return calloc(count, size);
+}
+
+void *trackedRealloc(void *ptr, size_t size) {
+  countAllocation(size);
+  return realloc(ptr, size);
+}
+
+#define malloc(size) trackedMalloc(size)
+#define calloc(count, size) trackedCalloc(count, size)
+#define realloc(ptr, size) trackedRealloc(ptr, size)
+
 /**
  * @brief Conveinience function to throw compiler error
  *
@@ -31,26 +84,98 @@ void CompilerError(str message) {
  * @return str Owned string
  */
 str fstr(str ln, ...) {
-  va_list args;
+  va_list args, measure;
   va_start(args, ln);
 
-  uint _LINE_MAXSIZE = strlen(ln) + 128;
-  str line = malloc(_LINE_MAXSIZE * sizeof(char));
-  int flen = vsnprintf(line, _LINE_MAXSIZE * sizeof(char), ln, args);
+  // Measure first, string literals make lines longer than any fixed bound
+  va_copy(measure, args);
+  int flen = vsnprintf(NULL, 0, ln, measure);
+  va_end(measure);
+
+  if (flen < 0)
+    CompilerError("Invalid formatted string.");
 
-  if (flen > _LINE_MAXSIZE)
-    CompilerError("Formattted string too large.");
+  str new = malloc((flen + 1) * sizeof(char));
+  vsnprintf(new, flen + 1, ln, args);
 
   va_end(args);
+  return new;
+}
 
-  str new;
-  if (flen > 0) {
-    new = malloc(flen * sizeof(char));
-    strcpy(new, line);
+/**
+ * @brief Quote a path for the shell, in single quotes with every single
+ * quote closed, escaped and reopened
+ *
+ * @return str Owned string
+ */
+str shellQuote(str text) {
+  uint quotes = 0;
+  for (str c = text; *c != '\0'; c++)
+    quotes += *c == '\'';
+
+  str quoted = malloc(strlen(text) + 3 * quotes + 3);
+  str out = quoted;
+  *out++ = '\'';
+  for (str c = text; *c != '\0'; c++) {
+    if (*c == '\'') {
+      memcpy(out, "'\\''", 4);
+      out += 4;
+    } else
+      *out++ = *c;
   }
+  *out++ = '\'';
+  *out = '\0';
+  return quoted;
+}
 
-  free(line);
-  return new;
+strview viewOf(str text) { return (strview){text, strlen(text)}; }
+
+strview viewSlice(strview view, uint from, uint to) {
+  return (strview){&view.ptr[from], to - from};
+}
+
+bool viewIs(strview view, str text) {
+  uint len = strlen(text);
+  return view.len == len && memcmp(view.ptr, text, len) == 0;
+}
+
+/**
+ * @brief Position of the first c in view, its length if there is none
+ */
+uint viewFind(strview view, char c) {
+  str at = memchr(view.ptr, c, view.len);
+  return at != NULL ? at - view.ptr : view.len;
+}
+
+strbuf createBuffer() {
+  strbuf buf = {.ptr = malloc(64 * sizeof(char)), .capacity = 64};
+  buf.ptr[0] = '\0';
+  return buf;
+}
+
+/**
+ * @brief Make room for extra more bytes and the terminator
+ */
+void reserveBuffer(strbuf *buf, uint extra) {
+  if (buf->len + extra < buf->capacity)
+    return;
+
+  uint capacity = buf->capacity ? buf->capacity : 64;
+  while (buf->len + extra >= capacity)
+    capacity *= 2;
+
+  str grown = malloc(capacity * sizeof(char));
+  memcpy(grown, buf->ptr, buf->len + 1);
+  free(buf->ptr);
+  buf->ptr = grown;
+  buf->capacity = capacity;
+}
+
+void appendBuffer(strbuf *buf, str text, uint len) {
+  reserveBuffer(buf, len);
+  memcpy(&buf->ptr[buf->len], text, len);
+  buf->len += len;
+  buf->ptr[buf->len] = '\0';
 }
 
 /**
@@ -59,22 +184,15 @@ str fstr(str ln, ...) {
  * @param buf
  * @param ln
  */
-void wline(str *buf, str ln) {
-  uint _flen = strlen(ln);
-  if (_flen == 0)
+void wline(strbuf *buf, str ln) {
+  uint len = strlen(ln);
+  if (len == 0)
     return;
 
-  uint _size = strlen(*buf);
-  str new = malloc((_size + (_size > 0 ? 2 : 1) + _flen) * sizeof(char));
-  strcpy(new, *buf);
-  free(*buf);
-
-  if (_size > 0)
-    new[_size++] = '\n';
-
-  strcpy(&(new[_size]), ln);
-  new[_size + _flen] = '\0';
-  *buf = new;
+  reserveBuffer(buf, len + 1);
+  if (buf->len > 0)
+    buf->ptr[buf->len++] = '\n';
+  appendBuffer(buf, ln, len);
 }
 
 /**
@@ -84,34 +202,32 @@ void wline(str *buf, str ln) {
  * @param ln
  * @param ...
  */
-void fline(str *buf, str ln, ...) {
-  va_list args;
+void fline(strbuf *buf, str ln, ...) {
+  va_list args, retry;
   va_start(args, ln);
+  va_copy(retry, args);
 
-  uint _LINE_MAXSIZE = strlen(ln) + 128;
-  str line = malloc(_LINE_MAXSIZE * sizeof(char));
-  int flen = vsnprintf(line, _LINE_MAXSIZE * sizeof(char), ln, args);
-
-  if (flen > _LINE_MAXSIZE)
-    CompilerError("Formattted string too large.");
-
+  // Format straight into the spare room, again only when it didn't fit
+  reserveBuffer(buf, 1);
+  uint at = buf->len + (buf->len > 0);
+  int flen = vsnprintf(&buf->ptr[at], buf->capacity - at, ln, args);
   va_end(args);
 
-  if (flen <= 0)
+  if (flen <= 0) {
+    buf->ptr[buf->len] = '\0';
+    va_end(retry);
     return;
+  }
 
-  uint _size = strlen(*buf);
-  str new = malloc((_size + (_size > 0 ? 2 : 1) + flen) * sizeof(char));
-  strcpy(new, *buf);
-  // free(*buf);
-
-  if (_size > 0)
-    new[_size++] = '\n';
+  if (at + flen >= buf->capacity) {
+    reserveBuffer(buf, at - buf->len + flen);
+    vsnprintf(&buf->ptr[at], flen + 1, ln, retry);
+  }
+  va_end(retry);
 
-  strcpy(&new[_size], line);
-  free(line);
-  new[_size + flen] = '\0';
-  *buf = new;
+  if (at > buf->len)
+    buf->ptr[buf->len] = '\n';
+  buf->len = at + flen;
 }
 
 /**
@@ -136,18 +252,19 @@ void setTargetCompiling(str module) {
         "Circular dependency, \"%s\" dependends on a module that is using it.",
         module));
 
-  uint __ti = 0;
-  str *targets = malloc(sizeof(str));
+  uint count = 0;
+  while (__TARGETS__[count] != NULL)
+    count++;
 
-  targets[__ti] = malloc(strlen(module) * sizeof(char));
-  strcpy(targets[__ti], module);
+  // The new module goes first, followed by the ones already compiling
+  str *targets = malloc((count + 2) * sizeof(str));
+  targets[0] = malloc((strlen(module) + 1) * sizeof(char));
+  strcpy(targets[0], module);
+
+  for (uint __ti = 0; __ti < count; __ti++)
+    targets[__ti + 1] = __TARGETS__[__ti];
+  targets[count + 1] = NULL;
 
-  while (__TARGETS__[__ti] != NULL) {
-    targets[__ti + 1] = malloc(strlen(__TARGETS__[__ti]) * sizeof(char));
-    strcpy(targets[__ti + 1], __TARGETS__[__ti]);
-    free(__TARGETS__[__ti]);
-    targets[(++__ti) + 1] = NULL;
-  }
   free(__TARGETS__);
   __TARGETS__ = targets;
 }
@@ -160,6 +277,24 @@ bool arrIncludes(str array[], uint len, str query) {
   return false;
 }
 
+/**
+ * @brief Check if a flag was passed to the compiler
+ */
+bool hasCompilerFlag(str flag) {
+  return arrIncludes(__CFLAGS__, __N_CFLAGS__, flag);
+}
+
+/**
+ * @brief Value of a flag passed as prefix=value, NULL if it wasn't passed
+ */
+str compilerFlagValue(str prefix) {
+  uint len = strlen(prefix);
+  for (uint i = 0; i < __N_CFLAGS__; i++)
+    if (strncmp(__CFLAGS__[i], prefix, len) == 0 && __CFLAGS__[i][len] == '=')
+      return &__CFLAGS__[i][len + 1];
+  return NULL;
+}
+
 int indexOf(str array[], uint len, str query) {
   for (uint i = 0; i < len; i++) {
     if (strcmp(array[i], query) == 0)